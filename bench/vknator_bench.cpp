@@ -0,0 +1,499 @@
+#include "vknator_engine.h"
+#include "vknator_log.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+
+// benchmark runner: renders generated scenes headless along fixed camera paths, writes the results as json
+// and compares them against a saved baseline.
+//
+// vknator_bench [--scenario NAME]... [--frames N] [--warmup N] [--size WxH] [--pass-state objects|dynamic|baked]
+//               [--output results.json] [--baseline baseline.json] [--threshold PERCENT] [--list]
+//
+// exits with 1 when a metric regressed past the threshold or a scene differs from the baseline, 2 on errors
+
+namespace {
+    // smaller differences are noise no matter the threshold
+    constexpr double MIN_REGRESSION_MS = 0.05;
+
+    struct Scenario {
+        const char* name;
+        SceneGenDesc scene;
+        CameraPath camera;
+    };
+
+    // changing a scenario invalidates the saved baselines, add new ones instead
+    const Scenario SCENARIOS[] = {
+        { "small",          { .seed = 1, .nodes = 64,   .meshes = 4,  .materials = 8,    .textures = 4,   .textureSize = 256, .lights = 16,   .hierarchyDepth = 2,  .meshDetail = 16 },  CameraPath::Orbit },
+        { "many_nodes",     { .seed = 2, .nodes = 8192, .meshes = 16, .materials = 64,   .textures = 16,  .textureSize = 256, .lights = 64,   .hierarchyDepth = 3,  .meshDetail = 8 },   CameraPath::Orbit },
+        { "deep_hierarchy", { .seed = 3, .nodes = 2048, .meshes = 8,  .materials = 16,   .textures = 8,   .textureSize = 256, .lights = 64,   .hierarchyDepth = 16, .meshDetail = 12 },  CameraPath::Static },
+        { "many_materials", { .seed = 4, .nodes = 2048, .meshes = 32, .materials = 2048, .textures = 512, .textureSize = 128, .lights = 64,   .hierarchyDepth = 2,  .meshDetail = 12 },  CameraPath::Flyover },
+        { "many_lights",    { .seed = 5, .nodes = 512,  .meshes = 8,  .materials = 16,   .textures = 8,   .textureSize = 256, .lights = 4096, .hierarchyDepth = 2,  .meshDetail = 16 },  CameraPath::Flyover },
+        { "heavy_meshes",   { .seed = 6, .nodes = 256,  .meshes = 6,  .materials = 16,   .textures = 8,   .textureSize = 512, .lights = 64,   .hierarchyDepth = 2,  .meshDetail = 128 }, CameraPath::Orbit },
+    };
+
+    const char* CameraName(CameraPath path){
+        switch (path){
+            case CameraPath::Orbit: return "orbit";
+            case CameraPath::Flyover: return "flyover";
+            default: return "static";
+        }
+    }
+
+    struct BenchOptions {
+        std::vector<std::string> scenarios;
+        uint32_t frames {300};
+        uint32_t warmup {30};
+        VkExtent2D extent {1280, 720};
+        PassStateMode passState {PassStateMode::ShaderObjects};
+        std::string output {"bench_results.json"};
+        std::string baseline;
+        double threshold {10.0};
+    };
+
+    // metrics are kept in output order, the comparison looks them up by name
+    struct Result {
+        std::string name;
+        const Scenario* scenario;
+        std::vector<std::pair<std::string, double>> metrics;
+    };
+
+    double Percentile(const std::vector<double>& sorted, double percent){
+        if (sorted.empty()){
+            return 0.0;
+        }
+        // nearest rank
+        size_t rank = (size_t)std::ceil(percent / 100.0 * sorted.size());
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    }
+
+    uint64_t ResidentBytes(){
+#ifdef __linux__
+        std::ifstream statm("/proc/self/statm");
+        uint64_t pages = 0, resident = 0;
+        if (statm >> pages >> resident){
+            return resident * 4096;
+        }
+#endif
+        return 0;
+    }
+
+    bool RunScenario(const Scenario& scenario, const BenchOptions& options, Result& result, std::string& device, PassStateMode& passState){
+        LOG_INFO("Scenario {}...", scenario.name);
+        EngineOptions engineOptions;
+        engineOptions.headless = true;
+        engineOptions.extent = options.extent;
+        engineOptions.cameraPath = scenario.camera;
+        engineOptions.passState = options.passState;
+
+        // a fresh engine per scenario, so no scenario pays for the memory or caches of the one before
+        auto engine = std::make_unique<VknatorEngine>();
+        auto initStart = std::chrono::steady_clock::now();
+        if (!engine->Init(engineOptions)){
+            return false;
+        }
+        double initMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - initStart).count();
+        device = engine->GetDeviceName();
+        passState = engine->GetPassState();
+
+        auto loadStart = std::chrono::steady_clock::now();
+        bool loaded = engine->LoadGeneratedScene(scenario.scene);
+        double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+        if (!loaded){
+            engine->Deinit();
+            return false;
+        }
+
+        uint32_t frame = 0;
+        for (; frame < options.warmup; frame++){
+            engine->RenderFrame(frame / OFFLINE_FRAME_RATE);
+        }
+        std::vector<double> frameMs;
+        frameMs.reserve(options.frames);
+        double gpuMs = 0.0;
+        for (uint32_t i = 0; i < options.frames; i++, frame++){
+            auto start = std::chrono::steady_clock::now();
+            engine->RenderFrame(frame / OFFLINE_FRAME_RATE);
+            frameMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            gpuMs += engine->GetGpuFrameMs();
+        }
+        VknatorEngine::FrameStats frameStats = engine->GetFrameStats();
+        VknatorEngine::MemoryStats memoryStats = engine->GetMemoryStats();
+        // the permutations of the scene may still be compiling, they count already
+        PipelineCompiler::Stats compilerStats = engine->m_PipelineCompiler.GetStats();
+        uint64_t residentBytes = ResidentBytes();
+        engine->Deinit();
+
+        double meanMs = 0.0;
+        for (double ms : frameMs){
+            meanMs += ms;
+        }
+        meanMs /= std::max<size_t>(frameMs.size(), 1);
+        std::sort(frameMs.begin(), frameMs.end());
+
+        result.name = scenario.name;
+        result.scenario = &scenario;
+        result.metrics = {
+            { "init_ms", initMs },
+            { "load_ms", loadMs },
+            { "frame_ms_mean", meanMs },
+            { "frame_ms_p50", Percentile(frameMs, 50.0) },
+            { "frame_ms_p90", Percentile(frameMs, 90.0) },
+            { "frame_ms_p95", Percentile(frameMs, 95.0) },
+            { "frame_ms_p99", Percentile(frameMs, 99.0) },
+            { "frame_ms_max", frameMs.empty() ? 0.0 : frameMs.back() },
+            // 0 without timestamp queries
+            { "gpu_frame_ms", gpuMs / std::max(options.frames, 1u) },
+            { "draws", (double)frameStats.draws },
+            { "triangles", (double)frameStats.triangles },
+            { "gpu_allocated_bytes", (double)memoryStats.gpuAllocatedBytes },
+            { "gpu_usage_bytes", (double)memoryStats.gpuUsageBytes },
+            { "cpu_resident_bytes", (double)residentBytes },
+            { "pipelines", (double)compilerStats.pipelines },
+            { "shader_objects", (double)compilerStats.shaderObjects },
+        };
+        LOG_INFO("{}: init {:.1f} ms, load {:.1f} ms, frame p50 {:.3f} ms p99 {:.3f} ms, {} draws, {} triangles, {} pipelines, {} shader object pairs",
+            scenario.name, initMs, loadMs, Percentile(frameMs, 50.0), Percentile(frameMs, 99.0), frameStats.draws, frameStats.triangles,
+            compilerStats.pipelines, compilerStats.shaderObjects);
+        return true;
+    }
+
+    std::string Escape(const std::string& text){
+        std::string escaped;
+        for (char c : text){
+            if (c == '"' || c == '\\'){
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    bool WriteResults(const std::string& path, const std::vector<Result>& results, const BenchOptions& options, const std::string& device,
+        PassStateMode passState){
+        std::ofstream file(path, std::ios::trunc);
+        if (!file.is_open()){
+            LOG_ERROR("Could not write results {}", path);
+            return false;
+        }
+        file << "{\n";
+        file << fmt::format("  \"version\": 1,\n  \"device\": \"{}\",\n  \"extent\": [{}, {}],\n  \"frames\": {},\n  \"warmup\": {},\n  \"pass_state\": \"{}\",\n",
+            Escape(device), options.extent.width, options.extent.height, options.frames, options.warmup, PassStateName(passState));
+        file << "  \"scenarios\": {\n";
+        for (size_t i = 0; i < results.size(); i++){
+            const Result& result = results[i];
+            const SceneGenDesc& scene = result.scenario->scene;
+            file << fmt::format("    \"{}\": {{\n", result.name);
+            file << fmt::format("      \"params\": {{ \"seed\": {}, \"nodes\": {}, \"meshes\": {}, \"materials\": {}, \"textures\": {}, "
+                "\"texture_size\": {}, \"lights\": {}, \"hierarchy_depth\": {}, \"mesh_detail\": {}, \"camera\": \"{}\" }},\n",
+                scene.seed, scene.nodes, scene.meshes, scene.materials, scene.textures, scene.textureSize, scene.lights,
+                scene.hierarchyDepth, scene.meshDetail, CameraName(result.scenario->camera));
+            file << "      \"metrics\": {\n";
+            for (size_t m = 0; m < result.metrics.size(); m++){
+                file << fmt::format("        \"{}\": {}{}\n", result.metrics[m].first, result.metrics[m].second, m + 1 < result.metrics.size() ? "," : "");
+            }
+            file << "      }\n";
+            file << fmt::format("    }}{}\n", i + 1 < results.size() ? "," : "");
+        }
+        file << "  }\n}\n";
+        LOG_INFO("Results written to {}", path);
+        return (bool)file;
+    }
+
+    //> json_reader
+    // just enough json to read back a results file
+    struct JsonValue {
+        enum class Type { Null, Bool, Number, String, Array, Object } type {Type::Null};
+        bool boolean {false};
+        double number {0.0};
+        std::string string;
+        std::vector<JsonValue> array;
+        std::vector<std::pair<std::string, JsonValue>> object;
+
+        const JsonValue* Find(const std::string& key) const {
+            for (const auto& member : object){
+                if (member.first == key){
+                    return &member.second;
+                }
+            }
+            return nullptr;
+        }
+    };
+
+    class JsonParser {
+    public:
+        explicit JsonParser(const std::string& text) : m_Text(text) {}
+
+        bool Parse(JsonValue& value){
+            return ParseValue(value) && (SkipSpace(), m_Pos == m_Text.size());
+        }
+
+    private:
+        void SkipSpace(){
+            while (m_Pos < m_Text.size() && std::isspace((unsigned char)m_Text[m_Pos])){
+                m_Pos++;
+            }
+        }
+
+        bool Consume(char c){
+            SkipSpace();
+            if (m_Pos < m_Text.size() && m_Text[m_Pos] == c){
+                m_Pos++;
+                return true;
+            }
+            return false;
+        }
+
+        bool ParseString(std::string& out){
+            if (!Consume('"')){
+                return false;
+            }
+            while (m_Pos < m_Text.size() && m_Text[m_Pos] != '"'){
+                char c = m_Text[m_Pos++];
+                if (c == '\\' && m_Pos < m_Text.size()){
+                    char escaped = m_Text[m_Pos++];
+                    switch (escaped){
+                        case 'n': out += '\n'; break;
+                        case 't': out += '\t'; break;
+                        case 'r': out += '\r'; break;
+                        case 'b': out += '\b'; break;
+                        case 'f': out += '\f'; break;
+                        // code points are not needed for the names in a results file
+                        case 'u': m_Pos = std::min(m_Pos + 4, m_Text.size()); out += '?'; break;
+                        default: out += escaped; break;
+                    }
+                } else {
+                    out += c;
+                }
+            }
+            return m_Pos++ < m_Text.size();
+        }
+
+        bool ParseValue(JsonValue& value){
+            SkipSpace();
+            if (m_Pos >= m_Text.size()){
+                return false;
+            }
+            char c = m_Text[m_Pos];
+            if (c == '{'){
+                m_Pos++;
+                value.type = JsonValue::Type::Object;
+                if (Consume('}')){
+                    return true;
+                }
+                do {
+                    std::pair<std::string, JsonValue> member;
+                    if (!ParseString(member.first) || !Consume(':') || !ParseValue(member.second)){
+                        return false;
+                    }
+                    value.object.push_back(std::move(member));
+                } while (Consume(','));
+                return Consume('}');
+            }
+            if (c == '['){
+                m_Pos++;
+                value.type = JsonValue::Type::Array;
+                if (Consume(']')){
+                    return true;
+                }
+                do {
+                    value.array.emplace_back();
+                    if (!ParseValue(value.array.back())){
+                        return false;
+                    }
+                } while (Consume(','));
+                return Consume(']');
+            }
+            if (c == '"'){
+                value.type = JsonValue::Type::String;
+                return ParseString(value.string);
+            }
+            for (const char* word : { "true", "false", "null" }){
+                size_t length = std::strlen(word);
+                if (m_Text.compare(m_Pos, length, word) == 0){
+                    m_Pos += length;
+                    value.type = word[0] == 'n' ? JsonValue::Type::Null : JsonValue::Type::Bool;
+                    value.boolean = word[0] == 't';
+                    return true;
+                }
+            }
+            const char* start = m_Text.c_str() + m_Pos;
+            char* end = nullptr;
+            value.number = std::strtod(start, &end);
+            if (end == start){
+                return false;
+            }
+            value.type = JsonValue::Type::Number;
+            m_Pos += end - start;
+            return true;
+        }
+
+        const std::string& m_Text;
+        size_t m_Pos {0};
+    };
+    //< json_reader
+
+    // metrics where more is worse, compared against the threshold
+    const char* COMPARED_METRICS[] = { "init_ms", "load_ms", "frame_ms_p50", "frame_ms_p95", "frame_ms_p99", "gpu_frame_ms", "gpu_allocated_bytes", "cpu_resident_bytes" };
+    // metrics that only depend on the scene, any difference means the scenario is not the one of the baseline
+    const char* SCENE_METRICS[] = { "draws", "triangles" };
+
+    // returns the number of regressions, -1 when the baseline can not be read
+    int CompareBaseline(const std::string& path, const std::vector<Result>& results, double threshold){
+        std::ifstream file(path);
+        if (!file.is_open()){
+            LOG_ERROR("Could not open baseline {}", path);
+            return -1;
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        std::string text = buffer.str();
+        JsonValue baseline;
+        if (!JsonParser(text).Parse(baseline) || !baseline.Find("scenarios")){
+            LOG_ERROR("Baseline {} is not a results file", path);
+            return -1;
+        }
+        const JsonValue& scenarios = *baseline.Find("scenarios");
+
+        int regressions = 0;
+        LOG_INFO("Comparing against {} (threshold {:.1f}%)", path, threshold);
+        for (const Result& result : results){
+            const JsonValue* saved = scenarios.Find(result.name);
+            const JsonValue* metrics = saved ? saved->Find("metrics") : nullptr;
+            if (!metrics){
+                LOG_INFO("  {}: not in the baseline", result.name);
+                continue;
+            }
+            auto current = [&](const char* name){
+                for (const auto& metric : result.metrics){
+                    if (metric.first == name){
+                        return metric.second;
+                    }
+                }
+                return 0.0;
+            };
+            for (const char* name : SCENE_METRICS){
+                const JsonValue* value = metrics->Find(name);
+                if (value && value->number != current(name)){
+                    LOG_ERROR("  {}: {} changed from {} to {}, the scene is not the baseline's", result.name, name, value->number, current(name));
+                    regressions++;
+                }
+            }
+            for (const char* name : COMPARED_METRICS){
+                const JsonValue* value = metrics->Find(name);
+                // a zero baseline means the metric was not measured there
+                if (!value || value->number <= 0.0){
+                    continue;
+                }
+                double now = current(name);
+                double change = (now - value->number) / value->number * 100.0;
+                bool isMs = std::strstr(name, "_ms") != nullptr;
+                bool regressed = change > threshold && (!isMs || now - value->number > MIN_REGRESSION_MS);
+                if (regressed){
+                    LOG_ERROR("  {}: {} regressed {:+.1f}% ({:.3f} -> {:.3f})", result.name, name, change, value->number, now);
+                    regressions++;
+                } else {
+                    LOG_INFO("  {}: {} {:+.1f}% ({:.3f} -> {:.3f})", result.name, name, change, value->number, now);
+                }
+            }
+        }
+        return regressions;
+    }
+
+    bool ParseOptions(int argc, char* argv[], BenchOptions& options, bool& list){
+        for (int i = 1; i < argc; i++){
+            bool hasValue = i + 1 < argc;
+            if (std::strcmp(argv[i], "--scenario") == 0 && hasValue){
+                options.scenarios.push_back(argv[++i]);
+            } else if (std::strcmp(argv[i], "--frames") == 0 && hasValue){
+                options.frames = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+            } else if (std::strcmp(argv[i], "--warmup") == 0 && hasValue){
+                options.warmup = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+            } else if (std::strcmp(argv[i], "--size") == 0 && hasValue){
+                uint32_t width = 0, height = 0;
+                if (std::sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0){
+                    LOG_ERROR("Invalid size {}, expected WxH", argv[i]);
+                    return false;
+                }
+                options.extent = { width, height };
+            } else if (std::strcmp(argv[i], "--pass-state") == 0 && hasValue){
+                if (!ParsePassState(argv[++i], options.passState)){
+                    LOG_ERROR("Invalid pass state {}, expected objects, dynamic or baked", argv[i]);
+                    return false;
+                }
+            } else if (std::strcmp(argv[i], "--output") == 0 && hasValue){
+                options.output = argv[++i];
+            } else if (std::strcmp(argv[i], "--baseline") == 0 && hasValue){
+                options.baseline = argv[++i];
+            } else if (std::strcmp(argv[i], "--threshold") == 0 && hasValue){
+                options.threshold = std::strtod(argv[++i], nullptr);
+            } else if (std::strcmp(argv[i], "--list") == 0){
+                list = true;
+            } else {
+                LOG_ERROR("Unknown argument {}", argv[i]);
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char* argv[]){
+    vknator::Log::Init();
+    BenchOptions options;
+    bool list = false;
+    if (!ParseOptions(argc, argv, options, list)){
+        return 2;
+    }
+    if (list){
+        for (const Scenario& scenario : SCENARIOS){
+            LOG_INFO("{}: {} nodes, {} meshes, {} materials, {} textures, {} lights, depth {}, {} camera", scenario.name,
+                scenario.scene.nodes, scenario.scene.meshes, scenario.scene.materials, scenario.scene.textures,
+                scenario.scene.lights, scenario.scene.hierarchyDepth, CameraName(scenario.camera));
+        }
+        return 0;
+    }
+
+    std::vector<const Scenario*> selected;
+    for (const Scenario& scenario : SCENARIOS){
+        bool wanted = options.scenarios.empty() || std::find(options.scenarios.begin(), options.scenarios.end(), scenario.name) != options.scenarios.end();
+        if (wanted){
+            selected.push_back(&scenario);
+        }
+    }
+    if (selected.size() < std::max<size_t>(options.scenarios.size(), 1)){
+        LOG_ERROR("Unknown scenario, see --list");
+        return 2;
+    }
+
+    std::vector<Result> results;
+    std::string device;
+    PassStateMode passState = options.passState;
+    for (const Scenario* scenario : selected){
+        Result result;
+        if (!RunScenario(*scenario, options, result, device, passState)){
+            LOG_ERROR("Scenario {} failed", scenario->name);
+            return 2;
+        }
+        results.push_back(std::move(result));
+    }
+    if (!WriteResults(options.output, results, options, device, passState)){
+        return 2;
+    }
+    if (!options.baseline.empty()){
+        int regressions = CompareBaseline(options.baseline, results, options.threshold);
+        if (regressions < 0){
+            return 2;
+        }
+        if (regressions > 0){
+            LOG_ERROR("{} regressions against the baseline", regressions);
+            return 1;
+        }
+        LOG_INFO("No regressions against the baseline");
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <mutex>
+#include <unordered_map>
+
+//> bindless
+// material as the bindless shaders read it from the material buffer (std430)
+struct GPUMaterial {
+    glm::vec4 colorFactors;
+    glm::vec4 metalRoughFactors;
+    uint32_t colorTexture;
+    uint32_t colorSampler;
+    uint32_t metalRoughTexture;
+    uint32_t metalRoughSampler;
+    uint32_t features;
+    float alphaCutoff;
+    uint32_t padding[2];
+};
+
+// one global update-after-bind set with every texture, sampler and material:
+//   binding 0: sampled images, binding 1: samplers, binding 2: storage buffer of GPUMaterial.
+// Entries are written as they are added and stay until Destroy, the set is bound once per pipeline
+// and draws only push their material index
+class BindlessDescriptors {
+public:
+    void Init(VkDevice device, VmaAllocator allocator, uint32_t maxTextures, uint32_t maxSamplers, uint32_t maxMaterials);
+    void Destroy();
+
+    // return the array index, adding the same view or sampler twice returns the first index.
+    // Safe to call from several threads and while the set is in use on the gpu
+    uint32_t AddTexture(VkImageView view);
+    uint32_t AddSampler(VkSampler sampler);
+    uint32_t AddMaterial(const GPUMaterial& material);
+
+    VkDescriptorSetLayout GetLayout() const { return m_Layout; }
+    VkDescriptorSet GetSet() const { return m_Set; }
+
+private:
+    void Write(uint32_t binding, uint32_t index, VkDescriptorType type, VkImageView view, VkSampler sampler);
+
+    VkDevice m_Device;
+    VmaAllocator m_Allocator;
+    VkDescriptorSetLayout m_Layout;
+    VkDescriptorPool m_Pool;
+    VkDescriptorSet m_Set;
+    AllocatedBuffer m_MaterialBuffer;
+
+    uint32_t m_MaxTextures;
+    uint32_t m_MaxSamplers;
+    uint32_t m_MaxMaterials;
+
+    std::mutex m_Mutex;
+    std::unordered_map<VkImageView, uint32_t> m_Textures;
+    std::unordered_map<VkSampler, uint32_t> m_Samplers;
+    uint32_t m_MaterialCount {0};
+};
+//< bindless
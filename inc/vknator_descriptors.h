@@ -4,6 +4,10 @@
 #include <vknator_types.h>
 #include <deque>
 #include <span>
+#include <unordered_map>
+#include <array>
+#include <mutex>
+#include <string>
 
 //> descriptor_layout
 struct DescriptorLayoutBuilder {
@@ -12,7 +16,15 @@ struct DescriptorLayoutBuilder {
 
     void add_binding(uint32_t binding, VkDescriptorType type);
     void clear();
-    VkDescriptorSetLayout build(VkDevice device, VkShaderStageFlags shaderStages);
+    // VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR makes a set that is pushed into the command buffer, never allocated
+    VkDescriptorSetLayout build(VkDevice device, VkShaderStageFlags shaderStages, VkDescriptorSetLayoutCreateFlags flags = 0);
+    // template for vkCmdPushDescriptorSetWithTemplateKHR, the data is one PushDescriptorInfo per binding in the order they were added
+    VkDescriptorUpdateTemplate build_push_template(VkDevice device, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set);
+};
+
+union PushDescriptorInfo {
+    VkDescriptorImageInfo image;
+    VkDescriptorBufferInfo buffer;
 };
 //< descriptor_layout
 //
@@ -29,7 +41,29 @@ struct DescriptorWriter {
     void update_set(VkDevice device, VkDescriptorSet set);
 };
 
+//> descriptor_usage
+// sets and descriptors per type, indexed by VkDescriptorType (the core types only)
+struct DescriptorUsage {
+    static constexpr uint32_t TYPE_COUNT = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT + 1;
+
+    uint32_t sets;
+    std::array<uint32_t, TYPE_COUNT> descriptors;
+
+    void add(const DescriptorUsage& other, int sign = 1);
+    // component wise maximum
+    void max(const DescriptorUsage& other);
+    uint32_t total_descriptors() const;
+};
+
+// descriptors one set of the layout takes, known for every layout made by DescriptorLayoutBuilder
+DescriptorUsage descriptor_layout_usage(VkDescriptorSetLayout layout);
+// destroys a layout made by DescriptorLayoutBuilder and forgets its usage, the handle may be reused by the driver
+void descriptor_layout_destroy(VkDevice device, VkDescriptorSetLayout layout);
+//< descriptor_usage
+
 //> descriptor_allocator_grow
+struct DescriptorPoolTuning;
+
 struct DescriptorAllocatorGrowable {
 public:
 	struct PoolSizeRatio {
@@ -37,20 +71,153 @@ public:
 		float ratio;
 	};
 
-	void init(VkDevice device, uint32_t initialSets, std::span<PoolSizeRatio> poolRatios);
+    struct Stats {
+        uint32_t pools;
+        uint32_t capacity;
+        // usage since the last clear_pools and the highest seen
+        DescriptorUsage current;
+        DescriptorUsage peak;
+    };
+
+    // with a tuning, the sizes learned under name in earlier runs replace initialSets and poolRatios,
+    // and the peak usage of this run is reported back on destroy_pools
+	void init(VkDevice device, uint32_t initialSets, std::span<PoolSizeRatio> poolRatios, DescriptorPoolTuning* tuning = nullptr, const std::string& name = {});
 	void clear_pools(VkDevice device);
 	void destroy_pools(VkDevice device);
 
 	VkDescriptorSet allocate(VkDevice device, VkDescriptorSetLayout layout);
 
+    Stats get_stats() const;
+
 private:
-	VkDescriptorPool get_pool(VkDevice device);
-	VkDescriptorPool create_pool(VkDevice device, uint32_t setCount, std::span<PoolSizeRatio> poolRatios);
+    struct Pool {
+        VkDescriptorPool pool;
+        uint32_t capacity;
+        DescriptorUsage used;
+    };
+
+	Pool get_pool(VkDevice device);
+	Pool create_pool(VkDevice device, uint32_t setCount, std::span<PoolSizeRatio> poolRatios);
 
 	std::vector<PoolSizeRatio> ratios;
-	std::vector<VkDescriptorPool> fullPools;
-	std::vector<VkDescriptorPool> readyPools;
+	std::vector<Pool> fullPools;
+	std::vector<Pool> readyPools;
 	uint32_t setsPerPool;
 
+    DescriptorUsage current;
+    DescriptorUsage peak;
+    DescriptorPoolTuning* tuning;
+    std::string name;
+};
+//< descriptor_allocator_grow
+
+//> descriptor_tuning
+// pool sizes learned from the usage of earlier runs. Every allocator reports its peak usage under its name,
+// the next run sizes the first pool for that peak and sets the ratios from the observed mix of types.
+// Peaks from older runs decay, so one heavy session does not oversize the pools forever.
+// The file is text, one line per allocator: "name sets type:count type:count ..."
+struct DescriptorPoolTuning {
+    void load(const std::string& path);
+    // writes the peaks of this run, merged with the decayed ones that were loaded
+    void save();
+
+    // types in the defaults are kept (at a small ratio when unused) so an allocation never finds a pool without them
+    void apply(const std::string& name, uint32_t& initialSets, std::vector<DescriptorAllocatorGrowable::PoolSizeRatio>& poolRatios) const;
+    void report(const std::string& name, const DescriptorUsage& peak);
+
+private:
+    std::string path;
+    std::unordered_map<std::string, DescriptorUsage> loaded;
+    std::unordered_map<std::string, DescriptorUsage> observed;
+    std::mutex mutex;
+};
+//< descriptor_tuning
+
+//> descriptor_cache
+// descriptor sets looked up by content: the layout plus every written buffer / image / sampler with its range and layout.
+// A set that was built before costs a hash lookup instead of an allocate and update.
+//  - Frame tier: one cache per frame in flight, for sets that reference per frame resources. Entries not used
+//    during the previous use of a frame slot are freed when that slot begins again.
+//  - Long lived tier: shared by all frames, entries unused for `lifetime` frames are freed. Pinned entries
+//    (sets the caller keeps around, like materials) are not evicted by age.
+// The key holds raw handles, which the driver may hand out again once the object is destroyed. invalidate has to
+// see every destroyed object a set may reference, ResourceRegistry does that for what it owns.
+// Not thread safe, use it from the thread that records the frame. The worker threads of RecordDrawsParallel
+// only bind sets that were looked up before the recording started, they never allocate
+struct DescriptorSetCache {
+public:
+    enum class Tier { Frame, LongLived };
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint32_t liveSets;
+        uint32_t pools;
+    };
+
+    // with a tuning, the pool sizes follow the live sets of earlier runs like DescriptorAllocatorGrowable
+    void init(VkDevice device, uint32_t frameCount, uint32_t setsPerPool, std::span<DescriptorAllocatorGrowable::PoolSizeRatio> poolRatios, uint32_t lifetime,
+        DescriptorPoolTuning* tuning = nullptr, const std::string& name = {});
+    void destroy();
+
+    // call once the fence of the frame slot was waited on, pools left empty by the eviction are destroyed
+    void begin_frame(uint32_t frameSlot, uint64_t frameNumber);
+
+    // the writer is only applied on a miss
+    VkDescriptorSet get(VkDescriptorSetLayout layout, DescriptorWriter& writer, Tier tier, bool pinned = false);
+    // frees every set, pinned or not, that references one of the buffers, image views or samplers.
+    // Call it once the gpu is done with the objects, the sets that use them are done then as well.
+    // Returns the pinned sets among them, their owners still hold them and have to replace them before the
+    // next bind. Valid until the next call
+    std::span<const VkDescriptorSet> invalidate(std::span<const uint64_t> handles);
+
+    Stats get_stats() const;
+    void reset_stats();
+
+private:
+    struct Entry {
+        std::vector<uint64_t> key;
+        VkDescriptorSet set;
+        uint32_t pool;
+        uint64_t lastUsed;
+        bool pinned;
+    };
+    struct Pool {
+        VkDescriptorPool pool;
+        bool full;
+        // live sets allocated from it
+        uint32_t sets;
+    };
+    struct Cache {
+        std::unordered_map<uint64_t, std::vector<Entry>> entries;
+        std::vector<Pool> pools;
+        uint32_t setsPerPool;
+    };
+
+    void build_key(VkDescriptorSetLayout layout, const DescriptorWriter& writer);
+    VkDescriptorSet allocate(Cache& cache, VkDescriptorSetLayout layout, uint32_t& poolIndex);
+    // frees the entries for which evict returns true
+    template <typename F> void evict(Cache& cache, F&& evict);
+    // destroys the empty pools but the newest, the entries are moved to the new pool indices
+    void release_empty_pools(Cache& cache);
+
+    VkDevice device;
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> ratios;
+    std::vector<Cache> frameCaches;
+    Cache longLived;
+    uint32_t currentSlot;
+    uint64_t currentFrame;
+    uint32_t lifetime;
+    // setsPerPool of init, a released pool takes back one step of growth down to it
+    uint32_t minSetsPerPool;
+    std::vector<uint64_t> scratchKey;
+    std::vector<uint64_t> scratchHandles;
+    std::vector<VkDescriptorSet> invalidatedPinned;
+    Stats stats;
+    DescriptorUsage live;
+    DescriptorUsage peak;
+    DescriptorPoolTuning* tuning;
+    std::string name;
 };
-//< descriptor_allocator_grow
\ No newline at end of file
+//< descriptor_cache
@@ -6,14 +6,123 @@
 #include "vknator_descriptors.h"
 #include <vknator_pipelines.h>
 #include <vknator_loader.h>
+#include <vknator_workers.h>
+#include <vknator_rendergraph.h>
+#include <vknator_resolution.h>
+#include <vknator_pipelinecompiler.h>
+#include <vknator_bindless.h>
+#include <vknator_resources.h>
+#include <vknator_lighting.h>
+#include <vknator_shadows.h>
+#include <vknator_visibility.h>
+#include <vknator_readback.h>
+#include <vknator_scenegen.h>
+#include <vknator_profiler.h>
+#include <span>
 
 constexpr unsigned int FRAME_OVERLAP = 2;
+// the draw targets grow by this factor when the window outgrows them, so drag-resizing does not reallocate every frame
+constexpr float DRAW_TARGET_HEADROOM = 1.25f;
+// the draw targets are created with these, the grown extent is checked against the limits of both
+constexpr VkFormat DRAW_IMAGE_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+constexpr VkImageUsageFlags DRAW_IMAGE_USAGE = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT
+    | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+constexpr VkFormat DEPTH_IMAGE_FORMAT = VK_FORMAT_D32_SFLOAT;
+constexpr VkImageUsageFlags DEPTH_IMAGE_USAGE = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+// below this many draws recording on a single thread is cheaper than fanning out
+constexpr uint32_t PARALLEL_RECORD_MIN_DRAWS = 512;
+// smallest amount of draws recorded into one secondary command buffer
+constexpr uint32_t PARALLEL_RECORD_MIN_CHUNK = 64;
+// recording time a chunk should take, big enough to hide the secondary buffer overhead
+constexpr double PARALLEL_RECORD_CHUNK_NS = 100000.0;
+// lowest render scale the dynamic resolution may pick
+constexpr float MIN_RENDER_SCALE = 0.5f;
+// pipeline cache file, relative to the working directory
+constexpr const char* PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+// seconds between pipeline cache saves while running, so a crash keeps most of the compiled pipelines
+constexpr double PIPELINE_CACHE_SAVE_INTERVAL = 60.0;
+// descriptor pool sizes learned from earlier runs, see DescriptorPoolTuning
+constexpr const char* DESCRIPTOR_TUNING_PATH = "descriptor_pools.txt";
+// materials go through one global bindless set instead of a descriptor set each
+constexpr bool BINDLESS_MATERIALS = true;
+constexpr uint32_t BINDLESS_MAX_TEXTURES = 4096;
+constexpr uint32_t BINDLESS_MAX_SAMPLERS = 64;
+constexpr uint32_t BINDLESS_MAX_MATERIALS = 4096;
+// unique materials, the legacy path suballocates their constants from one uniform buffer
+constexpr uint32_t MAX_MATERIALS = 4096;
+// the scene uniforms (set 0 of the material pipelines) are pushed with VK_KHR_push_descriptor when available,
+// otherwise they go through the descriptor cache
+constexpr bool PUSH_DESCRIPTORS = true;
+// frames a cached descriptor set survives without being used, pinned sets excluded
+constexpr uint32_t DESCRIPTOR_CACHE_LIFETIME = 300;
+// lights in the scene until changed in the ui
+constexpr int DEFAULT_LIGHT_COUNT = 256;
+// the light benchmark skips the first frames after a light count change, then averages the next ones
+constexpr uint32_t LIGHT_BENCH_WARMUP_FRAMES = 30;
+constexpr uint32_t LIGHT_BENCH_FRAMES = 120;
+// opaque geometry is drawn depth only first, the color pass then only shades the visible fragments.
+// Switchable at runtime, pays off when the scene has a lot of overdraw
+constexpr bool DEPTH_PREPASS = false;
+// opaque geometry goes through the visibility buffer instead of the forward pass, see VisibilityBuffer.
+// Switchable at runtime, needs bindless materials and the geometryShader feature
+constexpr bool VISIBILITY_BUFFER = false;
+// dense test scene of the render path benchmark: a grid of meshes, several layers deep so most of it is hidden
+constexpr int DENSE_SCENE_GRID_X = 16;
+constexpr int DENSE_SCENE_GRID_Y = 9;
+constexpr int DENSE_SCENE_LAYERS = 6;
+// the render path benchmark skips the first frames after switching the path, then averages the next ones
+constexpr uint32_t PATH_BENCH_WARMUP_FRAMES = 30;
+constexpr uint32_t PATH_BENCH_FRAMES = 240;
+// headless frames advance the scene by 1 / OFFLINE_FRAME_RATE seconds each, so the output does not depend on
+// how fast they render
+constexpr float OFFLINE_FRAME_RATE = 30.f;
+// 8 bit target the composite writes to without a swapchain, color attachment and copy source on every gpu
+constexpr VkFormat HEADLESS_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+// fixed camera moves of the headless frames, around the scene center at a distance of the scene radius
+enum class CameraPath : uint8_t {
+    // circles the scene once every 20 seconds
+    Orbit,
+    // low pass over the scene and back
+    Flyover,
+    // never moves
+    Static
+};
+
+// how the material pass state (raster, depth, blend) reaches the gpu. A mode the device does not support
+// falls back to the next one
+enum class PassStateMode : uint8_t {
+    // VK_EXT_shader_object: the materials bind shader objects instead of pipelines and set all state per batch,
+    // one pair of shaders per feature permutation serves both passes
+    ShaderObjects,
+    // pipelines take raster, depth and (with VK_EXT_extended_dynamic_state3) blend state as dynamic state,
+    // so one pipeline serves opaque and transparent draws
+    Dynamic,
+    // a pipeline per pass
+    Baked,
+};
+const char* PassStateName(PassStateMode mode);
+// false for an unknown name
+bool ParsePassState(const char* name, PassStateMode& mode);
+
+// how the engine runs, filled from the command line
+struct EngineOptions {
+    // no window, surface or swapchain, the composite goes to offscreen images and Run renders `frames` frames
+    // along a scripted camera path as fast as possible
+    bool headless {false};
+    uint32_t frames {1};
+    // headless only, every frame is read back and written there as png when set
+    std::string outputDirectory;
+    VkExtent2D extent {1700, 900};
+    CameraPath cameraPath {CameraPath::Orbit};
+    PassStateMode passState {PassStateMode::ShaderObjects};
+};
 
 struct DeletionQueue{
     std::deque<std::function<void()>> deletors;
 
     void PushFunction(std::function<void()>&& function){
-        deletors.push_back(function);
+        deletors.push_back(std::move(function));
     }
 
     void Flush(){
@@ -23,15 +132,32 @@ struct DeletionQueue{
         deletors.clear();
     }
 };
+// command pool owned by a single recording slot, so worker threads never share a pool
+struct WorkerCommands {
+    VkCommandPool commandPool;
+    std::vector<VkCommandBuffer> secondaryBuffers;
+    uint32_t usedBuffers {0};
+};
+
 struct FrameData {
     VkSemaphore swapchainSemaphore, renderSemaphore;
     VkFence renderFence;
 
     VkCommandPool commandPool;
     VkCommandBuffer mainCommandBuffer;
+    std::vector<WorkerCommands> workerCommands;
+
+    // async compute work, allocated from the compute queue family
+    VkCommandPool computeCommandPool;
+    VkCommandBuffer computeCommandBuffer;
+
+    // fragment shader invocations of the geometry pass, VK_NULL_HANDLE without pipelineStatisticsQuery
+    VkQueryPool statisticsPool {VK_NULL_HANDLE};
+    bool statisticsWritten {false};
+    bool statisticsPrepass {false};
 
-    DeletionQueue deletionQueue;
-    DescriptorAllocatorGrowable frameDescriptors;
+    // scene uniforms, one buffer per frame so the global set is the same every time this frame comes around
+    AllocatedBuffer sceneBuffer;
 };
 
 struct ComputePushConstants{
@@ -45,10 +171,20 @@ struct ComputeEffect{
     const char* name;
     VkPipeline pipeline;
     VkPipelineLayout layout;
+    // workgroup size reflected from the shader
+    glm::uvec3 localSize;
 
     ComputePushConstants data;
 };
 
+struct CompositePushConstants{
+    glm::vec2 inputSize;
+    glm::vec2 inputTexel;
+    glm::vec2 outputSize;
+    float sharpness;
+    float exposure;
+};
+
 struct GPUSceneData{
     glm::mat4 view;
     glm::mat4 proj;
@@ -56,28 +192,100 @@ struct GPUSceneData{
     glm::vec4 ambientColor;
     glm::vec4 sunlightDirection;
     glm::vec4 sunlightColor;
+    // clustered lighting, see ClusteredLighting
+    VkDeviceAddress lightBuffer;
+    VkDeviceAddress clusterBuffer;
+    glm::uvec4 clusterGrid;
+    glm::vec4 clusterDepth;
+    glm::vec4 clusterScreen;
+    // sun shadows, see CascadedShadows
+    GPUShadowData shadows;
+};
+
+struct PassTiming{
+    std::string name;
+    // smoothed over the recent frames
+    float ms;
+    // of the last finished frame
+    float lastMs;
+};
+
+// sweeps the light count over the powers of two up to MAX_LIGHTS and logs the gpu time of every pass
+struct LightBenchmark{
+    bool running {false};
+    uint32_t lightCount {0};
+    uint32_t frame {0};
+    float frameMsSum {0.f};
+    std::vector<PassTiming> sums;
+    // restored once the sweep is done
+    int savedLightCount {0};
+    bool savedDynamicResolution {false};
+};
+
+// renders the same scene with the forward pass, the forward pass after a depth prepass and the visibility buffer,
+// and logs the gpu time of every pass for each
+struct RenderPathBenchmark{
+    enum Path : uint32_t { Forward, ForwardPrepass, Visibility, Count };
+    bool running {false};
+    uint32_t path {0};
+    uint32_t frame {0};
+    float frameMsSum {0.f};
+    std::vector<PassTiming> sums;
+    float frameMs[Count] {};
+    // restored once every path was measured
+    bool savedDepthPrepass {false};
+    bool savedVisibility {false};
+    bool savedDynamicResolution {false};
 };
 
 struct GLTFMetallic_Roughness{
+    // generic pipelines, they branch on the feature bits at runtime and can draw every material.
+    // Used by a permutation until its specialized pipeline is compiled
     MaterialPipeline opaquePipeline;
     MaterialPipeline transparentPipeline;
+    // the shader objects are created with the sets and push constants of the pipeline layout
+    bool shaderObjects;
+    VkDescriptorSetLayout setLayouts[2];
+    VkPushConstantRange pushConstants;
+
+    // one per pass and feature combination. Draws use pipeline, which points at the generic pipeline
+    // until UpdatePermutations swaps in the specialized one
+    struct Permutation{
+        MaterialPipeline pipeline;
+        // compiledShaders instead with shader objects
+        std::shared_future<VkPipeline> compiled;
+        std::shared_future<GraphicsShaders> compiledShaders;
+        bool ready;
+    };
+    std::unordered_map<uint64_t, std::unique_ptr<Permutation>> permutations;
+    PipelineBuilder opaqueBuilder;
+    PipelineBuilder transparentBuilder;
+    PipelineCompiler* compiler;
+    // set when materials are bindless, materialLayout is unused then
+    BindlessDescriptors* bindless;
+    const char* vertexShader;
+    const char* fragmentShader;
 
     VkDescriptorSetLayout materialLayout;
 
     struct MaterialConstants{
         glm::vec4 colorFactors;
         glm::vec4 metal_rough_factors;
-        //padding, we need it anyway for uniform buffers (GPUs require minimum alignment size of 256 bytes)
-        glm::vec4 extra[14];
+        //MaterialFeatureBits, only read by the generic pipelines
+        uint32_t features;
+        float alphaCutoff;
+        uint32_t padding[2];
     };
 
     struct MaterialResources{
-        AllocatedImage colorImage;
+        VkImageView colorImage;
         VkSampler colorSampler;
-        AllocatedImage metalRoughImage;
+        VkImageView metalRoughImage;
         VkSampler metalRoughSampler;
         VkBuffer dataBuffer;
         uint32_t dataBufferOffset;
+        // cpu side of the data in dataBuffer, the bindless path copies it into the material buffer
+        const MaterialConstants* constants;
     };
 
     DescriptorWriter writer;
@@ -85,7 +293,85 @@ struct GLTFMetallic_Roughness{
     void BuildPipelines(VknatorEngine* engine);
     void ClearResources(VkDevice device);
 
-    MaterialInstance WriteMaterial(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorAllocatorGrowable& descriptorAllocator);
+    // returns the permutation right away, a new one is queued for compilation and starts out on the generic pipeline
+    MaterialPipeline* GetPermutation(MaterialPass pass, uint32_t features);
+    // swap in the permutations that finished compiling, call before recording any draws
+    void UpdatePermutations();
+
+    // features has to match the features written into the material constants
+    MaterialInstance WriteMaterial(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorSetCache& descriptorCache,
+        uint32_t features = MATERIAL_FEATURE_DEFAULT);
+};
+
+// creates every material and hands out handles. Materials with the same pass, constants, textures and samplers
+// are created once. Without bindless the constants are suballocated from one uniform buffer at the device's
+// uniform offset alignment, with bindless they are packed into the material storage buffer
+class MaterialSystem {
+public:
+    struct MaterialDesc{
+        MaterialPass pass;
+        VkImageView colorImage;
+        VkSampler colorSampler;
+        VkImageView metalRoughImage;
+        VkSampler metalRoughSampler;
+        GLTFMetallic_Roughness::MaterialConstants constants;
+    };
+
+    struct Stats{
+        uint32_t materials;
+        uint32_t requests;
+        uint32_t deduplicated;
+        // bytes of constants in the uniform buffer, 0 when bindless
+        size_t constantBytes;
+    };
+
+    // after the material pipelines were built
+    void Init(VkDevice device, VmaAllocator allocator, VkDeviceSize uniformAlignment, GLTFMetallic_Roughness* pipelines,
+        DescriptorSetCache* descriptorCache, uint32_t maxMaterials);
+    void Destroy();
+
+    // a null handle when the material buffer is full
+    MaterialHandle Create(const MaterialDesc& desc);
+    // nullptr for a null or stale handle
+    MaterialInstance* Get(MaterialHandle handle);
+
+    // replaces the released textures and samplers of a material when its set was invalidated
+    void SetFallback(VkImageView image, VkSampler sampler);
+    // rewrites the materials whose set is among freedSets, with the fallback in place of the destroyed handles.
+    // Call it after ResourceRegistry::Collect with what it reports, before anything is recorded
+    void Invalidate(std::span<const VkDescriptorSet> freedSets, std::span<const uint64_t> destroyedHandles);
+
+    Stats GetStats() const { return m_Stats; }
+
+private:
+    struct DescHash{
+        size_t operator()(const MaterialDesc& desc) const;
+    };
+    struct DescEqual{
+        bool operator()(const MaterialDesc& a, const MaterialDesc& b) const;
+    };
+    struct Entry{
+        MaterialHandle handle;
+        // of the constants in m_ConstantBuffer
+        uint32_t constantOffset;
+    };
+
+    MaterialInstance Write(const MaterialDesc& desc, uint32_t constantOffset);
+
+    VkDevice m_Device;
+    VmaAllocator m_Allocator;
+    GLTFMetallic_Roughness* m_Pipelines;
+    DescriptorSetCache* m_DescriptorCache;
+
+    AllocatedBuffer m_ConstantBuffer {};
+    VkDeviceSize m_ConstantStride {0};
+    uint32_t m_MaxMaterials {0};
+
+    ResourcePool<MaterialInstance> m_Materials;
+    std::unordered_map<MaterialDesc, Entry, DescHash, DescEqual> m_Lookup;
+    VkImageView m_FallbackImage {VK_NULL_HANDLE};
+    VkSampler m_FallbackSampler {VK_NULL_HANDLE};
+    Stats m_Stats {};
 };
 
 struct MeshNode : Node{
@@ -102,15 +388,22 @@ struct RenderObject{
 
     glm::mat4 transform;
     VkDeviceAddress vertexBufferAddress;
+    // for the visibility buffer shading
+    VkDeviceAddress indexBufferAddress;
+    // 0 when the mesh has no position stream
+    VkDeviceAddress positionBufferAddress;
+    // of the surface in mesh space
+    Bounds bounds;
 };
 struct DrawContext{
     std::vector<RenderObject> OpaqueSurfaces;
+    MaterialSystem* materials;
 };
 
 class VknatorEngine{
 public:
     //init engine
-    bool Init();
+    bool Init(const EngineOptions& options = {});
     // deinit engine resource
     void Deinit();
     //run main loop
@@ -119,30 +412,120 @@ public:
     void Draw();
     // ImmediateSubmit
     void ImmediateSubmit(std::function<void(VkCommandBuffer &cmd)>&&function);
-    // Draw Imgui
-    void DrawImgui(VkCommandBuffer cmd, VkImageView targetImageView);
-    // Draw geometry
-    void DrawGeometry(VkCommandBuffer cmd);
-
-    GPUMeshBuffers UploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices);
+    // Draw the draw image and imgui into the swapchain
+    void DrawComposite(VkCommandBuffer cmd, VkImageView targetImageView);
+    // Draw geometry, globalDescriptor is VK_NULL_HANDLE with push descriptors
+    void DrawGeometry(VkCommandBuffer cmd, VkDescriptorSet globalDescriptor);
+    // Draw the depth of the opaque surfaces the geometry pass then tests against with EQUAL
+    void DrawDepthPrepass(VkCommandBuffer cmd, VkDescriptorSet globalDescriptor);
+    // Draw the opaque surfaces into the shadow cascades scheduled this frame
+    void DrawShadows(VkCommandBuffer cmd);
+    // Draw the draw and triangle index of the surfaces the visibility buffer shades
+    void DrawVisibility(VkCommandBuffer cmd, VkImageView visibilityView);
+
+    // positionStream also writes the deinterleaved positions for the depth only passes
+    GPUMeshBuffers UploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices, bool positionStream = true);
+
+    // generates the scene and uploads it, it replaces the default content. Once after Init
+    bool LoadGeneratedScene(const SceneGenDesc& desc);
+    // one headless frame at sceneTime seconds
+    void RenderFrame(float sceneTime);
+
+    struct FrameStats {
+        uint32_t draws;
+        uint64_t triangles;
+    };
+    // opaque draws of the last frame and their triangles, shadow passes excluded
+    FrameStats GetFrameStats() const;
+    struct MemoryStats {
+        // in vma allocations, and what the driver reports for the whole process
+        uint64_t gpuAllocatedBytes;
+        uint64_t gpuUsageBytes;
+    };
+    MemoryStats GetMemoryStats() const;
+    float GetGpuFrameMs() const { return m_HasTimestamps ? m_GpuFrameMs : 0.f; }
+    const std::string& GetDeviceName() const { return m_DeviceName; }
+    // the requested mode or what it fell back to
+    PassStateMode GetPassState() const { return m_PassState; }
 public:
     VkDevice m_VkDevice;
+    PipelineCache m_PipelineCache;
+    ShaderLibrary m_ShaderLibrary;
+    PipelineCompiler m_PipelineCompiler;
+    // what the device supports of the requested mode
+    PassStateMode m_PassState {PassStateMode::ShaderObjects};
+    // material pipelines leave their pass state dynamic, see PassStateMode
+    bool m_UseDynamicState {false};
+    bool m_HasDynamicBlendState {false};
+    BindlessDescriptors m_Bindless;
+    bool m_UseBindless {false};
+    // set 0 is a push descriptor set, see PUSH_DESCRIPTORS
+    bool m_UsePushDescriptors {false};
     VkDescriptorSetLayout m_GPUSceneDataDescriptorSetLayout;
     AllocatedImage m_DrawImage;
     AllocatedImage m_DepthImage;
+    // runtime created objects, destroyed through the graphics timeline
+    ResourceRegistry m_Resources;
+    ImageHandle m_DrawImageHandle;
+    ImageHandle m_DepthImageHandle;
 
 private:
     void InitVulkan();
-    void CreateSwapchain(uint32_t width, uint32_t height);
+    void CreateSwapchain(uint32_t width, uint32_t height, VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
     void InitSwapchain();
+    // headless replacement of the swapchain, one image per frame in flight
+    void CreateOffscreenTargets();
+    void RunHeadless();
+    // camera of the headless frames
+    static glm::mat4 CameraPathView(CameraPath path, float time, glm::vec3 center, float radius);
+    void CreateDrawTargets(VkExtent3D extent);
+    // a set for the current draw image, the one of a previous image is freed together with that image
+    void UpdateDrawImageDescriptors();
     void InitCommands();
     void InitSyncStructures();
     void InitDescriptors();
     FrameData& GetCurrentFrame() { return m_Frames[m_FrameNumber % FRAME_OVERLAP];}
+    // destroy once every frame submitted so far has finished on the gpu, without waiting for the device
+    // timeline value to release resources with that the frames recorded so far may still use
+    uint64_t GetReleaseValue() const { return (uint64_t)m_FrameNumber + 1; }
     void DrawBackground(VkCommandBuffer cmd);
+    void SubmitCompute();
+    void ReadFrameTimestamps();
+    void ReadFrameStatistics();
+    // writes the scene uniforms of the frame, returns the set to bind or VK_NULL_HANDLE when it is pushed
+    VkDescriptorSet UploadSceneData();
+    void StartLightBenchmark();
+    // feed the pass timings of a finished frame
+    void UpdateLightBenchmark();
+    // adds the last frame's pass timings to sums, and formats sums averaged over frames for the log
+    void AccumulatePassTimings(std::vector<PassTiming>& sums) const;
+    static std::string FormatPassTimings(const std::vector<PassTiming>& sums, uint32_t frames);
+    void StartPathBenchmark();
+    void UpdatePathBenchmark();
+    void SetRenderPath(RenderPathBenchmark::Path path);
+    // splits the opaque surfaces of the frame into the visibility buffer draws and the ones left to the forward pass
+    void BuildVisibilityDraws(uint32_t frame);
+    // binds the scene, the materials and the targets of the visibility compute passes
+    void BindVisibilitySets(VkCommandBuffer cmd, VkImageView visibilityView, VkDescriptorSet globalDescriptor);
+    void SetViewportScissor(VkCommandBuffer cmd);
+    static GPUDepthPushConstants DepthPushConstants(const RenderObject& draw, const glm::mat4& matrix);
+    void RecordDraws(VkCommandBuffer cmd, std::span<const RenderObject> draws, VkDescriptorSet globalDescriptor);
+    // binds globalDescriptor, or pushes the scene buffer of the current frame when it is VK_NULL_HANDLE
+    void BindSceneDescriptor(VkCommandBuffer cmd, VkPipelineLayout layout, VkDescriptorSet globalDescriptor,
+        VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS);
+    void SetMaterialState(VkCommandBuffer cmd, const MaterialPipeline& pipeline);
+    // binds the shader objects and sets the state a pipeline would have baked in, SetMaterialState does the rest
+    void BindShaders(VkCommandBuffer cmd, const GraphicsShaders& shaders);
+    // depth write and compare of a material pipeline, depending on the depth prepass
+    void SetDepthState(VkCommandBuffer cmd, const MaterialPipeline& pipeline);
+    // statistics: the pipeline statistics query is active around the secondaries, they have to inherit it
+    void RecordDrawsParallel(VkCommandBuffer cmd, std::span<const RenderObject> draws, VkDescriptorSet globalDescriptor, bool statistics);
+    VkCommandBuffer GetSecondaryCommandBuffer(WorkerCommands& worker);
     void InitPipelines();
 	void InitBackgroundPipelines();
+    void InitCompositePipeline();
     void InitMeshPipeline();
+    void InitDepthPrepassPipeline();
     void InitImGui();
     void InitDefaultData();
     AllocatedBuffer CreateBuffer(std::size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
@@ -169,12 +552,43 @@ private:
     std::vector<VkImageView> m_SwapChainImageViews;
     VkQueue m_GraphicsQueue;
     uint8_t m_GraphicsQueueFamily;
+    // separate compute family if the gpu has one, otherwise the graphics queue
+    VkQueue m_ComputeQueue;
+    uint8_t m_ComputeQueueFamily;
+    bool m_HasAsyncCompute {false};
+    bool m_UseAsyncCompute {true};
+    // cross queue dependencies, both count frames (value n = frame n-1 reached that point).
+    // graphics signals once the draw image is no longer read, compute once the frame's compute work is done
+    VkSemaphore m_GraphicsTimeline;
+    VkSemaphore m_ComputeTimeline;
+#if defined(VK_EXT_extended_dynamic_state3)
+    // extension commands, loaded when the blend state can be dynamic
+    PFN_vkCmdSetColorBlendEnableEXT m_CmdSetColorBlendEnable {nullptr};
+    PFN_vkCmdSetColorBlendEquationEXT m_CmdSetColorBlendEquation {nullptr};
+#endif
+#if defined(VK_EXT_shader_object)
+    // the state commands shader objects need on top of the blend ones
+    PFN_vkCmdBindShadersEXT m_CmdBindShaders {nullptr};
+    PFN_vkCmdSetPolygonModeEXT m_CmdSetPolygonMode {nullptr};
+    PFN_vkCmdSetRasterizationSamplesEXT m_CmdSetRasterizationSamples {nullptr};
+    PFN_vkCmdSetSampleMaskEXT m_CmdSetSampleMask {nullptr};
+    PFN_vkCmdSetAlphaToCoverageEnableEXT m_CmdSetAlphaToCoverageEnable {nullptr};
+    PFN_vkCmdSetColorWriteMaskEXT m_CmdSetColorWriteMask {nullptr};
+    PFN_vkCmdSetVertexInputEXT m_CmdSetVertexInput {nullptr};
+#endif
+    PFN_vkCmdPushDescriptorSetWithTemplateKHR m_CmdPushDescriptorSetWithTemplate {nullptr};
+    VkDescriptorUpdateTemplate m_ScenePushTemplate {VK_NULL_HANDLE};
+    // same for the visibility compute passes
+    VkDescriptorUpdateTemplate m_ComputeScenePushTemplate {VK_NULL_HANDLE};
     FrameData m_Frames[FRAME_OVERLAP];
     DeletionQueue m_MainDeletionQueue;
     VmaAllocator m_Allocator;
     VkExtent2D m_DrawExtent;
 
-    DescriptorAllocatorGrowable m_GlobalDescriptorAllocator;
+    DescriptorPoolTuning m_DescriptorTuning;
+    DescriptorSetCache m_DescriptorCache;
+    // reused so recording a set does not allocate every frame
+    DescriptorWriter m_FrameWriter;
     VkDescriptorSet m_DrawImageDescriptors;
     VkDescriptorSetLayout m_DrawImageDescriptorLayout;
     /* pipelines */
@@ -184,6 +598,13 @@ private:
     VkPipeline m_MeshPipeline;
     VkPipelineLayout m_MeshPipelineLayout;
 
+    VkPipeline m_CompositePipeline;
+    VkPipelineLayout m_CompositePipelineLayout;
+    VkDescriptorSetLayout m_CompositeDescriptorLayout;
+    VkSampler m_CompositeSampler;
+    float m_UpscaleSharpness {0.3f};
+    float m_Exposure {1.f};
+
     //immediate submit structures
     VkFence m_ImmFence;
     VkCommandBuffer m_ImmCommandBuffer;
@@ -195,8 +616,18 @@ private:
     //scene data
     GPUSceneData m_SceneData;
     // materials
-    MaterialInstance m_DefaultData;
+    VkDeviceSize m_MinUniformAlignment {256};
+    MaterialHandle m_DefaultMaterial;
     GLTFMetallic_Roughness m_MetalRoughMaterial;
+    MaterialSystem m_Materials;
+    // lights
+    ClusteredLighting m_Lighting;
+    int m_LightCount {DEFAULT_LIGHT_COUNT};
+    LightBenchmark m_LightBenchmark;
+    // towards the sun, world space
+    glm::vec3 m_SunDirection {0.f, 1.f, 0.5f};
+    CascadedShadows m_Shadows;
+    bool m_CacheShadows {true};
 
     //textures
     AllocatedImage m_WhiteImage;
@@ -213,11 +644,70 @@ private:
     std::unordered_map<std::string, std::shared_ptr<Node>> m_LoadedNodes;
 
     bool m_ResizeRequested {false};
+    std::chrono::steady_clock::time_point m_LastPipelineCacheSave;
 
     int m_CurrentBackgroundEffect{0};
     bool m_IsRunning {true};
+    // see EngineOptions
+    bool m_Headless {false};
+    uint32_t m_HeadlessFrames {0};
+    FrameReadback m_Readback;
+    bool m_UseReadback {false};
+    // seconds the scene animates by, wall clock with a window and frame based headless
+    float m_SceneTime {0.f};
+    CameraPath m_CameraPath {CameraPath::Orbit};
+    glm::vec3 m_CameraCenter {0.f};
+    float m_CameraRadius {5.f};
+    // root of the generated scene, drawn instead of the default content when set
+    std::shared_ptr<Node> m_GeneratedScene;
+    std::vector<std::shared_ptr<MeshAsset>> m_GeneratedMeshes;
+    std::string m_DeviceName;
     bool m_IsMinimized {false};
     int m_FrameNumber {0};
     std::vector<std::shared_ptr<MeshAsset>> m_testMeshes;
     float m_RenderScale{1.f};
+
+    //dynamic resolution
+    ResolutionController m_ResolutionController;
+    bool m_DynamicResolution {true};
+    bool m_HasTimestamps {false};
+    float m_TimestampPeriod {1.0f};
+    float m_GpuFrameMs {0.0f};
+    std::vector<PassTiming> m_PassTimings;
+
+    // gpu scopes of the frame, the render graph passes and what is nested in them
+    GpuProfiler m_Profiler;
+    bool m_HasCalibratedTimestamps {false};
+
+    //parallel command recording
+    WorkerPool m_Workers;
+    bool m_ParallelRecording {true};
+    // see DEPTH_PREPASS
+    bool m_DepthPrepass {DEPTH_PREPASS};
+    VkPipeline m_DepthPrepassPipeline;
+    bool m_HasPipelineStatistics {false};
+    // secondary command buffers can run inside the statistics query, without it parallel frames are not measured
+    bool m_HasInheritedQueries {false};
+    // fragment shader invocations of the last measured frame without and with the prepass
+    uint64_t m_FragmentInvocations[2] {};
+    // see VISIBILITY_BUFFER
+    VisibilityBuffer m_Visibility;
+    bool m_HasVisibilityBuffer {false};
+    bool m_UseVisibilityBuffer {VISIBILITY_BUFFER};
+    // of the frame being recorded, the ui can change the settings in between
+    bool m_VisibilityActive {false};
+    bool m_DepthPrepassActive {false};
+    // opaque surfaces in the visibility buffer, by their index in the frame's draw list
+    std::vector<uint32_t> m_VisibilityDraws;
+    // the opaque surfaces left to the forward pass while the visibility buffer is on
+    std::vector<RenderObject> m_ForwardDraws;
+    bool m_DenseScene {false};
+    RenderPathBenchmark m_PathBenchmark;
+    uint32_t m_DrawChunkSize {PARALLEL_RECORD_MIN_CHUNK};
+    double m_RecordNsPerDraw {0.0};
+    std::vector<VkCommandBuffer> m_ChunkCommandBuffers;
+
+    RenderGraph m_RenderGraph;
+    // passes submitted to the compute queue
+    RenderGraph m_ComputeGraph;
 };
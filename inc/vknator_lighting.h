@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <vknator_pipelinecompiler.h>
+#include <glm/vec3.hpp>
+
+//> clustered_lighting
+// froxel grid the view frustum is split into, screen tiles in x and y and exponential view depth slices in z.
+// Must match the defines in lights.glsl
+constexpr uint32_t CLUSTER_GRID_X = 16;
+constexpr uint32_t CLUSTER_GRID_Y = 9;
+constexpr uint32_t CLUSTER_GRID_Z = 24;
+constexpr uint32_t CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+// lights past this in one cluster are dropped
+constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 128;
+constexpr uint32_t MAX_LIGHTS = 4096;
+// view depth covered by the slices, geometry beyond the far slice is lit by the last one
+constexpr float CLUSTER_NEAR = 0.1f;
+constexpr float CLUSTER_FAR = 1000.f;
+
+enum class LightType : uint32_t {
+    Point = 0,
+    Spot = 1
+};
+
+// world space light as the scene describes it
+struct Light {
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+    float intensity;
+    // spot lights only, cosines of the half angles where the cone starts and ends fading
+    glm::vec3 direction;
+    float innerCos;
+    float outerCos;
+    LightType type;
+};
+
+// circle a light moves along, Animate puts it at phase + speed * seconds radians
+struct LightOrbit {
+    glm::vec3 center;
+    float radius;
+    float speed;
+    float phase;
+};
+
+// light as the shaders read it (std430), in view space
+struct GPULight {
+    glm::vec4 positionRadius;
+    glm::vec4 colorIntensity;
+    // w = LightType
+    glm::vec4 direction;
+    // x = outer cosine, y = inner cosine
+    glm::vec4 spotCos;
+};
+
+// push constants of cluster_lights.comp
+struct ClusterPushConstants {
+    glm::mat4 inverseProjection;
+    VkDeviceAddress lightBuffer;
+    VkDeviceAddress clusterBuffer;
+    // xyz = grid size, w = light count
+    glm::uvec4 grid;
+    // near, far, slice scale, slice bias
+    glm::vec4 depth;
+    // xy = draw extent in pixels, zw = tile size in pixels
+    glm::vec4 screen;
+};
+
+// clustered forward lighting. Every frame the lights go into a per frame light buffer in view space, then a compute
+// pass gives every cluster the list of lights whose range touches it. The mesh shaders look up the cluster of a
+// fragment and only shade the lights in its list. Both buffers are reached through buffer device addresses
+// in the scene uniforms, no descriptor set changes
+class ClusteredLighting {
+public:
+    // queues the binning pipeline on the compiler, it is ready after the compiler's WaitAll
+    void Init(VkDevice device, VmaAllocator allocator, uint32_t frameCount, PipelineCompiler* compiler, ShaderLibrary* shaders);
+    void Destroy();
+
+    // replace the lights with count lights spread through the scene. The radii shrink as the count grows so a point
+    // is touched by about the same number of lights, which keeps the shading cost flat and shows the binning cost
+    void BuildBenchmarkScene(uint32_t count);
+    // replace the lights with the given ones, one orbit per light. Lights past MAX_LIGHTS are dropped
+    void SetLights(std::vector<Light> lights, std::vector<LightOrbit> orbits);
+    // radius at which count lights spread through a box of the given extent cover every point of it about
+    // overlap times
+    static float CoverageRadius(uint32_t count, glm::vec3 extent, float overlap);
+    // moves the lights of the benchmark scene along their orbits
+    void Animate(float seconds);
+
+    // transform the lights into view space and write them into the light buffer of the frame slot,
+    // the gpu has to be done with the slot
+    void Upload(uint32_t frame, const glm::mat4& view);
+    // bin the uploaded lights into the cluster buffer of the frame slot
+    void RecordBinning(VkCommandBuffer cmd, uint32_t frame, const glm::mat4& projection, VkExtent2D extent);
+
+    // addresses and grid parameters the mesh shaders need, see SceneData in input_structures.glsl
+    VkDeviceAddress GetLightAddress(uint32_t frame) const { return m_Frames[frame].lightAddress; }
+    VkDeviceAddress GetClusterAddress(uint32_t frame) const { return m_Frames[frame].clusterAddress; }
+    VkBuffer GetClusterBuffer(uint32_t frame) const { return m_Frames[frame].clusters.buffer; }
+    glm::uvec4 GetGrid() const;
+    glm::vec4 GetDepthParams() const;
+    glm::vec4 GetScreenParams(VkExtent2D extent) const;
+
+    uint32_t GetLightCount() const { return (uint32_t)m_Lights.size(); }
+
+private:
+    struct FrameLights {
+        AllocatedBuffer lights;
+        AllocatedBuffer clusters;
+        VkDeviceAddress lightAddress;
+        VkDeviceAddress clusterAddress;
+    };
+
+    AllocatedBuffer CreateBuffer(VkDeviceSize size, VmaMemoryUsage memoryUsage, VkDeviceAddress& address);
+
+    VkDevice m_Device;
+    VmaAllocator m_Allocator;
+    VkPipelineLayout m_Layout;
+    VkPipeline m_Pipeline;
+    glm::uvec3 m_LocalSize;
+
+    std::vector<FrameLights> m_Frames;
+    std::vector<Light> m_Lights;
+    std::vector<LightOrbit> m_Orbits;
+};
+//< clustered_lighting
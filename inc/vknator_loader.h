@@ -1,16 +1,16 @@
 #pragma once
 
 #include <vknator_types.h>
+#include <vknator_resources.h>
 #include <unordered_map>
 #include <filesystem>
 
-struct GLTFMaterial{
-    MaterialInstance data;
-};
 struct GeoSurface {
     uint32_t startIndex;
     uint32_t count;
-    std::shared_ptr<GLTFMaterial> material;
+    Bounds bounds;
+    // resolved through the MaterialSystem when the surface is drawn
+    MaterialHandle material;
 };
 
 struct MeshAsset {
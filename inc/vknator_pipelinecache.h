@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <mutex>
+#include <string>
+
+//> pipeline_cache
+// VkPipelineCache that survives restarts. The file is only used when its header matches the current gpu and driver,
+// saves go through a temporary file so a crash while writing never leaves a broken cache behind
+class PipelineCache {
+public:
+    struct Stats {
+        uint32_t pipelines;
+        uint32_t hits;
+        uint32_t misses;
+        double totalMs;
+    };
+
+    void Init(VkDevice device, VkPhysicalDevice physicalDevice, const std::string& path);
+    // saves and destroys the cache
+    void Destroy();
+
+    // write the cache to disk if it changed since the last save
+    void Save();
+
+    // create pipelines through the cache, the creation time and whether the cache had them is recorded per pipeline.
+    // safe to call from several threads
+    VkResult CreateGraphicsPipeline(const VkGraphicsPipelineCreateInfo& createInfo, const char* name, VkPipeline* outPipeline);
+    VkResult CreateComputePipeline(const VkComputePipelineCreateInfo& createInfo, const char* name, VkPipeline* outPipeline);
+
+    VkPipelineCache Get() const { return m_Cache; }
+    Stats GetStats();
+    void LogStats();
+
+private:
+    bool IsCompatible(const std::vector<char>& data) const;
+    void Record(const char* name, const VkPipelineCreationFeedback& feedback, double wallMs);
+
+    VkDevice m_Device;
+    VkPhysicalDeviceProperties m_DeviceProperties;
+    VkPipelineCache m_Cache {VK_NULL_HANDLE};
+    std::string m_Path;
+    size_t m_SavedSize {0};
+
+    std::mutex m_StatsMutex;
+    Stats m_Stats {};
+};
+//< pipeline_cache
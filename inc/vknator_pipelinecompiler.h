@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <vknator_pipelines.h>
+#include <vknator_workers.h>
+#include <vknator_shaderlibrary.h>
+#include <future>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+
+//> pipeline_compiler
+// compiles pipelines on the worker threads, shaders come from the shader library by name. Requests with
+// identical state are compiled once and share the handle, so the compiler owns every pipeline it returns
+// and destroys them in Destroy. The same goes for shader objects
+class PipelineCompiler {
+public:
+    struct Stats {
+        uint32_t pipelines;
+        // pairs of vertex and fragment shader objects
+        uint32_t shaderObjects;
+    };
+
+    // shader objects can be compiled once VK_EXT_shader_object is enabled on the device
+    void Init(VkDevice device, PipelineCache* cache, ShaderLibrary* shaders, WorkerPool* workers);
+    void Destroy();
+
+    // builder holds all state except the shaders, it is copied so the caller can keep changing it.
+    // target (optional) receives the handle once compiled, it is safe to read after WaitAll.
+    // An empty fragmentShader builds a depth only pipeline
+    std::shared_future<VkPipeline> CompileGraphics(const PipelineBuilder& builder, const std::string& vertexShader,
+        const std::string& fragmentShader, const std::string& name, VkPipeline* target = nullptr);
+    std::shared_future<VkPipeline> CompileCompute(VkPipelineLayout layout, const std::string& shader,
+        const std::string& name, VkPipeline* target = nullptr);
+    // the shader object version of CompileGraphics, only the specialization constants of builder are used.
+    // setLayouts and pushConstants have to match the pipeline layout the descriptors are bound with.
+    // Null shaders when VK_EXT_shader_object is not enabled
+    std::shared_future<GraphicsShaders> CompileShaderObjects(const PipelineBuilder& builder, std::span<const VkDescriptorSetLayout> setLayouts,
+        const VkPushConstantRange& pushConstants, const std::string& vertexShader, const std::string& fragmentShader,
+        const std::string& name, GraphicsShaders* target = nullptr);
+    bool HasShaderObjects() const { return m_CreateShaders != nullptr; }
+
+    // block until all queued pipelines are built and log the compile time breakdown
+    void WaitAll();
+
+    // distinct pipelines and shader objects requested so far, including the ones still compiling
+    Stats GetStats();
+
+private:
+    struct Timing {
+        std::string name;
+        double shaderMs;
+        double compileMs;
+    };
+
+    template <typename T>
+    struct Jobs {
+        std::unordered_map<uint64_t, std::shared_future<T>> compiled;
+        std::vector<std::pair<std::shared_future<T>, T*>> pending;
+    };
+
+    VkShaderModule GetShaderModule(const std::string& name, double& waitMs);
+    template <typename T>
+    std::shared_future<T> Queue(Jobs<T>& jobs, uint64_t hash, T* target, std::function<T()>&& job);
+
+    VkDevice m_Device;
+    PipelineCache* m_Cache;
+    ShaderLibrary* m_Shaders;
+    WorkerPool* m_Workers;
+
+#if defined(VK_EXT_shader_object)
+    PFN_vkCreateShadersEXT m_CreateShaders {nullptr};
+    PFN_vkDestroyShaderEXT m_DestroyShader {nullptr};
+#else
+    void* m_CreateShaders {nullptr};
+#endif
+
+    std::mutex m_Mutex;
+    Jobs<VkPipeline> m_Pipelines;
+    Jobs<GraphicsShaders> m_ShaderObjects;
+    std::vector<Timing> m_Timings;
+    uint32_t m_Deduplicated {0};
+    std::chrono::steady_clock::time_point m_BatchStart;
+    bool m_BatchRunning {false};
+};
+//< pipeline_compiler
@@ -1,10 +1,7 @@
 #pragma once
 
 #include <vknator_types.h>
-
-namespace vknatorutils {
-    bool LoadShaderModule(const char* filePath, VkDevice device, VkShaderModule* outShaderModule);
-}
+#include <vknator_pipelinecache.h>
 
 //< pipeline builder
 class PipelineBuilder {
@@ -19,10 +16,17 @@ public:
     VkPipelineDepthStencilStateCreateInfo m_DepthStencil;
     VkPipelineRenderingCreateInfo m_RenderInfo;
     VkFormat m_ColorAttachmentformat;
+    //uint32 specialization constants, applied to every stage
+    std::vector<VkSpecializationMapEntry> m_SpecializationEntries;
+    std::vector<uint32_t> m_SpecializationData;
+    VkSpecializationInfo m_SpecializationInfo;
+    //on top of viewport and scissor, which are always dynamic
+    std::vector<VkDynamicState> m_DynamicStates;
 
     PipelineBuilder(){ Clear(); }
 
     void Clear();
+    // fragment shader VK_NULL_HANDLE for depth only pipelines
     void SetShaders(VkShaderModule vertexShader, VkShaderModule fragementShader);
     void SetInputTopology(VkPrimitiveTopology topology);
     void SetPolygonMode(VkPolygonMode mode);
@@ -30,12 +34,22 @@ public:
     void SetMultisamplingNone();
     void DisableBlending();
     void SetColorAttachmentFormat(VkFormat format);
+    // no color attachment, only the depth format is rendered to
+    void SetDepthOnly();
     void SetDepthFormat(VkFormat format);
     void DisableDepthtest();
     void EnableDepthtest(bool depthWriteEnable, VkCompareOp op);
     void EnableBlendingAdditive();
     void EnableBlendingAlphablend();
+    void EnableDepthBias(float constantFactor, float slopeFactor);
+    void SetSpecializationConstant(uint32_t constantId, uint32_t value);
+    // the matching static state of the builder is ignored, it has to be set on the command buffer
+    void AddDynamicState(VkDynamicState state);
+
+    // hash over all state that ends up in the pipeline, except the shaders
+    uint64_t Hash() const;
 
-    VkPipeline BuildPipeline(VkDevice device);
+    // with a cache the pipeline goes through it and shows up in its stats under name
+    VkPipeline BuildPipeline(VkDevice device, PipelineCache* cache = nullptr, const char* name = "graphics");
 };
 //> pipeline builder
\ No newline at end of file
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <deque>
+#include <string>
+#include <string_view>
+
+//> gpu_profiler
+// the queues with their own queries, each gets its own lane in the trace
+enum class ProfilerQueue : uint8_t {
+    Graphics,
+    Compute,
+};
+constexpr uint32_t PROFILER_QUEUES = 2;
+
+// scopes a command buffer can open per frame, each takes two timestamp queries
+constexpr uint32_t PROFILER_MAX_SCOPES = 64;
+// resolved frames kept for the graphs and the trace export
+constexpr uint32_t PROFILER_HISTORY_FRAMES = 240;
+constexpr const char* PROFILER_TRACE_PATH = "gpu_trace.json";
+
+struct ProfilerScope {
+    std::string name;
+    // 0 for the outermost scopes of a command buffer
+    uint32_t depth;
+    // steady_clock nanoseconds, the gpu times are mapped onto the cpu clock
+    int64_t beginNs;
+    int64_t endNs;
+
+    float Ms() const { return (endNs - beginNs) / 1000000.f; }
+};
+
+struct ProfilerFrame {
+    uint64_t frameNumber;
+    // in the order the scopes were opened, a scope comes before the ones nested in it
+    std::vector<ProfilerScope> scopes[PROFILER_QUEUES];
+};
+
+// one scope over the last frames, for the overlay
+struct ProfilerScopeStats {
+    std::string name;
+    ProfilerQueue queue;
+    uint32_t depth;
+    float lastMs;
+    float avgMs;
+    float maxMs;
+    // ring of the last PROFILER_HISTORY_FRAMES times, the oldest at historyOffset
+    std::vector<float> history;
+    uint32_t historyOffset;
+    uint32_t samples;
+};
+
+// nested gpu time scopes, read back without ever waiting on the gpu.
+// Every frame slot has a timestamp query pool per queue. A command buffer resets its pool when it starts, the scopes
+// write a timestamp at both ends. The results are read once the slot comes around again and its fence has signalled,
+// FRAME_OVERLAP frames later, only the queries that are available by then are used.
+// With VK_EXT_calibrated_timestamps the gpu ticks are mapped onto steady_clock through a device / CLOCK_MONOTONIC
+// pair sampled every frame, so the gpu scopes line up with the cpu scopes in the trace. Without it every command
+// buffer is assumed to start when it was submitted.
+// Everything but the worker threads' secondary command buffers runs on the render thread, so none of this is locked
+class GpuProfiler {
+public:
+    static constexpr uint32_t NO_SCOPE = ~0u;
+
+    // queueFamilies holds the family of every ProfilerQueue, a family without timestamp support is not timed.
+    // calibrated needs VK_EXT_calibrated_timestamps enabled on the device
+    void Init(VkInstance instance, VkPhysicalDevice gpu, VkDevice device, uint32_t frameCount, float timestampPeriod,
+        const uint32_t (&queueFamilies)[PROFILER_QUEUES], bool calibrated);
+    void Destroy();
+
+    // resolves the frame that used the slot before, its fence has to have signalled. The frame stays valid until the
+    // next call, nullptr when nothing of it was available
+    const ProfilerFrame* BeginFrame(uint32_t slot, uint64_t frameNumber);
+    // resets the queries of the queue, before the first scope of the command buffer
+    void BeginCommands(VkCommandBuffer cmd, ProfilerQueue queue);
+    // right before the submit, the time the gpu side is aligned to without calibration
+    void EndCommands(ProfilerQueue queue);
+
+    // NO_SCOPE when cmd is not profiled or out of queries, EndScope ignores it
+    uint32_t BeginScope(VkCommandBuffer cmd, std::string_view name);
+    void EndScope(VkCommandBuffer cmd, uint32_t scope);
+
+    class Scope {
+    public:
+        Scope(GpuProfiler& profiler, VkCommandBuffer cmd, std::string_view name)
+            : m_Profiler(profiler), m_Cmd(cmd), m_Scope(profiler.BeginScope(cmd, name)) {}
+        ~Scope() { m_Profiler.EndScope(m_Cmd, m_Scope); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        GpuProfiler& m_Profiler;
+        VkCommandBuffer m_Cmd;
+        uint32_t m_Scope;
+    };
+
+    // render thread only, recorded even without timestamp support
+    class CpuScope {
+    public:
+        CpuScope(GpuProfiler& profiler, std::string_view name);
+        ~CpuScope();
+        CpuScope(const CpuScope&) = delete;
+        CpuScope& operator=(const CpuScope&) = delete;
+    private:
+        GpuProfiler& m_Profiler;
+        std::string_view m_Name;
+        uint32_t m_Depth;
+        int64_t m_BeginNs;
+    };
+
+    bool IsEnabled() const { return m_Enabled; }
+    bool IsCalibrated() const { return m_Calibrated; }
+    // upper bound of the error of the last clock sample
+    float GetClockDeviationUs() const { return m_Calibration.deviationNs / 1000.f; }
+    // the scopes of the last resolved frame, in its order
+    const std::vector<ProfilerScopeStats>& GetStats() const { return m_Stats; }
+
+    // chrome trace event json of the kept frames, loads in chrome://tracing and ui.perfetto.dev
+    bool ExportTrace(const std::string& path) const;
+
+private:
+    struct PendingScope {
+        std::string name;
+        uint32_t depth;
+    };
+
+    struct QueueQueries {
+        VkQueryPool pool {VK_NULL_HANDLE};
+        std::vector<PendingScope> scopes;
+        int64_t submitNs {0};
+    };
+
+    struct Slot {
+        QueueQueries queues[PROFILER_QUEUES];
+        uint64_t frameNumber {0};
+    };
+
+    struct Calibration {
+        uint64_t gpuTicks {0};
+        int64_t hostNs {0};
+        uint64_t deviationNs {0};
+    };
+
+    struct CpuEvent {
+        ProfilerScope scope;
+        uint64_t frameNumber;
+    };
+
+    // index of the queue cmd was begun on, PROFILER_QUEUES for none
+    uint32_t FindQueue(VkCommandBuffer cmd) const;
+    void Calibrate();
+    void UpdateStats(const ProfilerFrame& frame);
+
+    VkDevice m_Device {VK_NULL_HANDLE};
+    bool m_Enabled {false};
+    float m_TimestampPeriod {1.f};
+    // 0 for the queues that are not timed
+    uint32_t m_ValidBits[PROFILER_QUEUES] {};
+
+    std::vector<Slot> m_Slots;
+    uint32_t m_Slot {0};
+    VkCommandBuffer m_Commands[PROFILER_QUEUES] {};
+    uint32_t m_Depth[PROFILER_QUEUES] {};
+    std::vector<uint64_t> m_Results;
+
+    bool m_Calibrated {false};
+    PFN_vkGetCalibratedTimestampsEXT m_GetCalibratedTimestamps {nullptr};
+    Calibration m_Calibration;
+
+    uint64_t m_FrameNumber {0};
+    uint32_t m_CpuDepth {0};
+    std::deque<CpuEvent> m_CpuEvents;
+    std::deque<ProfilerFrame> m_History;
+    std::vector<ProfilerScopeStats> m_Stats;
+};
+//< gpu_profiler
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <vknator_workers.h>
+#include <deque>
+#include <future>
+
+//> frame_readback
+// encodes running at the same time before the render loop waits for the oldest one, bounds the memory of queued frames
+constexpr uint32_t READBACK_MAX_PENDING_ENCODES = 8;
+
+// copies finished frames back to the cpu and writes them out as png, for rendering without a window.
+// Every frame slot has its own host visible buffer the output image is copied into, the copy is read once the slot's
+// fence signalled. The pixels are then moved out of the buffer and encoded on a separate worker pool, so the buffer is
+// free again for the next frame of the slot right away. The gpu never waits for an encode or the disk, only the cpu
+// does once READBACK_MAX_PENDING_ENCODES frames are queued
+class FrameReadback {
+public:
+    // frames are written to directory/frame_NNNNN.png, format is the one of the copied image (8 bit rgba or bgra)
+    bool Init(VkDevice device, VmaAllocator allocator, uint32_t frameCount, VkExtent2D extent, VkFormat format,
+        const std::string& directory, uint32_t encoderThreads);
+    // waits for the queued encodes, the gpu has to be done with every slot
+    void Destroy();
+
+    // buffer the frame slot copies into, for the render graph
+    VkBuffer GetBuffer(uint32_t frame) const { return m_Slots[frame].buffer.buffer; }
+    // copies image (TRANSFER_SRC_OPTIMAL) into the buffer of the frame slot, frameIndex names the written file
+    void RecordCopy(VkCommandBuffer cmd, uint32_t frame, VkImage image, uint32_t frameIndex);
+    // hands the last copy of the frame slot to the encoders. The gpu has to be done with the slot
+    void Collect(uint32_t frame);
+
+    struct Stats {
+        uint32_t written;
+        uint32_t failed;
+        // times the render loop waited for an encode to finish
+        uint32_t stalls;
+        double encodeMs;
+        uint64_t bytes;
+    };
+    Stats GetStats() const { return m_Stats; }
+
+private:
+    struct Slot {
+        AllocatedBuffer buffer;
+        bool pending {false};
+        uint32_t frameIndex {0};
+    };
+
+    struct EncodeResult {
+        bool written;
+        double ms;
+        uint64_t bytes;
+    };
+
+    // drops finished encodes, waits for the oldest one while more than maxPending are left
+    void Retire(size_t maxPending);
+
+    VkDevice m_Device;
+    VmaAllocator m_Allocator;
+    VkExtent2D m_Extent;
+    bool m_SwapRedBlue {false};
+    std::string m_Directory;
+    std::vector<Slot> m_Slots;
+
+    WorkerPool m_Encoders;
+    std::deque<std::future<EncodeResult>> m_Encodes;
+    Stats m_Stats {};
+};
+//< frame_readback
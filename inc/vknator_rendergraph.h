@@ -0,0 +1,179 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <vknator_profiler.h>
+#include <functional>
+#include <string>
+
+//> render_graph
+// how a pass touches an image or buffer. The graph turns these into layouts, stage and access masks
+enum class RGUsage : uint8_t {
+    ColorAttachment,
+    DepthAttachment,
+    StorageRead,
+    StorageWrite,
+    Sampled,
+    TransferSrc,
+    TransferDst,
+    // buffers
+    UniformBuffer,
+    StorageBufferRead,
+    StorageBufferWrite,
+    IndirectBuffer,
+};
+
+enum class RGQueue : uint8_t {
+    Graphics,
+    Compute,
+    Transfer
+};
+
+// index of a resource inside the graph, only valid for the frame it was declared in
+using RGHandle = uint32_t;
+constexpr RGHandle RG_INVALID_HANDLE = ~0u;
+
+// transient images are owned by the graph, their usage flags are derived from the declared accesses
+struct RGImageDesc {
+    VkFormat format;
+    VkExtent3D extent;
+};
+
+struct RGStats {
+    uint32_t declaredPasses;
+    uint32_t culledPasses;
+    uint32_t barrierBatches;
+    uint32_t imageBarriers;
+    uint32_t bufferBarriers;
+    VkDeviceSize transientRequested;  // bytes if every transient had its own memory
+    VkDeviceSize transientAllocated;  // bytes after aliasing
+};
+
+class RenderGraph;
+
+// small helper returned by AddPass to declare what the pass reads and writes
+class RGPassBuilder {
+public:
+    RGPassBuilder(RenderGraph* graph, uint32_t pass) : m_Graph(graph), m_Pass(pass) {}
+
+    RGPassBuilder& Read(RGHandle resource, RGUsage usage);
+    // discard: the pass overwrites the whole resource, older contents are not needed
+    RGPassBuilder& Write(RGHandle resource, RGUsage usage, bool discard = false);
+    // the pass has effects outside the graph and must never be culled
+    RGPassBuilder& SideEffect();
+
+private:
+    RenderGraph* m_Graph;
+    uint32_t m_Pass;
+};
+
+class RenderGraph {
+public:
+    using ExecuteFunction = std::function<void(VkCommandBuffer cmd)>;
+
+    void Init(VkDevice device, VmaAllocator allocator, uint32_t framesInFlight);
+    void Destroy();
+
+    // start describing a new frame. Declared passes and resources are dropped,
+    // transient memory is kept and reused while the frame layout does not change
+    void Reset();
+
+    // imported images start in initialLayout, finalLayout != UNDEFINED marks them as graph output
+    RGHandle ImportImage(const char* name, const AllocatedImage& image, VkImageLayout initialLayout, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+    RGHandle ImportBuffer(const char* name, VkBuffer buffer, bool output = false);
+    RGHandle CreateImage(const char* name, const RGImageDesc& desc);
+
+    RGPassBuilder AddPass(const char* name, RGQueue queue, ExecuteFunction&& execute);
+
+    // image behind a handle, transient images are only backed by memory after Compile
+    const AllocatedImage& GetImage(RGHandle resource) const;
+
+    // cull, compute barriers and place transient images in memory
+    void Compile();
+    void Execute(VkCommandBuffer cmd);
+    // record passes [firstPass, endPass) only, so a frame can be split over several submits on the same queue
+    void Execute(VkCommandBuffer cmd, uint32_t firstPass, uint32_t endPass);
+
+    uint32_t GetPassCount() const { return (uint32_t)m_Passes.size(); }
+
+    // every executed pass gets a profiler scope of its name, nullptr turns timing off
+    void SetProfiler(GpuProfiler* profiler) { m_Profiler = profiler; }
+
+    const RGStats& GetStats() const { return m_Stats; }
+
+private:
+    friend class RGPassBuilder;
+
+    struct Access {
+        RGHandle resource;
+        RGUsage usage;
+        bool write;
+        bool discard;
+    };
+
+    struct Pass {
+        std::string name;
+        RGQueue queue;
+        ExecuteFunction execute;
+        std::vector<Access> accesses;
+        bool sideEffect {false};
+        bool culled {false};
+        // barriers emitted before the pass runs
+        std::vector<VkImageMemoryBarrier2> imageBarriers;
+        std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+    };
+
+    struct Resource {
+        std::string name;
+        bool isImage;
+        bool transient;
+        bool output;
+        AllocatedImage image;
+        VkBuffer buffer;
+        RGImageDesc desc;
+        VkImageUsageFlags usage;
+        VkImageLayout initialLayout;
+        VkImageLayout finalLayout;
+        // first and last pass using the transient, used to find memory that can be shared
+        uint32_t firstPass;
+        uint32_t lastPass;
+    };
+
+    // memory block shared by transient images whose lifetimes do not overlap
+    struct MemoryBlock {
+        VmaAllocation allocation;
+        VkDeviceSize size;
+        std::vector<std::pair<uint32_t, uint32_t>> lifetimes;
+    };
+
+    struct TransientLayout {
+        std::vector<AllocatedImage> images;
+        std::vector<VmaAllocation> allocations;
+        VkDeviceSize requested {0};
+        VkDeviceSize allocated {0};
+    };
+
+    void CullPasses();
+    void ComputeBarriers();
+    void AllocateTransients();
+    void RetireTransients();
+
+    VkDevice m_Device;
+    VmaAllocator m_Allocator;
+    uint32_t m_FramesInFlight;
+    uint64_t m_FrameIndex {0};
+
+    std::vector<Pass> m_Passes;
+    std::vector<Resource> m_Resources;
+    std::vector<VkImageMemoryBarrier2> m_FinalBarriers;
+
+    // transients of the current layout, rebuilt when the declared transients change
+    TransientLayout m_Transients;
+    std::string m_TransientKey;
+    // layouts replaced while frames may still use them, freed after m_FramesInFlight frames
+    std::vector<std::pair<uint64_t, TransientLayout>> m_Retired;
+
+    GpuProfiler* m_Profiler {nullptr};
+
+    RGStats m_Stats {};
+};
+//< render_graph
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vknator_types.h>
+
+//> resolution_controller
+// picks the render scale from measured gpu frame times, so the frame time target holds under changing load.
+// PID controller on the normalized frame time error, the output is the render scale itself
+class ResolutionController {
+public:
+    void SetTarget(float targetMs) { m_TargetMs = targetMs; }
+    void SetLimits(float minScale, float maxScale);
+
+    // feed the gpu time of a finished frame, returns the render scale for the next one
+    float Update(float gpuMs);
+    // forget the controller history, e.g. after the controller was disabled for a while
+    void Reset(float scale);
+
+    float GetScale() const { return m_Scale; }
+    float GetTargetMs() const { return m_TargetMs; }
+    float GetFilteredMs() const { return m_FilteredMs; }
+
+private:
+    float m_TargetMs {16.0f};
+    float m_MinScale {0.5f};
+    float m_MaxScale {1.0f};
+
+    // gains on the error (target - measured) / target
+    float m_Kp {0.25f};
+    float m_Ki {0.05f};
+    float m_Kd {0.1f};
+    // smoothing of the measured time, single frames are too noisy to react on
+    float m_Smoothing {0.2f};
+    // largest scale change per frame, avoids visible pumping
+    float m_MaxStep {0.05f};
+
+    float m_Scale {1.0f};
+    float m_Integral {0.0f};
+    float m_PreviousError {0.0f};
+    float m_FilteredMs {0.0f};
+};
+//< resolution_controller
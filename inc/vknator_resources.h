@@ -0,0 +1,207 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <span>
+#include <vector>
+
+struct DescriptorSetCache;
+
+//> resource_handles
+// index into a ResourcePool plus the generation of the slot when the handle was made. Once the resource is
+// released the slot generation moves on, so a stale handle is detected instead of reaching a reused slot
+template <typename T>
+struct ResourceHandle {
+    uint32_t index {UINT32_MAX};
+    uint32_t generation {0};
+
+    bool IsNull() const { return index == UINT32_MAX; }
+    bool operator==(const ResourceHandle& other) const { return index == other.index && generation == other.generation; }
+};
+
+using BufferHandle = ResourceHandle<AllocatedBuffer>;
+using ImageHandle = ResourceHandle<AllocatedImage>;
+using SamplerHandle = ResourceHandle<VkSampler>;
+using PipelineHandle = ResourceHandle<VkPipeline>;
+using MaterialHandle = ResourceHandle<MaterialInstance>;
+
+template <typename T>
+class ResourcePool {
+public:
+    ResourceHandle<T> Add(const T& resource){
+        uint32_t index;
+        if (!m_FreeSlots.empty()){
+            index = m_FreeSlots.back();
+            m_FreeSlots.pop_back();
+        } else {
+            index = (uint32_t)m_Slots.size();
+            m_Slots.push_back({});
+        }
+        Slot& slot = m_Slots[index];
+        slot.resource = resource;
+        slot.alive = true;
+        m_Live++;
+        return { index, slot.generation };
+    }
+
+    // nullptr for a null, released or stale handle
+    T* Get(ResourceHandle<T> handle){
+        if (handle.index >= m_Slots.size()){
+            return nullptr;
+        }
+        Slot& slot = m_Slots[handle.index];
+        return slot.alive && slot.generation == handle.generation ? &slot.resource : nullptr;
+    }
+
+    // frees the slot and hands the resource back for destruction, false for a stale handle
+    bool Remove(ResourceHandle<T> handle, T& resource){
+        T* current = Get(handle);
+        if (!current){
+            return false;
+        }
+        resource = *current;
+        Slot& slot = m_Slots[handle.index];
+        slot.alive = false;
+        slot.generation++;
+        m_FreeSlots.push_back(handle.index);
+        m_Live--;
+        return true;
+    }
+
+    template <typename F>
+    void ForEachLive(F&& function){
+        for (Slot& slot : m_Slots){
+            if (slot.alive){
+                function(slot.resource);
+            }
+        }
+    }
+
+    void Clear(){
+        m_Slots.clear();
+        m_FreeSlots.clear();
+        m_Live = 0;
+    }
+
+    uint32_t GetLiveCount() const { return m_Live; }
+
+private:
+    struct Slot {
+        T resource;
+        uint32_t generation {0};
+        bool alive {false};
+    };
+    std::vector<Slot> m_Slots;
+    std::vector<uint32_t> m_FreeSlots;
+    uint32_t m_Live {0};
+};
+//< resource_handles
+
+//> deletion_queue_typed
+// objects of one type waiting for the gpu, each tagged with the timeline value after which it is unused.
+// Values only grow, so the retired objects are always at the front. The storage is kept between frames,
+// after warm up pushing and retiring allocate nothing
+template <typename T>
+class TimelineDeletionQueue {
+public:
+    void Push(const T& object, uint64_t value){
+        m_Pending.push_back({ value, object });
+    }
+
+    // calls destroy for every object whose value was reached, returns how many
+    template <typename F>
+    uint32_t Retire(uint64_t completedValue, F&& destroy){
+        size_t count = 0;
+        while (count < m_Pending.size() && m_Pending[count].first <= completedValue){
+            destroy(m_Pending[count].second);
+            count++;
+        }
+        if (count > 0){
+            m_Pending.erase(m_Pending.begin(), m_Pending.begin() + count);
+        }
+        return (uint32_t)count;
+    }
+
+    uint32_t GetPendingCount() const { return (uint32_t)m_Pending.size(); }
+
+private:
+    std::vector<std::pair<uint64_t, T>> m_Pending;
+};
+//< deletion_queue_typed
+
+//> resource_registry
+// owner of gpu objects that are created and destroyed while frames are in flight. Released objects go into
+// typed queues tagged with a value of the graphics timeline and are destroyed in batches once the timeline
+// reached it, without closures or per object allocations. Main thread only
+class ResourceRegistry {
+public:
+    struct Stats {
+        uint32_t buffers;
+        uint32_t images;
+        uint32_t samplers;
+        uint32_t pipelines;
+        uint32_t pending;
+        uint64_t destroyed;
+        uint64_t staleHandles;
+    };
+
+    void Init(VkDevice device, VmaAllocator allocator);
+    // the cached sets that reference a buffer, view or sampler are freed when Collect destroys it
+    void SetDescriptorCache(DescriptorSetCache* cache) { m_DescriptorCache = cache; }
+    // the device has to be idle, destroys everything pending and everything still alive
+    void Destroy();
+
+    BufferHandle AddBuffer(const AllocatedBuffer& buffer);
+    ImageHandle AddImage(const AllocatedImage& image);
+    SamplerHandle AddSampler(VkSampler sampler);
+    PipelineHandle AddPipeline(VkPipeline pipeline);
+
+    // nullptr (and counted as stale) when the handle was released
+    const AllocatedBuffer* GetBuffer(BufferHandle handle);
+    const AllocatedImage* GetImage(ImageHandle handle);
+    VkSampler GetSampler(SamplerHandle handle);
+    VkPipeline GetPipeline(PipelineHandle handle);
+
+    // the handle is dead right away, the object is destroyed once Collect is called with a completed value >= value
+    void Release(BufferHandle handle, uint64_t value);
+    void Release(ImageHandle handle, uint64_t value);
+    void Release(SamplerHandle handle, uint64_t value);
+    void Release(PipelineHandle handle, uint64_t value);
+    // objects the registry does not track, like the views and swapchain left behind by a resize
+    void Release(VkImageView view, uint64_t value);
+    void Release(VkSwapchainKHR swapchain, uint64_t value);
+
+    // destroy what the gpu is done with, completedValue is the current value of the timeline the releases were tagged with
+    void Collect(uint64_t completedValue);
+    // of the last Collect: the buffers, views and samplers it destroyed, and the pinned cached sets that referenced
+    // them. The owners of those sets have to replace them before they are bound again
+    std::span<const uint64_t> GetDestroyedHandles() const { return m_DestroyedHandles; }
+    std::span<const VkDescriptorSet> GetInvalidatedSets() const { return m_InvalidatedSets; }
+
+    Stats GetStats() const;
+
+private:
+    void CountStale(const char* type);
+
+    VkDevice m_Device;
+    VmaAllocator m_Allocator;
+    DescriptorSetCache* m_DescriptorCache {nullptr};
+
+    ResourcePool<AllocatedBuffer> m_Buffers;
+    ResourcePool<AllocatedImage> m_Images;
+    ResourcePool<VkSampler> m_Samplers;
+    ResourcePool<VkPipeline> m_Pipelines;
+
+    TimelineDeletionQueue<AllocatedBuffer> m_BufferQueue;
+    TimelineDeletionQueue<AllocatedImage> m_ImageQueue;
+    TimelineDeletionQueue<VkSampler> m_SamplerQueue;
+    TimelineDeletionQueue<VkPipeline> m_PipelineQueue;
+    TimelineDeletionQueue<VkImageView> m_ViewQueue;
+    TimelineDeletionQueue<VkSwapchainKHR> m_SwapchainQueue;
+    // handed to the descriptor cache after every Collect, kept between frames
+    std::vector<uint64_t> m_DestroyedHandles;
+    std::vector<VkDescriptorSet> m_InvalidatedSets;
+
+    uint64_t m_Destroyed {0};
+    uint64_t m_StaleHandles {0};
+};
+//< resource_registry
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <vknator_lighting.h>
+#include <string>
+
+//> scene_generator
+// parameters of a procedural scene. The same parameters always give the same scene, on every platform
+struct SceneGenDesc {
+    uint32_t seed {1};
+    uint32_t nodes {256};
+    uint32_t meshes {8};
+    uint32_t materials {16};
+    // 0 leaves every material untextured
+    uint32_t textures {8};
+    uint32_t textureSize {256};
+    uint32_t lights {64};
+    // levels of the node tree, 1 puts every node at the root
+    uint32_t hierarchyDepth {3};
+    // rings of the sphere and torus meshes, their triangle count grows with its square
+    uint32_t meshDetail {16};
+};
+
+struct GeneratedMesh {
+    std::string name;
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    Bounds bounds;
+};
+
+struct GeneratedTexture {
+    uint32_t size;
+    // rgba8, size * size texels
+    std::vector<uint32_t> pixels;
+};
+
+struct GeneratedMaterial {
+    // index into the textures, -1 for untextured
+    int32_t texture;
+    glm::vec4 colorFactors;
+    glm::vec4 metalRoughFactors;
+};
+
+struct GeneratedNode {
+    // index of a node before this one, -1 for the roots
+    int32_t parent;
+    uint32_t mesh;
+    uint32_t material;
+    glm::mat4 localTransform;
+};
+
+// cpu side of a generated scene, the engine uploads it
+struct GeneratedScene {
+    std::vector<GeneratedMesh> meshes;
+    std::vector<GeneratedTexture> textures;
+    std::vector<GeneratedMaterial> materials;
+    std::vector<GeneratedNode> nodes;
+    // desc.lights lights orbiting above the nodes, with the same seed as the rest
+    std::vector<Light> lights;
+    std::vector<LightOrbit> lightOrbits;
+    // sphere around the roots, for the camera paths
+    glm::vec3 center;
+    float radius;
+};
+
+// spheres, boxes and tori spread over the box the light benchmark fills, the deeper levels of the tree hang
+// smaller copies off their parent
+GeneratedScene GenerateScene(const SceneGenDesc& desc);
+//< scene_generator
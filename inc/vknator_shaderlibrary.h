@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <vknator_descriptors.h>
+#include <initializer_list>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+
+//> shader_library
+// reflected descriptor binding of an embedded shader, count 0 = unbounded array
+struct ShaderBinding {
+    uint32_t set;
+    uint32_t binding;
+    VkDescriptorType type;
+    uint32_t count;
+};
+
+// compiled shader embedded into the binary at build time (tools/shadergen.cpp)
+struct EmbeddedShader {
+    const char* name;
+    VkShaderStageFlagBits stage;
+    std::span<const uint32_t> code;
+    std::span<const ShaderBinding> bindings;
+    uint32_t pushConstantSize;
+    uint32_t localSize[3];
+};
+
+extern const EmbeddedShader g_EmbeddedShaders[];
+extern const size_t g_EmbeddedShaderCount;
+
+// hands out the embedded shaders by name (file name without .spv, e.g. "mesh.vert").
+// Every module is created once on first use and shared by all pipelines until Destroy
+class ShaderLibrary {
+public:
+    void Init(VkDevice device);
+    void Destroy();
+
+    // nullptr if there is no such shader
+    const EmbeddedShader* Find(const std::string& name) const;
+    // VK_NULL_HANDLE if there is no such shader. Safe to call from several threads
+    VkShaderModule GetModule(const std::string& name);
+    // workgroup size of a compute shader, 1x1x1 for anything else. Never 0, sizes unknown at build time are logged
+    // and clamped to 1
+    glm::uvec3 GetLocalSize(const std::string& name) const;
+
+    // compare a hand built set layout (after build) and push constant size with what the shaders declare,
+    // mismatches are logged
+    bool ValidateSetLayout(std::initializer_list<const char*> shaders, uint32_t set, const DescriptorLayoutBuilder& layout) const;
+    bool ValidatePushConstants(std::initializer_list<const char*> shaders, uint32_t size) const;
+
+private:
+    VkDevice m_Device;
+    std::unordered_map<std::string, const EmbeddedShader*> m_Shaders;
+    std::mutex m_Mutex;
+    std::unordered_map<std::string, VkShaderModule> m_Modules;
+};
+//< shader_library
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <vknator_pipelinecompiler.h>
+#include <glm/vec3.hpp>
+
+//> cascaded_shadows
+// must match SHADOW_CASCADES in shadows.glsl
+constexpr uint32_t SHADOW_CASCADES = 4;
+constexpr uint32_t SHADOW_MAP_SIZE = 2048;
+// view depth covered by the cascades, further away is unshadowed
+constexpr float SHADOW_DISTANCE = 60.f;
+// blend between uniform (0) and logarithmic (1) cascade splits
+constexpr float SHADOW_SPLIT_LAMBDA = 0.8f;
+// casters up to this far towards the sun from a cascade still throw shadows into it
+constexpr float SHADOW_CASTER_DISTANCE = 50.f;
+// cached cascades are fit this much larger than their view slice, the camera can move inside the margin
+// before they have to be fit and rendered again
+constexpr float SHADOW_CACHE_MARGIN = 0.25f;
+// frames between re-renders of a cascade that is still valid, so moving casters show up in it.
+// 0 = only when it has to be refit. The near cascades are redrawn every frame
+constexpr uint32_t SHADOW_UPDATE_INTERVALS[SHADOW_CASCADES] = { 1, 2, 4, 0 };
+
+// shadow part of the scene uniforms (std140), see ShadowData in shadows.glsl
+struct GPUShadowData {
+    // view space to shadow map uv and depth, per cascade
+    glm::mat4 matrices[SHADOW_CASCADES];
+    // view depth where each cascade ends
+    glm::vec4 splits;
+    // view space offset along the normal per cascade, about one shadow texel
+    glm::vec4 normalBias;
+    // x = texel size in uv, y = 1 when shadows are on
+    glm::vec4 params;
+};
+
+// shadows of the sun in a layered depth map, one layer per cascade. Cascades are fit around a bounding sphere of their
+// slice of the view frustum, snapped to whole shadow texels so they do not shimmer while the camera moves.
+// Cascades past the near ones are cached: they keep their fit and contents until the sun or the static casters
+// change or the camera leaves the margin they were fit with, and otherwise only redraw at their update interval
+class CascadedShadows {
+public:
+    struct Stats {
+        // of the last frame
+        uint32_t renderedCascades;
+        uint32_t drawnObjects;
+        uint32_t culledObjects;
+        // cascade frames served from the cache since the start
+        uint64_t cachedCascades;
+        uint64_t refits;
+    };
+
+    // queues the depth only pipeline on the compiler, it is ready after the compiler's WaitAll
+    void Init(VkDevice device, VmaAllocator allocator, PipelineCompiler* compiler, ShaderLibrary* shaders);
+    void Destroy();
+
+    // sunDirection points towards the sun. Picks the cascades to render this frame, they have to be rendered
+    // before the scene samples the map
+    void Update(uint64_t frame, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& sunDirection);
+    // the static casters moved, every cascade is fit and rendered again
+    void InvalidateStatic() { m_StaticVersion++; }
+    // off renders every cascade every frame
+    void SetCaching(bool enabled) { m_Caching = enabled; }
+    void SetEnabled(bool enabled) { m_Enabled = enabled; }
+    bool IsEnabled() const { return m_Enabled; }
+
+    bool NeedsRender(uint32_t cascade) const { return m_Enabled && m_Cascades[cascade].render; }
+    bool NeedsRender() const;
+    const glm::mat4& GetViewProj(uint32_t cascade) const { return m_Cascades[cascade].viewProj; }
+    // sphere in world space against the caster volume of the cascade
+    bool IsVisible(uint32_t cascade, const glm::mat4& transform, const Bounds& bounds) const;
+    GPUShadowData GetSceneData(const glm::mat4& view) const;
+
+    // layout the map was left in by the last frame, UNDEFINED before it was first rendered
+    VkImageLayout GetLayout() const { return m_Rendered ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED; }
+    const AllocatedImage& GetImage() const { return m_Image; }
+    VkImageView GetLayerView(uint32_t cascade) const { return m_LayerViews[cascade]; }
+    VkSampler GetSampler() const { return m_Sampler; }
+    VkPipeline GetPipeline() const { return m_Pipeline; }
+    VkPipelineLayout GetPipelineLayout() const { return m_Layout; }
+
+    void CountDraws(uint32_t drawn, uint32_t culled);
+    Stats GetStats() const { return m_Stats; }
+
+private:
+    struct Cascade {
+        glm::mat4 viewProj;
+        // fit sphere in world space, the one the cached contents were rendered with
+        glm::vec3 center;
+        float radius;
+        // ortho box in light space
+        glm::vec2 boxCenter;
+        float zNear;
+        float zFar;
+        float splitFar;
+        glm::vec3 sunDirection;
+        uint32_t staticVersion;
+        bool valid;
+        bool render;
+    };
+
+    void Fit(Cascade& cascade, const glm::mat4& lightView, const glm::vec3& center, float radius);
+
+    VkDevice m_Device;
+    VmaAllocator m_Allocator;
+    AllocatedImage m_Image;
+    VkImageView m_LayerViews[SHADOW_CASCADES];
+    VkSampler m_Sampler;
+    VkPipelineLayout m_Layout;
+    VkPipeline m_Pipeline;
+
+    Cascade m_Cascades[SHADOW_CASCADES] {};
+    glm::mat4 m_LightView {1.f};
+    uint32_t m_StaticVersion {0};
+    bool m_Caching {true};
+    bool m_Enabled {true};
+    bool m_Rendered {false};
+    Stats m_Stats {};
+};
+//< cascaded_shadows
@@ -41,12 +41,35 @@ struct GPUMeshBuffers {
     AllocatedBuffer indexBuffer;
     AllocatedBuffer vertexBuffer;
     VkDeviceAddress vertexBufferAddress;
+    // the visibility buffer shading fetches the triangles through it
+    VkDeviceAddress indexBufferAddress;
+    // only the positions, 3 floats per vertex, for the depth only passes. Empty and 0 when not uploaded
+    AllocatedBuffer positionBuffer;
+    VkDeviceAddress positionBufferAddress {0};
+};
+
+// bounding box and sphere around the vertices of a surface, in mesh space
+struct Bounds {
+    glm::vec3 origin;
+    float sphereRadius;
+    glm::vec3 extents;
 };
 
 // push constants for our mesh object draws
 struct GPUDrawPushConstants {
     glm::mat4 worldMatrix;
     VkDeviceAddress vertexBuffer;
+    // index into the bindless material buffer, unused by the per material descriptor sets
+    uint32_t materialIndex;
+};
+
+// push constants of the depth only passes, see depth_only.vert
+struct GPUDepthPushConstants {
+    glm::mat4 worldMatrix;
+    // position stream, or the full vertex buffer when the mesh has none
+    VkDeviceAddress positionBuffer;
+    // floats between two positions, 3 in the position stream and sizeof(Vertex) / 4 in the vertex buffer
+    uint32_t positionStride;
 };
 
 #define VK_CHECK(x)                                                   \
@@ -62,14 +85,63 @@ enum class MaterialPass : uint8_t {
     Other
 };
 
+//> material_features
+// features a material can use. Each combination gets its own pipeline with the bits baked in as a
+// specialization constant, must match the FEATURE_ defines in input_structures.glsl
+enum MaterialFeatureBits : uint32_t {
+    MATERIAL_FEATURE_COLOR_TEXTURE = 1 << 0,
+    MATERIAL_FEATURE_VERTEX_COLOR = 1 << 1,
+    MATERIAL_FEATURE_ALPHA_TEST = 1 << 2,
+    MATERIAL_FEATURE_LIT = 1 << 3,
+
+    MATERIAL_FEATURE_DEFAULT = MATERIAL_FEATURE_COLOR_TEXTURE | MATERIAL_FEATURE_VERTEX_COLOR | MATERIAL_FEATURE_LIT,
+    // spec constant value of the generic pipeline, it reads the bits from the material data instead
+    MATERIAL_FEATURE_GENERIC = 0xFFFFFFFF
+};
+//< material_features
+
+// raster, depth and blend state of a material pass
+struct MaterialPassState{
+    VkPrimitiveTopology topology;
+    VkCullModeFlags cullMode;
+    VkFrontFace frontFace;
+    bool depthTest;
+    bool depthWrite;
+    VkCompareOp depthCompare;
+    // additive blending
+    bool blend;
+};
+
+#if !defined(VK_EXT_shader_object)
+// headers older than VK_EXT_shader_object, the handles below stay null and the shader object path is never enabled
+VK_DEFINE_NON_DISPATCHABLE_HANDLE(VkShaderEXT)
+#endif
+
+// linked vertex and fragment shader objects (VK_EXT_shader_object), bound instead of a pipeline
+struct GraphicsShaders{
+    VkShaderEXT vertex {VK_NULL_HANDLE};
+    VkShaderEXT fragment {VK_NULL_HANDLE};
+};
+
 struct MaterialPipeline{
+    // VK_NULL_HANDLE when the material draws with shaders, every state is set per batch then
     VkPipeline pipeline;
+    GraphicsShaders shaders;
     VkPipelineLayout layout;
+    // pipelines built with the pass state dynamic get it set on the command buffer whenever they are bound.
+    // Blending is only dynamic with VK_EXT_extended_dynamic_state3
+    bool dynamicState;
+    bool dynamicBlend;
+    MaterialPassState state;
+    // drawn by the depth prepass: opaque and not alpha tested. Depth write and compare are always dynamic,
+    // the color pass switches them to EQUAL without a write for these
+    bool depthPrepass;
 };
 
 struct MaterialInstance{
     MaterialPipeline* pipeline;
     VkDescriptorSet materialSet;
+    uint32_t materialIndex;
     MaterialPass passType;
 };
 //> node_types
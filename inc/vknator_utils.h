@@ -1,8 +1,13 @@
 #pragma once
 
 #include <vulkan/vulkan.h>
+#include <cstdint>
+#include <string>
 
 namespace vknatorutils{
     void TransitionImage(VkCommandBuffer cmd, VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout);
     void CopyImageToImage(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D srcSize, VkExtent2D dstSize);
+    // writes 8 bit rgb pixels with tightly packed rows as a png. The image data goes into stored deflate blocks,
+    // fast to write but as large as the raw pixels
+    bool WritePng(const std::string& path, const uint8_t* rgb, uint32_t width, uint32_t height);
 }
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <vknator_pipelinecompiler.h>
+#include <vknator_resources.h>
+
+//> visibility_buffer
+// draws the visibility pass can take per frame, the rest goes through the forward pass
+constexpr uint32_t MAX_VISIBILITY_DRAWS = 16384;
+// one bin per bindless material, must match VISIBILITY_MATERIAL_BINS in visibility.glsl
+constexpr uint32_t VISIBILITY_MATERIAL_BINS = 4096;
+// pixels shaded per workgroup of visibility_shade.comp, must match VISIBILITY_SHADE_GROUP in visibility.glsl
+constexpr uint32_t VISIBILITY_SHADE_GROUP = 64;
+// format of the visibility target: draw index + 1 (0 = nothing drawn) and triangle index
+constexpr VkFormat VISIBILITY_FORMAT = VK_FORMAT_R32G32_UINT;
+
+// one draw of the visibility pass (std430), see VisibilityDraw in visibility.glsl
+struct GPUVisibilityDraw {
+    glm::mat4 transform;
+    VkDeviceAddress vertexBuffer;
+    VkDeviceAddress indexBuffer;
+    uint32_t firstIndex;
+    uint32_t materialIndex;
+    uint32_t padding[2];
+};
+
+// push constants of vis.vert
+struct VisibilityRasterPushConstants {
+    glm::mat4 matrix;
+    VkDeviceAddress positionBuffer;
+    uint32_t positionStride;
+    uint32_t drawIndex;
+};
+
+// push constants of the visibility compute passes
+struct VisibilityPushConstants {
+    VkDeviceAddress drawBuffer;
+    VkDeviceAddress binBuffer;
+    VkDeviceAddress pixelBuffer;
+    glm::uvec2 extent;
+};
+
+// visibility buffer rendering of the opaque surfaces. The raster pass only writes the draw and triangle of the
+// nearest surface per pixel, then compute passes sort the covered pixels by material and shade each of them once,
+// fetching the triangle's vertices through the buffer addresses of its draw. Shading cost follows the covered
+// pixels instead of the submitted triangles and the overdraw. Needs the bindless materials, the shade pass reads
+// the material of a pixel through its index
+class VisibilityBuffer {
+public:
+    // queues the raster and compute pipelines on the compiler, they are ready after the compiler's WaitAll.
+    // sceneLayout and materialLayout are sets 0 and 1 of the shade pass
+    void Init(VkDevice device, VmaAllocator allocator, ResourceRegistry* resources, uint32_t frameCount, PipelineCompiler* compiler,
+        ShaderLibrary* shaders, VkDescriptorSetLayout sceneLayout, VkDescriptorSetLayout materialLayout);
+    void Destroy();
+
+    // the pixel list of the frame slot holds one entry per pixel of extent, grows the list when it is smaller.
+    // the old one is released with releaseValue
+    void EnsureCapacity(uint32_t frame, VkExtent2D extent, uint64_t releaseValue);
+
+    // draw list of the frame slot, MAX_VISIBILITY_DRAWS entries. The gpu has to be done with the slot
+    GPUVisibilityDraw* MapDraws(uint32_t frame) { return (GPUVisibilityDraw*)m_Frames[frame].draws.info.pMappedData; }
+
+    // counts the covered pixels of every material, clears the bins first
+    void RecordCount(VkCommandBuffer cmd, uint32_t frame, VkExtent2D extent);
+    // prefix sum over the counts, gives every material its range of the pixel list and sizes the shade dispatch
+    void RecordBins(VkCommandBuffer cmd, uint32_t frame, VkExtent2D extent);
+    // writes every covered pixel into the range of its material
+    void RecordScatter(VkCommandBuffer cmd, uint32_t frame, VkExtent2D extent);
+    // shades the pixel list in material order, one indirect dispatch for all materials
+    void RecordShade(VkCommandBuffer cmd, uint32_t frame, VkExtent2D extent);
+
+    VkPipeline GetRasterPipeline() const { return m_RasterPipeline; }
+    VkPipelineLayout GetRasterLayout() const { return m_RasterLayout; }
+    // set 2 of the compute passes: the visibility target and the draw image, both storage images
+    VkDescriptorSetLayout GetTargetLayout() const { return m_TargetLayout; }
+    VkPipelineLayout GetComputeLayout() const { return m_ComputeLayout; }
+    VkBuffer GetBinBuffer(uint32_t frame) const { return m_Frames[frame].bins.buffer; }
+    VkBuffer GetPixelBuffer(uint32_t frame);
+
+private:
+    struct FrameBuffers {
+        // written by the cpu
+        AllocatedBuffer draws;
+        VkDeviceAddress drawAddress;
+        // indirect dispatch, pixel total, then counts, offsets and cursors of every material. Only touched by the gpu
+        AllocatedBuffer bins;
+        VkDeviceAddress binAddress;
+        // packed pixel coordinates sorted by material, grows with the draw extent
+        BufferHandle pixels;
+        VkDeviceAddress pixelAddress {0};
+        uint32_t pixelCapacity {0};
+    };
+
+    void Dispatch(VkCommandBuffer cmd, VkPipeline pipeline, const VisibilityPushConstants& push, glm::uvec3 groups);
+    VisibilityPushConstants PushConstants(uint32_t frame, VkExtent2D extent) const;
+    AllocatedBuffer CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkDeviceAddress& address);
+
+    VkDevice m_Device;
+    VmaAllocator m_Allocator;
+    ResourceRegistry* m_Resources;
+
+    VkPipelineLayout m_RasterLayout;
+    VkPipeline m_RasterPipeline;
+    VkDescriptorSetLayout m_TargetLayout;
+    VkPipelineLayout m_ComputeLayout;
+    VkPipeline m_CountPipeline;
+    VkPipeline m_BinsPipeline;
+    VkPipeline m_ScatterPipeline;
+    VkPipeline m_ShadePipeline;
+    glm::uvec3 m_PixelLocalSize;
+
+    std::vector<FrameBuffers> m_Frames;
+};
+//< visibility_buffer
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vknator_types.h>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+
+//> worker_pool
+// fixed set of worker threads used to spread CPU heavy work (command recording, ...) over all cores
+class WorkerPool {
+public:
+    void Init(uint32_t threadCount);
+    void Shutdown();
+
+    // number of threads that can work on a ParallelFor at the same time (workers + calling thread)
+    uint32_t GetSlotCount() const { return (uint32_t)m_Threads.size() + 1; }
+
+    // queue a single job, the returned future holds its result
+    template <typename F>
+    std::future<std::invoke_result_t<F>> Submit(F&& job){
+        using ResultType = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<ResultType()>>(std::forward<F>(job));
+        std::future<ResultType> result = task->get_future();
+        if (m_Threads.empty()){
+            //no workers, run inline so callers never dead lock
+            (*task)();
+            return result;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Jobs.emplace_back([task](){ (*task)(); });
+        }
+        m_Condition.notify_one();
+        return result;
+    }
+
+    // run job(slot) once for every slot in [0, slotCount). The calling thread takes part in the work
+    // and the function returns once all slots are done. A slot is never run by two threads at once,
+    // so per-slot resources (command pools, ...) need no extra locking
+    void ParallelFor(uint32_t slotCount, const std::function<void(uint32_t)>& job);
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> m_Threads;
+    std::deque<std::function<void()>> m_Jobs;
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    bool m_Stopping {false};
+};
+//< worker_pool
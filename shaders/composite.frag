@@ -0,0 +1,47 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+#include "upscale.glsl"
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragColor;
+
+// hdr draw image, only the top left inputSize pixels are valid
+layout(set = 0, binding = 0) uniform sampler2D inputImage;
+
+layout( push_constant ) uniform constants
+{
+    vec2 inputSize;
+    vec2 inputTexel;    // 1 / size of the whole input image
+    vec2 outputSize;
+    float sharpness;
+    float exposure;
+} PushConstants;
+
+// fitted aces curve (Narkowicz)
+vec3 tonemapACES(vec3 x)
+{
+    const float a = 2.51;
+    const float b = 0.03;
+    const float c = 2.43;
+    const float d = 0.59;
+    const float e = 0.14;
+    return clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0, 1.0);
+}
+
+// the swapchain is UNORM, so the srgb encoding happens here
+vec3 linearToSrgb(vec3 color)
+{
+    vec3 low = color * 12.92;
+    vec3 high = 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055;
+    return mix(high, low, lessThanEqual(color, vec3(0.0031308)));
+}
+
+void main()
+{
+    vec3 color = upscaleEdgeAdaptive(inputImage, gl_FragCoord.xy, PushConstants.inputSize, PushConstants.inputTexel,
+        PushConstants.outputSize, PushConstants.sharpness);
+    color = tonemapACES(max(color, vec3(0.0)) * PushConstants.exposure);
+    outFragColor = vec4(linearToSrgb(color), 1.0);
+}
@@ -0,0 +1,25 @@
+#version 450
+
+#extension GL_EXT_buffer_reference : require
+
+// vertex shader of the depth only passes, the matrix already holds the pass' view projection.
+// Reads only the positions, a quarter of the full vertex when the mesh has a position stream
+
+layout(buffer_reference, std430) readonly buffer PositionBuffer{
+   float positions[];
+};
+
+//push constants block, matches GPUDepthPushConstants
+layout ( push_constant) uniform constants
+{
+   mat4 render_matrix;
+   PositionBuffer positionBuffer;
+   uint positionStride;
+} PushConstants;
+
+void main(){
+   uint base = uint(gl_VertexIndex) * PushConstants.positionStride;
+   vec3 position = vec3(PushConstants.positionBuffer.positions[base], PushConstants.positionBuffer.positions[base + 1],
+      PushConstants.positionBuffer.positions[base + 2]);
+   gl_Position = PushConstants.render_matrix * vec4(position, 1.0f);
+}
@@ -0,0 +1,35 @@
+#version 450
+
+#extension GL_EXT_buffer_reference : require
+
+// depth prepass of the opaque surfaces. The color pass tests for EQUAL against this depth, so the position is
+// computed with the same expression as in mesh_vert.glsl and both declare gl_Position invariant
+
+layout (set = 0, binding = 0) uniform SceneData{
+   mat4 view;
+   mat4 proj;
+   mat4 viewproj;
+} sceneData;
+
+layout(buffer_reference, std430) readonly buffer PositionBuffer{
+   float positions[];
+};
+
+//push constants block, matches GPUDepthPushConstants
+layout ( push_constant) uniform constants
+{
+   mat4 render_matrix;
+   PositionBuffer positionBuffer;
+   uint positionStride;
+} PushConstants;
+
+invariant gl_Position;
+
+void main(){
+   uint base = uint(gl_VertexIndex) * PushConstants.positionStride;
+   vec4 position = vec4(PushConstants.positionBuffer.positions[base], PushConstants.positionBuffer.positions[base + 1],
+      PushConstants.positionBuffer.positions[base + 2], 1.0f);
+
+   vec4 worldPosition = PushConstants.render_matrix * position;
+   gl_Position = sceneData.viewproj * worldPosition;
+}
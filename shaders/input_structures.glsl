@@ -1,3 +1,11 @@
+#extension GL_EXT_buffer_reference : require
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+#include "lights.glsl"
+#include "shadows.glsl"
+
 layout (set = 0, binding = 0) uniform SceneData{
 
    mat4 view;
@@ -6,13 +14,121 @@ layout (set = 0, binding = 0) uniform SceneData{
    vec4 ambientColor;
    vec4 sunlightDirectiion; //w for sun power
    vec4 sunlightColor;
+   // clustered lighting of the frame, see ClusteredLighting
+   LightBuffer lightBuffer;
+   ClusterBuffer clusterBuffer;
+   uvec4 clusterGrid; //w = light count
+   vec4 clusterDepth; //near, far, scale, bias
+   vec4 clusterScreen; //xy = extent, zw = tile size in pixels
+   // sun shadows, see CascadedShadows
+   ShadowData shadows;
 
 } sceneData;
 
+layout (set = 0, binding = 1) uniform sampler2DArrayShadow shadowMap;
+
+struct Vertex {
+   vec3 position;
+   float uv_x;
+   vec3 normal;
+   float uv_y;
+   vec4 color;
+};
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer{
+   Vertex vertices[];
+};
+
+#ifndef VISIBILITY_SHADING
+//push constants block, matches GPUDrawPushConstants. The visibility shading brings its own
+layout ( push_constant) uniform constants
+{
+   mat4 render_matrix;
+   VertexBuffer vertexBuffer;
+   uint materialIndex;
+} PushConstants;
+#endif
+
+#ifdef BINDLESS
+//> bindless
+// every texture, sampler and material lives in one global set, a draw only pushes its material index
+struct Material {
+   vec4 colorFactors;
+   vec4 metal_rough_factors;
+   uint colorTexture;
+   uint colorSampler;
+   uint metalRoughTexture;
+   uint metalRoughSampler;
+   uint features;
+   float alphaCutoff;
+};
+
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(set = 1, binding = 1) uniform sampler samplers[];
+layout(set = 1, binding = 2, std430) readonly buffer MaterialBuffer{
+   Material materials[];
+} materialBuffer;
+
+Material getMaterialAt(uint index){
+   return materialBuffer.materials[index];
+}
+
+#ifndef VISIBILITY_SHADING
+Material getMaterial(){
+   return getMaterialAt(PushConstants.materialIndex);
+}
+#endif
+
+vec4 sampleColor(Material material, vec2 uv){
+   return texture(sampler2D(textures[nonuniformEXT(material.colorTexture)], samplers[nonuniformEXT(material.colorSampler)]), uv);
+}
+
+// compute shaders have no neighbouring fragments to take the uv derivatives from, they pass their own
+vec4 sampleColorGrad(Material material, vec2 uv, vec2 uvDx, vec2 uvDy){
+   return textureGrad(sampler2D(textures[nonuniformEXT(material.colorTexture)], samplers[nonuniformEXT(material.colorSampler)]),
+      uv, uvDx, uvDy);
+}
+//< bindless
+#else
 layout(set = 1, binding = 0) uniform GLTFMaterialData{
    vec4 colorFactors;
    vec4 metal_rough_factors;
+   uint features;
+   float alphaCutoff;
 } materialData;
 
 layout(set = 1, binding = 1) uniform sampler2D colorTex;
-layout(set = 1, binding = 2) uniform sampler2D metalRoughTex;
\ No newline at end of file
+layout(set = 1, binding = 2) uniform sampler2D metalRoughTex;
+
+struct Material {
+   vec4 colorFactors;
+   vec4 metal_rough_factors;
+   uint features;
+   float alphaCutoff;
+};
+
+Material getMaterial(){
+   return Material(materialData.colorFactors, materialData.metal_rough_factors, materialData.features, materialData.alphaCutoff);
+}
+
+vec4 sampleColor(Material material, vec2 uv){
+   return texture(colorTex, uv);
+}
+#endif
+
+//> material_features
+// MaterialFeatureBits. Specialized pipelines bake the bits in so the unused branches are compiled out,
+// the generic pipeline keeps the default and reads them from the material
+#define FEATURE_COLOR_TEXTURE 1u
+#define FEATURE_VERTEX_COLOR 2u
+#define FEATURE_ALPHA_TEST 4u
+#define FEATURE_LIT 8u
+#define FEATURES_GENERIC 0xFFFFFFFFu
+
+layout(constant_id = 0) const uint SPEC_FEATURES = FEATURES_GENERIC;
+
+bool hasFeature(Material material, uint feature){
+   uint features = (SPEC_FEATURES == FEATURES_GENERIC) ? material.features : SPEC_FEATURES;
+   return (features & feature) != 0u;
+}
+//< material_features
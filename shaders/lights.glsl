@@ -0,0 +1,59 @@
+//> clustered_lighting
+// light and cluster buffers of the clustered lighting, shared by cluster_lights.comp and the mesh shaders.
+// The grid must match the CLUSTER_ constants in vknator_lighting.h
+#define CLUSTER_GRID_X 16u
+#define CLUSTER_GRID_Y 9u
+#define CLUSTER_GRID_Z 24u
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+#define MAX_LIGHTS_PER_CLUSTER 128u
+
+#define LIGHT_POINT 0u
+#define LIGHT_SPOT 1u
+
+// GPULight, in view space
+struct Light {
+   vec4 positionRadius;
+   vec4 colorIntensity;
+   vec4 direction; //w = type
+   vec4 spotCos; //x = outer, y = inner
+};
+
+layout(buffer_reference, std430) readonly buffer LightBuffer{
+   Light lights[];
+};
+
+// count of every cluster, then MAX_LIGHTS_PER_CLUSTER light indices per cluster
+layout(buffer_reference, std430) buffer ClusterBuffer{
+   uint counts[CLUSTER_COUNT];
+   uint indices[];
+};
+
+// depth = (near, far, scale, bias), viewDepth is positive
+uint clusterSlice(float viewDepth, vec4 depth){
+   float slice = log(max(viewDepth, depth.x)) * depth.z - depth.w;
+   return min(uint(max(slice, 0.0)), CLUSTER_GRID_Z - 1u);
+}
+
+uint clusterIndex(uvec3 cluster){
+   return cluster.x + cluster.y * CLUSTER_GRID_X + cluster.z * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+}
+
+// diffuse light reaching a view space point from one light, windowed inverse square falloff
+vec3 shadeLight(Light light, vec3 position, vec3 normal){
+   vec3 toLight = light.positionRadius.xyz - position;
+   float distanceSq = dot(toLight, toLight);
+   float radius = light.positionRadius.w;
+   if (distanceSq >= radius * radius){
+      return vec3(0.0);
+   }
+   vec3 L = toLight * inversesqrt(distanceSq);
+   float window = clamp(1.0 - (distanceSq * distanceSq) / (radius * radius * radius * radius), 0.0, 1.0);
+   float attenuation = window * window / max(distanceSq, 0.01);
+
+   if (uint(light.direction.w) == LIGHT_SPOT){
+      float cosAngle = dot(-L, light.direction.xyz);
+      attenuation *= smoothstep(light.spotCos.x, light.spotCos.y, cosAngle);
+   }
+   return light.colorIntensity.rgb * light.colorIntensity.w * max(dot(normal, L), 0.0) * attenuation;
+}
+//< clustered_lighting
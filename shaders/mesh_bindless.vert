@@ -0,0 +1,5 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+#define BINDLESS
+#include "mesh_vert.glsl"
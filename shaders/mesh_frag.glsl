@@ -0,0 +1,28 @@
+// shared by mesh.frag and mesh_bindless.frag
+#include "input_structures.glsl"
+#include "surface_shading.glsl"
+
+layout (location = 0) in vec3 inNormal;
+layout (location = 1) in vec4 inColor;
+layout (location = 2) in vec2 inUV;
+layout (location = 3) in vec3 inViewPosition;
+
+layout (location = 0) out vec4 outFragColor;
+
+void main(){
+   Material material = getMaterial();
+
+   vec4 color = inColor;
+   if (hasFeature(material, FEATURE_COLOR_TEXTURE)){
+      color *= sampleColor(material, inUV);
+   }
+   if (hasFeature(material, FEATURE_ALPHA_TEST) && color.a < material.alphaCutoff){
+      discard;
+   }
+   if (!hasFeature(material, FEATURE_LIT)){
+      outFragColor = color;
+      return;
+   }
+
+   outFragColor = vec4(shadeSurface(color.xyz, inNormal, inViewPosition, gl_FragCoord.xy), color.a);
+}
@@ -0,0 +1,29 @@
+// shared by mesh.vert and mesh_bindless.vert
+#include "input_structures.glsl"
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec4 outColor;
+layout (location = 2) out vec2 outUV;
+layout (location = 3) out vec3 outViewPosition;
+
+// the depth prepass computes the same position, the EQUAL depth test needs it bit for bit
+invariant gl_Position;
+
+void main(){
+   Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+   Material material = getMaterial();
+
+   vec4 position = vec4(v.position, 1.0f);
+
+   vec4 worldPosition = PushConstants.render_matrix * position;
+   gl_Position = sceneData.viewproj * worldPosition;
+   outViewPosition = (sceneData.view * worldPosition).xyz;
+
+   outNormal = (PushConstants.render_matrix * vec4(v.normal, 0.f)).xyz;
+   outColor = material.colorFactors;
+   if (hasFeature(material, FEATURE_VERTEX_COLOR)){
+      outColor *= v.color;
+   }
+   outUV.x = v.uv_x;
+   outUV.y = v.uv_y;
+}
@@ -0,0 +1,41 @@
+//> cascaded_shadows
+// sun shadows from the cascaded shadow map, SHADOW_CASCADES must match vknator_shadows.h
+#define SHADOW_CASCADES 4
+
+// GPUShadowData
+struct ShadowData {
+   mat4 matrices[SHADOW_CASCADES]; //view space to shadow uv and depth
+   vec4 splits; //view depth where each cascade ends
+   vec4 normalBias; //view space offset along the normal per cascade
+   vec4 params; //x = texel size in uv, y = 1 when shadows are on
+};
+
+// 1 = lit. viewNormal has to be normalized
+float sampleShadow(ShadowData shadows, sampler2DArrayShadow shadowMap, vec3 viewPos, vec3 viewNormal){
+   float viewDepth = -viewPos.z;
+   if (shadows.params.y == 0.0 || viewDepth > shadows.splits[SHADOW_CASCADES - 1]){
+      return 1.0;
+   }
+   int cascade = 0;
+   for (int i = 0; i < SHADOW_CASCADES - 1; i++){
+      if (viewDepth > shadows.splits[i]){
+         cascade = i + 1;
+      }
+   }
+
+   // offset along the normal by about a texel of the cascade against acne on surfaces facing away from the sun
+   vec4 shadowPos = shadows.matrices[cascade] * vec4(viewPos + viewNormal * shadows.normalBias[cascade], 1.0);
+   vec3 coord = shadowPos.xyz / shadowPos.w;
+
+   // 3x3 taps of the hardware 2x2 compare. The map has a single mip, zero gradients give the same result as
+   // texture() and also work in the visibility buffer's compute shading
+   float lit = 0.0;
+   for (int x = -1; x <= 1; x++){
+      for (int y = -1; y <= 1; y++){
+         vec2 uv = coord.xy + vec2(x, y) * shadows.params.x;
+         lit += textureGrad(shadowMap, vec4(uv, float(cascade), coord.z), vec2(0.0), vec2(0.0));
+      }
+   }
+   return lit / 9.0;
+}
+//< cascaded_shadows
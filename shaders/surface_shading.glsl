@@ -0,0 +1,21 @@
+// lighting of an opaque surface point, shared by the forward mesh shaders and the visibility buffer shading so both
+// paths produce the same image. Needs input_structures.glsl. normal is in world space, viewPosition in view space,
+// pixel is the position in the draw image the clusters are looked up with
+vec3 shadeSurface(vec3 color, vec3 normal, vec3 viewPosition, vec2 pixel){
+   float lightValue = max(dot(normal, sceneData.sunlightDirectiion.xyz), 0.1f);
+   vec3 ambient = color * sceneData.ambientColor.xyz;
+
+   // only the lights binned into the cluster of this point are shaded
+   uvec2 tile = min(uvec2(pixel / sceneData.clusterScreen.zw), uvec2(CLUSTER_GRID_X - 1u, CLUSTER_GRID_Y - 1u));
+   uint cluster = clusterIndex(uvec3(tile, clusterSlice(-viewPosition.z, sceneData.clusterDepth)));
+   uint lightCount = sceneData.clusterBuffer.counts[cluster];
+   vec3 viewNormal = normalize(mat3(sceneData.view) * normal);
+   float shadow = sampleShadow(sceneData.shadows, shadowMap, viewPosition, viewNormal);
+   vec3 lights = vec3(0.0);
+   for (uint i = 0u; i < lightCount; i++){
+      uint lightIndex = sceneData.clusterBuffer.indices[cluster * MAX_LIGHTS_PER_CLUSTER + i];
+      lights += shadeLight(sceneData.lightBuffer.lights[lightIndex], viewPosition, viewNormal);
+   }
+
+   return color * (lightValue * shadow * sceneData.sunlightColor.w + lights) + ambient;
+}
@@ -0,0 +1,78 @@
+// edge adaptive spatial upscaling with sharpening, shared by the passes that resample the draw image
+
+float luma(vec3 color)
+{
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+vec3 fetchClamped(sampler2D image, ivec2 texel, vec2 inputSize)
+{
+    return texelFetch(image, clamp(texel, ivec2(0), ivec2(inputSize) - 1), 0).rgb;
+}
+
+// polynomial approximation of lanczos2, takes the squared distance
+float lanczos2(float x2)
+{
+    x2 = min(x2, 4.0);
+    float window = 2.0 / 5.0 * x2 - 1.0;
+    float base = 1.0 / 4.0 * x2 - 1.0;
+    return (25.0 / 16.0 * window * window - (25.0 / 16.0 - 1.0)) * (base * base);
+}
+
+// outputPixel: pixel center in output pixels, inputSize: rendered area of the image,
+// inputTexel: 1 / size of the whole image
+vec3 upscaleEdgeAdaptive(sampler2D image, vec2 outputPixel, vec2 inputSize, vec2 inputTexel, vec2 outputSize, float sharpness)
+{
+    // position of the output pixel center in input pixels
+    vec2 src = outputPixel * inputSize / outputSize - 0.5;
+    ivec2 base = ivec2(floor(src));
+    vec2 f = src - vec2(base);
+
+    // luma gradient over the 2x2 footprint gives the edge direction
+    float l00 = luma(fetchClamped(image, base, inputSize));
+    float l10 = luma(fetchClamped(image, base + ivec2(1, 0), inputSize));
+    float l01 = luma(fetchClamped(image, base + ivec2(0, 1), inputSize));
+    float l11 = luma(fetchClamped(image, base + ivec2(1, 1), inputSize));
+    vec2 gradient = vec2((l10 - l00) + (l11 - l01), (l01 - l00) + (l11 - l10));
+    float gradientLength = length(gradient);
+    vec2 across = gradientLength > 1e-5 ? gradient / gradientLength : vec2(1.0, 0.0);
+    vec2 along = vec2(-across.y, across.x);
+    // on strong edges the kernel is stretched along the edge, so the edge stays sharp and does not stair step
+    float edge = clamp(gradientLength * 2.0, 0.0, 1.0);
+    float alongScale = 1.0 / (1.0 + edge);
+
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+    vec3 minColor = vec3(1e10);
+    vec3 maxColor = vec3(-1e10);
+    // 12 taps, the 4x4 neighborhood without its corners
+    for (int y = -1; y <= 2; y++)
+    {
+        for (int x = -1; x <= 2; x++)
+        {
+            if ((x == -1 || x == 2) && (y == -1 || y == 2))
+            {
+                continue;
+            }
+            vec3 color = fetchClamped(image, base + ivec2(x, y), inputSize);
+            vec2 offset = vec2(x, y) - f;
+            vec2 rotated = vec2(dot(offset, across), dot(offset, along) * alongScale);
+            float weight = lanczos2(dot(rotated, rotated));
+            sum += color * weight;
+            weightSum += weight;
+            if (x >= 0 && x <= 1 && y >= 0 && y <= 1)
+            {
+                minColor = min(minColor, color);
+                maxColor = max(maxColor, color);
+            }
+        }
+    }
+    vec3 color = sum / max(weightSum, 1e-4);
+
+    // sharpen against the plain bilinear reconstruction of the same spot
+    vec3 smoothColor = textureLod(image, (src + 0.5) * inputTexel, 0.0).rgb;
+    color += sharpness * (color - smoothColor);
+
+    // lanczos and sharpening ring, keep the result inside the range of the closest texels
+    return clamp(color, minColor, maxColor);
+}
@@ -0,0 +1,12 @@
+#version 450
+
+// raster pass of the visibility buffer: which draw and which of its triangles is nearest, nothing else.
+// The draw index is stored + 1 so 0 means no surface. gl_PrimitiveID needs the geometryShader feature
+
+layout (location = 0) flat in uint inDrawIndex;
+
+layout (location = 0) out uvec2 outVisibility;
+
+void main(){
+   outVisibility = uvec2(inDrawIndex + 1u, uint(gl_PrimitiveID));
+}
@@ -0,0 +1,28 @@
+#version 450
+
+#extension GL_EXT_buffer_reference : require
+
+// raster pass of the visibility buffer, only the positions are read. The matrix already holds the view projection
+
+layout(buffer_reference, std430) readonly buffer PositionBuffer{
+   float positions[];
+};
+
+//push constants block, matches VisibilityRasterPushConstants
+layout ( push_constant) uniform constants
+{
+   mat4 render_matrix;
+   PositionBuffer positionBuffer;
+   uint positionStride;
+   uint drawIndex;
+} PushConstants;
+
+layout (location = 0) flat out uint outDrawIndex;
+
+void main(){
+   uint base = uint(gl_VertexIndex) * PushConstants.positionStride;
+   vec3 position = vec3(PushConstants.positionBuffer.positions[base], PushConstants.positionBuffer.positions[base + 1],
+      PushConstants.positionBuffer.positions[base + 2]);
+   gl_Position = PushConstants.render_matrix * vec4(position, 1.0f);
+   outDrawIndex = PushConstants.drawIndex;
+}
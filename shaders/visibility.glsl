@@ -0,0 +1,56 @@
+//> visibility_buffer
+// buffers of the visibility buffer passes, shared by the compute shaders. Must match vknator_visibility.h
+
+#define VISIBILITY_MATERIAL_BINS 4096u
+#define VISIBILITY_SHADE_GROUP 64u
+// the guaranteed maxComputeWorkGroupCount, a 4k frame needs more shade groups than that so they are spread over y
+#define VISIBILITY_MAX_GROUPS_X 65535u
+
+// GPUVisibilityDraw, the addresses as uvec2 so the shade pass can turn them into its vertex and index buffers
+// (GL_EXT_buffer_reference_uvec2)
+struct VisibilityDraw {
+   mat4 transform;
+   uvec2 vertexBuffer;
+   uvec2 indexBuffer;
+   uint firstIndex;
+   uint materialIndex;
+   uint padding0;
+   uint padding1;
+};
+
+layout(buffer_reference, std430) readonly buffer VisibilityDraws{
+   VisibilityDraw draws[];
+};
+
+// indirect dispatch of the shade pass (groups in rows of up to VISIBILITY_MAX_GROUPS_X), then per material: covered pixels, first entry in the pixel list
+// and how many entries were written so far
+layout(buffer_reference, std430) buffer VisibilityBins{
+   uint dispatch[3];
+   uint pixelCount;
+   uint counts[VISIBILITY_MATERIAL_BINS];
+   uint offsets[VISIBILITY_MATERIAL_BINS];
+   uint cursors[VISIBILITY_MATERIAL_BINS];
+};
+
+// x | y << 16, sorted by material
+layout(buffer_reference, std430) buffer VisibilityPixels{
+   uint pixels[];
+};
+
+// VisibilityPushConstants
+layout(push_constant) uniform constants
+{
+   VisibilityDraws drawBuffer;
+   VisibilityBins bins;
+   VisibilityPixels pixelBuffer;
+   uvec2 extent;
+} PushConstants;
+
+uint packPixel(uvec2 pixel){
+   return pixel.x | (pixel.y << 16);
+}
+
+uvec2 unpackPixel(uint packed){
+   return uvec2(packed & 0xFFFFu, packed >> 16);
+}
+//< visibility_buffer
@@ -1,13 +1,54 @@
 #include "vknator_engine.h"
 #include <iostream>
+#include <cstring>
 #include "vknator_log.h"
 
+// --headless                 render without a window
+// --frames N                 headless frames to render, implies --headless
+// --output DIR               write every headless frame to DIR as png, implies --headless
+// --size WxH                 resolution of the window or the headless frames
+// --pass-state MODE          objects, dynamic or baked, how the material pass state is set (see PassStateMode)
+static bool ParseOptions(int argc, char* argv[], EngineOptions& options){
+    for (int i = 1; i < argc; i++){
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--headless") == 0){
+            options.headless = true;
+        } else if (std::strcmp(argv[i], "--frames") == 0 && hasValue){
+            options.headless = true;
+            options.frames = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--output") == 0 && hasValue){
+            options.headless = true;
+            options.outputDirectory = argv[++i];
+        } else if (std::strcmp(argv[i], "--size") == 0 && hasValue){
+            uint32_t width = 0, height = 0;
+            if (std::sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0){
+                LOG_ERROR("Invalid size {}, expected WxH", argv[i]);
+                return false;
+            }
+            options.extent = { width, height };
+        } else if (std::strcmp(argv[i], "--pass-state") == 0 && hasValue){
+            if (!ParsePassState(argv[++i], options.passState)){
+                LOG_ERROR("Invalid pass state {}, expected objects, dynamic or baked", argv[i]);
+                return false;
+            }
+        } else {
+            LOG_ERROR("Unknown argument {}", argv[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
 int main (int argc, char* argv[]){
     vknator::Log::Init();
+    EngineOptions options;
+    if (!ParseOptions(argc, argv, options)){
+        return 1;
+    }
     VknatorEngine engine = VknatorEngine();
-    if (engine.Init()){
+    if (engine.Init(options)){
         engine.Run();
         engine.Deinit();
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,132 @@
+#include <vknator_bindless.h>
+
+void BindlessDescriptors::Init(VkDevice device, VmaAllocator allocator, uint32_t maxTextures, uint32_t maxSamplers, uint32_t maxMaterials){
+    m_Device = device;
+    m_Allocator = allocator;
+    m_MaxTextures = maxTextures;
+    m_MaxSamplers = maxSamplers;
+    m_MaxMaterials = maxMaterials;
+
+    VkDescriptorSetLayoutBinding bindings[3] = {};
+    // compute for the visibility buffer shading
+    bindings[0] = { 0, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, maxTextures, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, nullptr };
+    bindings[1] = { 1, VK_DESCRIPTOR_TYPE_SAMPLER, maxSamplers, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, nullptr };
+    bindings[2] = { 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, nullptr };
+
+    // unwritten array slots are never read, and new entries can be written while older frames still use the set
+    VkDescriptorBindingFlags flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+        | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+    VkDescriptorBindingFlags bindingFlags[3] = { flags, flags, VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT };
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO };
+    flagsInfo.bindingCount = 3;
+    flagsInfo.pBindingFlags = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+    layoutInfo.pNext = &flagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = 3;
+    layoutInfo.pBindings = bindings;
+    VK_CHECK(vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, &m_Layout));
+
+    VkDescriptorPoolSize poolSizes[] = {
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, maxTextures },
+        { VK_DESCRIPTOR_TYPE_SAMPLER, maxSamplers },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+    };
+    VkDescriptorPoolCreateInfo poolInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = 3;
+    poolInfo.pPoolSizes = poolSizes;
+    VK_CHECK(vkCreateDescriptorPool(m_Device, &poolInfo, nullptr, &m_Pool));
+
+    VkDescriptorSetAllocateInfo allocInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    allocInfo.descriptorPool = m_Pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &m_Layout;
+    VK_CHECK(vkAllocateDescriptorSets(m_Device, &allocInfo, &m_Set));
+
+    // materials are written straight into mapped memory, a new material never touches one in use
+    VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    bufferInfo.size = sizeof(GPUMaterial) * maxMaterials;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    VmaAllocationCreateInfo vmaallocInfo = {};
+    vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    VK_CHECK(vmaCreateBuffer(m_Allocator, &bufferInfo, &vmaallocInfo, &m_MaterialBuffer.buffer, &m_MaterialBuffer.allocation, &m_MaterialBuffer.info));
+
+    VkDescriptorBufferInfo materialInfo = { m_MaterialBuffer.buffer, 0, VK_WHOLE_SIZE };
+    VkWriteDescriptorSet write = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    write.dstSet = m_Set;
+    write.dstBinding = 2;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &materialInfo;
+    vkUpdateDescriptorSets(m_Device, 1, &write, 0, nullptr);
+
+    LOG_DEBUG("Bindless set with {} textures, {} samplers, {} materials", maxTextures, maxSamplers, maxMaterials);
+}
+
+void BindlessDescriptors::Destroy(){
+    vmaDestroyBuffer(m_Allocator, m_MaterialBuffer.buffer, m_MaterialBuffer.allocation);
+    vkDestroyDescriptorPool(m_Device, m_Pool, nullptr);
+    vkDestroyDescriptorSetLayout(m_Device, m_Layout, nullptr);
+    m_Textures.clear();
+    m_Samplers.clear();
+    m_MaterialCount = 0;
+}
+
+void BindlessDescriptors::Write(uint32_t binding, uint32_t index, VkDescriptorType type, VkImageView view, VkSampler sampler){
+    VkDescriptorImageInfo imageInfo = { sampler, view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    VkWriteDescriptorSet write = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    write.dstSet = m_Set;
+    write.dstBinding = binding;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = type;
+    write.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(m_Device, 1, &write, 0, nullptr);
+}
+
+uint32_t BindlessDescriptors::AddTexture(VkImageView view){
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto it = m_Textures.find(view);
+    if (it != m_Textures.end()){
+        return it->second;
+    }
+    if (m_Textures.size() == m_MaxTextures){
+        LOG_ERROR("Bindless texture array is full ({}), using texture 0", m_MaxTextures);
+        return 0;
+    }
+    uint32_t index = (uint32_t)m_Textures.size();
+    Write(0, index, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, view, VK_NULL_HANDLE);
+    m_Textures[view] = index;
+    return index;
+}
+
+uint32_t BindlessDescriptors::AddSampler(VkSampler sampler){
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto it = m_Samplers.find(sampler);
+    if (it != m_Samplers.end()){
+        return it->second;
+    }
+    if (m_Samplers.size() == m_MaxSamplers){
+        LOG_ERROR("Bindless sampler array is full ({}), using sampler 0", m_MaxSamplers);
+        return 0;
+    }
+    uint32_t index = (uint32_t)m_Samplers.size();
+    Write(1, index, VK_DESCRIPTOR_TYPE_SAMPLER, VK_NULL_HANDLE, sampler);
+    m_Samplers[sampler] = index;
+    return index;
+}
+
+uint32_t BindlessDescriptors::AddMaterial(const GPUMaterial& material){
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_MaterialCount == m_MaxMaterials){
+        LOG_ERROR("Bindless material buffer is full ({}), using material 0", m_MaxMaterials);
+        return 0;
+    }
+    uint32_t index = m_MaterialCount++;
+    ((GPUMaterial*)m_MaterialBuffer.info.pMappedData)[index] = material;
+    return index;
+}
@@ -1,5 +1,14 @@
 ﻿#include "vknator_descriptors.h"
 #include "vknator_initializers.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace {
+    // filled by DescriptorLayoutBuilder::build, read by the allocators for their telemetry
+    std::mutex layoutUsageMutex;
+    std::unordered_map<VkDescriptorSetLayout, DescriptorUsage> layoutUsage;
+}
 
 //> descriptor_bind
 void DescriptorLayoutBuilder::add_binding(uint32_t binding, VkDescriptorType type)
@@ -19,7 +28,7 @@ void DescriptorLayoutBuilder::clear()
 //< descriptor_bind
 
 //> descriptor_layout
-VkDescriptorSetLayout DescriptorLayoutBuilder::build(VkDevice device, VkShaderStageFlags shaderStages)
+VkDescriptorSetLayout DescriptorLayoutBuilder::build(VkDevice device, VkShaderStageFlags shaderStages, VkDescriptorSetLayoutCreateFlags flags)
 {
     for (auto& b : bindings) {
         b.stageFlags |= shaderStages;
@@ -30,13 +39,53 @@ VkDescriptorSetLayout DescriptorLayoutBuilder::build(VkDevice device, VkShaderSt
 
     info.pBindings = bindings.data();
     info.bindingCount = (uint32_t)bindings.size();
-    info.flags = 0;
+    info.flags = flags;
 
     VkDescriptorSetLayout set;
     VK_CHECK(vkCreateDescriptorSetLayout(device, &info, nullptr, &set));
 
+    // push descriptor sets are never allocated from a pool
+    if (!(flags & VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR)) {
+        DescriptorUsage usage {};
+        usage.sets = 1;
+        for (const VkDescriptorSetLayoutBinding& b : bindings) {
+            if (b.descriptorType < DescriptorUsage::TYPE_COUNT) {
+                usage.descriptors[b.descriptorType] += b.descriptorCount;
+            }
+        }
+        std::lock_guard<std::mutex> lock(layoutUsageMutex);
+        layoutUsage[set] = usage;
+    }
+
     return set;
 }
+
+VkDescriptorUpdateTemplate DescriptorLayoutBuilder::build_push_template(VkDevice device, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set)
+{
+    std::vector<VkDescriptorUpdateTemplateEntry> entries;
+    for (size_t i = 0; i < bindings.size(); i++) {
+        VkDescriptorUpdateTemplateEntry entry {};
+        entry.dstBinding = bindings[i].binding;
+        entry.descriptorCount = bindings[i].descriptorCount;
+        entry.descriptorType = bindings[i].descriptorType;
+        entry.offset = i * sizeof(PushDescriptorInfo);
+        entry.stride = sizeof(PushDescriptorInfo);
+        entries.push_back(entry);
+    }
+
+    VkDescriptorUpdateTemplateCreateInfo info = {.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO};
+    info.descriptorUpdateEntryCount = (uint32_t)entries.size();
+    info.pDescriptorUpdateEntries = entries.data();
+    info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR;
+    info.pipelineBindPoint = bindPoint;
+    info.pipelineLayout = layout;
+    info.set = set;
+
+    VkDescriptorUpdateTemplate updateTemplate;
+    VK_CHECK(vkCreateDescriptorUpdateTemplate(device, &info, nullptr, &updateTemplate));
+
+    return updateTemplate;
+}
 //< descriptor_layout
 
 //> write_image
@@ -97,8 +146,57 @@ void DescriptorWriter::update_set(VkDevice device, VkDescriptorSet set)
     vkUpdateDescriptorSets(device, (uint32_t)writes.size(), writes.data(), 0, nullptr);
 }
 //< writer_end
+//> descriptor_usage
+void DescriptorUsage::add(const DescriptorUsage& other, int sign)
+{
+    sets += sign * other.sets;
+    for (uint32_t t = 0; t < TYPE_COUNT; t++) {
+        descriptors[t] += sign * other.descriptors[t];
+    }
+}
+
+void DescriptorUsage::max(const DescriptorUsage& other)
+{
+    sets = std::max(sets, other.sets);
+    for (uint32_t t = 0; t < TYPE_COUNT; t++) {
+        descriptors[t] = std::max(descriptors[t], other.descriptors[t]);
+    }
+}
+
+uint32_t DescriptorUsage::total_descriptors() const
+{
+    uint32_t total = 0;
+    for (uint32_t count : descriptors) {
+        total += count;
+    }
+    return total;
+}
+
+DescriptorUsage descriptor_layout_usage(VkDescriptorSetLayout layout)
+{
+    std::lock_guard<std::mutex> lock(layoutUsageMutex);
+    auto it = layoutUsage.find(layout);
+    if (it != layoutUsage.end()) {
+        return it->second;
+    }
+    // not made by the builder, only the set is counted
+    DescriptorUsage usage {};
+    usage.sets = 1;
+    return usage;
+}
+
+void descriptor_layout_destroy(VkDevice device, VkDescriptorSetLayout layout)
+{
+    {
+        std::lock_guard<std::mutex> lock(layoutUsageMutex);
+        layoutUsage.erase(layout);
+    }
+    vkDestroyDescriptorSetLayout(device, layout, nullptr);
+}
+//< descriptor_usage
+
 //> growpool_2
-void DescriptorAllocatorGrowable::init(VkDevice device, uint32_t maxSets, std::span<PoolSizeRatio> poolRatios)
+void DescriptorAllocatorGrowable::init(VkDevice device, uint32_t maxSets, std::span<PoolSizeRatio> poolRatios, DescriptorPoolTuning* tuning, const std::string& name)
 {
     ratios.clear();
 
@@ -106,7 +204,15 @@ void DescriptorAllocatorGrowable::init(VkDevice device, uint32_t maxSets, std::s
         ratios.push_back(r);
     }
 
-    VkDescriptorPool newPool = create_pool(device, maxSets, poolRatios);
+    this->tuning = tuning;
+    this->name = name;
+    if (tuning) {
+        tuning->apply(name, maxSets, ratios);
+    }
+    current = {};
+    peak = {};
+
+    Pool newPool = create_pool(device, maxSets, ratios);
 
     setsPerPool = maxSets * 1.5; //grow it next allocation
 
@@ -115,33 +221,63 @@ void DescriptorAllocatorGrowable::init(VkDevice device, uint32_t maxSets, std::s
 
 void DescriptorAllocatorGrowable::clear_pools(VkDevice device)
 {
-    for (auto p : readyPools) {
-        vkResetDescriptorPool(device, p, 0);
+    // more than one pool was needed, replace them with one that holds everything the frame used
+    // instead of keeping a chain of ever bigger pools around
+    if (readyPools.size() + fullPools.size() > 1) {
+        uint32_t needed = std::min<uint32_t>(current.sets * 1.25f, 4092);
+        destroy_pools(device);
+        readyPools.push_back(create_pool(device, std::max(needed, 1u), ratios));
+        setsPerPool = std::min<uint32_t>(needed * 1.5f, 4092);
+    }
+    for (auto& p : readyPools) {
+        vkResetDescriptorPool(device, p.pool, 0);
+        p.used = {};
     }
-    for (auto p : fullPools) {
-        vkResetDescriptorPool(device, p, 0);
+    for (auto& p : fullPools) {
+        vkResetDescriptorPool(device, p.pool, 0);
+        p.used = {};
         readyPools.push_back(p);
     }
     fullPools.clear();
+    current = {};
 }
 
 void DescriptorAllocatorGrowable::destroy_pools(VkDevice device)
 {
 	for (auto p : readyPools) {
-		vkDestroyDescriptorPool(device, p, nullptr);
+		vkDestroyDescriptorPool(device, p.pool, nullptr);
 	}
     readyPools.clear();
 	for (auto p : fullPools) {
-		vkDestroyDescriptorPool(device,p,nullptr);
+		vkDestroyDescriptorPool(device,p.pool,nullptr);
     }
     fullPools.clear();
+
+    if (tuning && peak.sets > 0) {
+        tuning->report(name, peak);
+    }
+}
+
+DescriptorAllocatorGrowable::Stats DescriptorAllocatorGrowable::get_stats() const
+{
+    Stats result {};
+    result.pools = (uint32_t)(readyPools.size() + fullPools.size());
+    for (const Pool& p : readyPools) {
+        result.capacity += p.capacity;
+    }
+    for (const Pool& p : fullPools) {
+        result.capacity += p.capacity;
+    }
+    result.current = current;
+    result.peak = peak;
+    return result;
 }
 //< growpool_2
 
 //> growpool_1
-VkDescriptorPool DescriptorAllocatorGrowable::get_pool(VkDevice device)
+DescriptorAllocatorGrowable::Pool DescriptorAllocatorGrowable::get_pool(VkDevice device)
 {
-    VkDescriptorPool newPool;
+    Pool newPool;
     if (readyPools.size() != 0) {
         newPool = readyPools.back();
         readyPools.pop_back();
@@ -159,13 +295,13 @@ VkDescriptorPool DescriptorAllocatorGrowable::get_pool(VkDevice device)
     return newPool;
 }
 
-VkDescriptorPool DescriptorAllocatorGrowable::create_pool(VkDevice device, uint32_t setCount, std::span<PoolSizeRatio> poolRatios)
+DescriptorAllocatorGrowable::Pool DescriptorAllocatorGrowable::create_pool(VkDevice device, uint32_t setCount, std::span<PoolSizeRatio> poolRatios)
 {
 	std::vector<VkDescriptorPoolSize> poolSizes;
 	for (PoolSizeRatio ratio : poolRatios) {
 		poolSizes.push_back(VkDescriptorPoolSize{
 			.type = ratio.type,
-			.descriptorCount = uint32_t(ratio.ratio * setCount)
+			.descriptorCount = std::max(uint32_t(ratio.ratio * setCount), 1u)
 		});
 	}
 
@@ -176,8 +312,8 @@ VkDescriptorPool DescriptorAllocatorGrowable::create_pool(VkDevice device, uint3
 	pool_info.poolSizeCount = (uint32_t)poolSizes.size();
 	pool_info.pPoolSizes = poolSizes.data();
 
-	VkDescriptorPool newPool;
-	vkCreateDescriptorPool(device, &pool_info, nullptr, &newPool);
+	Pool newPool = {VK_NULL_HANDLE, setCount, {}};
+	VK_CHECK(vkCreateDescriptorPool(device, &pool_info, nullptr, &newPool.pool));
     return newPool;
 }
 //< growpool_1
@@ -186,12 +322,12 @@ VkDescriptorPool DescriptorAllocatorGrowable::create_pool(VkDevice device, uint3
 VkDescriptorSet DescriptorAllocatorGrowable::allocate(VkDevice device, VkDescriptorSetLayout layout)
 {
     //get or create a pool to allocate from
-    VkDescriptorPool poolToUse = get_pool(device);
+    Pool poolToUse = get_pool(device);
 
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.pNext = nullptr;
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = poolToUse;
+	allocInfo.descriptorPool = poolToUse.pool;
 	allocInfo.descriptorSetCount = 1;
 	allocInfo.pSetLayouts = &layout;
 
@@ -204,12 +340,383 @@ VkDescriptorSet DescriptorAllocatorGrowable::allocate(VkDevice device, VkDescrip
         fullPools.push_back(poolToUse);
 
         poolToUse = get_pool(device);
-        allocInfo.descriptorPool = poolToUse;
+        allocInfo.descriptorPool = poolToUse.pool;
 
        VK_CHECK( vkAllocateDescriptorSets(device, &allocInfo, &ds));
     }
 
+    DescriptorUsage usage = descriptor_layout_usage(layout);
+    poolToUse.used.add(usage);
+    current.add(usage);
+    peak.max(current);
+
     readyPools.push_back(poolToUse);
     return ds;
 }
-//< growpool_3
\ No newline at end of file
+//< growpool_3
+
+//> descriptor_tuning
+namespace {
+    // weight of the peaks from earlier runs
+    constexpr float TUNING_DECAY = 0.75f;
+    // headroom over the peak for the first pool
+    constexpr float TUNING_HEADROOM = 1.25f;
+    // ratio for default types that were never used
+    constexpr float TUNING_MIN_RATIO = 0.125f;
+}
+
+void DescriptorPoolTuning::load(const std::string& path)
+{
+    this->path = path;
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        LOG_INFO("No descriptor pool tuning at {}, using the default pool sizes", path);
+        return;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream in(line);
+        std::string name;
+        DescriptorUsage usage {};
+        if (!(in >> name >> usage.sets) || usage.sets == 0) {
+            continue;
+        }
+        uint32_t type;
+        char colon;
+        uint32_t count;
+        while (in >> type >> colon >> count) {
+            if (colon == ':' && type < DescriptorUsage::TYPE_COUNT) {
+                usage.descriptors[type] = count;
+            }
+        }
+        loaded[name] = usage;
+    }
+    LOG_INFO("Loaded descriptor pool tuning for {} allocators from {}", loaded.size(), path);
+}
+
+void DescriptorPoolTuning::save()
+{
+    if (path.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unordered_map<std::string, DescriptorUsage> merged = observed;
+    for (auto& [name, old] : loaded) {
+        DescriptorUsage decayed {};
+        decayed.sets = (uint32_t)(old.sets * TUNING_DECAY);
+        for (uint32_t t = 0; t < DescriptorUsage::TYPE_COUNT; t++) {
+            decayed.descriptors[t] = (uint32_t)(old.descriptors[t] * TUNING_DECAY);
+        }
+        if (decayed.sets == 0) {
+            continue;
+        }
+        merged[name].max(decayed);
+    }
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file.is_open()) {
+        LOG_ERROR("Failed to write descriptor pool tuning to {}", path);
+        return;
+    }
+    for (auto& [name, usage] : merged) {
+        file << name << ' ' << usage.sets;
+        for (uint32_t t = 0; t < DescriptorUsage::TYPE_COUNT; t++) {
+            if (usage.descriptors[t] > 0) {
+                file << ' ' << t << ':' << usage.descriptors[t];
+            }
+        }
+        file << '\n';
+    }
+}
+
+void DescriptorPoolTuning::apply(const std::string& name, uint32_t& initialSets, std::vector<DescriptorAllocatorGrowable::PoolSizeRatio>& poolRatios) const
+{
+    auto it = loaded.find(name);
+    if (name.empty() || it == loaded.end()) {
+        return;
+    }
+    const DescriptorUsage& usage = it->second;
+    initialSets = std::clamp<uint32_t>(usage.sets * TUNING_HEADROOM, 1, 4092);
+
+    std::array<bool, DescriptorUsage::TYPE_COUNT> listed {};
+    for (DescriptorAllocatorGrowable::PoolSizeRatio& ratio : poolRatios) {
+        if (ratio.type < DescriptorUsage::TYPE_COUNT) {
+            listed[ratio.type] = true;
+            ratio.ratio = std::max((float)usage.descriptors[ratio.type] / usage.sets, TUNING_MIN_RATIO);
+        }
+    }
+    for (uint32_t t = 0; t < DescriptorUsage::TYPE_COUNT; t++) {
+        if (!listed[t] && usage.descriptors[t] > 0) {
+            poolRatios.push_back({(VkDescriptorType)t, (float)usage.descriptors[t] / usage.sets});
+        }
+    }
+}
+
+void DescriptorPoolTuning::report(const std::string& name, const DescriptorUsage& peak)
+{
+    if (name.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    observed[name].max(peak);
+}
+//< descriptor_tuning
+
+//> descriptor_cache
+void DescriptorSetCache::init(VkDevice device, uint32_t frameCount, uint32_t setsPerPool, std::span<DescriptorAllocatorGrowable::PoolSizeRatio> poolRatios, uint32_t lifetime,
+    DescriptorPoolTuning* tuning, const std::string& name)
+{
+    this->device = device;
+    ratios.assign(poolRatios.begin(), poolRatios.end());
+    this->tuning = tuning;
+    this->name = name;
+    if (tuning) {
+        // the peak is over all live sets, spread over the frame caches and the long lived one
+        uint32_t liveSets = setsPerPool * (frameCount + 1);
+        tuning->apply(name, liveSets, ratios);
+        setsPerPool = std::max(liveSets / (frameCount + 1), 1u);
+    }
+    live = {};
+    peak = {};
+    frameCaches.resize(frameCount);
+    for (Cache& cache : frameCaches) {
+        cache.setsPerPool = setsPerPool;
+    }
+    longLived.setsPerPool = setsPerPool;
+    minSetsPerPool = setsPerPool;
+    // a long lived set may be in use by any frame in flight, it has to outlive them before it can be freed
+    this->lifetime = std::max(lifetime, frameCount + 1);
+    currentSlot = 0;
+    currentFrame = 0;
+    stats = {};
+}
+
+void DescriptorSetCache::destroy()
+{
+    auto destroyCache = [&](Cache& cache) {
+        for (Pool& p : cache.pools) {
+            vkDestroyDescriptorPool(device, p.pool, nullptr);
+        }
+        cache.pools.clear();
+        cache.entries.clear();
+    };
+    for (Cache& cache : frameCaches) {
+        destroyCache(cache);
+    }
+    destroyCache(longLived);
+    stats.liveSets = 0;
+
+    if (tuning && peak.sets > 0) {
+        tuning->report(name, peak);
+    }
+}
+
+template <typename F>
+void DescriptorSetCache::evict(Cache& cache, F&& shouldEvict)
+{
+    for (auto it = cache.entries.begin(); it != cache.entries.end();) {
+        std::vector<Entry>& bucket = it->second;
+        for (size_t i = 0; i < bucket.size();) {
+            if (shouldEvict(bucket[i])) {
+                Pool& p = cache.pools[bucket[i].pool];
+                vkFreeDescriptorSets(device, p.pool, 1, &bucket[i].set);
+                p.full = false;
+                p.sets--;
+                // the layout is the first word of the key
+                live.add(descriptor_layout_usage((VkDescriptorSetLayout)bucket[i].key[0]), -1);
+                bucket[i] = std::move(bucket.back());
+                bucket.pop_back();
+                stats.evictions++;
+                stats.liveSets--;
+            } else {
+                i++;
+            }
+        }
+        it = bucket.empty() ? cache.entries.erase(it) : std::next(it);
+    }
+}
+
+void DescriptorSetCache::release_empty_pools(Cache& cache)
+{
+    // the newest pool is the biggest, it stays so a cache that emptied out does not create one again next frame
+    std::vector<uint32_t> remap(cache.pools.size());
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < cache.pools.size(); i++) {
+        if (cache.pools[i].sets == 0 && i + 1 < cache.pools.size()) {
+            vkDestroyDescriptorPool(device, cache.pools[i].pool, nullptr);
+            cache.setsPerPool = std::max<uint32_t>(cache.setsPerPool / 1.5, minSetsPerPool);
+            continue;
+        }
+        remap[i] = kept;
+        cache.pools[kept++] = cache.pools[i];
+    }
+    if (kept == cache.pools.size()) {
+        return;
+    }
+    cache.pools.resize(kept);
+    for (auto& [hash, bucket] : cache.entries) {
+        for (Entry& e : bucket) {
+            e.pool = remap[e.pool];
+        }
+    }
+}
+
+void DescriptorSetCache::begin_frame(uint32_t frameSlot, uint64_t frameNumber)
+{
+    currentSlot = frameSlot;
+    currentFrame = frameNumber;
+
+    // the previous frame on this slot is done on the gpu, whatever it did not use can go
+    uint64_t previousUse = frameNumber >= frameCaches.size() ? frameNumber - frameCaches.size() : 0;
+    evict(frameCaches[frameSlot], [&](const Entry& e) { return e.lastUsed < previousUse; });
+    release_empty_pools(frameCaches[frameSlot]);
+
+    if (frameNumber > lifetime) {
+        evict(longLived, [&](const Entry& e) { return !e.pinned && e.lastUsed + lifetime < frameNumber; });
+        release_empty_pools(longLived);
+    }
+}
+
+void DescriptorSetCache::build_key(VkDescriptorSetLayout layout, const DescriptorWriter& writer)
+{
+    // raw handles and ranges, two sets with the same key are interchangeable
+    scratchKey.clear();
+    scratchKey.push_back((uint64_t)layout);
+    for (const VkWriteDescriptorSet& write : writer.writes) {
+        scratchKey.push_back(((uint64_t)write.dstBinding << 32) | (uint64_t)write.descriptorType);
+        if (write.pImageInfo) {
+            scratchKey.push_back((uint64_t)write.pImageInfo->sampler);
+            scratchKey.push_back((uint64_t)write.pImageInfo->imageView);
+            scratchKey.push_back((uint64_t)write.pImageInfo->imageLayout);
+        }
+        if (write.pBufferInfo) {
+            scratchKey.push_back((uint64_t)write.pBufferInfo->buffer);
+            scratchKey.push_back(write.pBufferInfo->offset);
+            scratchKey.push_back(write.pBufferInfo->range);
+        }
+    }
+}
+
+VkDescriptorSet DescriptorSetCache::allocate(Cache& cache, VkDescriptorSetLayout layout, uint32_t& poolIndex)
+{
+    VkDescriptorSetAllocateInfo allocInfo = {.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    VkDescriptorSet ds;
+    // newest pools first, they are the most likely to have space
+    for (uint32_t i = (uint32_t)cache.pools.size(); i-- > 0;) {
+        if (cache.pools[i].full) {
+            continue;
+        }
+        allocInfo.descriptorPool = cache.pools[i].pool;
+        VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &ds);
+        if (result == VK_SUCCESS) {
+            cache.pools[i].sets++;
+            poolIndex = i;
+            return ds;
+        }
+        if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) {
+            VK_CHECK(result);
+        }
+        cache.pools[i].full = true;
+    }
+
+    // pools allow freeing single sets, that is what eviction does
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    for (DescriptorAllocatorGrowable::PoolSizeRatio ratio : ratios) {
+        poolSizes.push_back({ratio.type, std::max(uint32_t(ratio.ratio * cache.setsPerPool), 1u)});
+    }
+    VkDescriptorPoolCreateInfo poolInfo = {.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    poolInfo.maxSets = cache.setsPerPool;
+    poolInfo.poolSizeCount = (uint32_t)poolSizes.size();
+    poolInfo.pPoolSizes = poolSizes.data();
+    Pool newPool = {VK_NULL_HANDLE, false, 0};
+    VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &newPool.pool));
+    cache.pools.push_back(newPool);
+    cache.setsPerPool = std::min<uint32_t>(cache.setsPerPool * 1.5, 4092);
+
+    allocInfo.descriptorPool = newPool.pool;
+    VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, &ds));
+    poolIndex = (uint32_t)cache.pools.size() - 1;
+    cache.pools[poolIndex].sets++;
+    return ds;
+}
+
+VkDescriptorSet DescriptorSetCache::get(VkDescriptorSetLayout layout, DescriptorWriter& writer, Tier tier, bool pinned)
+{
+    Cache& cache = tier == Tier::Frame ? frameCaches[currentSlot] : longLived;
+
+    build_key(layout, writer);
+    uint64_t hash = 14695981039346656037ull;
+    for (uint64_t word : scratchKey) {
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+
+    std::vector<Entry>& bucket = cache.entries[hash];
+    for (Entry& e : bucket) {
+        if (e.key == scratchKey) {
+            e.lastUsed = currentFrame;
+            e.pinned |= pinned;
+            stats.hits++;
+            return e.set;
+        }
+    }
+
+    stats.misses++;
+    Entry e;
+    e.key = scratchKey;
+    e.set = allocate(cache, layout, e.pool);
+    e.lastUsed = currentFrame;
+    e.pinned = pinned;
+    writer.update_set(device, e.set);
+    bucket.push_back(std::move(e));
+    stats.liveSets++;
+    live.add(descriptor_layout_usage(layout));
+    peak.max(live);
+    return bucket.back().set;
+}
+
+std::span<const VkDescriptorSet> DescriptorSetCache::invalidate(std::span<const uint64_t> handles)
+{
+    invalidatedPinned.clear();
+    if (handles.empty()) {
+        return invalidatedPinned;
+    }
+    scratchHandles.assign(handles.begin(), handles.end());
+    std::sort(scratchHandles.begin(), scratchHandles.end());
+    // ranges and layouts in the key may match a handle by chance, that only costs a rebuild of the set
+    auto mentions = [&](const Entry& e) {
+        bool found = std::any_of(e.key.begin() + 1, e.key.end(),
+            [&](uint64_t word) { return word != 0 && std::binary_search(scratchHandles.begin(), scratchHandles.end(), word); });
+        if (found && e.pinned) {
+            invalidatedPinned.push_back(e.set);
+        }
+        return found;
+    };
+    for (Cache& cache : frameCaches) {
+        evict(cache, mentions);
+    }
+    evict(longLived, mentions);
+    return invalidatedPinned;
+}
+
+DescriptorSetCache::Stats DescriptorSetCache::get_stats() const
+{
+    Stats result = stats;
+    result.pools = (uint32_t)longLived.pools.size();
+    for (const Cache& cache : frameCaches) {
+        result.pools += (uint32_t)cache.pools.size();
+    }
+    return result;
+}
+
+void DescriptorSetCache::reset_stats()
+{
+    uint32_t live = stats.liveSets;
+    stats = {};
+    stats.liveSets = live;
+}
+//< descriptor_cache
@@ -15,6 +15,10 @@
 #include "imgui_impl_vulkan.h"
 
 #include "glm/gtx/transform.hpp"
+#include "glm/gtc/constants.hpp"
+#include <atomic>
+#include <cstring>
+#include <optional>
 
 #ifdef NDEBUG
     const bool enableValidationLayers = false;
@@ -23,23 +27,49 @@
 #endif
 
 float z_axis = -5.f;
-bool VknatorEngine::Init(){
-    LOG_INFO("Init engine...");
+
+const char* PassStateName(PassStateMode mode){
+    switch (mode){
+        case PassStateMode::ShaderObjects: return "objects";
+        case PassStateMode::Dynamic: return "dynamic";
+        default: return "baked";
+    }
+}
+
+bool ParsePassState(const char* name, PassStateMode& mode){
+    for (PassStateMode candidate : { PassStateMode::ShaderObjects, PassStateMode::Dynamic, PassStateMode::Baked }){
+        if (std::strcmp(name, PassStateName(candidate)) == 0){
+            mode = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+bool VknatorEngine::Init(const EngineOptions& options){
+    LOG_INFO("Init engine{}...", options.headless ? " (headless)" : "");
+    auto initStart = std::chrono::steady_clock::now();
 
     bool success = true;
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) < 0) {
-        LOG_ERROR("Error SDL2 Initialization : {}", SDL_GetError());
-        success = false;
-    }
-    m_Window = SDL_CreateWindow("VKnator Engine",
-                                    SDL_WINDOWPOS_UNDEFINED,
-                                    SDL_WINDOWPOS_UNDEFINED,
-                                    m_WindowExtent.width,
-                                    m_WindowExtent.height,
-                                    SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
-    if (m_Window == NULL){
-        LOG_ERROR("Error window creation");
-        success = false;
+    m_Headless = options.headless;
+    m_HeadlessFrames = options.frames;
+    m_WindowExtent = options.extent;
+    m_CameraPath = options.cameraPath;
+    m_PassState = options.passState;
+    if (!m_Headless){
+        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) < 0) {
+            LOG_ERROR("Error SDL2 Initialization : {}", SDL_GetError());
+            success = false;
+        }
+        m_Window = SDL_CreateWindow("VKnator Engine",
+                                        SDL_WINDOWPOS_UNDEFINED,
+                                        SDL_WINDOWPOS_UNDEFINED,
+                                        m_WindowExtent.width,
+                                        m_WindowExtent.height,
+                                        SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+        if (m_Window == NULL){
+            LOG_ERROR("Error window creation");
+            success = false;
+        }
     }
     LOG_DEBUG("Init vulkan...");        InitVulkan();
     LOG_DEBUG("Init swapchain...");     InitSwapchain();
@@ -47,15 +77,32 @@ bool VknatorEngine::Init(){
     LOG_DEBUG("Init sync structures...");InitSyncStructures();
     LOG_DEBUG("Init descriptors...");   InitDescriptors();
     LOG_DEBUG("Init pipelines...");     InitPipelines();
-    LOG_DEBUG("Init ImGui ...");        InitImGui();
+    m_PipelineCache.LogStats();
+    if (!m_Headless){
+        LOG_DEBUG("Init ImGui ...");    InitImGui();
+    }
     LOG_DEBUG("Init default data...");  InitDefaultData();
+    if (m_Headless && !options.outputDirectory.empty()){
+        // the encoders share the cores with the recording workers, half of them keeps both busy
+        uint32_t encoderThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+        m_UseReadback = m_Readback.Init(m_VkDevice, m_Allocator, FRAME_OVERLAP, m_SwapChainExtent, m_SwapChainImageFormat,
+            options.outputDirectory, encoderThreads);
+        success = success && m_UseReadback;
+    }
 
-    success ? LOG_INFO("Init engine done") : LOG_ERROR("Init engine failed");
+    double initMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - initStart).count();
+    PipelineCompiler::Stats compilerStats = m_PipelineCompiler.GetStats();
+    success ? LOG_INFO("Init engine done in {:.1f} ms, {} pipelines and {} shader object pairs with {} pass state",
+        initMs, compilerStats.pipelines, compilerStats.shaderObjects, PassStateName(m_PassState)) : LOG_ERROR("Init engine failed");
     return success;
 }
 
 
 void VknatorEngine::Run(){
+    if (m_Headless){
+        RunHeadless();
+        return;
+    }
     LOG_INFO("Run engine...");
 
     SDL_Event event;
@@ -71,6 +118,10 @@ void VknatorEngine::Run(){
                 if (event.window.event == SDL_WINDOWEVENT_RESTORED){
                     m_IsMinimized = false;
                 }
+                //recreate right away instead of waiting for the swapchain to go out of date
+                if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED){
+                    m_ResizeRequested = true;
+                }
             }
             ImGui_ImplSDL2_ProcessEvent(&event);
         }
@@ -82,6 +133,11 @@ void VknatorEngine::Run(){
         if (m_ResizeRequested){
             ResizeSwapchain();
         }
+        auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - m_LastPipelineCacheSave).count() > PIPELINE_CACHE_SAVE_INTERVAL){
+            m_PipelineCache.Save();
+            m_LastPipelineCacheSave = now;
+        }
         // imgui new frame
         ImGui_ImplVulkan_NewFrame();
         ImGui_ImplSDL2_NewFrame(m_Window);
@@ -100,28 +156,345 @@ void VknatorEngine::Run(){
 			ImGui::InputFloat4("data3",(float*)& selected.data.data3);
 			ImGui::InputFloat4("data4",(float*)& selected.data.data4);
 
-            ImGui::SliderFloat("Render scale", &m_RenderScale, 0.0f, 1.0f);
+            ImGui::BeginDisabled(!m_HasTimestamps);
+            if (ImGui::Checkbox("Dynamic resolution", &m_DynamicResolution) && m_DynamicResolution){
+                m_ResolutionController.Reset(m_RenderScale);
+            }
+            ImGui::EndDisabled();
+            ImGui::BeginDisabled(m_DynamicResolution);
+            ImGui::SliderFloat("Render scale", &m_RenderScale, MIN_RENDER_SCALE, 1.0f);
+            ImGui::EndDisabled();
+            ImGui::Text("GPU frame: %.2f ms (target %.2f ms)", m_DynamicResolution ? m_ResolutionController.GetFilteredMs() : m_GpuFrameMs,
+                m_ResolutionController.GetTargetMs());
+            ImGui::SliderFloat("Sharpness", &m_UpscaleSharpness, 0.0f, 1.0f);
+            ImGui::SliderFloat("Exposure", &m_Exposure, 0.1f, 4.0f);
             ImGui::SliderFloat("z_axis", &z_axis, -5.0f, 1.0f);
 
 			ImGui::End();
 		}
+        if (ImGui::Begin("renderer")) {
+            ImGui::Checkbox("Parallel recording", &m_ParallelRecording);
+            ImGui::BeginDisabled(m_PathBenchmark.running);
+            ImGui::Checkbox("Depth prepass", &m_DepthPrepass);
+            ImGui::SameLine();
+            ImGui::BeginDisabled(!m_HasVisibilityBuffer);
+            ImGui::Checkbox("Visibility buffer", &m_UseVisibilityBuffer);
+            ImGui::EndDisabled();
+            ImGui::EndDisabled();
+            if (m_HasPipelineStatistics){
+                ImGui::Text("Fragment shader invocations: %llu without prepass, %llu with",
+                    (unsigned long long)m_FragmentInvocations[0], (unsigned long long)m_FragmentInvocations[1]);
+                if (!m_HasInheritedQueries && m_ParallelRecording){
+                    ImGui::Text("  (frames recorded in parallel are not measured, no inheritedQueries)");
+                }
+            }
+            if (m_VisibilityActive){
+                ImGui::Text("Visibility buffer: %zu draws, %zu left to the forward pass", m_VisibilityDraws.size(), m_ForwardDraws.size());
+            }
+            // the static casters change with the scene
+            if (ImGui::Checkbox("Dense scene", &m_DenseScene)){
+                m_Shadows.InvalidateStatic();
+            }
+            ImGui::SameLine();
+            ImGui::BeginDisabled(!m_HasTimestamps || !m_HasVisibilityBuffer || m_PathBenchmark.running || m_LightBenchmark.running);
+            if (ImGui::Button("Render path benchmark")){
+                StartPathBenchmark();
+            }
+            ImGui::EndDisabled();
+            if (m_PathBenchmark.running){
+                ImGui::SameLine();
+                ImGui::Text("running, path %u of %u", m_PathBenchmark.path + 1, (uint32_t)RenderPathBenchmark::Count);
+            }
+            ImGui::BeginDisabled(!m_HasAsyncCompute);
+            ImGui::Checkbox("Async compute", &m_UseAsyncCompute);
+            ImGui::EndDisabled();
+            ImGui::Text("Compute queue family: %u%s", m_ComputeQueueFamily, m_HasAsyncCompute ? "" : " (shared with graphics)");
+            ImGui::Text("Draws: %zu", m_MainDrawContext.OpaqueSurfaces.size());
+            MaterialSystem::Stats materialStats = m_Materials.GetStats();
+            ImGui::Text("Materials: %u unique (%u of %u deduplicated), %zu bytes of constants",
+                materialStats.materials, materialStats.deduplicated, materialStats.requests, materialStats.constantBytes);
+            PipelineCache::Stats cacheStats = m_PipelineCache.GetStats();
+            ImGui::Text("Pipelines: %u (%u cache hits, %u misses) in %.1f ms", cacheStats.pipelines, cacheStats.hits, cacheStats.misses, cacheStats.totalMs);
+            PipelineCompiler::Stats compilerStats = m_PipelineCompiler.GetStats();
+            ImGui::Text("Material pass state: %s, %u shader object pairs", PassStateName(m_PassState), compilerStats.shaderObjects);
+            DescriptorSetCache::Stats setStats = m_DescriptorCache.get_stats();
+            uint64_t setLookups = setStats.hits + setStats.misses;
+            ImGui::Text("Descriptor sets: %u live, %.1f%% hit rate, %llu evicted", setStats.liveSets,
+                setLookups ? 100.0 * setStats.hits / setLookups : 0.0, (unsigned long long)setStats.evictions);
+            ImGui::Text("Descriptor pools: %u", setStats.pools);
+            ResourceRegistry::Stats resourceStats = m_Resources.GetStats();
+            ImGui::Text("Resources: %u images, %u buffers, %u waiting for the gpu, %llu destroyed, %llu stale handles",
+                resourceStats.images, resourceStats.buffers, resourceStats.pending,
+                (unsigned long long)resourceStats.destroyed, (unsigned long long)resourceStats.staleHandles);
+            ImGui::Text("Chunk size: %u (%.1f ns/draw)", m_DrawChunkSize, m_RecordNsPerDraw);
+            ImGui::BeginDisabled(m_LightBenchmark.running);
+            ImGui::SliderInt("Lights", &m_LightCount, 0, MAX_LIGHTS);
+            ImGui::BeginDisabled(!m_HasTimestamps || m_PathBenchmark.running);
+            if (ImGui::Button("Light benchmark")){
+                StartLightBenchmark();
+            }
+            ImGui::EndDisabled();
+            ImGui::EndDisabled();
+            if (m_LightBenchmark.running){
+                ImGui::SameLine();
+                ImGui::Text("running, %u lights", m_LightBenchmark.lightCount);
+            }
+            bool shadows = m_Shadows.IsEnabled();
+            if (ImGui::Checkbox("Shadows", &shadows)){
+                m_Shadows.SetEnabled(shadows);
+            }
+            ImGui::SameLine();
+            if (ImGui::Checkbox("Cache cascades", &m_CacheShadows)){
+                m_Shadows.SetCaching(m_CacheShadows);
+            }
+            ImGui::SliderFloat3("Sun direction", &m_SunDirection.x, -1.f, 1.f);
+            CascadedShadows::Stats shadowStats = m_Shadows.GetStats();
+            ImGui::Text("Shadow cascades: %u rendered, %u casters drawn, %u culled, %llu cached, %llu refits",
+                shadowStats.renderedCascades, shadowStats.drawnObjects, shadowStats.culledObjects,
+                (unsigned long long)shadowStats.cachedCascades, (unsigned long long)shadowStats.refits);
+            const RGStats& graphStats = m_RenderGraph.GetStats();
+            ImGui::Text("Graph: %u passes (%u culled), %u barrier batches, %u image / %u buffer barriers",
+                graphStats.declaredPasses, graphStats.culledPasses, graphStats.barrierBatches, graphStats.imageBarriers, graphStats.bufferBarriers);
+            ImGui::Text("Transient memory: %.1f MB (%.1f MB without aliasing)",
+                graphStats.transientAllocated / (1024.0 * 1024.0), graphStats.transientRequested / (1024.0 * 1024.0));
+            ImGui::End();
+        }
+        if (ImGui::Begin("gpu profiler")){
+            if (!m_Profiler.IsEnabled()){
+                ImGui::Text("No timestamp support on the graphics queue");
+            } else {
+                if (m_Profiler.IsCalibrated()){
+                    ImGui::Text("Clocks calibrated, deviation %.1f us", m_Profiler.GetClockDeviationUs());
+                } else {
+                    ImGui::Text("Clocks aligned at submit");
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Export trace")){
+                    m_Profiler.ExportTrace(PROFILER_TRACE_PATH);
+                }
+                // the times are FRAME_OVERLAP frames old, the graphs cover the last PROFILER_HISTORY_FRAMES frames
+                if (ImGui::BeginTable("scopes", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)){
+                    ImGui::TableSetupColumn("scope");
+                    ImGui::TableSetupColumn("last ms");
+                    ImGui::TableSetupColumn("avg ms");
+                    ImGui::TableSetupColumn("history", ImGuiTableColumnFlags_WidthStretch, 3.f);
+                    ImGui::TableHeadersRow();
+                    const std::vector<ProfilerScopeStats>& stats = m_Profiler.GetStats();
+                    for (size_t i = 0; i < stats.size(); i++){
+                        const ProfilerScopeStats& scope = stats[i];
+                        ImGui::PushID((int)i);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%*s%s", (int)scope.depth * 2, "", scope.name.c_str());
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%.3f", scope.lastMs);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%.3f", scope.avgMs);
+                        ImGui::TableNextColumn();
+                        ImGui::PlotLines("##history", scope.history.data(), (int)scope.history.size(), (int)scope.historyOffset,
+                            nullptr, 0.f, scope.maxMs, ImVec2(-1.f, ImGui::GetTextLineHeight()));
+                        ImGui::PopID();
+                    }
+                    ImGui::EndTable();
+                }
+            }
+            ImGui::End();
+        }
         //make imgui calculate internal draw structures
         ImGui::Render();
 
+        m_SceneTime = SDL_GetTicks() / 1000.f;
         Draw();
     }
 }
 
-void VknatorEngine::Draw(){
+void VknatorEngine::RunHeadless(){
+    LOG_INFO("Run headless, {} frames of {}x{}...", m_HeadlessFrames, m_SwapChainExtent.width, m_SwapChainExtent.height);
+    // every frame at full resolution, the output should not depend on the gpu load
+    m_DynamicResolution = false;
+    m_RenderScale = 1.f;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < m_HeadlessFrames; frame++){
+        RenderFrame(frame / OFFLINE_FRAME_RATE);
+    }
+    VK_CHECK(vkDeviceWaitIdle(m_VkDevice));
+    // the last frames are still waiting in their readback buffers
+    if (m_UseReadback){
+        for (uint32_t slot = 0; slot < FRAME_OVERLAP; slot++){
+            m_Readback.Collect(slot);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOG_INFO("Rendered {} frames in {:.2f} s ({:.1f} fps)", m_HeadlessFrames, seconds, seconds > 0.0 ? m_HeadlessFrames / seconds : 0.0);
+}
+
+void VknatorEngine::RenderFrame(float sceneTime){
+    m_SceneTime = sceneTime;
+    Draw();
+}
+
+glm::mat4 VknatorEngine::CameraPathView(CameraPath path, float time, glm::vec3 center, float radius){
+    glm::vec3 up {0.f, 1.f, 0.f};
+    switch (path){
+        case CameraPath::Orbit: {
+            // one turn every 20 seconds, bobbing up and down a little
+            float angle = time * glm::two_pi<float>() / 20.f;
+            glm::vec3 eye = center + radius * glm::vec3(glm::sin(angle), 0.1f + 0.1f * glm::sin(time * 0.7f), glm::cos(angle));
+            return glm::lookAt(eye, center, up);
+        }
+        case CameraPath::Flyover: {
+            // from one side to the other in 10 seconds and back, looking ahead and down
+            float sweep = 1.f - glm::abs(glm::fract(time / 20.f) * 2.f - 1.f);
+            glm::vec3 eye = center + radius * glm::vec3(1.6f * sweep - 0.8f, 0.25f, 0.5f);
+            return glm::lookAt(eye, eye + glm::vec3(0.f, -0.35f, -1.f), up);
+        }
+        case CameraPath::Static:
+        default:
+            return glm::lookAt(center + radius * glm::vec3(0.f, 0.4f, 1.f), center, up);
+    }
+}
+
+bool VknatorEngine::LoadGeneratedScene(const SceneGenDesc& desc){
+    GeneratedScene scene = GenerateScene(desc);
 
-    UpdateScene();
+    std::vector<AllocatedImage> textures;
+    for (GeneratedTexture& texture : scene.textures){
+        AllocatedImage image = CreateImage(texture.pixels.data(), VkExtent3D{ texture.size, texture.size, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
+            VK_IMAGE_USAGE_SAMPLED_BIT, true);
+        textures.push_back(image);
+        m_MainDeletionQueue.PushFunction([=, this](){ DestroyImage(image); });
+    }
+
+    std::vector<MaterialHandle> materials;
+    for (const GeneratedMaterial& generated : scene.materials){
+        MaterialSystem::MaterialDesc material{};
+        material.pass = MaterialPass::MainColor;
+        material.colorImage = generated.texture >= 0 ? textures[generated.texture].imageView : m_WhiteImage.imageView;
+        material.metalRoughImage = m_WhiteImage.imageView;
+        material.colorSampler = m_DefaultSamplerLinear;
+        material.metalRoughSampler = m_DefaultSamplerLinear;
+        material.constants.colorFactors = generated.colorFactors;
+        material.constants.metal_rough_factors = generated.metalRoughFactors;
+        material.constants.features = MATERIAL_FEATURE_DEFAULT;
+        material.constants.alphaCutoff = 0.5f;
+        MaterialHandle handle = m_Materials.Create(material);
+        if (handle.IsNull()){
+            LOG_ERROR("Generated scene needs more than the {} materials available", MAX_MATERIALS);
+            return false;
+        }
+        materials.push_back(handle);
+    }
+
+    for (GeneratedMesh& generated : scene.meshes){
+        std::shared_ptr<MeshAsset> mesh = std::make_shared<MeshAsset>();
+        mesh->name = generated.name;
+        mesh->meshBuffers = UploadMesh(generated.indices, generated.vertices);
+        mesh->surfaces.push_back(GeoSurface{ 0, (uint32_t)generated.indices.size(), generated.bounds, {} });
+        m_GeneratedMeshes.push_back(std::move(mesh));
+    }
+
+    // the material sits on the surface, every mesh and material pair in use gets its own asset on the same buffers
+    std::unordered_map<uint64_t, std::shared_ptr<MeshAsset>> variants;
+    auto variant = [&](uint32_t mesh, uint32_t material){
+        std::shared_ptr<MeshAsset>& asset = variants[((uint64_t)mesh << 32) | material];
+        if (!asset){
+            asset = std::make_shared<MeshAsset>(*m_GeneratedMeshes[mesh]);
+            asset->surfaces[0].material = materials[material];
+        }
+        return asset;
+    };
+
+    std::shared_ptr<Node> root = std::make_shared<Node>();
+    root->localTransform = glm::mat4(1.f);
+    std::vector<std::shared_ptr<MeshNode>> nodes;
+    nodes.reserve(scene.nodes.size());
+    for (const GeneratedNode& generated : scene.nodes){
+        std::shared_ptr<MeshNode> node = std::make_shared<MeshNode>();
+        node->mesh = variant(generated.mesh, generated.material);
+        node->localTransform = generated.localTransform;
+        if (generated.parent < 0){
+            node->parent = root;
+            root->children.push_back(node);
+        } else {
+            node->parent = nodes[generated.parent];
+            nodes[generated.parent]->children.push_back(node);
+        }
+        nodes.push_back(std::move(node));
+    }
+    root->refreshTransform(glm::mat4(1.f));
+    m_GeneratedScene = root;
+
+    // the generator's lights, the count matches so UpdateScene keeps them
+    m_Lighting.SetLights(scene.lights, scene.lightOrbits);
+    m_LightCount = (int)m_Lighting.GetLightCount();
+    m_CameraCenter = scene.center;
+    m_CameraRadius = scene.radius;
+    m_Shadows.InvalidateStatic();
+    LOG_INFO("Generated scene: {} nodes, {} meshes, {} materials, {} textures, {} lights, depth {}",
+        scene.nodes.size(), scene.meshes.size(), materials.size(), textures.size(), m_LightCount, desc.hierarchyDepth);
+    return true;
+}
+
+VknatorEngine::FrameStats VknatorEngine::GetFrameStats() const {
+    FrameStats stats {};
+    stats.draws = (uint32_t)m_MainDrawContext.OpaqueSurfaces.size();
+    for (const RenderObject& draw : m_MainDrawContext.OpaqueSurfaces){
+        stats.triangles += draw.indexCount / 3;
+    }
+    return stats;
+}
 
-    VK_CHECK(vkWaitForFences(m_VkDevice, 1, &GetCurrentFrame().renderFence, true, 1000000000));
-    GetCurrentFrame().deletionQueue.Flush();
-    GetCurrentFrame().frameDescriptors.clear_pools(m_VkDevice);
+VknatorEngine::MemoryStats VknatorEngine::GetMemoryStats() const {
+    const VkPhysicalDeviceMemoryProperties* memoryProperties;
+    vmaGetMemoryProperties(m_Allocator, &memoryProperties);
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(m_Allocator, budgets);
+    MemoryStats stats {};
+    for (uint32_t heap = 0; heap < memoryProperties->memoryHeapCount; heap++){
+        stats.gpuAllocatedBytes += budgets[heap].statistics.allocationBytes;
+        stats.gpuUsageBytes += budgets[heap].usage;
+    }
+    return stats;
+}
 
-    uint32_t swapChainImageIndex;
-    VkResult result = vkAcquireNextImageKHR(m_VkDevice, m_SwapChain, 1000000000, GetCurrentFrame().swapchainSemaphore, nullptr, &swapChainImageIndex);
+void VknatorEngine::Draw(){
+    GpuProfiler::CpuScope drawScope(m_Profiler, "draw");
+    {
+        GpuProfiler::CpuScope scope(m_Profiler, "update scene");
+        UpdateScene();
+    }
+    {
+        GpuProfiler::CpuScope scope(m_Profiler, "wait for gpu");
+        VK_CHECK(vkWaitForFences(m_VkDevice, 1, &GetCurrentFrame().renderFence, true, 1000000000));
+    }
+    // the graphics timeline is at n + 1 once frame n is done
+    uint64_t completedValue;
+    VK_CHECK(vkGetSemaphoreCounterValue(m_VkDevice, m_GraphicsTimeline, &completedValue));
+    m_Resources.Collect(completedValue);
+    m_Materials.Invalidate(m_Resources.GetInvalidatedSets(), m_Resources.GetDestroyedHandles());
+    m_DescriptorCache.begin_frame(m_FrameNumber % FRAME_OVERLAP, (uint64_t)m_FrameNumber);
+    // secondary buffers of this frame are no longer in flight, recycle them
+    for (WorkerCommands& worker : GetCurrentFrame().workerCommands){
+        VK_CHECK(vkResetCommandPool(m_VkDevice, worker.commandPool, 0));
+        worker.usedBuffers = 0;
+    }
+    ReadFrameTimestamps();
+    ReadFrameStatistics();
+    uint32_t frameSlot = m_FrameNumber % FRAME_OVERLAP;
+    // the copy of the frame that used this slot before is done, it goes to the encoders
+    if (m_UseReadback){
+        m_Readback.Collect(frameSlot);
+    }
+    m_Lighting.Upload(frameSlot, m_SceneData.view);
+    // permutations finished in the background replace their fallback before any draw is recorded
+    m_MetalRoughMaterial.UpdatePermutations();
+
+    // headless every frame slot has its own offscreen image
+    uint32_t swapChainImageIndex = frameSlot;
+    VkResult result = VK_SUCCESS;
+    if (!m_Headless){
+        result = vkAcquireNextImageKHR(m_VkDevice, m_SwapChain, 1000000000, GetCurrentFrame().swapchainSemaphore, nullptr, &swapChainImageIndex);
+    }
     if (result == VK_ERROR_OUT_OF_DATE_KHR){
         m_ResizeRequested = true;
         return;
@@ -132,6 +505,14 @@ void VknatorEngine::Draw(){
 
     VK_CHECK(vkResetFences(m_VkDevice, 1, &GetCurrentFrame().renderFence));
 
+    // timeline value of this frame on both queues
+    uint64_t frameValue = (uint64_t)m_FrameNumber + 1;
+    bool asyncCompute = m_HasAsyncCompute && m_UseAsyncCompute;
+    if (asyncCompute){
+        // goes out first, so the compute queue can start as soon as the previous frame released the draw image
+        SubmitCompute();
+    }
+
     VK_CHECK(vkResetCommandBuffer(GetCurrentFrame().mainCommandBuffer, 0));
 
     VkCommandBuffer cmd = GetCurrentFrame().mainCommandBuffer;
@@ -139,51 +520,177 @@ void VknatorEngine::Draw(){
     VkCommandBufferBeginInfo cmdBeginInfo = vknatorinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 
     VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
-    // transition our main draw image into general layout so we can write into it
-	// we will overwrite it all so we dont care about what was the older layout
-    vknatorutils::TransitionImage(cmd, m_DrawImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-    //make a clear-color from frame number. This will flash with a 120 frame period.
-    DrawBackground(cmd);
-
-    vknatorutils::TransitionImage(cmd, m_DrawImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-    vknatorutils::TransitionImage(cmd, m_DepthImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
-    DrawGeometry(cmd);
-
-    //make the swapchain image into presentable mode
-    vknatorutils::TransitionImage(cmd, m_DrawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-    vknatorutils::TransitionImage(cmd, m_SwapChainImages[swapChainImageIndex],VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-//< draw_first
-//> imgui_draw
-	// execute a copy from the draw image into the swapchain
-	vknatorutils::CopyImageToImage(cmd, m_DrawImage.image, m_SwapChainImages[swapChainImageIndex], m_DrawExtent, m_SwapChainExtent);
+    // ends with the command buffer, the submit and present are timed on their own
+    std::optional<GpuProfiler::CpuScope> recordScope;
+    recordScope.emplace(m_Profiler, "record");
+    // the outermost scope is the gpu time of the whole frame, the render graph passes nest in it
+    m_Profiler.BeginCommands(cmd, ProfilerQueue::Graphics);
+    uint32_t frameScope = m_Profiler.BeginScope(cmd, "frame");
+    if (m_HasPipelineStatistics){
+        vkCmdResetQueryPool(cmd, GetCurrentFrame().statisticsPool, 0, 1);
+    }
+
+    // the cluster grid covers the part of the draw image rendered to this frame
+    m_SceneData.lightBuffer = m_Lighting.GetLightAddress(frameSlot);
+    m_SceneData.clusterBuffer = m_Lighting.GetClusterAddress(frameSlot);
+    m_SceneData.clusterGrid = m_Lighting.GetGrid();
+    m_SceneData.clusterDepth = m_Lighting.GetDepthParams();
+    m_SceneData.clusterScreen = m_Lighting.GetScreenParams(m_DrawExtent);
+    // the layout has to be taken before the update, it changes once the first cascade is scheduled
+    VkImageLayout shadowLayout = m_Shadows.GetLayout();
+    m_Shadows.Update((uint64_t)m_FrameNumber, m_SceneData.view, m_SceneData.proj, m_SunDirection);
+    m_SceneData.shadows = m_Shadows.GetSceneData(m_SceneData.view);
+    VkDescriptorSet sceneDescriptor = UploadSceneData();
+    // the ui can change the settings while the frame is recorded, every pass sees the ones taken here.
+    // the visibility buffer lays down the depth itself, the prepass would only repeat it
+    m_VisibilityActive = m_UseVisibilityBuffer && m_HasVisibilityBuffer;
+    m_DepthPrepassActive = m_DepthPrepass && !m_VisibilityActive;
+    if (m_VisibilityActive){
+        BuildVisibilityDraws(frameSlot);
+        m_Visibility.EnsureCapacity(frameSlot, m_DrawExtent, GetReleaseValue());
+    }
+
+    // describe the frame, the render graph works out the barriers between the passes
+    m_RenderGraph.Reset();
+    AllocatedImage swapchainImage { .image = m_SwapChainImages[swapChainImageIndex], .imageView = m_SwapChainImageViews[swapChainImageIndex],
+                                    .imageExtent = { m_SwapChainExtent.width, m_SwapChainExtent.height, 1 }, .imageFormat = m_SwapChainImageFormat };
+    // the draw and depth images are completely rewritten every frame, so their old contents are never needed.
+    // with async compute the background is already in the draw image and has to be kept
+    RGHandle drawImage = m_RenderGraph.ImportImage("draw", m_DrawImage, asyncCompute ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED);
+    RGHandle depthImage = m_RenderGraph.ImportImage("depth", m_DepthImage, VK_IMAGE_LAYOUT_UNDEFINED);
+    RGHandle swapchain = m_RenderGraph.ImportImage("swapchain", swapchainImage, VK_IMAGE_LAYOUT_UNDEFINED,
+        m_Headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    RGHandle lightClusters = m_RenderGraph.ImportBuffer("light clusters", m_Lighting.GetClusterBuffer(frameSlot));
+    // cached cascades live on across frames, the map is never discarded
+    RGHandle shadowMap = m_RenderGraph.ImportImage("shadow map", m_Shadows.GetImage(), shadowLayout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    if (!asyncCompute){
+        m_RenderGraph.AddPass("background", RGQueue::Compute, [this](VkCommandBuffer cmd){ DrawBackground(cmd); })
+            .Write(drawImage, RGUsage::StorageWrite, true);
+    }
 
-	// set swapchain image layout to Attachment Optimal so we can draw it
-	vknatorutils::TransitionImage(cmd, m_SwapChainImages[swapChainImageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    m_RenderGraph.AddPass("light clusters", RGQueue::Compute, [this, frameSlot](VkCommandBuffer cmd){
+        m_Lighting.RecordBinning(cmd, frameSlot, m_SceneData.proj, m_DrawExtent);
+    }).Write(lightClusters, RGUsage::StorageBufferWrite, true);
 
-	//draw imgui into the swapchain image
-	DrawImgui(cmd,  m_SwapChainImageViews[swapChainImageIndex]);
+    if (m_Shadows.NeedsRender()){
+        m_RenderGraph.AddPass("shadows", RGQueue::Graphics, [this](VkCommandBuffer cmd){ DrawShadows(cmd); })
+            .Write(shadowMap, RGUsage::DepthAttachment);
+    }
 
-	// set swapchain image layout to Present so we can draw it
-	vknatorutils::TransitionImage(cmd, m_SwapChainImages[swapChainImageIndex], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    // the prepass owns the depth clear, the geometry pass then keeps its contents
+    bool depthPrepass = m_DepthPrepassActive;
+    if (depthPrepass){
+        m_RenderGraph.AddPass("depth prepass", RGQueue::Graphics, [this, sceneDescriptor](VkCommandBuffer cmd){ DrawDepthPrepass(cmd, sceneDescriptor); })
+            .Write(depthImage, RGUsage::DepthAttachment, true);
+    }
 
+    // so does the visibility pass. The compute passes bin its pixels by material and shade them into the draw image,
+    // the geometry pass then only draws the surfaces the visibility buffer cannot take
+    bool visibility = m_VisibilityActive;
+    if (visibility){
+        RGHandle visibilityImage = m_RenderGraph.CreateImage("visibility", { VISIBILITY_FORMAT, m_DrawImage.imageExtent });
+        RGHandle visibilityBins = m_RenderGraph.ImportBuffer("visibility bins", m_Visibility.GetBinBuffer(frameSlot));
+        RGHandle visibilityPixels = m_RenderGraph.ImportBuffer("visibility pixels", m_Visibility.GetPixelBuffer(frameSlot));
+
+        m_RenderGraph.AddPass("visibility", RGQueue::Graphics, [this, visibilityImage](VkCommandBuffer cmd){
+            DrawVisibility(cmd, m_RenderGraph.GetImage(visibilityImage).imageView);
+        }).Write(visibilityImage, RGUsage::ColorAttachment, true)
+          .Write(depthImage, RGUsage::DepthAttachment, true);
+
+        m_RenderGraph.AddPass("visibility count", RGQueue::Compute, [this, visibilityImage, sceneDescriptor, frameSlot](VkCommandBuffer cmd){
+            BindVisibilitySets(cmd, m_RenderGraph.GetImage(visibilityImage).imageView, sceneDescriptor);
+            m_Visibility.RecordCount(cmd, frameSlot, m_DrawExtent);
+        }).Read(visibilityImage, RGUsage::StorageRead)
+          .Write(visibilityBins, RGUsage::StorageBufferWrite, true);
+
+        m_RenderGraph.AddPass("visibility bins", RGQueue::Compute, [this, frameSlot](VkCommandBuffer cmd){
+            m_Visibility.RecordBins(cmd, frameSlot, m_DrawExtent);
+        }).Write(visibilityBins, RGUsage::StorageBufferWrite);
+
+        m_RenderGraph.AddPass("visibility scatter", RGQueue::Compute, [this, visibilityImage, sceneDescriptor, frameSlot](VkCommandBuffer cmd){
+            BindVisibilitySets(cmd, m_RenderGraph.GetImage(visibilityImage).imageView, sceneDescriptor);
+            m_Visibility.RecordScatter(cmd, frameSlot, m_DrawExtent);
+        }).Read(visibilityImage, RGUsage::StorageRead)
+          .Write(visibilityBins, RGUsage::StorageBufferWrite)
+          .Write(visibilityPixels, RGUsage::StorageBufferWrite, true);
+
+        m_RenderGraph.AddPass("visibility shade", RGQueue::Compute, [this, visibilityImage, sceneDescriptor, frameSlot](VkCommandBuffer cmd){
+            BindVisibilitySets(cmd, m_RenderGraph.GetImage(visibilityImage).imageView, sceneDescriptor);
+            m_Visibility.RecordShade(cmd, frameSlot, m_DrawExtent);
+        }).Read(visibilityImage, RGUsage::StorageRead)
+          .Read(visibilityBins, RGUsage::IndirectBuffer)
+          .Read(visibilityBins, RGUsage::StorageBufferRead)
+          .Read(visibilityPixels, RGUsage::StorageBufferRead)
+          .Read(lightClusters, RGUsage::StorageBufferRead)
+          .Read(shadowMap, RGUsage::Sampled)
+          .Write(drawImage, RGUsage::StorageWrite);
+    }
+
+    m_RenderGraph.AddPass("geometry", RGQueue::Graphics, [this, sceneDescriptor](VkCommandBuffer cmd){ DrawGeometry(cmd, sceneDescriptor); })
+        .Read(lightClusters, RGUsage::StorageBufferRead)
+        .Read(shadowMap, RGUsage::Sampled)
+        .Write(drawImage, RGUsage::ColorAttachment)
+        .Write(depthImage, RGUsage::DepthAttachment, !depthPrepass && !visibility);
+//< draw_first
+//> imgui_draw
+    // single pass from the hdr draw image to the swapchain: upscale, tonemap and gamma in a fullscreen triangle,
+    // then imgui on top in the same rendering scope. Nothing in between goes through memory
+    m_RenderGraph.AddPass("composite", RGQueue::Graphics, [&](VkCommandBuffer cmd){ DrawComposite(cmd, swapchainImage.imageView); })
+        .Read(drawImage, RGUsage::Sampled)
+        .Write(swapchain, RGUsage::ColorAttachment, true);
+
+    if (m_UseReadback){
+        RGHandle readback = m_RenderGraph.ImportBuffer("readback", m_Readback.GetBuffer(frameSlot), true);
+        m_RenderGraph.AddPass("readback", RGQueue::Graphics, [this, frameSlot, image = swapchainImage.image](VkCommandBuffer cmd){
+            m_Readback.RecordCopy(cmd, frameSlot, image, (uint32_t)m_FrameNumber);
+        }).Read(swapchain, RGUsage::TransferSrc)
+          .Write(readback, RGUsage::TransferDst, true);
+    }
+
+    m_RenderGraph.Compile();
+    m_RenderGraph.Execute(cmd);
+
+    m_Profiler.EndScope(cmd, frameScope);
 	//finalize the command buffer (we can no longer add commands, but it can now be executed)
 	VK_CHECK(vkEndCommandBuffer(cmd));
+    recordScope.reset();
 //< imgui_draw
 
     //prepare the submission to the queue.
     //we want to wait on the _presentSemaphore, as that semaphore is signaled when the swapchain is ready
     //we will signal the _renderSemaphore, to signal that rendering has finished
+    //the graphics timeline tells the compute queue when the draw image can be overwritten by the next frame
 
     VkCommandBufferSubmitInfo cmdinfo = vknatorinit::command_buffer_submit_info(cmd);
 
-    VkSemaphoreSubmitInfo waitInfo = vknatorinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,GetCurrentFrame().swapchainSemaphore);
-    VkSemaphoreSubmitInfo signalInfo = vknatorinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, GetCurrentFrame().renderSemaphore);
+    VkSemaphoreSubmitInfo waitInfos[] = {
+        vknatorinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, GetCurrentFrame().swapchainSemaphore),
+        // vertex work can start before the background is done, only the color writes have to wait
+        vknatorinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, m_ComputeTimeline, frameValue),
+    };
+    VkSemaphoreSubmitInfo signalInfos[] = {
+        vknatorinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, GetCurrentFrame().renderSemaphore),
+        vknatorinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_GraphicsTimeline, frameValue),
+    };
 
-    VkSubmitInfo2 submit = vknatorinit::submit_info(&cmdinfo,&signalInfo,&waitInfo);
+    // headless there is nothing to acquire or present, only the timelines are left
+    uint32_t swapchainSemaphores = m_Headless ? 0 : 1;
+    VkSubmitInfo2 submit = vknatorinit::submit_info(&cmdinfo, signalInfos + 1 - swapchainSemaphores, waitInfos + 1 - swapchainSemaphores);
+    submit.waitSemaphoreInfoCount = swapchainSemaphores + (asyncCompute ? 1 : 0);
+    submit.signalSemaphoreInfoCount = swapchainSemaphores + 1;
 
     //submit command buffer to the queue and execute it.
     // _renderFence will now block until the graphic commands finish execution
-    VK_CHECK(vkQueueSubmit2(m_GraphicsQueue, 1, &submit, GetCurrentFrame().renderFence));
+    m_Profiler.EndCommands(ProfilerQueue::Graphics);
+    {
+        GpuProfiler::CpuScope scope(m_Profiler, "submit");
+        VK_CHECK(vkQueueSubmit2(m_GraphicsQueue, 1, &submit, GetCurrentFrame().renderFence));
+    }
+    if (m_Headless){
+        m_FrameNumber++;
+        return;
+    }
     //prepare present
     // this will put the image we just rendered to into the visible window.
     // we want to wait on the _renderSemaphore for that,
@@ -199,8 +706,12 @@ void VknatorEngine::Draw(){
 
     presentInfo.pImageIndices = &swapChainImageIndex;
 
-    result = vkQueuePresentKHR(m_GraphicsQueue, &presentInfo);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR){
+    {
+        GpuProfiler::CpuScope scope(m_Profiler, "present");
+        result = vkQueuePresentKHR(m_GraphicsQueue, &presentInfo);
+    }
+    //suboptimal happens when moving to a monitor with a different setup, the swapchain still works but should be rebuilt
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR){
         m_ResizeRequested = true;
     }
     m_FrameNumber++;
@@ -216,18 +727,443 @@ void VknatorEngine::DrawBackground(VkCommandBuffer cmd)
 	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_GradientPipelineLayout, 0, 1, &m_DrawImageDescriptors, 0, nullptr);
 
     vkCmdPushConstants(cmd, m_GradientPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputePushConstants), &effect.data);
-	// execute the compute pipeline dispatch. We are using 16x16 workgroup size so we need to divide by it
-	vkCmdDispatch(cmd, std::ceil(m_DrawExtent.width / 16.0), std::ceil(m_DrawExtent.height / 16.0), 1);
+	// execute the compute pipeline dispatch, one thread per pixel with the workgroup size of the shader
+	vkCmdDispatch(cmd, (m_DrawExtent.width + effect.localSize.x - 1) / effect.localSize.x, (m_DrawExtent.height + effect.localSize.y - 1) / effect.localSize.y, 1);
+}
+
+void VknatorEngine::SubmitCompute(){
+    VkCommandBuffer cmd = GetCurrentFrame().computeCommandBuffer;
+    uint64_t frameValue = (uint64_t)m_FrameNumber + 1;
+
+    VK_CHECK(vkResetCommandBuffer(cmd, 0));
+    VkCommandBufferBeginInfo cmdBeginInfo = vknatorinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+    m_Profiler.BeginCommands(cmd, ProfilerQueue::Compute);
+    uint32_t computeScope = m_Profiler.BeginScope(cmd, "async compute");
+
+    // compute passes of the frame, they only depend on the graphics queue through the draw image
+    m_ComputeGraph.Reset();
+    // left in GENERAL, the graphics queue takes it over from there
+    RGHandle drawImage = m_ComputeGraph.ImportImage("draw", m_DrawImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+    m_ComputeGraph.AddPass("background", RGQueue::Compute, [this](VkCommandBuffer cmd){ DrawBackground(cmd); })
+        .Write(drawImage, RGUsage::StorageWrite, true);
+
+    m_ComputeGraph.Compile();
+    m_ComputeGraph.Execute(cmd);
+    m_Profiler.EndScope(cmd, computeScope);
+    VK_CHECK(vkEndCommandBuffer(cmd));
+    m_Profiler.EndCommands(ProfilerQueue::Compute);
+
+    // the previous frame must be done reading the draw image before the background overwrites it
+    VkCommandBufferSubmitInfo cmdinfo = vknatorinit::command_buffer_submit_info(cmd);
+    VkSemaphoreSubmitInfo waitInfo = vknatorinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, m_GraphicsTimeline, frameValue - 1);
+    VkSemaphoreSubmitInfo signalInfo = vknatorinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_ComputeTimeline, frameValue);
+
+    VkSubmitInfo2 submit = vknatorinit::submit_info(&cmdinfo, &signalInfo, &waitInfo);
+    // no fence, the graphics submit of the frame waits for this one and its fence covers both
+    VK_CHECK(vkQueueSubmit2(m_ComputeQueue, 1, &submit, VK_NULL_HANDLE));
 }
 
-void VknatorEngine::DrawGeometry(VkCommandBuffer cmd){
+void VknatorEngine::ReadFrameStatistics(){
+    FrameData& frame = GetCurrentFrame();
+    if (!frame.statisticsWritten){
+        return;
+    }
+    //the fence of this frame was waited on, the query is available
+    uint64_t fragmentInvocations = 0;
+    VkResult result = vkGetQueryPoolResults(m_VkDevice, frame.statisticsPool, 0, 1, sizeof(uint64_t), &fragmentInvocations,
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    frame.statisticsWritten = false;
+    if (result == VK_SUCCESS){
+        m_FragmentInvocations[frame.statisticsPrepass ? 1 : 0] = fragmentInvocations;
+    }
+}
+
+void VknatorEngine::ReadFrameTimestamps(){
+    //the fence of this frame was waited on, the profiler resolves the scopes it recorded
+    const ProfilerFrame* frame = m_Profiler.BeginFrame(m_FrameNumber % FRAME_OVERLAP, (uint64_t)m_FrameNumber);
+    if (!frame){
+        return;
+    }
+    // the outermost graphics scope spans the frame, the ones right inside it and the async compute scope are the passes
+    const std::vector<ProfilerScope>& graphicsScopes = frame->scopes[(size_t)ProfilerQueue::Graphics];
+    if (graphicsScopes.empty() || graphicsScopes[0].depth != 0){
+        return;
+    }
+    m_GpuFrameMs = graphicsScopes[0].Ms();
+    if (m_DynamicResolution){
+        m_RenderScale = m_ResolutionController.Update(m_GpuFrameMs);
+    }
+
+    // the passes can change between frames, the list follows the last frame and keeps the history of known passes
+    std::vector<PassTiming> timings;
+    for (const std::vector<ProfilerScope>& scopes : frame->scopes){
+        for (const ProfilerScope& scope : scopes){
+            if (scope.depth != 1){
+                continue;
+            }
+            float ms = scope.Ms();
+            auto previous = std::find_if(m_PassTimings.begin(), m_PassTimings.end(), [&](const PassTiming& t){ return t.name == scope.name; });
+            float smoothed = (previous == m_PassTimings.end()) ? ms : previous->ms * 0.9f + ms * 0.1f;
+            timings.push_back({ scope.name, smoothed, ms });
+        }
+    }
+    m_PassTimings.swap(timings);
+    if (m_LightBenchmark.running){
+        UpdateLightBenchmark();
+    }
+    if (m_PathBenchmark.running){
+        UpdatePathBenchmark();
+    }
+}
+
+void VknatorEngine::AccumulatePassTimings(std::vector<PassTiming>& sums) const{
+    for (const PassTiming& timing : m_PassTimings){
+        auto sum = std::find_if(sums.begin(), sums.end(), [&](const PassTiming& t){ return t.name == timing.name; });
+        if (sum == sums.end()){
+            sums.push_back({ timing.name, 0.f, 0.f });
+            sum = sums.end() - 1;
+        }
+        sum->ms += timing.lastMs;
+    }
+}
+
+std::string VknatorEngine::FormatPassTimings(const std::vector<PassTiming>& sums, uint32_t frames){
+    std::string passes;
+    for (const PassTiming& sum : sums){
+        passes += fmt::format(", {} {:.3f} ms", sum.name, sum.ms / frames);
+    }
+    return passes;
+}
+
+void VknatorEngine::StartLightBenchmark(){
+    // fixed resolution, otherwise the controller hides the cost of the lights
+    m_LightBenchmark.savedLightCount = m_LightCount;
+    m_LightBenchmark.savedDynamicResolution = m_DynamicResolution;
+    m_DynamicResolution = false;
+    m_RenderScale = 1.0f;
+
+    m_LightBenchmark.running = true;
+    m_LightBenchmark.lightCount = 1;
+    m_LightBenchmark.frame = 0;
+    m_LightBenchmark.frameMsSum = 0.f;
+    m_LightBenchmark.sums.clear();
+    m_LightCount = 1;
+    LOG_INFO("Light benchmark: 1 to {} lights, {} frames each", MAX_LIGHTS, LIGHT_BENCH_FRAMES);
+}
+
+void VknatorEngine::UpdateLightBenchmark(){
+    LightBenchmark& bench = m_LightBenchmark;
+    // the warm up also covers the frames still in flight with the previous light count
+    if (++bench.frame <= LIGHT_BENCH_WARMUP_FRAMES){
+        return;
+    }
+    bench.frameMsSum += m_GpuFrameMs;
+    AccumulatePassTimings(bench.sums);
+    if (bench.frame < LIGHT_BENCH_WARMUP_FRAMES + LIGHT_BENCH_FRAMES){
+        return;
+    }
+
+    LOG_INFO("Light benchmark {:>4} lights: frame {:.3f} ms{}", bench.lightCount, bench.frameMsSum / LIGHT_BENCH_FRAMES,
+        FormatPassTimings(bench.sums, LIGHT_BENCH_FRAMES));
+
+    bench.lightCount *= 2;
+    bench.frame = 0;
+    bench.frameMsSum = 0.f;
+    bench.sums.clear();
+    if (bench.lightCount > MAX_LIGHTS){
+        bench.running = false;
+        m_LightCount = bench.savedLightCount;
+        m_DynamicResolution = bench.savedDynamicResolution;
+        if (m_DynamicResolution){
+            m_ResolutionController.Reset(m_RenderScale);
+        }
+        LOG_INFO("Light benchmark done");
+        return;
+    }
+    m_LightCount = (int)bench.lightCount;
+}
+
+void VknatorEngine::StartPathBenchmark(){
+    RenderPathBenchmark& bench = m_PathBenchmark;
+    bench.savedDepthPrepass = m_DepthPrepass;
+    bench.savedVisibility = m_UseVisibilityBuffer;
+    bench.savedDynamicResolution = m_DynamicResolution;
+    // the paths are compared at the same pixel count
+    m_DynamicResolution = false;
+    m_RenderScale = 1.0f;
+
+    bench.running = true;
+    bench.path = RenderPathBenchmark::Forward;
+    bench.frame = 0;
+    bench.frameMsSum = 0.f;
+    bench.sums.clear();
+    SetRenderPath(RenderPathBenchmark::Forward);
+    LOG_INFO("Render path benchmark: {} draws, {} frames per path", m_MainDrawContext.OpaqueSurfaces.size(), PATH_BENCH_FRAMES);
+}
+
+void VknatorEngine::SetRenderPath(RenderPathBenchmark::Path path){
+    m_DepthPrepass = path == RenderPathBenchmark::ForwardPrepass;
+    m_UseVisibilityBuffer = path == RenderPathBenchmark::Visibility;
+}
+
+void VknatorEngine::UpdatePathBenchmark(){
+    static const char* pathNames[RenderPathBenchmark::Count] = { "forward", "forward + prepass", "visibility buffer" };
+    RenderPathBenchmark& bench = m_PathBenchmark;
+    // the warm up also covers the frames still in flight with the previous path
+    if (++bench.frame <= PATH_BENCH_WARMUP_FRAMES){
+        return;
+    }
+    bench.frameMsSum += m_GpuFrameMs;
+    AccumulatePassTimings(bench.sums);
+    if (bench.frame < PATH_BENCH_WARMUP_FRAMES + PATH_BENCH_FRAMES){
+        return;
+    }
+
+    bench.frameMs[bench.path] = bench.frameMsSum / PATH_BENCH_FRAMES;
+    LOG_INFO("Render path benchmark {}: frame {:.3f} ms{}", pathNames[bench.path], bench.frameMs[bench.path],
+        FormatPassTimings(bench.sums, PATH_BENCH_FRAMES));
+
+    bench.path++;
+    bench.frame = 0;
+    bench.frameMsSum = 0.f;
+    bench.sums.clear();
+    if (bench.path < RenderPathBenchmark::Count){
+        SetRenderPath((RenderPathBenchmark::Path)bench.path);
+        return;
+    }
+    bench.running = false;
+    m_DepthPrepass = bench.savedDepthPrepass;
+    m_UseVisibilityBuffer = bench.savedVisibility;
+    m_DynamicResolution = bench.savedDynamicResolution;
+    if (m_DynamicResolution){
+        m_ResolutionController.Reset(m_RenderScale);
+    }
+    LOG_INFO("Render path benchmark done: forward {:.3f} ms, forward + prepass {:.3f} ms, visibility buffer {:.3f} ms",
+        bench.frameMs[RenderPathBenchmark::Forward], bench.frameMs[RenderPathBenchmark::ForwardPrepass], bench.frameMs[RenderPathBenchmark::Visibility]);
+}
+
+VkDescriptorSet VknatorEngine::UploadSceneData(){
+    //write data to buffer, the frame fence was waited on so the gpu is done with it
+    AllocatedBuffer& gpuSceneBuffer = GetCurrentFrame().sceneBuffer;
+    GPUSceneData* gpuSceneData = (GPUSceneData*)gpuSceneBuffer.allocation->GetMappedData();
+    *gpuSceneData = m_SceneData;
+
+    //pushed while recording, or a cached set that only changes with the buffer
+    if (m_UsePushDescriptors){
+        return VK_NULL_HANDLE;
+    }
+    m_FrameWriter.clear();
+    m_FrameWriter.write_buffer(0, gpuSceneBuffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    m_FrameWriter.write_image(1, m_Shadows.GetImage().imageView, m_Shadows.GetSampler(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    return m_DescriptorCache.get(m_GPUSceneDataDescriptorSetLayout, m_FrameWriter, DescriptorSetCache::Tier::Frame);
+}
+
+void VknatorEngine::DrawDepthPrepass(VkCommandBuffer cmd, VkDescriptorSet globalDescriptor){
+    VkRenderingAttachmentInfo depthAttachment = vknatorinit::depth_attachment_info(m_DepthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+    VkRenderingInfo renderInfo = vknatorinit::rendering_info(m_DrawExtent, nullptr, &depthAttachment);
+    renderInfo.colorAttachmentCount = 0;
+    vkCmdBeginRendering(cmd, &renderInfo);
+
+    SetViewportScissor(cmd);
+    // shares the material layout for the scene set, so the transform is computed exactly like in mesh.vert
+    VkPipelineLayout layout = m_MetalRoughMaterial.opaquePipeline.layout;
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_DepthPrepassPipeline);
+    BindSceneDescriptor(cmd, layout, globalDescriptor);
+
+    VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+    for (const RenderObject& draw : m_MainDrawContext.OpaqueSurfaces){
+        // transparent and alpha tested surfaces keep their normal depth state in the color pass
+        if (!draw.material->pipeline->depthPrepass){
+            continue;
+        }
+        if (draw.indexBuffer != lastIndexBuffer){
+            lastIndexBuffer = draw.indexBuffer;
+            vkCmdBindIndexBuffer(cmd, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        }
+        GPUDepthPushConstants pushConstants = DepthPushConstants(draw, draw.transform);
+        vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(GPUDepthPushConstants), &pushConstants);
+        vkCmdDrawIndexed(cmd, draw.indexCount, 1, draw.firstIndex, 0, 0);
+    }
+
+    vkCmdEndRendering(cmd);
+}
+
+void VknatorEngine::DrawGeometry(VkCommandBuffer cmd, VkDescriptorSet globalDescriptor){
+    // with the visibility buffer only the surfaces it left out are drawn here
+    std::span<const RenderObject> draws = m_MainDrawContext.OpaqueSurfaces;
+    if (m_VisibilityActive){
+        draws = m_ForwardDraws;
+    }
+    bool parallel = m_ParallelRecording && draws.size() >= PARALLEL_RECORD_MIN_DRAWS;
+
     //begin a render pass  connected to our draw image
-	VkRenderingAttachmentInfo colorAttachment = vknatorinit::attachment_info(m_DrawImage.imageView, nullptr, VK_IMAGE_LAYOUT_GENERAL);
+	VkRenderingAttachmentInfo colorAttachment = vknatorinit::attachment_info(m_DrawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
     VkRenderingAttachmentInfo depthAttachment = vknatorinit::depth_attachment_info(m_DepthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+    if (m_DepthPrepassActive || m_VisibilityActive){
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    }
 
 	VkRenderingInfo renderInfo = vknatorinit::rendering_info(m_DrawExtent, &colorAttachment, &depthAttachment);
+    if (parallel){
+        // the draws come from secondary command buffers recorded on the worker threads
+        renderInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+    }
+    FrameData& frame = GetCurrentFrame();
+    // the invocations compare the forward pass with and without the prepass, a partial forward pass would skew them.
+    // A query active around secondary command buffers needs inheritedQueries
+    bool statistics = m_HasPipelineStatistics && !m_VisibilityActive && (!parallel || m_HasInheritedQueries);
+    if (statistics){
+        vkCmdBeginQuery(cmd, frame.statisticsPool, 0, 0);
+    }
 	vkCmdBeginRendering(cmd, &renderInfo);
 
+    if (parallel){
+        RecordDrawsParallel(cmd, draws, globalDescriptor, statistics);
+    } else {
+        SetViewportScissor(cmd);
+        RecordDraws(cmd, draws, globalDescriptor);
+    }
+
+    vkCmdEndRendering(cmd);
+    if (statistics){
+        vkCmdEndQuery(cmd, frame.statisticsPool, 0);
+        frame.statisticsWritten = true;
+        frame.statisticsPrepass = m_DepthPrepassActive;
+    }
+}
+
+void VknatorEngine::BuildVisibilityDraws(uint32_t frame){
+    static_assert(VISIBILITY_MATERIAL_BINS >= BINDLESS_MAX_MATERIALS, "every bindless material needs its own bin");
+    m_VisibilityDraws.clear();
+    m_ForwardDraws.clear();
+    GPUVisibilityDraw* gpuDraws = m_Visibility.MapDraws(frame);
+    const std::vector<RenderObject>& surfaces = m_MainDrawContext.OpaqueSurfaces;
+    for (uint32_t i = 0; i < (uint32_t)surfaces.size(); i++){
+        const RenderObject& draw = surfaces[i];
+        // the surfaces the prepass skips need their fragment shader for alpha testing or blending, they stay forward.
+        // so does everything past a full draw list
+        if (!draw.material->pipeline->depthPrepass || m_VisibilityDraws.size() == MAX_VISIBILITY_DRAWS){
+            m_ForwardDraws.push_back(draw);
+            continue;
+        }
+        GPUVisibilityDraw& gpuDraw = gpuDraws[m_VisibilityDraws.size()];
+        gpuDraw.transform = draw.transform;
+        gpuDraw.vertexBuffer = draw.vertexBufferAddress;
+        gpuDraw.indexBuffer = draw.indexBufferAddress;
+        gpuDraw.firstIndex = draw.firstIndex;
+        gpuDraw.materialIndex = draw.material->materialIndex;
+        m_VisibilityDraws.push_back(i);
+    }
+}
+
+void VknatorEngine::DrawVisibility(VkCommandBuffer cmd, VkImageView visibilityView){
+    // draw index 0 marks the pixels no surface covers
+    VkClearValue clear {};
+    VkRenderingAttachmentInfo colorAttachment = vknatorinit::attachment_info(visibilityView, &clear, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    VkRenderingAttachmentInfo depthAttachment = vknatorinit::depth_attachment_info(m_DepthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+    VkRenderingInfo renderInfo = vknatorinit::rendering_info(m_DrawExtent, &colorAttachment, &depthAttachment);
+    vkCmdBeginRendering(cmd, &renderInfo);
+
+    SetViewportScissor(cmd);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_Visibility.GetRasterPipeline());
+
+    const std::vector<RenderObject>& surfaces = m_MainDrawContext.OpaqueSurfaces;
+    VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+    for (uint32_t i = 0; i < (uint32_t)m_VisibilityDraws.size(); i++){
+        const RenderObject& draw = surfaces[m_VisibilityDraws[i]];
+        if (draw.indexBuffer != lastIndexBuffer){
+            lastIndexBuffer = draw.indexBuffer;
+            vkCmdBindIndexBuffer(cmd, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        }
+        GPUDepthPushConstants depth = DepthPushConstants(draw, m_SceneData.viewproj * draw.transform);
+        VisibilityRasterPushConstants pushConstants;
+        pushConstants.matrix = depth.worldMatrix;
+        pushConstants.positionBuffer = depth.positionBuffer;
+        pushConstants.positionStride = depth.positionStride;
+        pushConstants.drawIndex = i;
+        vkCmdPushConstants(cmd, m_Visibility.GetRasterLayout(), VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VisibilityRasterPushConstants), &pushConstants);
+        vkCmdDrawIndexed(cmd, draw.indexCount, 1, draw.firstIndex, 0, 0);
+    }
+
+    vkCmdEndRendering(cmd);
+}
+
+void VknatorEngine::BindVisibilitySets(VkCommandBuffer cmd, VkImageView visibilityView, VkDescriptorSet globalDescriptor){
+    VkPipelineLayout layout = m_Visibility.GetComputeLayout();
+    BindSceneDescriptor(cmd, layout, globalDescriptor, VK_PIPELINE_BIND_POINT_COMPUTE);
+    VkDescriptorSet materialSet = m_Bindless.GetSet();
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 1, 1, &materialSet, 0, nullptr);
+
+    // the transient visibility image can be placed differently every frame, the set only lives for the frame
+    m_FrameWriter.clear();
+    m_FrameWriter.write_image(0, visibilityView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    m_FrameWriter.write_image(1, m_DrawImage.imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    VkDescriptorSet targetSet = m_DescriptorCache.get(m_Visibility.GetTargetLayout(), m_FrameWriter, DescriptorSetCache::Tier::Frame);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 2, 1, &targetSet, 0, nullptr);
+}
+
+void VknatorEngine::DrawShadows(VkCommandBuffer cmd){
+    VkExtent2D extent { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE };
+    VkViewport viewport = { 0.f, 0.f, (float)SHADOW_MAP_SIZE, (float)SHADOW_MAP_SIZE, 0.f, 1.f };
+    VkRect2D scissor = { { 0, 0 }, extent };
+
+    for (uint32_t cascade = 0; cascade < SHADOW_CASCADES; cascade++){
+        if (!m_Shadows.NeedsRender(cascade)){
+            continue;
+        }
+        // clears only the layer of this cascade, the cached ones keep their depth
+        VkRenderingAttachmentInfo depthAttachment = vknatorinit::depth_attachment_info(m_Shadows.GetLayerView(cascade), VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+        VkRenderingInfo renderInfo = vknatorinit::rendering_info(extent, nullptr, &depthAttachment);
+        renderInfo.colorAttachmentCount = 0;
+        vkCmdBeginRendering(cmd, &renderInfo);
+
+        vkCmdSetViewport(cmd, 0, 1, &viewport);
+        vkCmdSetScissor(cmd, 0, 1, &scissor);
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_Shadows.GetPipeline());
+
+        const glm::mat4& viewProj = m_Shadows.GetViewProj(cascade);
+        VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+        uint32_t drawn = 0;
+        uint32_t culled = 0;
+        for (const RenderObject& draw : m_MainDrawContext.OpaqueSurfaces){
+            if (!m_Shadows.IsVisible(cascade, draw.transform, draw.bounds)){
+                culled++;
+                continue;
+            }
+            if (draw.indexBuffer != lastIndexBuffer){
+                lastIndexBuffer = draw.indexBuffer;
+                vkCmdBindIndexBuffer(cmd, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+            }
+
+            GPUDepthPushConstants pushConstants = DepthPushConstants(draw, viewProj * draw.transform);
+            vkCmdPushConstants(cmd, m_Shadows.GetPipelineLayout(), VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDepthPushConstants), &pushConstants);
+
+            vkCmdDrawIndexed(cmd, draw.indexCount, 1, draw.firstIndex, 0, 0);
+            drawn++;
+        }
+        m_Shadows.CountDraws(drawn, culled);
+
+        vkCmdEndRendering(cmd);
+    }
+}
+
+GPUDepthPushConstants VknatorEngine::DepthPushConstants(const RenderObject& draw, const glm::mat4& matrix){
+    GPUDepthPushConstants pushConstants;
+    pushConstants.worldMatrix = matrix;
+    // meshes uploaded without the position stream read the positions out of the full vertices
+    if (draw.positionBufferAddress != 0){
+        pushConstants.positionBuffer = draw.positionBufferAddress;
+        pushConstants.positionStride = 3;
+    } else {
+        pushConstants.positionBuffer = draw.vertexBufferAddress;
+        pushConstants.positionStride = sizeof(Vertex) / sizeof(float);
+    }
+    return pushConstants;
+}
+
+void VknatorEngine::SetViewportScissor(VkCommandBuffer cmd){
 	//set dynamic viewport and scissor
 	VkViewport viewport = {};
 	viewport.x = 0;
@@ -246,49 +1182,237 @@ void VknatorEngine::DrawGeometry(VkCommandBuffer cmd){
 	scissor.extent.height = viewport.height;
 
 	vkCmdSetScissor(cmd, 0, 1, &scissor);
+}
 
-    AllocatedBuffer gpuSceneBuffer = CreateBuffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    GetCurrentFrame().deletionQueue.PushFunction([=, this](){
-        DestroyBuffer(gpuSceneBuffer);
-    });
+void VknatorEngine::RecordDraws(VkCommandBuffer cmd, std::span<const RenderObject> draws, VkDescriptorSet globalDescriptor){
+    //only rebind state when it changes between consecutive draws
+    MaterialPipeline* lastPipeline = nullptr;
+    VkPipelineLayout lastLayout = VK_NULL_HANDLE;
+    VkDescriptorSet lastMaterialSet = VK_NULL_HANDLE;
+    VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+
+    for (const RenderObject& draw : draws){
+        if (draw.material->pipeline != lastPipeline){
+            lastPipeline = draw.material->pipeline;
+            lastMaterialSet = VK_NULL_HANDLE;
+            if (draw.material->pipeline->pipeline != VK_NULL_HANDLE){
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->pipeline->pipeline);
+            } else {
+                BindShaders(cmd, draw.material->pipeline->shaders);
+            }
+            //set 0 stays bound across pipelines with the same layout
+            if (draw.material->pipeline->layout != lastLayout){
+                lastLayout = draw.material->pipeline->layout;
+                BindSceneDescriptor(cmd, lastLayout, globalDescriptor);
+            }
+            if (draw.material->pipeline->dynamicState){
+                SetMaterialState(cmd, *draw.material->pipeline);
+            }
+            SetDepthState(cmd, *draw.material->pipeline);
+        }
+        if (draw.material->materialSet != lastMaterialSet){
+            lastMaterialSet = draw.material->materialSet;
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->pipeline->layout, 1, 1, &draw.material->materialSet, 0, nullptr);
+        }
+        if (draw.indexBuffer != lastIndexBuffer){
+            lastIndexBuffer = draw.indexBuffer;
+            vkCmdBindIndexBuffer(cmd, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        }
 
-    //write data to buffer
-    GPUSceneData* gpuSceneData = (GPUSceneData*)gpuSceneBuffer.allocation->GetMappedData();
-    *gpuSceneData = m_SceneData;
+        GPUDrawPushConstants pushConstants;
+        pushConstants.vertexBuffer = draw.vertexBufferAddress;
+        pushConstants.worldMatrix = draw.transform;
+        pushConstants.materialIndex = draw.material->materialIndex;
 
-    //create descriptor set that binds that buffer and update it
-    VkDescriptorSet globalDescriptor = GetCurrentFrame().frameDescriptors.allocate(m_VkDevice, m_GPUSceneDataDescriptorSetLayout);
-    DescriptorWriter writer;
-    writer.write_buffer(0, gpuSceneBuffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    writer.update_set(m_VkDevice, globalDescriptor);
+        vkCmdPushConstants(cmd, draw.material->pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
 
-    for (const RenderObject& draw : m_MainDrawContext.OpaqueSurfaces){
+        vkCmdDrawIndexed(cmd, draw.indexCount, 1, draw.firstIndex, 0, 0);
+    }
+}
 
-        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->pipeline->pipeline);
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->pipeline->layout, 0, 1, &globalDescriptor, 0, nullptr);
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->pipeline->layout, 1, 1, &draw.material->materialSet, 0, nullptr);
+void VknatorEngine::BindSceneDescriptor(VkCommandBuffer cmd, VkPipelineLayout layout, VkDescriptorSet globalDescriptor, VkPipelineBindPoint bindPoint){
+    if (globalDescriptor != VK_NULL_HANDLE){
+        vkCmdBindDescriptorSets(cmd, bindPoint, layout, 0, 1, &globalDescriptor, 0, nullptr);
+        return;
+    }
+    PushDescriptorInfo sceneInfos[2];
+    sceneInfos[0].buffer = { GetCurrentFrame().sceneBuffer.buffer, 0, sizeof(GPUSceneData) };
+    sceneInfos[1].image = { m_Shadows.GetSampler(), m_Shadows.GetImage().imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    VkDescriptorUpdateTemplate pushTemplate = bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ? m_ComputeScenePushTemplate : m_ScenePushTemplate;
+    m_CmdPushDescriptorSetWithTemplate(cmd, pushTemplate, layout, 0, sceneInfos);
+}
 
-        vkCmdBindIndexBuffer(cmd, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+void VknatorEngine::SetDepthState(VkCommandBuffer cmd, const MaterialPipeline& pipeline){
+    // after the prepass the depth buffer already holds the nearest surface, only it passes
+    if (m_DepthPrepassActive && pipeline.depthPrepass){
+        vkCmdSetDepthWriteEnable(cmd, VK_FALSE);
+        vkCmdSetDepthCompareOp(cmd, VK_COMPARE_OP_EQUAL);
+    } else {
+        vkCmdSetDepthWriteEnable(cmd, pipeline.state.depthWrite);
+        vkCmdSetDepthCompareOp(cmd, pipeline.state.depthCompare);
+    }
+}
 
-        GPUDrawPushConstants pushConstants;
-        pushConstants.vertexBuffer = draw.vertexBufferAddress;
-        pushConstants.worldMatrix = draw.transform;
+void VknatorEngine::SetMaterialState(VkCommandBuffer cmd, const MaterialPipeline& pipeline){
+    const MaterialPassState& state = pipeline.state;
+    vkCmdSetPrimitiveTopology(cmd, state.topology);
+    vkCmdSetCullMode(cmd, state.cullMode);
+    vkCmdSetFrontFace(cmd, state.frontFace);
+    vkCmdSetDepthTestEnable(cmd, state.depthTest);
+#if defined(VK_EXT_extended_dynamic_state3)
+    if (pipeline.dynamicBlend){
+        VkBool32 blendEnable = state.blend;
+        m_CmdSetColorBlendEnable(cmd, 0, 1, &blendEnable);
+        //same equation as PipelineBuilder::EnableBlendingAdditive
+        VkColorBlendEquationEXT equation{};
+        equation.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        equation.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        equation.colorBlendOp = VK_BLEND_OP_ADD;
+        equation.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        equation.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        equation.alphaBlendOp = VK_BLEND_OP_ADD;
+        m_CmdSetColorBlendEquation(cmd, 0, 1, &equation);
+    }
+#endif
+}
+
+void VknatorEngine::BindShaders(VkCommandBuffer cmd, const GraphicsShaders& shaders){
+#if defined(VK_EXT_shader_object)
+    // the stages the device has enabled need a shader or null, geometry is enabled for the visibility buffer
+    VkShaderStageFlagBits stages[] = { VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
+        VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT, VK_SHADER_STAGE_GEOMETRY_BIT, VK_SHADER_STAGE_FRAGMENT_BIT };
+    VkShaderEXT bound[] = { shaders.vertex, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, shaders.fragment };
+    m_CmdBindShaders(cmd, 5, stages, bound);
+
+    // shader objects read the viewport and scissor count from the command buffer as well, the pipelines of the
+    // other passes only declare the plain viewport and scissor
+    VkViewport viewport = { 0.f, 0.f, (float)m_DrawExtent.width, (float)m_DrawExtent.height, 0.f, 1.f };
+    vkCmdSetViewportWithCount(cmd, 1, &viewport);
+    VkRect2D scissor = { {0, 0}, m_DrawExtent };
+    vkCmdSetScissorWithCount(cmd, 1, &scissor);
+
+    // what PipelineBuilder bakes into every material pipeline. Cheap next to a pipeline bind and only
+    // done when the shaders change, which is once per batch
+    m_CmdSetVertexInput(cmd, 0, nullptr, 0, nullptr);
+    vkCmdSetRasterizerDiscardEnable(cmd, VK_FALSE);
+    m_CmdSetPolygonMode(cmd, VK_POLYGON_MODE_FILL);
+    vkCmdSetPrimitiveRestartEnable(cmd, VK_FALSE);
+    vkCmdSetDepthBiasEnable(cmd, VK_FALSE);
+    vkCmdSetDepthBoundsTestEnable(cmd, VK_FALSE);
+    vkCmdSetStencilTestEnable(cmd, VK_FALSE);
+    m_CmdSetRasterizationSamples(cmd, VK_SAMPLE_COUNT_1_BIT);
+    VkSampleMask sampleMask = ~0u;
+    m_CmdSetSampleMask(cmd, VK_SAMPLE_COUNT_1_BIT, &sampleMask);
+    m_CmdSetAlphaToCoverageEnable(cmd, VK_FALSE);
+    VkColorComponentFlags writeMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    m_CmdSetColorWriteMask(cmd, 0, 1, &writeMask);
+#endif
+}
 
-        vkCmdPushConstants(cmd, draw.material->pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
+void VknatorEngine::RecordDrawsParallel(VkCommandBuffer cmd, std::span<const RenderObject> draws, VkDescriptorSet globalDescriptor, bool statistics){
+    uint32_t slotCount = m_Workers.GetSlotCount();
 
-        vkCmdDrawIndexed(cmd, draw.indexCount, 1, draw.firstIndex, 0, 0);
+    // size the chunks from the measured recording cost: big enough to hide the per secondary buffer overhead,
+    // but never bigger than an even split so every slot gets work
+    uint32_t chunkSize = PARALLEL_RECORD_MIN_CHUNK;
+    if (m_RecordNsPerDraw > 0.0){
+        chunkSize = (uint32_t)(PARALLEL_RECORD_CHUNK_NS / m_RecordNsPerDraw);
+    }
+    uint32_t evenSplit = (uint32_t)((draws.size() + slotCount - 1) / slotCount);
+    chunkSize = std::clamp(chunkSize, PARALLEL_RECORD_MIN_CHUNK, std::max(PARALLEL_RECORD_MIN_CHUNK, evenSplit));
+    uint32_t chunkCount = (uint32_t)((draws.size() + chunkSize - 1) / chunkSize);
+    m_ChunkCommandBuffers.resize(chunkCount);
+
+    VkFormat colorFormat = m_DrawImage.imageFormat;
+    VkCommandBufferInheritanceRenderingInfo inheritRendering = vknatorinit::command_buffer_inheritance_rendering_info(&colorFormat, m_DepthImage.imageFormat);
+    VkCommandBufferInheritanceInfo inheritInfo = vknatorinit::command_buffer_inheritance_info(&inheritRendering);
+    // the statistics query of the geometry pass is active while the secondaries execute
+    if (statistics){
+        inheritInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
     }
+    VkCommandBufferBeginInfo beginInfo = vknatorinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+    beginInfo.pInheritanceInfo = &inheritInfo;
+
+    FrameData& frame = GetCurrentFrame();
+    std::atomic<uint32_t> nextChunk {0};
+    std::atomic<int64_t> recordNs {0};
+
+    // every slot pulls chunks until none are left, each chunk goes into its own secondary buffer
+    // so the primary can execute them in the original draw order
+    m_Workers.ParallelFor(slotCount, [&](uint32_t slot){
+        WorkerCommands& worker = frame.workerCommands[slot];
+        for (uint32_t chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++){
+            auto start = std::chrono::steady_clock::now();
+
+            size_t first = (size_t)chunk * chunkSize;
+            size_t count = std::min<size_t>(chunkSize, draws.size() - first);
+
+            VkCommandBuffer secondary = GetSecondaryCommandBuffer(worker);
+            VK_CHECK(vkBeginCommandBuffer(secondary, &beginInfo));
+            //dynamic state is not inherited from the primary
+            SetViewportScissor(secondary);
+            RecordDraws(secondary, draws.subspan(first, count), globalDescriptor);
+            VK_CHECK(vkEndCommandBuffer(secondary));
+            m_ChunkCommandBuffers[chunk] = secondary;
+
+            recordNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+    });
 
-    vkCmdEndRendering(cmd);
+    vkCmdExecuteCommands(cmd, chunkCount, m_ChunkCommandBuffers.data());
+
+    double nsPerDraw = (double)recordNs.load() / (double)draws.size();
+    m_RecordNsPerDraw = (m_RecordNsPerDraw == 0.0) ? nsPerDraw : m_RecordNsPerDraw * 0.9 + nsPerDraw * 0.1;
+    m_DrawChunkSize = chunkSize;
 }
 
-void VknatorEngine::DrawImgui(VkCommandBuffer cmd, VkImageView targetImageView){
-    VkRenderingAttachmentInfo colorAttachment = vknatorinit::attachment_info(targetImageView, nullptr, VK_IMAGE_LAYOUT_GENERAL);
+VkCommandBuffer VknatorEngine::GetSecondaryCommandBuffer(WorkerCommands& worker){
+    if (worker.usedBuffers == worker.secondaryBuffers.size()){
+        VkCommandBufferAllocateInfo allocInfo = vknatorinit::command_buffer_allocate_info(worker.commandPool, 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+        VkCommandBuffer newBuffer;
+        VK_CHECK(vkAllocateCommandBuffers(m_VkDevice, &allocInfo, &newBuffer));
+        worker.secondaryBuffers.push_back(newBuffer);
+    }
+    return worker.secondaryBuffers[worker.usedBuffers++];
+}
+
+void VknatorEngine::DrawComposite(VkCommandBuffer cmd, VkImageView targetImageView){
+    // long lived, the set stays valid until the draw image is recreated and the old one ages out
+    m_FrameWriter.clear();
+    m_FrameWriter.write_image(0, m_DrawImage.imageView, m_CompositeSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    VkDescriptorSet compositeDescriptor = m_DescriptorCache.get(m_CompositeDescriptorLayout, m_FrameWriter, DescriptorSetCache::Tier::LongLived);
+
+    //the fullscreen triangle covers every pixel, the old swapchain contents never need to be loaded
+    VkRenderingAttachmentInfo colorAttachment = vknatorinit::attachment_info(targetImageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	VkRenderingInfo renderInfo = vknatorinit::rendering_info(m_SwapChainExtent, &colorAttachment, nullptr);
 
 	vkCmdBeginRendering(cmd, &renderInfo);
 
-	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+    VkViewport viewport = { 0.f, 0.f, (float)m_SwapChainExtent.width, (float)m_SwapChainExtent.height, 0.f, 1.f };
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    VkRect2D scissor = { {0, 0}, m_SwapChainExtent };
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    CompositePushConstants pushConstants;
+    pushConstants.inputSize = glm::vec2(m_DrawExtent.width, m_DrawExtent.height);
+    pushConstants.inputTexel = glm::vec2(1.f / m_DrawImage.imageExtent.width, 1.f / m_DrawImage.imageExtent.height);
+    pushConstants.outputSize = glm::vec2(m_SwapChainExtent.width, m_SwapChainExtent.height);
+    pushConstants.sharpness = m_UpscaleSharpness;
+    pushConstants.exposure = m_Exposure;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_CompositePipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_CompositePipelineLayout, 0, 1, &compositeDescriptor, 0, nullptr);
+    vkCmdPushConstants(cmd, m_CompositePipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(CompositePushConstants), &pushConstants);
+    {
+        GpuProfiler::Scope scope(m_Profiler, cmd, "tonemap");
+        vkCmdDraw(cmd, 3, 1, 0, 0);
+    }
+
+	if (!m_Headless){
+        GpuProfiler::Scope scope(m_Profiler, cmd, "imgui");
+		ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+	}
 
 	vkCmdEndRendering(cmd);
 }
@@ -298,20 +1422,33 @@ void VknatorEngine::Deinit(){
 
     //wait for GPU to stop
     vkDeviceWaitIdle(m_VkDevice);
+    m_Workers.Shutdown();
+    if (m_UseReadback){
+        m_Readback.Destroy();
+    }
 
+    // the variants of the generated meshes share these buffers
+    m_testMeshes.insert(m_testMeshes.end(), m_GeneratedMeshes.begin(), m_GeneratedMeshes.end());
     for (auto& mesh : m_testMeshes){
         DestroyBuffer(mesh->meshBuffers.indexBuffer);
         DestroyBuffer(mesh->meshBuffers.vertexBuffer);
+        if (mesh->meshBuffers.positionBuffer.buffer != VK_NULL_HANDLE){
+            DestroyBuffer(mesh->meshBuffers.positionBuffer);
+        }
     }
 
     // destroy command pools, which destroy all allocated command buffers
     for (int i = 0; i < FRAME_OVERLAP; i++){
         vkDestroyCommandPool(m_VkDevice, m_Frames[i].commandPool, nullptr);
+        vkDestroyCommandPool(m_VkDevice, m_Frames[i].computeCommandPool, nullptr);
+        vkDestroyQueryPool(m_VkDevice, m_Frames[i].statisticsPool, nullptr);
+        for (WorkerCommands& worker : m_Frames[i].workerCommands){
+            vkDestroyCommandPool(m_VkDevice, worker.commandPool, nullptr);
+        }
         //destroy sync objects
         vkDestroyFence(m_VkDevice, m_Frames[i].renderFence, nullptr);
         vkDestroySemaphore(m_VkDevice, m_Frames[i].renderSemaphore, nullptr);
         vkDestroySemaphore(m_VkDevice ,m_Frames[i].swapchainSemaphore, nullptr);
-        m_Frames[i].deletionQueue.Flush();
     }
 
     m_MainDeletionQueue.Flush();
@@ -319,17 +1456,21 @@ void VknatorEngine::Deinit(){
     // destroy swapchain resources
     DestroySwapchain();
 
-    vkDestroySurfaceKHR(m_VkInstance, m_VkSurface, nullptr);
+    if (!m_Headless){
+        vkDestroySurfaceKHR(m_VkInstance, m_VkSurface, nullptr);
+    }
 
     vkDestroyDevice(m_VkDevice, nullptr);
     vkb::destroy_debug_utils_messenger(m_VkInstance, m_VkDebugMessenger);
     vkDestroyInstance(m_VkInstance, nullptr);
-    //Destroy window
-    SDL_DestroyWindow( m_Window );
-    m_Window = NULL;
+    if (!m_Headless){
+        //Destroy window
+        SDL_DestroyWindow( m_Window );
+        m_Window = NULL;
 
-    //Quit SDL subsystems
-    SDL_Quit();
+        //Quit SDL subsystems
+        SDL_Quit();
+    }
     LOG_DEBUG("Done");
 }
 
@@ -340,6 +1481,8 @@ void VknatorEngine::InitVulkan(){
     .request_validation_layers(enableValidationLayers)
     .use_default_debug_messenger()
     .require_api_version(1, 3, 0)
+    // no surface extensions headless, so it also runs where no window system is installed
+    .set_headless(m_Headless)
     .build();
     vkb::Instance vkbInstance = instance.value();
     // grab VKInstance from vkb istance
@@ -348,7 +1491,9 @@ void VknatorEngine::InitVulkan(){
     m_VkDebugMessenger = vkbInstance.debug_messenger;
 
     //We want a gpu that can write to the SDL surface and supports vulkan 1.3
-    SDL_Vulkan_CreateSurface(m_Window, m_VkInstance, &m_VkSurface);
+    if (!m_Headless){
+        SDL_Vulkan_CreateSurface(m_Window, m_VkInstance, &m_VkSurface);
+    }
 
     //use vkbootstrap to select a gpu.
     VkPhysicalDeviceVulkan13Features features13{};
@@ -358,24 +1503,146 @@ void VknatorEngine::InitVulkan(){
     VkPhysicalDeviceVulkan12Features features12{};
     features12.bufferDeviceAddress = true;
     features12.descriptorIndexing = true;
+    features12.timelineSemaphore = true;
+    // the parts of descriptor indexing the bindless set uses, all guaranteed with descriptorIndexing
+    features12.runtimeDescriptorArray = true;
+    features12.shaderSampledImageArrayNonUniformIndexing = true;
+    features12.descriptorBindingPartiallyBound = true;
+    features12.descriptorBindingUpdateUnusedWhilePending = true;
+    features12.descriptorBindingSampledImageUpdateAfterBind = true;
+    features12.descriptorBindingStorageBufferUpdateAfterBind = true;
 
     vkb::PhysicalDeviceSelector selector{ vkbInstance };
+    // headless nothing is presented, any vulkan 1.3 device will do (lavapipe included)
+    if (!m_Headless){
+        selector.set_surface(m_VkSurface);
+    }
     vkb::PhysicalDevice physicalDevice = selector
         .set_minimum_version(1, 3)
         .set_required_features_13(features13)
         .set_required_features_12(features12)
-        .set_surface(m_VkSurface)
         .select()
         .value();
     LOG_INFO("GPU used: {}",  physicalDevice.name);
+    m_DeviceName = physicalDevice.name;
+
+    // shader objects bring the dynamic blend commands along, extended_dynamic_state3 is not needed with them
+#if defined(VK_EXT_shader_object)
+    VkPhysicalDeviceShaderObjectFeaturesEXT shaderObject = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT };
+    if (m_PassState == PassStateMode::ShaderObjects && physicalDevice.enable_extension_if_present(VK_EXT_SHADER_OBJECT_EXTENSION_NAME)){
+        VkPhysicalDeviceFeatures2 features2 = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, .pNext = &shaderObject };
+        vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &features2);
+        shaderObject = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT, .shaderObject = shaderObject.shaderObject };
+    }
+    if (m_PassState == PassStateMode::ShaderObjects && !shaderObject.shaderObject){
+        LOG_INFO("No VK_EXT_shader_object, the materials fall back to pipelines");
+        m_PassState = PassStateMode::Dynamic;
+    }
+#else
+    if (m_PassState == PassStateMode::ShaderObjects){
+        LOG_INFO("The Vulkan headers predate VK_EXT_shader_object, the materials fall back to pipelines");
+        m_PassState = PassStateMode::Dynamic;
+    }
+#endif
+    // cull, depth and topology state are core dynamic state in 1.3, blending needs extended_dynamic_state3
+    m_UseDynamicState = m_PassState != PassStateMode::Baked;
+    m_HasDynamicBlendState = m_PassState == PassStateMode::ShaderObjects;
+#if defined(VK_EXT_extended_dynamic_state3)
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT dynamicState3 = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT };
+    bool useDynamicState3 = false;
+    if (m_PassState == PassStateMode::Dynamic && physicalDevice.enable_extension_if_present(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)){
+        VkPhysicalDeviceFeatures2 features2 = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, .pNext = &dynamicState3 };
+        vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &features2);
+        m_HasDynamicBlendState = dynamicState3.extendedDynamicState3ColorBlendEnable && dynamicState3.extendedDynamicState3ColorBlendEquation;
+        //only enable what is used
+        dynamicState3 = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT };
+        dynamicState3.extendedDynamicState3ColorBlendEnable = m_HasDynamicBlendState;
+        dynamicState3.extendedDynamicState3ColorBlendEquation = m_HasDynamicBlendState;
+        useDynamicState3 = m_HasDynamicBlendState;
+    }
+#endif
+    LOG_INFO("Material pass state: {}", m_PassState == PassStateMode::ShaderObjects ? "dynamic, shader objects"
+        : !m_UseDynamicState ? "baked into pipelines"
+        : (m_HasDynamicBlendState ? "dynamic" : "dynamic, blending baked into pipelines"));
+
+    // the fragment invocation counts of the depth prepass stats, optional
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice.physical_device, &supportedFeatures);
+    m_HasPipelineStatistics = supportedFeatures.pipelineStatisticsQuery;
+    physicalDevice.features.pipelineStatisticsQuery = m_HasPipelineStatistics;
+    m_HasInheritedQueries = m_HasPipelineStatistics && supportedFeatures.inheritedQueries;
+    physicalDevice.features.inheritedQueries = m_HasInheritedQueries;
+    // the visibility buffer writes gl_PrimitiveID, which needs the geometry shader feature
+    m_HasVisibilityBuffer = supportedFeatures.geometryShader;
+    physicalDevice.features.geometryShader = m_HasVisibilityBuffer;
+
+    m_UsePushDescriptors = PUSH_DESCRIPTORS && physicalDevice.enable_extension_if_present(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+    LOG_INFO("Scene descriptors: {}", m_UsePushDescriptors ? "push descriptors" : "cached sets");
+    // lines the gpu profiler scopes up with the cpu ones, optional
+    m_HasCalibratedTimestamps = physicalDevice.enable_extension_if_present(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
 
     vkb::DeviceBuilder deviceBuilder {physicalDevice};
+#if defined(VK_EXT_extended_dynamic_state3)
+    if (useDynamicState3){
+        deviceBuilder.add_pNext(&dynamicState3);
+    }
+#endif
+#if defined(VK_EXT_shader_object)
+    if (m_PassState == PassStateMode::ShaderObjects){
+        deviceBuilder.add_pNext(&shaderObject);
+    }
+#endif
     vkb::Device vkbDevice = deviceBuilder.build().value();
     m_VkDevice = vkbDevice.device;
     m_ActiveGPU = physicalDevice.physical_device;
+#if defined(VK_EXT_extended_dynamic_state3)
+    if (m_HasDynamicBlendState){
+        m_CmdSetColorBlendEnable = (PFN_vkCmdSetColorBlendEnableEXT)vkGetDeviceProcAddr(m_VkDevice, "vkCmdSetColorBlendEnableEXT");
+        m_CmdSetColorBlendEquation = (PFN_vkCmdSetColorBlendEquationEXT)vkGetDeviceProcAddr(m_VkDevice, "vkCmdSetColorBlendEquationEXT");
+    }
+#endif
+#if defined(VK_EXT_shader_object)
+    if (m_PassState == PassStateMode::ShaderObjects){
+        m_CmdBindShaders = (PFN_vkCmdBindShadersEXT)vkGetDeviceProcAddr(m_VkDevice, "vkCmdBindShadersEXT");
+        m_CmdSetPolygonMode = (PFN_vkCmdSetPolygonModeEXT)vkGetDeviceProcAddr(m_VkDevice, "vkCmdSetPolygonModeEXT");
+        m_CmdSetRasterizationSamples = (PFN_vkCmdSetRasterizationSamplesEXT)vkGetDeviceProcAddr(m_VkDevice, "vkCmdSetRasterizationSamplesEXT");
+        m_CmdSetSampleMask = (PFN_vkCmdSetSampleMaskEXT)vkGetDeviceProcAddr(m_VkDevice, "vkCmdSetSampleMaskEXT");
+        m_CmdSetAlphaToCoverageEnable = (PFN_vkCmdSetAlphaToCoverageEnableEXT)vkGetDeviceProcAddr(m_VkDevice, "vkCmdSetAlphaToCoverageEnableEXT");
+        m_CmdSetColorWriteMask = (PFN_vkCmdSetColorWriteMaskEXT)vkGetDeviceProcAddr(m_VkDevice, "vkCmdSetColorWriteMaskEXT");
+        m_CmdSetVertexInput = (PFN_vkCmdSetVertexInputEXT)vkGetDeviceProcAddr(m_VkDevice, "vkCmdSetVertexInputEXT");
+    }
+#endif
+    if (m_UsePushDescriptors){
+        m_CmdPushDescriptorSetWithTemplate = (PFN_vkCmdPushDescriptorSetWithTemplateKHR)vkGetDeviceProcAddr(m_VkDevice, "vkCmdPushDescriptorSetWithTemplateKHR");
+    }
 
     m_GraphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
     m_GraphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
+    //gpu frame timing needs timestamp support on the graphics queue
+    m_TimestampPeriod = physicalDevice.properties.limits.timestampPeriod;
+    m_MinUniformAlignment = physicalDevice.properties.limits.minUniformBufferOffsetAlignment;
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(m_ActiveGPU, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(m_ActiveGPU, &familyCount, families.data());
+    m_HasTimestamps = families[m_GraphicsQueueFamily].timestampValidBits > 0 && m_TimestampPeriod > 0.f;
+    if (!m_HasTimestamps){
+        LOG_INFO("No timestamp support on the graphics queue, dynamic resolution disabled");
+        m_DynamicResolution = false;
+    }
+    // a compute family without graphics runs next to the graphics queue, without one everything stays on graphics
+    auto computeQueue = vkbDevice.get_queue(vkb::QueueType::compute);
+    if (computeQueue){
+        m_ComputeQueue = computeQueue.value();
+        m_ComputeQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::compute).value();
+        m_HasAsyncCompute = true;
+        LOG_INFO("Async compute on queue family {}", m_ComputeQueueFamily);
+    } else {
+        m_ComputeQueue = m_GraphicsQueue;
+        m_ComputeQueueFamily = m_GraphicsQueueFamily;
+        m_HasAsyncCompute = false;
+        LOG_INFO("No separate compute queue family, compute runs on the graphics queue");
+    }
     // Init memory allocator
     VmaAllocatorCreateInfo allocatorInfo = {};
     allocatorInfo.physicalDevice = m_ActiveGPU;
@@ -385,9 +1652,28 @@ void VknatorEngine::InitVulkan(){
     vmaCreateAllocator(&allocatorInfo, &m_Allocator);
     m_MainDeletionQueue.PushFunction([&](){vmaDestroyAllocator(m_Allocator);}) ;
 
+    m_Resources.Init(m_VkDevice, m_Allocator);
+    m_MainDeletionQueue.PushFunction([&](){ m_Resources.Destroy(); });
+
+    m_ShaderLibrary.Init(m_VkDevice);
+    m_MainDeletionQueue.PushFunction([&](){ m_ShaderLibrary.Destroy(); });
+
+    m_PipelineCache.Init(m_VkDevice, m_ActiveGPU, PIPELINE_CACHE_PATH);
+    m_LastPipelineCacheSave = std::chrono::steady_clock::now();
+    m_MainDeletionQueue.PushFunction([&](){ m_PipelineCache.Destroy(); });
+
+    m_RenderGraph.Init(m_VkDevice, m_Allocator, FRAME_OVERLAP);
+    m_ComputeGraph.Init(m_VkDevice, m_Allocator, FRAME_OVERLAP);
+    m_RenderGraph.SetProfiler(&m_Profiler);
+    m_ComputeGraph.SetProfiler(&m_Profiler);
+    m_MainDeletionQueue.PushFunction([&](){
+        m_RenderGraph.Destroy();
+        m_ComputeGraph.Destroy();
+    });
+
 }
 
-void VknatorEngine::CreateSwapchain(uint32_t width, uint32_t height)
+void VknatorEngine::CreateSwapchain(uint32_t width, uint32_t height, VkSwapchainKHR oldSwapchain)
 {
     vkb::SwapchainBuilder swapchainBuilder{ m_ActiveGPU,m_VkDevice, m_VkSurface };
 
@@ -399,7 +1685,8 @@ void VknatorEngine::CreateSwapchain(uint32_t width, uint32_t height)
         //use vsync present mode
         .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
         .set_desired_extent(width, height)
-        .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+        //lets the driver reuse resources and keep presenting the old images while we switch over
+        .set_old_swapchain(oldSwapchain)
         .build()
         .value();
 
@@ -412,7 +1699,11 @@ void VknatorEngine::CreateSwapchain(uint32_t width, uint32_t height)
 
 void VknatorEngine::InitSwapchain()
 {
-    CreateSwapchain(m_WindowExtent.width, m_WindowExtent.height);
+    if (m_Headless){
+        CreateOffscreenTargets();
+    } else {
+        CreateSwapchain(m_WindowExtent.width, m_WindowExtent.height);
+    }
 
 //> init_swap
     //draw image size will match the window
@@ -421,18 +1712,41 @@ void VknatorEngine::InitSwapchain()
         m_WindowExtent.height,
         1
     };
+    //owned by the resource registry, which destroys whatever targets are current at shutdown
+    CreateDrawTargets(drawImageExtent);
+//< init_swap
+
+}
+
+void VknatorEngine::CreateOffscreenTargets(){
+    m_SwapChainImageFormat = HEADLESS_FORMAT;
+    m_SwapChainExtent = m_WindowExtent;
+    m_SwapChainImages.clear();
+    m_SwapChainImageViews.clear();
+    // the same size for the whole run, they live until shutdown
+    for (uint32_t i = 0; i < FRAME_OVERLAP; i++){
+        AllocatedImage image = CreateImage(VkExtent3D{ m_SwapChainExtent.width, m_SwapChainExtent.height, 1 }, m_SwapChainImageFormat,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+        m_SwapChainImages.push_back(image.image);
+        m_SwapChainImageViews.push_back(image.imageView);
+        m_MainDeletionQueue.PushFunction([=, this](){ DestroyImage(image); });
+    }
+}
+
+void VknatorEngine::CreateDrawTargets(VkExtent3D drawImageExtent){
 //> Draw image
 
-    m_DrawImage.imageFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+    m_DrawImage.imageFormat = DRAW_IMAGE_FORMAT;
     m_DrawImage.imageExtent = drawImageExtent;
 
-    VkImageUsageFlags drawImageUsages{};
-    drawImageUsages |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-    drawImageUsages |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-    drawImageUsages |= VK_IMAGE_USAGE_STORAGE_BIT;
-    drawImageUsages |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-
-    VkImageCreateInfo rimg_info = vknatorinit::image_create_info(m_DrawImage.imageFormat, drawImageUsages, drawImageExtent);
+    VkImageCreateInfo rimg_info = vknatorinit::image_create_info(m_DrawImage.imageFormat, DRAW_IMAGE_USAGE, drawImageExtent);
+    //written by the compute queue and read by graphics, concurrent sharing saves the ownership transfers
+    uint32_t drawImageFamilies[] = { m_GraphicsQueueFamily, m_ComputeQueueFamily };
+    if (m_HasAsyncCompute){
+        rimg_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        rimg_info.queueFamilyIndexCount = 2;
+        rimg_info.pQueueFamilyIndices = drawImageFamilies;
+    }
 
     //for the draw image, we want to allocate it from gpu local memory
     VmaAllocationCreateInfo rimg_allocinfo = {};
@@ -450,13 +1764,10 @@ void VknatorEngine::InitSwapchain()
 //> Depth image
 
     //hardcoding the draw format to 32 bit float
-    m_DepthImage.imageFormat = VK_FORMAT_D32_SFLOAT;
+    m_DepthImage.imageFormat = DEPTH_IMAGE_FORMAT;
     m_DepthImage.imageExtent = drawImageExtent;
 
-    VkImageUsageFlags depthImageUsages{};
-    depthImageUsages |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-
-    VkImageCreateInfo dimg_info = vknatorinit::image_create_info(m_DepthImage.imageFormat, depthImageUsages, drawImageExtent);
+    VkImageCreateInfo dimg_info = vknatorinit::image_create_info(m_DepthImage.imageFormat, DEPTH_IMAGE_USAGE, drawImageExtent);
 
     vmaCreateImage(m_Allocator, &dimg_info, &rimg_allocinfo, &m_DepthImage.image, &m_DepthImage.allocation, nullptr);
 
@@ -464,19 +1775,15 @@ void VknatorEngine::InitSwapchain()
 
     VK_CHECK(vkCreateImageView(m_VkDevice, &dview_info, nullptr, &m_DepthImage.imageView));
 
-    //add to deletion queues
-    m_MainDeletionQueue.PushFunction([=, *this]() {
-        vkDestroyImageView(m_VkDevice, m_DrawImage.imageView, nullptr);
-        vmaDestroyImage(m_Allocator, m_DrawImage.image, m_DrawImage.allocation);
-
-        vkDestroyImageView(m_VkDevice, m_DepthImage.imageView, nullptr);
-        vmaDestroyImage(m_Allocator, m_DepthImage.image, m_DepthImage.allocation);
-    });
-//< init_swap
-
+    m_DrawImageHandle = m_Resources.AddImage(m_DrawImage);
+    m_DepthImageHandle = m_Resources.AddImage(m_DepthImage);
 }
 
 void VknatorEngine::DestroySwapchain(){
+    // the offscreen targets go with the main deletion queue
+    if (m_Headless){
+        return;
+    }
     vkDestroySwapchainKHR(m_VkDevice, m_SwapChain, nullptr);
     for (int i = 0; i < m_SwapChainImageViews.size(); i++) {
         vkDestroyImageView(m_VkDevice, m_SwapChainImageViews[i], nullptr);
@@ -484,31 +1791,89 @@ void VknatorEngine::DestroySwapchain(){
 }
 
 void VknatorEngine::ResizeSwapchain(){
-    vkDeviceWaitIdle(m_VkDevice);
-
-    DestroySwapchain();
     int h, w;
     SDL_GetWindowSize(m_Window, &w, &h);
+    if (w == 0 || h == 0){
+        //minimized, nothing to present to
+        return;
+    }
     m_WindowExtent.height = h;
     m_WindowExtent.width = w;
 
-    CreateSwapchain(m_WindowExtent.width, m_WindowExtent.height);
+    //frames in flight may still use the old swapchain, it is retired instead of destroyed
+    VkSwapchainKHR oldSwapchain = m_SwapChain;
+    std::vector<VkImageView> oldImageViews = m_SwapChainImageViews;
+    CreateSwapchain(m_WindowExtent.width, m_WindowExtent.height, oldSwapchain);
+    for (VkImageView view : oldImageViews){
+        m_Resources.Release(view, GetReleaseValue());
+    }
+    m_Resources.Release(oldSwapchain, GetReleaseValue());
+
+    //the draw targets only grow, smaller windows render into a part of them
+    if (m_SwapChainExtent.width > m_DrawImage.imageExtent.width || m_SwapChainExtent.height > m_DrawImage.imageExtent.height){
+        m_Resources.Release(m_DrawImageHandle, GetReleaseValue());
+        m_Resources.Release(m_DepthImageHandle, GetReleaseValue());
+
+        //the headroom must not take either target past what the device allows for its format and usage
+        VkImageFormatProperties drawProperties;
+        VK_CHECK(vkGetPhysicalDeviceImageFormatProperties(m_ActiveGPU, DRAW_IMAGE_FORMAT, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_OPTIMAL,
+            DRAW_IMAGE_USAGE, 0, &drawProperties));
+        VkImageFormatProperties depthProperties;
+        VK_CHECK(vkGetPhysicalDeviceImageFormatProperties(m_ActiveGPU, DEPTH_IMAGE_FORMAT, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_OPTIMAL,
+            DEPTH_IMAGE_USAGE, 0, &depthProperties));
+        auto grow = [&](uint32_t current, uint32_t needed, uint32_t drawLimit, uint32_t depthLimit){
+            uint32_t target = std::max(current, (uint32_t)(needed * DRAW_TARGET_HEADROOM));
+            return std::min({ target, drawLimit, depthLimit });
+        };
+        VkExtent3D drawImageExtent = {
+            grow(m_DrawImage.imageExtent.width, m_SwapChainExtent.width, drawProperties.maxExtent.width, depthProperties.maxExtent.width),
+            grow(m_DrawImage.imageExtent.height, m_SwapChainExtent.height, drawProperties.maxExtent.height, depthProperties.maxExtent.height),
+            1
+        };
+        CreateDrawTargets(drawImageExtent);
+        UpdateDrawImageDescriptors();
+        LOG_DEBUG("Draw targets grown to {}x{}", drawImageExtent.width, drawImageExtent.height);
+    }
     m_ResizeRequested = false;
 }
 
+void VknatorEngine::UpdateDrawImageDescriptors(){
+    //pinned, nothing looks it up again. The frames in flight keep the old set, the cache frees it
+    //when the registry destroys the old image view
+    m_FrameWriter.clear();
+    m_FrameWriter.write_image(0, m_DrawImage.imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    m_DrawImageDescriptors = m_DescriptorCache.get(m_DrawImageDescriptorLayout, m_FrameWriter, DescriptorSetCache::Tier::LongLived, true);
+}
+
 void VknatorEngine::InitCommands(){
     VkCommandPoolCreateInfo cmdPoolInfo = vknatorinit::command_pool_create_info(m_GraphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+    //worker pools are reset as a whole every frame, so they dont need per buffer resets
+    VkCommandPoolCreateInfo workerPoolInfo = vknatorinit::command_pool_create_info(m_GraphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+    VkCommandPoolCreateInfo computePoolInfo = vknatorinit::command_pool_create_info(m_ComputeQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+
+    //keep one core for the main thread, it takes part in the recording as well
+    uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+    m_Workers.Init(cores - 1);
 
     for (int i = 0; i < FRAME_OVERLAP; i++){
         VK_CHECK(vkCreateCommandPool(m_VkDevice, &cmdPoolInfo, nullptr, &m_Frames[i].commandPool));
         VkCommandBufferAllocateInfo cmdBufferAllocInfo = vknatorinit::command_buffer_allocate_info(m_Frames[i].commandPool, 1);
         VK_CHECK(vkAllocateCommandBuffers(m_VkDevice, &cmdBufferAllocInfo, &m_Frames[i].mainCommandBuffer));
+
+        VK_CHECK(vkCreateCommandPool(m_VkDevice, &computePoolInfo, nullptr, &m_Frames[i].computeCommandPool));
+        VkCommandBufferAllocateInfo computeAllocInfo = vknatorinit::command_buffer_allocate_info(m_Frames[i].computeCommandPool, 1);
+        VK_CHECK(vkAllocateCommandBuffers(m_VkDevice, &computeAllocInfo, &m_Frames[i].computeCommandBuffer));
+
+        m_Frames[i].workerCommands.resize(m_Workers.GetSlotCount());
+        for (WorkerCommands& worker : m_Frames[i].workerCommands){
+            VK_CHECK(vkCreateCommandPool(m_VkDevice, &workerPoolInfo, nullptr, &worker.commandPool));
+        }
     }
 //> imm_cmd
     VK_CHECK(vkCreateCommandPool(m_VkDevice, &cmdPoolInfo, nullptr, &m_ImmCommandPool));
     VkCommandBufferAllocateInfo cmdBufferAllocInfo = vknatorinit::command_buffer_allocate_info(m_ImmCommandPool, 1);
     VK_CHECK(vkAllocateCommandBuffers(m_VkDevice, &cmdBufferAllocInfo, &m_ImmCommandBuffer));
-    m_MainDeletionQueue.PushFunction([=, *this](){vkDestroyCommandPool(m_VkDevice, m_ImmCommandPool, nullptr);});
+    m_MainDeletionQueue.PushFunction([=, this](){vkDestroyCommandPool(m_VkDevice, m_ImmCommandPool, nullptr);});
 //< imm_cmd
 }
 
@@ -524,34 +1889,73 @@ void VknatorEngine::InitSyncStructures(){
         VK_CHECK(vkCreateFence(m_VkDevice, &fenceCreateInfo, nullptr, &m_Frames[i].renderFence));
         VK_CHECK(vkCreateSemaphore(m_VkDevice, &semaphoreCreateInfo, nullptr, &m_Frames[i].swapchainSemaphore));
         VK_CHECK(vkCreateSemaphore(m_VkDevice, &semaphoreCreateInfo, nullptr, &m_Frames[i].renderSemaphore));
+
+        if (m_HasPipelineStatistics){
+            VkQueryPoolCreateInfo statisticsPoolInfo = { .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+            statisticsPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+            statisticsPoolInfo.queryCount = 1;
+            statisticsPoolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+            VK_CHECK(vkCreateQueryPool(m_VkDevice, &statisticsPoolInfo, nullptr, &m_Frames[i].statisticsPool));
+        }
     }
+    if (m_HasTimestamps){
+        const uint32_t queueFamilies[PROFILER_QUEUES] = { m_GraphicsQueueFamily, m_ComputeQueueFamily };
+        m_Profiler.Init(m_VkInstance, m_ActiveGPU, m_VkDevice, FRAME_OVERLAP, m_TimestampPeriod, queueFamilies, m_HasCalibratedTimestamps);
+        m_MainDeletionQueue.PushFunction([&](){ m_Profiler.Destroy(); });
+    }
+    //aim a bit below the display refresh, the remaining time is left for present and cpu jitter
+    SDL_DisplayMode displayMode;
+    float refreshRate = 60.f;
+    if (!m_Headless && SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(m_Window), &displayMode) == 0 && displayMode.refresh_rate > 0){
+        refreshRate = (float)displayMode.refresh_rate;
+    }
+    m_ResolutionController.SetTarget(0.9f * 1000.f / refreshRate);
+    m_ResolutionController.SetLimits(MIN_RENDER_SCALE, 1.0f);
+    m_ResolutionController.Reset(m_RenderScale);
+    //timeline semaphores for the graphics <-> compute dependencies, they start at 0 = nothing submitted yet
+    VkSemaphoreTypeCreateInfo timelineInfo = vknatorinit::semaphore_type_create_info(VK_SEMAPHORE_TYPE_TIMELINE, 0);
+    VkSemaphoreCreateInfo timelineCreateInfo = vknatorinit::semaphore_create_info();
+    timelineCreateInfo.pNext = &timelineInfo;
+    VK_CHECK(vkCreateSemaphore(m_VkDevice, &timelineCreateInfo, nullptr, &m_GraphicsTimeline));
+    VK_CHECK(vkCreateSemaphore(m_VkDevice, &timelineCreateInfo, nullptr, &m_ComputeTimeline));
+    m_MainDeletionQueue.PushFunction([=, this](){
+        vkDestroySemaphore(m_VkDevice, m_GraphicsTimeline, nullptr);
+        vkDestroySemaphore(m_VkDevice, m_ComputeTimeline, nullptr);
+    });
  //> imm_sync
     VK_CHECK(vkCreateFence(m_VkDevice, &fenceCreateInfo, nullptr, &m_ImmFence));
-    m_MainDeletionQueue.PushFunction([=, *this](){vkDestroyFence(m_VkDevice, m_ImmFence, nullptr);});
+    m_MainDeletionQueue.PushFunction([=, this](){vkDestroyFence(m_VkDevice, m_ImmFence, nullptr);});
  //< imm_sync
 }
 
 void VknatorEngine::InitDescriptors(){
-    //create a descriptor pool that will hold 10 sets with 1 image each
-	std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes =
-	{
-		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 }
-	};
-
-    m_GlobalDescriptorAllocator.init(m_VkDevice, 10, sizes);
+    //the sizes below are the defaults, the tuning replaces them with what earlier runs used.
+    //saved last, after every allocator reported its peak on destruction
+    m_DescriptorTuning.load(DESCRIPTOR_TUNING_PATH);
+    m_MainDeletionQueue.PushFunction([&](){ m_DescriptorTuning.save(); });
+
+    m_UseBindless = BINDLESS_MATERIALS;
+    if (m_UseBindless){
+        m_Bindless.Init(m_VkDevice, m_Allocator, BINDLESS_MAX_TEXTURES, BINDLESS_MAX_SAMPLERS, BINDLESS_MAX_MATERIALS);
+        m_MainDeletionQueue.PushFunction([&](){ m_Bindless.Destroy(); });
+    }
 
 	//make the descriptor set layout for our compute draw
 	{
 		DescriptorLayoutBuilder builder;
 		builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
 		m_DrawImageDescriptorLayout = builder.build(m_VkDevice, VK_SHADER_STAGE_COMPUTE_BIT);
+		m_ShaderLibrary.ValidateSetLayout({ "gradient_color.comp", "sky.comp" }, 0, builder);
 	}
     // make the descriptor set for the scene data
     {
 		DescriptorLayoutBuilder builder;
 		builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-		m_GPUSceneDataDescriptorSetLayout = builder.build(m_VkDevice, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+		builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+		// the visibility buffer shades in compute with the same scene set
+		m_GPUSceneDataDescriptorSetLayout = builder.build(m_VkDevice, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+            m_UsePushDescriptors ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR : 0);
+		m_ShaderLibrary.ValidateSetLayout({ "mesh.vert", "mesh.frag" }, 0, builder);
 	}
 
     // make the descriptor set for the checkerboard texutre data
@@ -559,47 +1963,79 @@ void VknatorEngine::InitDescriptors(){
 		DescriptorLayoutBuilder builder;
 		builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 		m_SingleImageDescriptorLayout = builder.build(m_VkDevice, VK_SHADER_STAGE_FRAGMENT_BIT);
+		m_ShaderLibrary.ValidateSetLayout({ "colored_triangle_mesh.vert", "text_image.frag" }, 0, builder);
 	}
 
-	//allocate a descriptor set for our draw image
-	m_DrawImageDescriptors = m_GlobalDescriptorAllocator.allocate(m_VkDevice, m_DrawImageDescriptorLayout);
-
-	DescriptorWriter writer;
-    writer.write_image(0, m_DrawImage.imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
-	writer.update_set(m_VkDevice, m_DrawImageDescriptors);
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> cacheSizes = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,  3},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,  3},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4},
+    };
+    m_DescriptorCache.init(m_VkDevice, FRAME_OVERLAP, 64, cacheSizes, DESCRIPTOR_CACHE_LIFETIME, &m_DescriptorTuning, "cache");
+    m_MainDeletionQueue.PushFunction([&](){ m_DescriptorCache.destroy(); });
+    m_Resources.SetDescriptorCache(&m_DescriptorCache);
+    UpdateDrawImageDescriptors();
 
     for (int i = 0; i < FRAME_OVERLAP; i++){
-    // create a descriptor pool
-        std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> frameSizes = {
-            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,  3},
-            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3},
-            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,  3},
-            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4},
-        };
-        m_Frames[i].frameDescriptors = DescriptorAllocatorGrowable();
-        m_Frames[i].frameDescriptors.init(m_VkDevice, 1000, frameSizes);
-
+        m_Frames[i].sceneBuffer = CreateBuffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
         m_MainDeletionQueue.PushFunction([&,i](){
-            m_Frames[i].frameDescriptors.destroy_pools(m_VkDevice);
+            DestroyBuffer(m_Frames[i].sceneBuffer);
         });
     }
     m_MainDeletionQueue.PushFunction([&](){
-        m_GlobalDescriptorAllocator.destroy_pools(m_VkDevice);
-        vkDestroyDescriptorSetLayout(m_VkDevice, m_DrawImageDescriptorLayout, nullptr);
-        vkDestroyDescriptorSetLayout(m_VkDevice, m_GPUSceneDataDescriptorSetLayout, nullptr);
-        vkDestroyDescriptorSetLayout(m_VkDevice, m_SingleImageDescriptorLayout, nullptr);
+        descriptor_layout_destroy(m_VkDevice, m_DrawImageDescriptorLayout);
+        descriptor_layout_destroy(m_VkDevice, m_GPUSceneDataDescriptorSetLayout);
+        descriptor_layout_destroy(m_VkDevice, m_SingleImageDescriptorLayout);
     });
 }
 
 void VknatorEngine::InitPipelines(){
+    // the Init functions only create the layouts and queue the pipelines, they all compile in parallel on the workers
+    m_PipelineCompiler.Init(m_VkDevice, &m_PipelineCache, &m_ShaderLibrary, &m_Workers);
+    m_MainDeletionQueue.PushFunction([&](){ m_PipelineCompiler.Destroy(); });
     // COMPUTE PIPELINE
     InitBackgroundPipelines();
+    InitCompositePipeline();
+    m_Lighting.Init(m_VkDevice, m_Allocator, FRAME_OVERLAP, &m_PipelineCompiler, &m_ShaderLibrary);
+    m_MainDeletionQueue.PushFunction([&](){ m_Lighting.Destroy(); });
+    m_Shadows.Init(m_VkDevice, m_Allocator, &m_PipelineCompiler, &m_ShaderLibrary);
+    m_Shadows.SetCaching(m_CacheShadows);
+    m_MainDeletionQueue.PushFunction([&](){ m_Shadows.Destroy(); });
     // GRAPHICS PIPELINE
     LOG_DEBUG("Init mesh pipeline");
     InitMeshPipeline();
     // MATERIAL PIPELINES
     LOG_DEBUG("Init material pipelines");
     m_MetalRoughMaterial.BuildPipelines(this);
+    InitDepthPrepassPipeline();
+    m_Materials.Init(m_VkDevice, m_Allocator, m_MinUniformAlignment, &m_MetalRoughMaterial, &m_DescriptorCache, MAX_MATERIALS);
+    m_MainDeletionQueue.PushFunction([&](){ m_Materials.Destroy(); });
+    m_MainDrawContext.materials = &m_Materials;
+    // the shade pass reads the materials through the bindless set
+    m_HasVisibilityBuffer = m_HasVisibilityBuffer && m_UseBindless;
+    if (m_HasVisibilityBuffer){
+        m_Visibility.Init(m_VkDevice, m_Allocator, &m_Resources, FRAME_OVERLAP, &m_PipelineCompiler, &m_ShaderLibrary,
+            m_GPUSceneDataDescriptorSetLayout, m_Bindless.GetLayout());
+        m_MainDeletionQueue.PushFunction([&](){ m_Visibility.Destroy(); });
+    } else {
+        m_UseVisibilityBuffer = false;
+        LOG_INFO("No visibility buffer, it needs bindless materials and the geometryShader feature");
+    }
+    if (m_UsePushDescriptors){
+        //every material pipeline shares the layout, one template covers them all
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+        builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        m_ScenePushTemplate = builder.build_push_template(m_VkDevice, VK_PIPELINE_BIND_POINT_GRAPHICS, m_MetalRoughMaterial.opaquePipeline.layout, 0);
+        m_MainDeletionQueue.PushFunction([&](){ vkDestroyDescriptorUpdateTemplate(m_VkDevice, m_ScenePushTemplate, nullptr); });
+        if (m_HasVisibilityBuffer){
+            m_ComputeScenePushTemplate = builder.build_push_template(m_VkDevice, VK_PIPELINE_BIND_POINT_COMPUTE, m_Visibility.GetComputeLayout(), 0);
+            m_MainDeletionQueue.PushFunction([&](){ vkDestroyDescriptorUpdateTemplate(m_VkDevice, m_ComputeScenePushTemplate, nullptr); });
+        }
+    }
+
+    m_PipelineCompiler.WaitAll();
 }
 
 void VknatorEngine::InitBackgroundPipelines(){
@@ -619,81 +2055,107 @@ void VknatorEngine::InitBackgroundPipelines(){
     computeLayout.pushConstantRangeCount = 1;
 
 	VK_CHECK(vkCreatePipelineLayout(m_VkDevice, &computeLayout, nullptr, &m_GradientPipelineLayout));
-
-    //layout code
-	VkShaderModule gradientShader;
-	if (!vknatorutils::LoadShaderModule("../shaders/gradient_color.comp.spv", m_VkDevice, &gradientShader))
-	{
-		LOG_ERROR("Error when building the gradient shader");
-	}
-    VkShaderModule skyShader;
-	if (!vknatorutils::LoadShaderModule("../shaders/sky.comp.spv", m_VkDevice, &skyShader))
-	{
-		LOG_ERROR("Error when building the sky shader");
-	}
-
-	VkPipelineShaderStageCreateInfo stageinfo{};
-	stageinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	stageinfo.pNext = nullptr;
-	stageinfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-	stageinfo.module = gradientShader;
-	stageinfo.pName = "main";
-
-	VkComputePipelineCreateInfo computePipelineCreateInfo{};
-	computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-	computePipelineCreateInfo.pNext = nullptr;
-	computePipelineCreateInfo.layout = m_GradientPipelineLayout;
-	computePipelineCreateInfo.stage = stageinfo;
+    m_ShaderLibrary.ValidatePushConstants({ "gradient_color.comp", "sky.comp" }, pushConstant.size);
 
     ComputeEffect gradient;
     gradient.layout = m_GradientPipelineLayout;
     gradient.name = "gradient";
+    gradient.localSize = m_ShaderLibrary.GetLocalSize("gradient_color.comp");
     gradient.data = {};
 
     //default colors
     gradient.data.data1 = glm::vec4(1, 0, 0, 1);
     gradient.data.data2 = glm::vec4(0, 0, 1, 1);
 
-	VK_CHECK(vkCreateComputePipelines(m_VkDevice, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &gradient.pipeline));
-
-    //change the shader module only to create the sky shader
-    computePipelineCreateInfo.stage.module = skyShader;
-
     ComputeEffect sky;
     sky.layout = m_GradientPipelineLayout;
     sky.name = "sky";
+    sky.localSize = m_ShaderLibrary.GetLocalSize("sky.comp");
     sky.data = {};
 
     //default sky parameters
     sky.data.data1 = glm::vec4(0.1, 0.2, 0.4 ,0.97);
-    VK_CHECK(vkCreateComputePipelines(m_VkDevice, VK_NULL_HANDLE,1,&computePipelineCreateInfo, nullptr, &sky.pipeline));
 
-    // add the 2 background effects into array
+    // add the 2 background effects into array, the pipelines are filled in once compiled
     m_BackgroundEffects.push_back(gradient);
     m_BackgroundEffects.push_back(sky);
-    //destroy shader modules properly
-    vkDestroyShaderModule(m_VkDevice, gradientShader, nullptr);
-    vkDestroyShaderModule(m_VkDevice, skyShader, nullptr);
+    m_PipelineCompiler.CompileCompute(m_GradientPipelineLayout, "gradient_color.comp", "gradient", &m_BackgroundEffects[0].pipeline);
+    m_PipelineCompiler.CompileCompute(m_GradientPipelineLayout, "sky.comp", "sky", &m_BackgroundEffects[1].pipeline);
 
 	m_MainDeletionQueue.PushFunction([&]() {
 		vkDestroyPipelineLayout(m_VkDevice, m_GradientPipelineLayout, nullptr);
-        vkDestroyPipeline(m_VkDevice, m_BackgroundEffects[0].pipeline, nullptr);
-        vkDestroyPipeline(m_VkDevice, m_BackgroundEffects[1].pipeline, nullptr);
     });
 }
 
-void VknatorEngine::InitMeshPipeline(){
+void VknatorEngine::InitCompositePipeline(){
+    {
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        m_CompositeDescriptorLayout = builder.build(m_VkDevice, VK_SHADER_STAGE_FRAGMENT_BIT);
+        m_ShaderLibrary.ValidateSetLayout({ "fullscreen.vert", "composite.frag" }, 0, builder);
+    }
 
-	VkShaderModule triangleFragShader;
-	if (!vknatorutils::LoadShaderModule("../shaders/text_image.frag.spv", m_VkDevice, &triangleFragShader))
-	{
-		LOG_ERROR("Error when building the triangle fragment shader");
-	}
-    VkShaderModule triangleVertexShader;
-	if (!vknatorutils::LoadShaderModule("../shaders/colored_triangle_mesh.vert.spv", m_VkDevice, &triangleVertexShader))
-	{
-		LOG_ERROR("Error when building the triangle mesh vertex shader");
-	}
+    VkPushConstantRange pushConstant{};
+    pushConstant.offset = 0;
+    pushConstant.size = sizeof(CompositePushConstants);
+    pushConstant.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkPipelineLayoutCreateInfo layoutInfo = vknatorinit::pipeline_layout_create_info();
+    layoutInfo.pSetLayouts = &m_CompositeDescriptorLayout;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pPushConstantRanges = &pushConstant;
+    layoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(m_VkDevice, &layoutInfo, nullptr, &m_CompositePipelineLayout));
+    m_ShaderLibrary.ValidatePushConstants({ "fullscreen.vert", "composite.frag" }, pushConstant.size);
+
+    PipelineBuilder pipelineBuilder;
+    pipelineBuilder.m_PipelineLayout = m_CompositePipelineLayout;
+    pipelineBuilder.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    pipelineBuilder.SetPolygonMode(VK_POLYGON_MODE_FILL);
+    pipelineBuilder.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+    pipelineBuilder.SetMultisamplingNone();
+    pipelineBuilder.DisableBlending();
+    pipelineBuilder.DisableDepthtest();
+    //renders straight into the swapchain
+    pipelineBuilder.SetColorAttachmentFormat(m_SwapChainImageFormat);
+    pipelineBuilder.SetDepthFormat(VK_FORMAT_UNDEFINED);
+    m_PipelineCompiler.CompileGraphics(pipelineBuilder, "fullscreen.vert", "composite.frag", "composite", &m_CompositePipeline);
+
+    //the shader reads outside the rendered area only through bilinear filtering, clamp keeps that at the border
+    VkSamplerCreateInfo samplerInfo = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    VK_CHECK(vkCreateSampler(m_VkDevice, &samplerInfo, nullptr, &m_CompositeSampler));
+
+    m_MainDeletionQueue.PushFunction([&]() {
+        vkDestroySampler(m_VkDevice, m_CompositeSampler, nullptr);
+        vkDestroyPipelineLayout(m_VkDevice, m_CompositePipelineLayout, nullptr);
+        descriptor_layout_destroy(m_VkDevice, m_CompositeDescriptorLayout);
+    });
+}
+
+void VknatorEngine::InitDepthPrepassPipeline(){
+    // the material layout for the scene set, the push constants are GPUDepthPushConstants in the same range
+    VkPipelineLayout layout = m_MetalRoughMaterial.opaquePipeline.layout;
+    m_ShaderLibrary.ValidatePushConstants({ "depth_prepass.vert" }, sizeof(GPUDepthPushConstants));
+
+    PipelineBuilder pipelineBuilder;
+    pipelineBuilder.m_PipelineLayout = layout;
+    pipelineBuilder.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    pipelineBuilder.SetPolygonMode(VK_POLYGON_MODE_FILL);
+    //same culling and depth test as the opaque material pipelines
+    pipelineBuilder.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+    pipelineBuilder.SetMultisamplingNone();
+    pipelineBuilder.SetDepthOnly();
+    pipelineBuilder.EnableDepthtest(true, VK_COMPARE_OP_LESS_OR_EQUAL);
+    pipelineBuilder.SetDepthFormat(m_DepthImage.imageFormat);
+    m_PipelineCompiler.CompileGraphics(pipelineBuilder, "depth_prepass.vert", "", "depth prepass", &m_DepthPrepassPipeline);
+}
+
+void VknatorEngine::InitMeshPipeline(){
 
     //build the pipeline layout that controls the inputs/outputs of the shader
 	//we are not using descriptor sets or other systems yet, so no need to use anything other than empty default
@@ -709,11 +2171,10 @@ void VknatorEngine::InitMeshPipeline(){
     pipelineLayoutInfo.setLayoutCount = 1;
 
     VK_CHECK(vkCreatePipelineLayout(m_VkDevice, &pipelineLayoutInfo, nullptr, &m_MeshPipelineLayout));
+    m_ShaderLibrary.ValidatePushConstants({ "colored_triangle_mesh.vert", "text_image.frag" }, bufferRange.size);
 
     PipelineBuilder pipelineBuilder;
     pipelineBuilder.m_PipelineLayout = m_MeshPipelineLayout;
-    //connecting the vertex and pixel shaders to the pipeline
-	pipelineBuilder.SetShaders(triangleVertexShader, triangleFragShader);
 	//it will draw triangles
 	pipelineBuilder.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
 	//filled triangles
@@ -729,16 +2190,11 @@ void VknatorEngine::InitMeshPipeline(){
 	//connect the image format we will draw into, from draw image
 	pipelineBuilder.SetColorAttachmentFormat(m_DrawImage.imageFormat);
 	pipelineBuilder.SetDepthFormat(m_DepthImage.imageFormat);
-    //finally build the pipeline
-	m_MeshPipeline = pipelineBuilder.BuildPipeline(m_VkDevice);
-
-	//clean structures
-	vkDestroyShaderModule(m_VkDevice, triangleFragShader, nullptr);
-	vkDestroyShaderModule(m_VkDevice, triangleVertexShader, nullptr);
+    //queue the pipeline with the vertex and pixel shaders
+	m_PipelineCompiler.CompileGraphics(pipelineBuilder, "colored_triangle_mesh.vert", "text_image.frag", "mesh", &m_MeshPipeline);
 
 	m_MainDeletionQueue.PushFunction([&]() {
 		vkDestroyPipelineLayout(m_VkDevice, m_MeshPipelineLayout, nullptr);
-		vkDestroyPipeline(m_VkDevice, m_MeshPipeline, nullptr);
 	});
 
 }
@@ -799,7 +2255,7 @@ void VknatorEngine::InitImGui(){
 	ImGui_ImplVulkan_DestroyFontUploadObjects();
 
 	// add the destroy the imgui created structures
-	m_MainDeletionQueue.PushFunction([=, *this]() {
+	m_MainDeletionQueue.PushFunction([=, this]() {
 		vkDestroyDescriptorPool(m_VkDevice, imguiPool, nullptr);
 		ImGui_ImplVulkan_Shutdown();
 	});
@@ -847,28 +2303,22 @@ void VknatorEngine::InitDefaultData() {
         DestroyImage(m_ErrorCheckerboardImage);
     });
 
-    GLTFMetallic_Roughness::MaterialResources materialResources;
-    //default the material textures
-    materialResources.colorImage = m_WhiteImage;
-    materialResources.metalRoughImage = m_WhiteImage;
-    materialResources.colorSampler = m_DefaultSamplerLinear;
-    materialResources.metalRoughSampler = m_DefaultSamplerLinear;
-    //set the uniform buffer for the material data
-    AllocatedBuffer materialConstants = CreateBuffer(sizeof(GLTFMetallic_Roughness::MaterialConstants), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-    //write the buffer
-	GLTFMetallic_Roughness::MaterialConstants* sceneUniformData = (GLTFMetallic_Roughness::MaterialConstants*)materialConstants.allocation->GetMappedData();
-	sceneUniformData->colorFactors = glm::vec4{1,1,1,1};
-	sceneUniformData->metal_rough_factors = glm::vec4{1,0.5,0,0};
+    // what a material shows once a texture it uses was released
+    m_Materials.SetFallback(m_ErrorCheckerboardImage.imageView, m_DefaultSamplerLinear);
 
-	m_MainDeletionQueue.PushFunction([=, this]() {
-        DestroyBuffer(materialConstants);
-	});
-
-	materialResources.dataBuffer = materialConstants.buffer;
-	materialResources.dataBufferOffset = 0;
+    MaterialSystem::MaterialDesc defaultMaterial{};
+    defaultMaterial.pass = MaterialPass::MainColor;
+    //default the material textures
+    defaultMaterial.colorImage = m_WhiteImage.imageView;
+    defaultMaterial.metalRoughImage = m_WhiteImage.imageView;
+    defaultMaterial.colorSampler = m_DefaultSamplerLinear;
+    defaultMaterial.metalRoughSampler = m_DefaultSamplerLinear;
+	defaultMaterial.constants.colorFactors = glm::vec4{1,1,1,1};
+	defaultMaterial.constants.metal_rough_factors = glm::vec4{1,0.5,0,0};
+	defaultMaterial.constants.features = MATERIAL_FEATURE_DEFAULT;
+	defaultMaterial.constants.alphaCutoff = 0.5f;
 
-    m_DefaultData = m_MetalRoughMaterial.WriteMaterial(m_VkDevice,MaterialPass::MainColor,materialResources, m_GlobalDescriptorAllocator);
+    m_DefaultMaterial = m_Materials.Create(defaultMaterial);
 
     m_testMeshes = loadGltfMeshes(this, "../assets/basicmesh.glb").value();
 
@@ -880,12 +2330,15 @@ void VknatorEngine::InitDefaultData() {
         newNode->worldTransform = glm::mat4(1.0f);
 
         for (auto& s : m->surfaces){
-            s.material = std::make_shared<GLTFMaterial>(m_DefaultData);
+            //every surface shares the one default material
+            s.material = m_DefaultMaterial;
         }
 
         m_LoadedNodes[m->name] = std::move(newNode);
         LOG_DEBUG("Loaded mesh: {}", m->name);
     }
+    // new static casters, the cached shadow cascades are out of date
+    m_Shadows.InvalidateStatic();
 }
 
 void VknatorEngine::ImmediateSubmit(std::function<void(VkCommandBuffer &cmd)>&&function){
@@ -915,20 +2368,39 @@ void VknatorEngine::ImmediateSubmit(std::function<void(VkCommandBuffer &cmd)>&&f
 void VknatorEngine::UpdateScene(){
     m_MainDrawContext.OpaqueSurfaces.clear();
 
-    for (auto& m : m_LoadedNodes) {
-		m.second->Draw(glm::mat4{1.f}, m_MainDrawContext);
-	}
-    //m_LoadedNodes["Suzanne"]->Draw(glm::rotate(glm::radians(180.f), glm::vec3{0,1,0}) * glm::translate(glm::vec3{1, 1, 1}), m_MainDrawContext);
+    // a generated scene replaces the test content
+    if (m_GeneratedScene){
+        m_GeneratedScene->Draw(glm::mat4{1.f}, m_MainDrawContext);
+    } else {
+        for (auto& m : m_LoadedNodes) {
+			m.second->Draw(glm::mat4{1.f}, m_MainDrawContext);
+		}
+        //m_LoadedNodes["Suzanne"]->Draw(glm::rotate(glm::radians(180.f), glm::vec3{0,1,0}) * glm::translate(glm::vec3{1, 1, 1}), m_MainDrawContext);
 
-	for (int x = -3; x < 3; x++) {
+		for (int x = -3; x < 3; x++) {
 
-		glm::mat4 scale = glm::scale(glm::vec3{0.2});
-		glm::mat4 translation =  glm::translate(glm::vec3{x, 1, 0});
+			glm::mat4 scale = glm::scale(glm::vec3{0.2});
+			glm::mat4 translation =  glm::translate(glm::vec3{x, 1, 0});
 
-		m_LoadedNodes["Cube"]->Draw(translation * scale, m_MainDrawContext);
-	}
+			m_LoadedNodes["Cube"]->Draw(translation * scale, m_MainDrawContext);
+		}
 
-	m_SceneData.view = glm::translate(glm::vec3{ 0,0,-5 });
+		// test scene of the render path benchmark, a wall of small triangles with most layers hidden behind the first
+		auto denseMesh = m_LoadedNodes.find("Suzanne");
+		if (m_DenseScene && denseMesh != m_LoadedNodes.end()){
+			glm::mat4 scale = glm::scale(glm::vec3{0.4f});
+			for (int layer = 0; layer < DENSE_SCENE_LAYERS; layer++){
+				for (int y = 0; y < DENSE_SCENE_GRID_Y; y++){
+					for (int x = 0; x < DENSE_SCENE_GRID_X; x++){
+						glm::vec3 position { (x - DENSE_SCENE_GRID_X / 2 + 0.5f) * 1.1f, (y - DENSE_SCENE_GRID_Y / 2) * 1.1f, -2.f - 1.5f * layer };
+						denseMesh->second->Draw(glm::translate(position) * scale, m_MainDrawContext);
+					}
+				}
+			}
+		}
+    }
+
+	m_SceneData.view = m_Headless ? CameraPathView(m_CameraPath, m_SceneTime, m_CameraCenter, m_CameraRadius) : glm::translate(glm::vec3{ 0,0,-5 });
 	// camera projection
 	m_SceneData.proj = glm::perspective(glm::radians(70.f), (float)m_WindowExtent.width / (float)m_WindowExtent.height, 10000.f, 0.1f);
 
@@ -937,10 +2409,19 @@ void VknatorEngine::UpdateScene(){
 	m_SceneData.proj[1][1] *= -1;
 	m_SceneData.viewproj = m_SceneData.proj * m_SceneData.view;
 
+	// the lights follow the count picked in the ui or by the benchmark
+	if (m_Lighting.GetLightCount() != (uint32_t)m_LightCount){
+		m_Lighting.BuildBenchmarkScene((uint32_t)m_LightCount);
+	}
+	m_Lighting.Animate(m_SceneTime);
+
 	//some default lighting parameters
 	m_SceneData.ambientColor = glm::vec4(.1f);
 	m_SceneData.sunlightColor = glm::vec4(1.f);
-	m_SceneData.sunlightDirection = glm::vec4(0,1,0.5,1.f);
+	if (glm::length(m_SunDirection) < 0.01f){
+		m_SunDirection = glm::vec3(0.f, 1.f, 0.f);
+	}
+	m_SceneData.sunlightDirection = glm::vec4(glm::normalize(m_SunDirection), 1.f);
 }
 AllocatedBuffer VknatorEngine::CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage){
     //allocate the buffer
@@ -965,10 +2446,11 @@ void VknatorEngine::DestroyBuffer(const AllocatedBuffer& buffer){
     vmaDestroyBuffer(m_Allocator, buffer.buffer, buffer.allocation);
 }
 
-GPUMeshBuffers VknatorEngine::UploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices)
+GPUMeshBuffers VknatorEngine::UploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices, bool positionStream)
 {
 	const size_t vertexBufferSize = vertices.size() * sizeof(Vertex);
 	const size_t indexBufferSize = indices.size() * sizeof(uint32_t);
+	const size_t positionBufferSize = positionStream ? vertices.size() * sizeof(glm::vec3) : 0;
 
 	GPUMeshBuffers newSurface;
 
@@ -980,11 +2462,22 @@ GPUMeshBuffers VknatorEngine::UploadMesh(std::span<uint32_t> indices, std::span<
 	VkBufferDeviceAddressInfo deviceAdressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = newSurface.vertexBuffer.buffer };
 	newSurface.vertexBufferAddress = vkGetBufferDeviceAddress(m_VkDevice, &deviceAdressInfo);
 
-	//create index buffer
-	newSurface.indexBuffer = CreateBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	//create index buffer, also read as a storage buffer by the visibility buffer shading
+	newSurface.indexBuffer = CreateBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+							| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	VkBufferDeviceAddressInfo indexAdressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = newSurface.indexBuffer.buffer };
+	newSurface.indexBufferAddress = vkGetBufferDeviceAddress(m_VkDevice, &indexAdressInfo);
+
+	//create position buffer, a quarter of the vertex buffer for the passes that only need the positions
+	if (positionStream){
+		newSurface.positionBuffer = CreateBuffer(positionBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+								VMA_MEMORY_USAGE_GPU_ONLY);
+		VkBufferDeviceAddressInfo positionAdressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = newSurface.positionBuffer.buffer };
+		newSurface.positionBufferAddress = vkGetBufferDeviceAddress(m_VkDevice, &positionAdressInfo);
+	}
 
     // create temporal CPU writable staging buffer
-    AllocatedBuffer staging = CreateBuffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+    AllocatedBuffer staging = CreateBuffer(vertexBufferSize + indexBufferSize + positionBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
 
 	void* data = staging.allocation->GetMappedData();
 
@@ -992,6 +2485,11 @@ GPUMeshBuffers VknatorEngine::UploadMesh(std::span<uint32_t> indices, std::span<
 	memcpy(data, vertices.data(), vertexBufferSize);
 	// copy index buffer
 	memcpy((char*)data + vertexBufferSize, indices.data(), indexBufferSize);
+	// deinterleave the positions
+	glm::vec3* positions = (glm::vec3*)((char*)data + vertexBufferSize + indexBufferSize);
+	for (size_t i = 0; positionStream && i < vertices.size(); i++){
+		positions[i] = vertices[i].position;
+	}
 
 	ImmediateSubmit([&](VkCommandBuffer cmd) {
 		VkBufferCopy vertexCopy{ 0 };
@@ -1007,6 +2505,15 @@ GPUMeshBuffers VknatorEngine::UploadMesh(std::span<uint32_t> indices, std::span<
 		indexCopy.size = indexBufferSize;
 
 		vkCmdCopyBuffer(cmd, staging.buffer, newSurface.indexBuffer.buffer, 1, &indexCopy);
+
+		if (positionStream){
+			VkBufferCopy positionCopy{ 0 };
+			positionCopy.dstOffset = 0;
+			positionCopy.srcOffset = vertexBufferSize + indexBufferSize;
+			positionCopy.size = positionBufferSize;
+
+			vkCmdCopyBuffer(cmd, staging.buffer, newSurface.positionBuffer.buffer, 1, &positionCopy);
+		}
 	});
 
 	DestroyBuffer(staging);
@@ -1084,21 +2591,15 @@ void VknatorEngine::DestroyImage(const AllocatedImage& img){
 }
 
 void GLTFMetallic_Roughness::BuildPipelines(VknatorEngine* engine){
-    VkShaderModule meshFragShader;
-	if (!vknatorutils::LoadShaderModule("../shaders/mesh.frag.spv", engine->m_VkDevice, &meshFragShader))
-	{
-		LOG_ERROR("Error when building the mesh fragment shader");
-	}
-    VkShaderModule meshVertexShader;
-	if (!vknatorutils::LoadShaderModule("../shaders/mesh.vert.spv", engine->m_VkDevice, &meshVertexShader))
-	{
-		LOG_ERROR("Error when building the mesh mesh vertex shader");
-	}
-
     VkPushConstantRange matrixRange{};
     matrixRange.offset = 0;
     matrixRange.size = sizeof(GPUDrawPushConstants);
-    matrixRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    //the bindless fragment shader reads the material index
+    matrixRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    bindless = engine->m_UseBindless ? &engine->m_Bindless : nullptr;
+    vertexShader = bindless ? "mesh_bindless.vert" : "mesh.vert";
+    fragmentShader = bindless ? "mesh_bindless.frag" : "mesh.frag";
 
     DescriptorLayoutBuilder layoutBuilder;
     layoutBuilder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
@@ -1106,7 +2607,11 @@ void GLTFMetallic_Roughness::BuildPipelines(VknatorEngine* engine){
     layoutBuilder.add_binding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 
     materialLayout = layoutBuilder.build(engine->m_VkDevice, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-    VkDescriptorSetLayout layouts[] = {engine->m_GPUSceneDataDescriptorSetLayout, materialLayout };
+    if (!bindless){
+        engine->m_ShaderLibrary.ValidateSetLayout({ vertexShader, fragmentShader }, 1, layoutBuilder);
+    }
+    engine->m_ShaderLibrary.ValidatePushConstants({ vertexShader, fragmentShader }, matrixRange.size);
+    VkDescriptorSetLayout layouts[] = {engine->m_GPUSceneDataDescriptorSetLayout, bindless ? bindless->GetLayout() : materialLayout };
 
 
     VkPipelineLayoutCreateInfo meshLayoutInfo = vknatorinit::pipeline_layout_create_info();
@@ -1119,11 +2624,13 @@ void GLTFMetallic_Roughness::BuildPipelines(VknatorEngine* engine){
     VK_CHECK(vkCreatePipelineLayout(engine->m_VkDevice, &meshLayoutInfo, nullptr, &newLayout));
     opaquePipeline.layout = newLayout;
     transparentPipeline.layout = newLayout;
+    shaderObjects = engine->m_PassState == PassStateMode::ShaderObjects;
+    setLayouts[0] = layouts[0];
+    setLayouts[1] = layouts[1];
+    pushConstants = matrixRange;
 
     PipelineBuilder pipelineBuilder;
     pipelineBuilder.m_PipelineLayout = newLayout;
-    //connecting the vertex and pixel shaders to the pipeline
-	pipelineBuilder.SetShaders(meshVertexShader, meshFragShader);
 	//it will draw triangles
 	pipelineBuilder.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
 	//filled triangles
@@ -1141,42 +2648,293 @@ void GLTFMetallic_Roughness::BuildPipelines(VknatorEngine* engine){
 	pipelineBuilder.SetColorAttachmentFormat(engine->m_DrawImage.imageFormat);
 	pipelineBuilder.SetDepthFormat(engine->m_DepthImage.imageFormat);
 
-    pipelineBuilder.m_PipelineLayout = newLayout;
-    //finally build the pipeline
-    opaquePipeline.pipeline = pipelineBuilder.BuildPipeline(engine->m_VkDevice);
+    //the same state again for the dynamic path, set per batch when the pipeline is bound
+    opaquePipeline.state = { VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE, true, true, VK_COMPARE_OP_LESS_OR_EQUAL, false };
+    transparentPipeline.state = opaquePipeline.state;
+    transparentPipeline.state.depthWrite = false;
+    transparentPipeline.state.blend = true;
+    opaquePipeline.dynamicState = transparentPipeline.dynamicState = engine->m_UseDynamicState;
+    opaquePipeline.dynamicBlend = transparentPipeline.dynamicBlend = engine->m_HasDynamicBlendState;
+    opaquePipeline.depthPrepass = transparentPipeline.depthPrepass = false;
+    //depth write and compare are always dynamic (core in 1.3), the depth prepass switches them per pass
+    pipelineBuilder.AddDynamicState(VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE);
+    pipelineBuilder.AddDynamicState(VK_DYNAMIC_STATE_DEPTH_COMPARE_OP);
+    if (engine->m_UseDynamicState){
+        pipelineBuilder.AddDynamicState(VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY);
+        pipelineBuilder.AddDynamicState(VK_DYNAMIC_STATE_CULL_MODE);
+        pipelineBuilder.AddDynamicState(VK_DYNAMIC_STATE_FRONT_FACE);
+        pipelineBuilder.AddDynamicState(VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE);
+    }
+#if defined(VK_EXT_extended_dynamic_state3)
+    if (engine->m_HasDynamicBlendState){
+        pipelineBuilder.AddDynamicState(VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT);
+        pipelineBuilder.AddDynamicState(VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT);
+    }
+#endif
 
-    // create the transparent variant
-	pipelineBuilder.EnableBlendingAdditive();
+    compiler = &engine->m_PipelineCompiler;
+    opaquePipeline.pipeline = transparentPipeline.pipeline = VK_NULL_HANDLE;
+    if (shaderObjects){
+        //nothing is baked, one pair of shaders draws both passes and the builders only carry the specialization
+        opaqueBuilder = transparentBuilder = pipelineBuilder;
+        compiler->CompileShaderObjects(pipelineBuilder, setLayouts, pushConstants, vertexShader, fragmentShader, "gltf", &opaquePipeline.shaders);
+        compiler->CompileShaderObjects(pipelineBuilder, setLayouts, pushConstants, vertexShader, fragmentShader, "gltf", &transparentPipeline.shaders);
+        return;
+    }
+
+    //queue the generic pipeline, the builder is copied so it can be changed for the next variant right away.
+    //no specialization, the shaders default to reading the features from the material
+    opaqueBuilder = pipelineBuilder;
+    compiler->CompileGraphics(pipelineBuilder, vertexShader, fragmentShader, "gltf opaque", &opaquePipeline.pipeline);
 
-	pipelineBuilder.EnableDepthtest(false, VK_COMPARE_OP_LESS_OR_EQUAL);
+    // create the transparent variant. With the blend state dynamic nothing baked differs from opaque,
+    // the compiler dedupes it (and every transparent permutation) to the opaque pipeline
+    if (!engine->m_HasDynamicBlendState){
+        pipelineBuilder.EnableBlendingAdditive();
 
-	transparentPipeline.pipeline = pipelineBuilder.BuildPipeline(engine->m_VkDevice);
+        pipelineBuilder.EnableDepthtest(false, VK_COMPARE_OP_LESS_OR_EQUAL);
+    }
 
-	//clean structures
-	vkDestroyShaderModule(engine->m_VkDevice, meshFragShader, nullptr);
-	vkDestroyShaderModule(engine->m_VkDevice, meshVertexShader, nullptr);
+    transparentBuilder = pipelineBuilder;
+	compiler->CompileGraphics(pipelineBuilder, vertexShader, fragmentShader, "gltf transparent", &transparentPipeline.pipeline);
 }
-MaterialInstance GLTFMetallic_Roughness::WriteMaterial(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorAllocatorGrowable& descriptorAllocator){
+
+MaterialPipeline* GLTFMetallic_Roughness::GetPermutation(MaterialPass pass, uint32_t features){
+    bool transparent = pass == MaterialPass::Transparent;
+    uint64_t key = ((uint64_t)transparent << 32) | features;
+    auto it = permutations.find(key);
+    if (it != permutations.end()){
+        return &it->second->pipeline;
+    }
+
+    auto permutation = std::make_unique<Permutation>();
+    // draw with the generic pipeline until the specialized one is there
+    permutation->pipeline = transparent ? transparentPipeline : opaquePipeline;
+    permutation->pipeline.depthPrepass = !transparent && !(features & MATERIAL_FEATURE_ALPHA_TEST);
+    permutation->ready = false;
+
+    PipelineBuilder builder = transparent ? transparentBuilder : opaqueBuilder;
+    builder.SetSpecializationConstant(0, features);
+    if (shaderObjects){
+        // shared by both passes like the generic shaders
+        std::string name = fmt::format("gltf {:#x}", features);
+        permutation->compiledShaders = compiler->CompileShaderObjects(builder, setLayouts, pushConstants, vertexShader, fragmentShader, name);
+    } else {
+        std::string name = fmt::format("gltf {} {:#x}", transparent ? "transparent" : "opaque", features);
+        permutation->compiled = compiler->CompileGraphics(builder, vertexShader, fragmentShader, name);
+    }
+
+    MaterialPipeline* result = &permutation->pipeline;
+    permutations[key] = std::move(permutation);
+    return result;
+}
+
+void GLTFMetallic_Roughness::UpdatePermutations(){
+    for (auto& [key, permutation] : permutations){
+        if (permutation->ready){
+            continue;
+        }
+        if (shaderObjects){
+            if (permutation->compiledShaders.wait_for(std::chrono::seconds(0)) != std::future_status::ready){
+                continue;
+            }
+            permutation->ready = true;
+            GraphicsShaders shaders = permutation->compiledShaders.get();
+            // a failed compile keeps drawing with the generic shaders
+            if (shaders.vertex != VK_NULL_HANDLE){
+                permutation->pipeline.shaders = shaders;
+            }
+            continue;
+        }
+        if (permutation->compiled.wait_for(std::chrono::seconds(0)) != std::future_status::ready){
+            continue;
+        }
+        permutation->ready = true;
+        VkPipeline pipeline = permutation->compiled.get();
+        // a failed compile keeps drawing with the generic pipeline
+        if (pipeline != VK_NULL_HANDLE){
+            permutation->pipeline.pipeline = pipeline;
+        }
+    }
+}
+MaterialInstance GLTFMetallic_Roughness::WriteMaterial(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorSetCache& descriptorCache,
+    uint32_t features){
     MaterialInstance matData;
     matData.passType = pass;
-    if (pass == MaterialPass::Transparent){
-        matData.pipeline = &transparentPipeline;
-    } else {
-        matData.pipeline = &opaquePipeline;
+    matData.pipeline = GetPermutation(pass, features);
+
+    if (bindless){
+        // no set of its own, the material is an entry in the global buffer
+        GPUMaterial material{};
+        material.colorFactors = resources.constants->colorFactors;
+        material.metalRoughFactors = resources.constants->metal_rough_factors;
+        material.colorTexture = bindless->AddTexture(resources.colorImage);
+        material.colorSampler = bindless->AddSampler(resources.colorSampler);
+        material.metalRoughTexture = bindless->AddTexture(resources.metalRoughImage);
+        material.metalRoughSampler = bindless->AddSampler(resources.metalRoughSampler);
+        material.features = resources.constants->features;
+        material.alphaCutoff = resources.constants->alphaCutoff;
+        matData.materialIndex = bindless->AddMaterial(material);
+        matData.materialSet = bindless->GetSet();
+        return matData;
     }
-    matData.materialSet = descriptorAllocator.allocate(device, materialLayout);
+
+    matData.materialIndex = 0;
 
     writer.clear();
     writer.write_buffer(0, resources.dataBuffer, sizeof(MaterialConstants), resources.dataBufferOffset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    writer.write_image(1, resources.colorImage.imageView, resources.colorSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-	writer.write_image(2, resources.metalRoughImage.imageView, resources.metalRoughSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.write_image(1, resources.colorImage, resources.colorSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	writer.write_image(2, resources.metalRoughImage, resources.metalRoughSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 
-	writer.update_set(device, matData.materialSet);
+    // materials with the same constants and textures share a set, pinned since the instance holds on to it
+    matData.materialSet = descriptorCache.get(materialLayout, writer, DescriptorSetCache::Tier::LongLived, true);
     return matData;
 
 }
 
 
+void MaterialSystem::Init(VkDevice device, VmaAllocator allocator, VkDeviceSize uniformAlignment, GLTFMetallic_Roughness* pipelines,
+    DescriptorSetCache* descriptorCache, uint32_t maxMaterials){
+    m_Device = device;
+    m_Allocator = allocator;
+    m_Pipelines = pipelines;
+    m_DescriptorCache = descriptorCache;
+    m_MaxMaterials = maxMaterials;
+    m_Stats = {};
+
+    if (m_Pipelines->bindless){
+        //the bindless path packs the constants into its storage buffer, nothing to suballocate here
+        return;
+    }
+    //every material starts at a valid dynamic offset, which is what a uniform buffer binding needs
+    m_ConstantStride = (sizeof(GLTFMetallic_Roughness::MaterialConstants) + uniformAlignment - 1) & ~(uniformAlignment - 1);
+
+    VkBufferCreateInfo bufferInfo = {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferInfo.size = m_ConstantStride * maxMaterials;
+    bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    VK_CHECK(vmaCreateBuffer(m_Allocator, &bufferInfo, &allocInfo, &m_ConstantBuffer.buffer, &m_ConstantBuffer.allocation, &m_ConstantBuffer.info));
+}
+
+void MaterialSystem::Destroy(){
+    if (m_ConstantBuffer.buffer != VK_NULL_HANDLE){
+        vmaDestroyBuffer(m_Allocator, m_ConstantBuffer.buffer, m_ConstantBuffer.allocation);
+        m_ConstantBuffer = {};
+    }
+    m_Materials.Clear();
+    m_Lookup.clear();
+}
+
+size_t MaterialSystem::DescHash::operator()(const MaterialDesc& desc) const{
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&](uint64_t value){ hash = (hash ^ value) * 1099511628211ull; };
+    mix((uint64_t)desc.pass);
+    mix((uint64_t)desc.colorImage);
+    mix((uint64_t)desc.colorSampler);
+    mix((uint64_t)desc.metalRoughImage);
+    mix((uint64_t)desc.metalRoughSampler);
+    const uint32_t* words = (const uint32_t*)&desc.constants;
+    for (size_t i = 0; i < sizeof(desc.constants) / sizeof(uint32_t); i++){
+        mix(words[i]);
+    }
+    return (size_t)hash;
+}
+
+bool MaterialSystem::DescEqual::operator()(const MaterialDesc& a, const MaterialDesc& b) const{
+    //constants compared bitwise, the padding is zeroed by Create
+    return a.pass == b.pass && a.colorImage == b.colorImage && a.colorSampler == b.colorSampler
+        && a.metalRoughImage == b.metalRoughImage && a.metalRoughSampler == b.metalRoughSampler
+        && memcmp(&a.constants, &b.constants, sizeof(a.constants)) == 0;
+}
+
+MaterialHandle MaterialSystem::Create(const MaterialDesc& desc){
+    MaterialDesc key = desc;
+    key.constants.padding[0] = key.constants.padding[1] = 0;
+
+    m_Stats.requests++;
+    auto it = m_Lookup.find(key);
+    if (it != m_Lookup.end()){
+        m_Stats.deduplicated++;
+        return it->second.handle;
+    }
+    if (m_Stats.materials == m_MaxMaterials){
+        LOG_ERROR("Material limit of {} reached", m_MaxMaterials);
+        return {};
+    }
+
+    uint32_t constantOffset = 0;
+    if (m_ConstantBuffer.buffer != VK_NULL_HANDLE){
+        constantOffset = (uint32_t)(m_Stats.materials * m_ConstantStride);
+        memcpy((char*)m_ConstantBuffer.info.pMappedData + constantOffset, &key.constants, sizeof(key.constants));
+        m_Stats.constantBytes += m_ConstantStride;
+    }
+
+    MaterialHandle handle = m_Materials.Add(Write(key, constantOffset));
+    m_Lookup.emplace(key, Entry{ handle, constantOffset });
+    m_Stats.materials++;
+    return handle;
+}
+
+MaterialInstance MaterialSystem::Write(const MaterialDesc& desc, uint32_t constantOffset){
+    GLTFMetallic_Roughness::MaterialResources resources;
+    resources.colorImage = desc.colorImage;
+    resources.colorSampler = desc.colorSampler;
+    resources.metalRoughImage = desc.metalRoughImage;
+    resources.metalRoughSampler = desc.metalRoughSampler;
+    resources.constants = &desc.constants;
+    resources.dataBuffer = m_ConstantBuffer.buffer;
+    resources.dataBufferOffset = constantOffset;
+    return m_Pipelines->WriteMaterial(m_Device, desc.pass, resources, *m_DescriptorCache, desc.constants.features);
+}
+
+MaterialInstance* MaterialSystem::Get(MaterialHandle handle){
+    return m_Materials.Get(handle);
+}
+
+void MaterialSystem::SetFallback(VkImageView image, VkSampler sampler){
+    m_FallbackImage = image;
+    m_FallbackSampler = sampler;
+}
+
+void MaterialSystem::Invalidate(std::span<const VkDescriptorSet> freedSets, std::span<const uint64_t> destroyedHandles){
+    if (freedSets.empty()){
+        return;
+    }
+    auto contains = [](auto span, auto value){ return std::find(span.begin(), span.end(), value) != span.end(); };
+    auto replace = [&](auto& handle, auto fallback){
+        if (contains(destroyedHandles, (uint64_t)handle)){
+            handle = fallback;
+        }
+    };
+
+    // rekeyed after the loop, the new descriptions may collide with each other or with a live material
+    std::vector<std::pair<MaterialDesc, Entry>> rewritten;
+    for (auto it = m_Lookup.begin(); it != m_Lookup.end();){
+        MaterialInstance* instance = m_Materials.Get(it->second.handle);
+        if (!instance || !contains(freedSets, instance->materialSet)){
+            ++it;
+            continue;
+        }
+        MaterialDesc desc = it->first;
+        replace(desc.colorImage, m_FallbackImage);
+        replace(desc.metalRoughImage, m_FallbackImage);
+        replace(desc.colorSampler, m_FallbackSampler);
+        replace(desc.metalRoughSampler, m_FallbackSampler);
+        // in place, the draws look the instance up through its handle
+        *instance = Write(desc, it->second.constantOffset);
+        rewritten.push_back({ desc, it->second });
+        it = m_Lookup.erase(it);
+    }
+    for (auto& [desc, entry] : rewritten){
+        m_Lookup.emplace(desc, entry);
+    }
+    if (!rewritten.empty()){
+        LOG_INFO("Rewrote {} materials whose textures were released", rewritten.size());
+    }
+}
+
 void MeshNode::Draw(const glm::mat4& topMatrix, DrawContext& ctx){
     glm::mat4 nodeMatrix = topMatrix * worldTransform;
 
@@ -1185,10 +2943,16 @@ void MeshNode::Draw(const glm::mat4& topMatrix, DrawContext& ctx){
         def.indexCount = s.count;
         def.firstIndex = s.startIndex;
         def.indexBuffer = mesh->meshBuffers.indexBuffer.buffer;
-        def.material = &s.material->data;
+        def.material = ctx.materials->Get(s.material);
+        if (!def.material){
+            continue;
+        }
 
         def.transform = nodeMatrix;
         def.vertexBufferAddress = mesh->meshBuffers.vertexBufferAddress;
+        def.indexBufferAddress = mesh->meshBuffers.indexBufferAddress;
+        def.positionBufferAddress = mesh->meshBuffers.positionBufferAddress;
+        def.bounds = s.bounds;
 
         ctx.OpaqueSurfaces.push_back(def);
     }
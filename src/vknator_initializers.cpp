@@ -14,7 +14,7 @@ VkCommandPoolCreateInfo vknatorinit::command_pool_create_info(uint32_t queueFami
 
 
 VkCommandBufferAllocateInfo vknatorinit::command_buffer_allocate_info(
-    VkCommandPool pool, uint32_t count /*= 1*/)
+    VkCommandPool pool, uint32_t count /*= 1*/, VkCommandBufferLevel level /*= VK_COMMAND_BUFFER_LEVEL_PRIMARY*/)
 {
     VkCommandBufferAllocateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -22,7 +22,7 @@ VkCommandBufferAllocateInfo vknatorinit::command_buffer_allocate_info(
 
     info.commandPool = pool;
     info.commandBufferCount = count;
-    info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    info.level = level;
     return info;
 }
 //< init_cmd
@@ -38,6 +38,33 @@ VkCommandBufferBeginInfo vknatorinit::command_buffer_begin_info(VkCommandBufferU
     info.flags = flags;
     return info;
 }
+
+VkCommandBufferInheritanceRenderingInfo vknatorinit::command_buffer_inheritance_rendering_info(const VkFormat* colorFormat, VkFormat depthFormat)
+{
+    VkCommandBufferInheritanceRenderingInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+    info.pNext = nullptr;
+
+    info.colorAttachmentCount = colorFormat ? 1 : 0;
+    info.pColorAttachmentFormats = colorFormat;
+    info.depthAttachmentFormat = depthFormat;
+    info.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+    info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    return info;
+}
+
+VkCommandBufferInheritanceInfo vknatorinit::command_buffer_inheritance_info(VkCommandBufferInheritanceRenderingInfo* renderingInfo)
+{
+    VkCommandBufferInheritanceInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    info.pNext = renderingInfo;
+
+    // with dynamic rendering there is no render pass object to inherit
+    info.renderPass = VK_NULL_HANDLE;
+    info.subpass = 0;
+    info.framebuffer = VK_NULL_HANDLE;
+    return info;
+}
 //< init_cmd_draw
 
 //> init_sync
@@ -60,6 +87,16 @@ VkSemaphoreCreateInfo vknatorinit::semaphore_create_info(VkSemaphoreCreateFlags
     info.flags = flags;
     return info;
 }
+
+VkSemaphoreTypeCreateInfo vknatorinit::semaphore_type_create_info(VkSemaphoreType type, uint64_t initialValue /*= 0*/)
+{
+    VkSemaphoreTypeCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    info.pNext = nullptr;
+    info.semaphoreType = type;
+    info.initialValue = initialValue;
+    return info;
+}
 //< init_sync
 
 //> init_submit
@@ -76,6 +113,15 @@ VkSemaphoreSubmitInfo vknatorinit::semaphore_submit_info(VkPipelineStageFlags2 s
 	return submitInfo;
 }
 
+VkSemaphoreSubmitInfo vknatorinit::semaphore_submit_info(VkPipelineStageFlags2 stageMask, VkSemaphore semaphore, uint64_t value)
+{
+	//timeline semaphores wait for / signal a counter value instead of a binary state
+	VkSemaphoreSubmitInfo submitInfo = semaphore_submit_info(stageMask, semaphore);
+	submitInfo.value = value;
+
+	return submitInfo;
+}
+
 VkCommandBufferSubmitInfo vknatorinit::command_buffer_submit_info(VkCommandBuffer cmd)
 {
 	VkCommandBufferSubmitInfo info{};
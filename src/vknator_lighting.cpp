@@ -0,0 +1,165 @@
+#include <vknator_lighting.h>
+#include <glm/gtc/constants.hpp>
+#include <glm/trigonometric.hpp>
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace {
+    // box the benchmark lights are spread through, around the test meshes
+    const glm::vec3 BENCH_MIN { -6.f, -1.f, -8.f };
+    const glm::vec3 BENCH_MAX { 6.f, 3.f, 2.f };
+    // average number of lights whose range contains a point of the box
+    constexpr float BENCH_OVERLAP = 8.f;
+}
+
+void ClusteredLighting::Init(VkDevice device, VmaAllocator allocator, uint32_t frameCount, PipelineCompiler* compiler, ShaderLibrary* shaders){
+    m_Device = device;
+    m_Allocator = allocator;
+
+    VkPushConstantRange pushConstant{};
+    pushConstant.offset = 0;
+    pushConstant.size = sizeof(ClusterPushConstants);
+    pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo layoutInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    layoutInfo.pPushConstantRanges = &pushConstant;
+    layoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(m_Device, &layoutInfo, nullptr, &m_Layout));
+    shaders->ValidatePushConstants({ "cluster_lights.comp" }, pushConstant.size);
+    m_LocalSize = shaders->GetLocalSize("cluster_lights.comp");
+    compiler->CompileCompute(m_Layout, "cluster_lights.comp", "light clusters", &m_Pipeline);
+
+    // the lights are rewritten by the cpu every frame, the clusters only ever touched by the gpu
+    m_Frames.resize(frameCount);
+    for (FrameLights& frame : m_Frames){
+        frame.lights = CreateBuffer(sizeof(GPULight) * MAX_LIGHTS, VMA_MEMORY_USAGE_CPU_TO_GPU, frame.lightAddress);
+        frame.clusters = CreateBuffer(sizeof(uint32_t) * CLUSTER_COUNT * (1 + MAX_LIGHTS_PER_CLUSTER), VMA_MEMORY_USAGE_GPU_ONLY, frame.clusterAddress);
+    }
+    LOG_DEBUG("Clustered lighting with {}x{}x{} clusters, {} lights per cluster", CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, MAX_LIGHTS_PER_CLUSTER);
+}
+
+void ClusteredLighting::Destroy(){
+    for (FrameLights& frame : m_Frames){
+        vmaDestroyBuffer(m_Allocator, frame.lights.buffer, frame.lights.allocation);
+        vmaDestroyBuffer(m_Allocator, frame.clusters.buffer, frame.clusters.allocation);
+    }
+    m_Frames.clear();
+    vkDestroyPipelineLayout(m_Device, m_Layout, nullptr);
+}
+
+AllocatedBuffer ClusteredLighting::CreateBuffer(VkDeviceSize size, VmaMemoryUsage memoryUsage, VkDeviceAddress& address){
+    VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    VmaAllocationCreateInfo vmaallocInfo = {};
+    vmaallocInfo.usage = memoryUsage;
+    vmaallocInfo.flags = memoryUsage == VMA_MEMORY_USAGE_CPU_TO_GPU ? VMA_ALLOCATION_CREATE_MAPPED_BIT : 0;
+    AllocatedBuffer buffer;
+    VK_CHECK(vmaCreateBuffer(m_Allocator, &bufferInfo, &vmaallocInfo, &buffer.buffer, &buffer.allocation, &buffer.info));
+
+    VkBufferDeviceAddressInfo addressInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
+    addressInfo.buffer = buffer.buffer;
+    address = vkGetBufferDeviceAddress(m_Device, &addressInfo);
+    return buffer;
+}
+
+void ClusteredLighting::BuildBenchmarkScene(uint32_t count){
+    count = std::min(count, MAX_LIGHTS);
+    // fixed seed, every run of the benchmark sees the same scene
+    std::mt19937 rng(1337);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+    glm::vec3 extent = BENCH_MAX - BENCH_MIN;
+    float radius = CoverageRadius(count, extent, BENCH_OVERLAP);
+
+    m_Lights.resize(count);
+    m_Orbits.resize(count);
+    for (uint32_t i = 0; i < count; i++){
+        LightOrbit& orbit = m_Orbits[i];
+        orbit.center = BENCH_MIN + extent * glm::vec3(unit(rng), unit(rng), unit(rng));
+        orbit.radius = 0.2f + unit(rng);
+        orbit.speed = 0.5f + unit(rng);
+        orbit.phase = unit(rng) * glm::two_pi<float>();
+
+        Light& light = m_Lights[i];
+        light.position = orbit.center;
+        light.radius = radius;
+        light.color = glm::vec3(0.2f) + 0.8f * glm::vec3(unit(rng), unit(rng), unit(rng));
+        light.intensity = 0.5f;
+        // every fourth light is a spot looking down into the scene
+        light.type = (i % 4 == 3) ? LightType::Spot : LightType::Point;
+        light.direction = glm::normalize(glm::vec3(unit(rng) - 0.5f, -1.f, unit(rng) - 0.5f));
+        light.innerCos = std::cos(glm::radians(20.f));
+        light.outerCos = std::cos(glm::radians(35.f));
+    }
+}
+
+void ClusteredLighting::SetLights(std::vector<Light> lights, std::vector<LightOrbit> orbits){
+    size_t count = std::min({ lights.size(), orbits.size(), (size_t)MAX_LIGHTS });
+    lights.resize(count);
+    orbits.resize(count);
+    m_Lights = std::move(lights);
+    m_Orbits = std::move(orbits);
+}
+
+float ClusteredLighting::CoverageRadius(uint32_t count, glm::vec3 extent, float overlap){
+    float volume = extent.x * extent.y * extent.z;
+    // count spheres of this radius cover every point overlap times on average
+    float radius = std::cbrt(3.f * overlap * volume / (4.f * glm::pi<float>() * std::max(count, 1u)));
+    return std::clamp(radius, 0.25f, 6.f);
+}
+
+void ClusteredLighting::Animate(float seconds){
+    for (size_t i = 0; i < m_Lights.size(); i++){
+        const LightOrbit& orbit = m_Orbits[i];
+        float angle = orbit.phase + orbit.speed * seconds;
+        m_Lights[i].position = orbit.center + orbit.radius * glm::vec3(std::cos(angle), 0.f, std::sin(angle));
+    }
+}
+
+void ClusteredLighting::Upload(uint32_t frame, const glm::mat4& view){
+    GPULight* gpuLights = (GPULight*)m_Frames[frame].lights.info.pMappedData;
+    glm::mat3 rotation = glm::mat3(view);
+    for (size_t i = 0; i < m_Lights.size(); i++){
+        const Light& light = m_Lights[i];
+        GPULight& gpu = gpuLights[i];
+        gpu.positionRadius = glm::vec4(glm::vec3(view * glm::vec4(light.position, 1.f)), light.radius);
+        gpu.colorIntensity = glm::vec4(light.color, light.intensity);
+        gpu.direction = glm::vec4(glm::normalize(rotation * light.direction), (float)light.type);
+        gpu.spotCos = glm::vec4(light.outerCos, light.innerCos, 0.f, 0.f);
+    }
+}
+
+void ClusteredLighting::RecordBinning(VkCommandBuffer cmd, uint32_t frame, const glm::mat4& projection, VkExtent2D extent){
+    ClusterPushConstants push;
+    push.inverseProjection = glm::inverse(projection);
+    push.lightBuffer = m_Frames[frame].lightAddress;
+    push.clusterBuffer = m_Frames[frame].clusterAddress;
+    push.grid = GetGrid();
+    push.depth = GetDepthParams();
+    push.screen = GetScreenParams(extent);
+
+    // one thread per cluster, an empty light list still clears the counts
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_Pipeline);
+    vkCmdPushConstants(cmd, m_Layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ClusterPushConstants), &push);
+    vkCmdDispatch(cmd, (CLUSTER_COUNT + m_LocalSize.x - 1) / m_LocalSize.x, 1, 1);
+}
+
+glm::uvec4 ClusteredLighting::GetGrid() const{
+    return glm::uvec4(CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, (uint32_t)m_Lights.size());
+}
+
+glm::vec4 ClusteredLighting::GetDepthParams() const{
+    // slice = log(depth) * scale - bias, so slice 0 starts at the near and slice Z at the far distance
+    float logRange = std::log(CLUSTER_FAR / CLUSTER_NEAR);
+    float scale = (float)CLUSTER_GRID_Z / logRange;
+    float bias = (float)CLUSTER_GRID_Z * std::log(CLUSTER_NEAR) / logRange;
+    return glm::vec4(CLUSTER_NEAR, CLUSTER_FAR, scale, bias);
+}
+
+glm::vec4 ClusteredLighting::GetScreenParams(VkExtent2D extent) const{
+    float tileX = std::ceil((float)extent.width / CLUSTER_GRID_X);
+    float tileY = std::ceil((float)extent.height / CLUSTER_GRID_Y);
+    return glm::vec4((float)extent.width, (float)extent.height, tileX, tileY);
+}
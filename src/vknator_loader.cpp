@@ -104,6 +104,17 @@ std::optional<std::vector<std::shared_ptr<MeshAsset>>> loadGltfMeshes(VknatorEng
                         vertices[initial_vtx + index].color = v;
                     });
             }
+            //bounds of the vertices of this surface, used for culling
+            size_t vertexCount = gltf.accessors[p.findAttribute("POSITION")->second].count;
+            glm::vec3 minPos = vertices[initial_vtx].position;
+            glm::vec3 maxPos = vertices[initial_vtx].position;
+            for (size_t i = initial_vtx; i < initial_vtx + vertexCount; i++){
+                minPos = glm::min(minPos, vertices[i].position);
+                maxPos = glm::max(maxPos, vertices[i].position);
+            }
+            newSurface.bounds.origin = (maxPos + minPos) / 2.f;
+            newSurface.bounds.extents = (maxPos - minPos) / 2.f;
+            newSurface.bounds.sphereRadius = glm::length(newSurface.bounds.extents);
             newMesh.surfaces.push_back(newSurface);
         }
 
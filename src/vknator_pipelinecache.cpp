@@ -0,0 +1,149 @@
+#include <vknator_pipelinecache.h>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+
+void PipelineCache::Init(VkDevice device, VkPhysicalDevice physicalDevice, const std::string& path){
+    m_Device = device;
+    m_Path = path;
+    vkGetPhysicalDeviceProperties(physicalDevice, &m_DeviceProperties);
+
+    std::vector<char> data;
+    std::ifstream file(m_Path, std::ios::ate | std::ios::binary);
+    if (file.is_open()){
+        data.resize((size_t)file.tellg());
+        file.seekg(0);
+        file.read(data.data(), data.size());
+        if (!file || !IsCompatible(data)){
+            // written by another gpu or driver (or truncated), the driver would ignore it anyway
+            LOG_INFO("Pipeline cache {} does not match this device, starting empty", m_Path);
+            data.clear();
+        }
+    } else {
+        LOG_INFO("No pipeline cache at {}, starting empty", m_Path);
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+    VK_CHECK(vkCreatePipelineCache(m_Device, &cacheInfo, nullptr, &m_Cache));
+    m_SavedSize = data.size();
+    LOG_DEBUG("Pipeline cache loaded with {} bytes", data.size());
+}
+
+void PipelineCache::Destroy(){
+    Save();
+    vkDestroyPipelineCache(m_Device, m_Cache, nullptr);
+    m_Cache = VK_NULL_HANDLE;
+}
+
+bool PipelineCache::IsCompatible(const std::vector<char>& data) const{
+    VkPipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header)){
+        return false;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    return header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && header.headerSize >= sizeof(header)
+        && header.vendorID == m_DeviceProperties.vendorID
+        && header.deviceID == m_DeviceProperties.deviceID
+        && std::memcmp(header.pipelineCacheUUID, m_DeviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::Save(){
+    if (m_Cache == VK_NULL_HANDLE){
+        return;
+    }
+    size_t size = 0;
+    VK_CHECK(vkGetPipelineCacheData(m_Device, m_Cache, &size, nullptr));
+    // caches only ever grow, same size means nothing new was compiled
+    if (size == m_SavedSize){
+        return;
+    }
+    std::vector<char> data(size);
+    VK_CHECK(vkGetPipelineCacheData(m_Device, m_Cache, &size, data.data()));
+
+    // write next to the real file and swap it in, rename replaces the old cache in one step
+    std::string tmpPath = m_Path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()){
+            LOG_ERROR("Could not write pipeline cache {}", tmpPath);
+            return;
+        }
+        file.write(data.data(), size);
+        file.flush();
+        if (!file){
+            LOG_ERROR("Could not write pipeline cache {}", tmpPath);
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(tmpPath, m_Path, error);
+    if (error){
+        LOG_ERROR("Could not replace pipeline cache {}: {}", m_Path, error.message());
+        std::filesystem::remove(tmpPath, error);
+        return;
+    }
+    m_SavedSize = size;
+    LOG_DEBUG("Pipeline cache saved with {} bytes", size);
+}
+
+VkResult PipelineCache::CreateGraphicsPipeline(const VkGraphicsPipelineCreateInfo& createInfo, const char* name, VkPipeline* outPipeline){
+    VkPipelineCreationFeedback pipelineFeedback {};
+    VkPipelineCreationFeedbackCreateInfo feedbackInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO };
+    feedbackInfo.pNext = createInfo.pNext;
+    feedbackInfo.pPipelineCreationFeedback = &pipelineFeedback;
+
+    VkGraphicsPipelineCreateInfo info = createInfo;
+    info.pNext = &feedbackInfo;
+
+    auto start = std::chrono::steady_clock::now();
+    VkResult result = vkCreateGraphicsPipelines(m_Device, m_Cache, 1, &info, nullptr, outPipeline);
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (result == VK_SUCCESS){
+        Record(name, pipelineFeedback, wallMs);
+    }
+    return result;
+}
+
+VkResult PipelineCache::CreateComputePipeline(const VkComputePipelineCreateInfo& createInfo, const char* name, VkPipeline* outPipeline){
+    VkPipelineCreationFeedback pipelineFeedback {};
+    VkPipelineCreationFeedbackCreateInfo feedbackInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO };
+    feedbackInfo.pNext = createInfo.pNext;
+    feedbackInfo.pPipelineCreationFeedback = &pipelineFeedback;
+
+    VkComputePipelineCreateInfo info = createInfo;
+    info.pNext = &feedbackInfo;
+
+    auto start = std::chrono::steady_clock::now();
+    VkResult result = vkCreateComputePipelines(m_Device, m_Cache, 1, &info, nullptr, outPipeline);
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (result == VK_SUCCESS){
+        Record(name, pipelineFeedback, wallMs);
+    }
+    return result;
+}
+
+void PipelineCache::Record(const char* name, const VkPipelineCreationFeedback& feedback, double wallMs){
+    // drivers without feedback leave the valid bit unset, the hit is unknown then and counted as a miss
+    bool valid = feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT;
+    bool hit = valid && (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT);
+    double ms = valid ? feedback.duration / 1000000.0 : wallMs;
+
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    m_Stats.pipelines++;
+    hit ? m_Stats.hits++ : m_Stats.misses++;
+    m_Stats.totalMs += ms;
+    LOG_DEBUG("Pipeline {} created in {:.2f} ms (cache {})", name, ms, valid ? (hit ? "hit" : "miss") : "unknown");
+}
+
+PipelineCache::Stats PipelineCache::GetStats(){
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    return m_Stats;
+}
+
+void PipelineCache::LogStats(){
+    Stats stats = GetStats();
+    LOG_INFO("Pipelines: {} created in {:.2f} ms, {} cache hits, {} misses", stats.pipelines, stats.totalMs, stats.hits, stats.misses);
+}
@@ -0,0 +1,258 @@
+#include <vknator_pipelinecompiler.h>
+#include <vknator_initializers.h>
+#include <algorithm>
+
+namespace {
+    uint64_t HashString(const std::string& value, uint64_t hash){
+        for (char c : value){
+            hash = (hash ^ (uint8_t)c) * 1099511628211ull;
+        }
+        return hash;
+    }
+}
+
+void PipelineCompiler::Init(VkDevice device, PipelineCache* cache, ShaderLibrary* shaders, WorkerPool* workers){
+    m_Device = device;
+    m_Cache = cache;
+    m_Shaders = shaders;
+    m_Workers = workers;
+#if defined(VK_EXT_shader_object)
+    // null unless the extension was enabled on the device
+    m_CreateShaders = (PFN_vkCreateShadersEXT)vkGetDeviceProcAddr(device, "vkCreateShadersEXT");
+    m_DestroyShader = (PFN_vkDestroyShaderEXT)vkGetDeviceProcAddr(device, "vkDestroyShaderEXT");
+#endif
+}
+
+void PipelineCompiler::Destroy(){
+    WaitAll();
+    for (auto& [hash, pipeline] : m_Pipelines.compiled){
+        if (pipeline.get() != VK_NULL_HANDLE){
+            vkDestroyPipeline(m_Device, pipeline.get(), nullptr);
+        }
+    }
+    m_Pipelines.compiled.clear();
+#if defined(VK_EXT_shader_object)
+    for (auto& [hash, shaders] : m_ShaderObjects.compiled){
+        for (VkShaderEXT shader : { shaders.get().vertex, shaders.get().fragment }){
+            if (shader != VK_NULL_HANDLE){
+                m_DestroyShader(m_Device, shader, nullptr);
+            }
+        }
+    }
+#endif
+    m_ShaderObjects.compiled.clear();
+}
+
+VkShaderModule PipelineCompiler::GetShaderModule(const std::string& name, double& waitMs){
+    auto start = std::chrono::steady_clock::now();
+    VkShaderModule module = m_Shaders->GetModule(name);
+    waitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return module;
+}
+
+template <typename T>
+std::shared_future<T> PipelineCompiler::Queue(Jobs<T>& jobs, uint64_t hash, T* target, std::function<T()>&& job){
+    auto result = std::make_shared<std::promise<T>>();
+    std::shared_future<T> pipeline = result->get_future().share();
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (!m_BatchRunning){
+            m_BatchStart = std::chrono::steady_clock::now();
+            m_BatchRunning = true;
+        }
+        auto it = jobs.compiled.find(hash);
+        if (it != jobs.compiled.end()){
+            m_Deduplicated++;
+            jobs.pending.push_back({ it->second, target });
+            return it->second;
+        }
+        jobs.compiled[hash] = pipeline;
+        jobs.pending.push_back({ pipeline, target });
+    }
+    // submitted outside the lock, without worker threads the job runs inline and takes the lock itself
+    m_Workers->Submit([result, job = std::move(job)](){ result->set_value(job()); });
+    return pipeline;
+}
+
+std::shared_future<VkPipeline> PipelineCompiler::CompileGraphics(const PipelineBuilder& builder, const std::string& vertexShader,
+    const std::string& fragmentShader, const std::string& name, VkPipeline* target){
+    uint64_t hash = HashString(fragmentShader, HashString(vertexShader, builder.Hash()));
+
+    return Queue<VkPipeline>(m_Pipelines, hash, target, [this, builder = PipelineBuilder(builder), vertexShader, fragmentShader, name]() mutable {
+        double shaderMs = 0.0;
+        VkShaderModule vertexModule = GetShaderModule(vertexShader, shaderMs);
+        VkShaderModule fragmentModule = fragmentShader.empty() ? VK_NULL_HANDLE : GetShaderModule(fragmentShader, shaderMs);
+        if (vertexModule == VK_NULL_HANDLE || (fragmentModule == VK_NULL_HANDLE && !fragmentShader.empty())){
+            LOG_ERROR("Pipeline {} skipped, shaders are missing", name);
+            return (VkPipeline)VK_NULL_HANDLE;
+        }
+        auto start = std::chrono::steady_clock::now();
+        builder.SetShaders(vertexModule, fragmentModule);
+        VkPipeline pipeline = builder.BuildPipeline(m_Device, m_Cache, name.c_str());
+        double compileMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Timings.push_back({ name, shaderMs, compileMs });
+        return pipeline;
+    });
+}
+
+std::shared_future<VkPipeline> PipelineCompiler::CompileCompute(VkPipelineLayout layout, const std::string& shader,
+    const std::string& name, VkPipeline* target){
+    // compute state is only the layout and the shader
+    uint64_t hash = HashString(shader, 14695981039346656037ull ^ (uint64_t)layout);
+
+    return Queue<VkPipeline>(m_Pipelines, hash, target, [this, layout, shader, name](){
+        double shaderMs = 0.0;
+        VkShaderModule module = GetShaderModule(shader, shaderMs);
+        if (module == VK_NULL_HANDLE){
+            LOG_ERROR("Pipeline {} skipped, shader is missing", name);
+            return (VkPipeline)VK_NULL_HANDLE;
+        }
+        auto start = std::chrono::steady_clock::now();
+        VkComputePipelineCreateInfo computePipelineCreateInfo{};
+        computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        computePipelineCreateInfo.layout = layout;
+        computePipelineCreateInfo.stage = vknatorinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, module);
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        if (m_Cache->CreateComputePipeline(computePipelineCreateInfo, name.c_str(), &pipeline) != VK_SUCCESS){
+            LOG_ERROR("failed to create compute pipeline {}", name);
+            pipeline = VK_NULL_HANDLE;
+        }
+        double compileMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Timings.push_back({ name, shaderMs, compileMs });
+        return pipeline;
+    });
+}
+
+std::shared_future<GraphicsShaders> PipelineCompiler::CompileShaderObjects(const PipelineBuilder& builder, std::span<const VkDescriptorSetLayout> setLayouts,
+    const VkPushConstantRange& pushConstants, const std::string& vertexShader, const std::string& fragmentShader,
+    const std::string& name, GraphicsShaders* target){
+    // everything the shaders are created with besides the code
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&](uint64_t value){ hash = (hash ^ value) * 1099511628211ull; };
+    for (VkDescriptorSetLayout layout : setLayouts){
+        add((uint64_t)layout);
+    }
+    add(pushConstants.stageFlags);
+    add(pushConstants.offset);
+    add(pushConstants.size);
+    for (size_t i = 0; i < builder.m_SpecializationEntries.size(); i++){
+        add(builder.m_SpecializationEntries[i].constantID);
+        add(builder.m_SpecializationData[i]);
+    }
+    hash = HashString(fragmentShader, HashString(vertexShader, hash));
+
+    std::vector<VkDescriptorSetLayout> layouts(setLayouts.begin(), setLayouts.end());
+    return Queue<GraphicsShaders>(m_ShaderObjects, hash, target, [this, entries = builder.m_SpecializationEntries,
+        data = builder.m_SpecializationData, layouts = std::move(layouts), pushConstants, vertexShader, fragmentShader, name](){
+        GraphicsShaders shaders;
+#if defined(VK_EXT_shader_object)
+        const EmbeddedShader* vertex = m_Shaders->Find(vertexShader);
+        const EmbeddedShader* fragment = fragmentShader.empty() ? nullptr : m_Shaders->Find(fragmentShader);
+        if (!m_CreateShaders || !vertex || (!fragment && !fragmentShader.empty())){
+            LOG_ERROR("Shader objects {} skipped, {}", name, m_CreateShaders ? "shaders are missing" : "VK_EXT_shader_object is not enabled");
+            return shaders;
+        }
+        auto start = std::chrono::steady_clock::now();
+        VkSpecializationInfo specialization{};
+        specialization.mapEntryCount = (uint32_t)entries.size();
+        specialization.pMapEntries = entries.data();
+        specialization.dataSize = data.size() * sizeof(uint32_t);
+        specialization.pData = data.data();
+
+        // linked, the driver may optimize across the stages like it does for a pipeline
+        VkShaderCreateInfoEXT infos[2];
+        uint32_t count = 0;
+        for (const EmbeddedShader* shader : { vertex, fragment }){
+            if (!shader){
+                continue;
+            }
+            VkShaderCreateInfoEXT& info = infos[count++];
+            info = { .sType = VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT };
+            info.flags = fragment ? VK_SHADER_CREATE_LINK_STAGE_BIT_EXT : 0;
+            info.stage = shader->stage;
+            info.nextStage = shader == vertex && fragment ? VK_SHADER_STAGE_FRAGMENT_BIT : 0;
+            info.codeType = VK_SHADER_CODE_TYPE_SPIRV_EXT;
+            info.codeSize = shader->code.size_bytes();
+            info.pCode = shader->code.data();
+            info.pName = "main";
+            info.setLayoutCount = (uint32_t)layouts.size();
+            info.pSetLayouts = layouts.data();
+            info.pushConstantRangeCount = 1;
+            info.pPushConstantRanges = &pushConstants;
+            info.pSpecializationInfo = entries.empty() ? nullptr : &specialization;
+        }
+        VkShaderEXT created[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+        if (m_CreateShaders(m_Device, count, infos, nullptr, created) != VK_SUCCESS){
+            LOG_ERROR("failed to create shader objects {}", name);
+            for (VkShaderEXT shader : created){
+                if (shader != VK_NULL_HANDLE){
+                    m_DestroyShader(m_Device, shader, nullptr);
+                }
+            }
+            return shaders;
+        }
+        shaders.vertex = created[0];
+        shaders.fragment = created[1];
+        double compileMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Timings.push_back({ name, 0.0, compileMs });
+#else
+        LOG_ERROR("Shader objects {} skipped, the Vulkan headers predate VK_EXT_shader_object", name);
+#endif
+        return shaders;
+    });
+}
+
+void PipelineCompiler::WaitAll(){
+    std::vector<std::pair<std::shared_future<VkPipeline>, VkPipeline*>> pending;
+    std::vector<std::pair<std::shared_future<GraphicsShaders>, GraphicsShaders*>> pendingShaders;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        pending.swap(m_Pipelines.pending);
+        pendingShaders.swap(m_ShaderObjects.pending);
+    }
+    for (auto& [pipeline, target] : pending){
+        if (target){
+            *target = pipeline.get();
+        } else {
+            pipeline.wait();
+        }
+    }
+    for (auto& [shaders, target] : pendingShaders){
+        if (target){
+            *target = shaders.get();
+        } else {
+            shaders.wait();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!m_BatchRunning){
+        return;
+    }
+    m_BatchRunning = false;
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_BatchStart).count();
+
+    std::sort(m_Timings.begin(), m_Timings.end(), [](const Timing& a, const Timing& b){ return a.compileMs > b.compileMs; });
+    double summedMs = 0.0;
+    for (const Timing& timing : m_Timings){
+        summedMs += timing.shaderMs + timing.compileMs;
+    }
+    LOG_INFO("Compiled {} pipelines and shader objects ({} deduplicated) in {:.2f} ms, {:.2f} ms of work on {} threads",
+        m_Timings.size(), m_Deduplicated, wallMs, summedMs, m_Workers->GetSlotCount() - 1);
+    for (const Timing& timing : m_Timings){
+        LOG_INFO("    {:<20} compile {:8.2f} ms, shaders {:8.2f} ms", timing.name, timing.compileMs, timing.shaderMs);
+    }
+    m_Timings.clear();
+    m_Deduplicated = 0;
+}
+
+PipelineCompiler::Stats PipelineCompiler::GetStats(){
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return { (uint32_t)m_Pipelines.compiled.size(), (uint32_t)m_ShaderObjects.compiled.size() };
+}
@@ -1,38 +1,8 @@
 #include <vknator_pipelines.h>
-#include <fstream>
+#include <algorithm>
 #include <vknator_log.h>
 #include <vknator_initializers.h>
 
-//> load_shader
-bool vknatorutils::LoadShaderModule(const char* filePath, VkDevice device, VkShaderModule* outShaderModule){
-    std::ifstream file(filePath, std::ios::ate | std::ios::binary);
-
-    if (!file.is_open()){
-        LOG_ERROR("Could not open file {}", filePath);
-        return false;
-    }
-    size_t fileSize = (size_t)file.tellg();
-    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
-
-    file.seekg(0);
-    //load the entire file
-    file.read((char*)buffer.data(), fileSize);
-
-    VkShaderModuleCreateInfo shaderCreateInfo{};
-    shaderCreateInfo.pNext = nullptr;
-    shaderCreateInfo.codeSize = buffer.size() * sizeof(uint32_t);
-    shaderCreateInfo.pCode = buffer.data();
-    shaderCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    VkShaderModule shaderModule;
-    // Check if shader module could be loaded successfully
-    if (vkCreateShaderModule(device, &shaderCreateInfo, nullptr, &shaderModule) != VK_SUCCESS){
-        return false;
-    }
-    *outShaderModule = shaderModule;
-    return true;
-}
-//< load_shader
-
 //> pipeline builder
 void PipelineBuilder::Clear(){
     //clear all of the structs we need back to 0 with their correct stype
@@ -52,9 +22,27 @@ void PipelineBuilder::Clear(){
 	m_RenderInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
 
 	m_ShaderStages.clear();
+
+    m_SpecializationEntries.clear();
+    m_SpecializationData.clear();
+    m_SpecializationInfo = {};
+    m_DynamicStates.clear();
 }
 
-VkPipeline PipelineBuilder::BuildPipeline(VkDevice device){
+VkPipeline PipelineBuilder::BuildPipeline(VkDevice device, PipelineCache* cache, const char* name){
+    //copies of the builder still point at the format of the original
+    m_RenderInfo.pColorAttachmentFormats = m_RenderInfo.colorAttachmentCount ? &m_ColorAttachmentformat : nullptr;
+    //same for the specialization data, it is only hooked up here
+    if (!m_SpecializationEntries.empty()){
+        m_SpecializationInfo.mapEntryCount = (uint32_t)m_SpecializationEntries.size();
+        m_SpecializationInfo.pMapEntries = m_SpecializationEntries.data();
+        m_SpecializationInfo.dataSize = m_SpecializationData.size() * sizeof(uint32_t);
+        m_SpecializationInfo.pData = m_SpecializationData.data();
+        for (VkPipelineShaderStageCreateInfo& stage : m_ShaderStages){
+            stage.pSpecializationInfo = &m_SpecializationInfo;
+        }
+    }
+
     //make viewport state form our stored viewport and scissor
     //at the moment wi wont support multiple viewports and scissors
     VkPipelineViewportStateCreateInfo viewportState = {};
@@ -72,7 +60,7 @@ VkPipeline PipelineBuilder::BuildPipeline(VkDevice device){
 
     colorBlending.logicOpEnable = VK_FALSE;
     colorBlending.logicOp = VK_LOGIC_OP_COPY;
-    colorBlending.attachmentCount = 1;
+    colorBlending.attachmentCount = m_RenderInfo.colorAttachmentCount;
     colorBlending.pAttachments = &m_ColorBlendAttachment;
 
 
@@ -97,20 +85,21 @@ VkPipeline PipelineBuilder::BuildPipeline(VkDevice device){
     pipelineInfo.pDepthStencilState = &m_DepthStencil;
     pipelineInfo.layout = m_PipelineLayout;
 
-    VkDynamicState state[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    std::vector<VkDynamicState> state = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    state.insert(state.end(), m_DynamicStates.begin(), m_DynamicStates.end());
 
     VkPipelineDynamicStateCreateInfo dynamicInfo = {.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO};
-    dynamicInfo.pDynamicStates = &state[0];
-    dynamicInfo.dynamicStateCount = 2;
+    dynamicInfo.pDynamicStates = state.data();
+    dynamicInfo.dynamicStateCount = (uint32_t)state.size();
 
     pipelineInfo.pDynamicState = &dynamicInfo;
 
     // its easy to error out on create graphics pipeline, so we handle it a bit
     // better than the common VK_CHECK case
     VkPipeline newPipeline;
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
-            nullptr, &newPipeline)
-        != VK_SUCCESS) {
+    VkResult result = cache ? cache->CreateGraphicsPipeline(pipelineInfo, name, &newPipeline)
+                            : vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &newPipeline);
+    if (result != VK_SUCCESS) {
         LOG_ERROR("failed to create pipeline");
         return VK_NULL_HANDLE; // failed to create graphics pipeline
     } else {
@@ -118,10 +107,54 @@ VkPipeline PipelineBuilder::BuildPipeline(VkDevice device){
     }
 }
 
+uint64_t PipelineBuilder::Hash() const{
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&](const void* data, size_t size){
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; i++){
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+    //field by field, the create info structs carry pointers and padding that must not affect the hash
+    add(&m_InputAssembly.topology, sizeof(m_InputAssembly.topology));
+    add(&m_InputAssembly.primitiveRestartEnable, sizeof(VkBool32));
+    add(&m_Rasterizer.polygonMode, sizeof(m_Rasterizer.polygonMode));
+    add(&m_Rasterizer.cullMode, sizeof(m_Rasterizer.cullMode));
+    add(&m_Rasterizer.frontFace, sizeof(m_Rasterizer.frontFace));
+    add(&m_Rasterizer.lineWidth, sizeof(float));
+    add(&m_Rasterizer.depthBiasEnable, sizeof(VkBool32));
+    add(&m_Rasterizer.depthBiasConstantFactor, sizeof(float));
+    add(&m_Rasterizer.depthBiasSlopeFactor, sizeof(float));
+    add(&m_ColorBlendAttachment, sizeof(m_ColorBlendAttachment));
+    add(&m_Multisampling.rasterizationSamples, sizeof(m_Multisampling.rasterizationSamples));
+    add(&m_Multisampling.sampleShadingEnable, sizeof(VkBool32));
+    add(&m_Multisampling.alphaToCoverageEnable, sizeof(VkBool32));
+    add(&m_DepthStencil.depthTestEnable, sizeof(VkBool32));
+    add(&m_DepthStencil.depthWriteEnable, sizeof(VkBool32));
+    add(&m_DepthStencil.depthCompareOp, sizeof(m_DepthStencil.depthCompareOp));
+    add(&m_DepthStencil.stencilTestEnable, sizeof(VkBool32));
+    add(&m_PipelineLayout, sizeof(m_PipelineLayout));
+    add(&m_RenderInfo.colorAttachmentCount, sizeof(uint32_t));
+    if (m_RenderInfo.colorAttachmentCount){
+        add(&m_ColorAttachmentformat, sizeof(m_ColorAttachmentformat));
+    }
+    add(&m_RenderInfo.depthAttachmentFormat, sizeof(VkFormat));
+    for (size_t i = 0; i < m_SpecializationEntries.size(); i++){
+        add(&m_SpecializationEntries[i].constantID, sizeof(uint32_t));
+        add(&m_SpecializationData[i], sizeof(uint32_t));
+    }
+    for (VkDynamicState state : m_DynamicStates){
+        add(&state, sizeof(state));
+    }
+    return hash;
+}
+
 void PipelineBuilder::SetShaders(VkShaderModule vertexShader, VkShaderModule fragementShader){
     m_ShaderStages.clear();
     m_ShaderStages.push_back(vknatorinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, vertexShader));
-    m_ShaderStages.push_back(vknatorinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragementShader));
+    if (fragementShader != VK_NULL_HANDLE){
+        m_ShaderStages.push_back(vknatorinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragementShader));
+    }
 }
 
 void PipelineBuilder::SetInputTopology(VkPrimitiveTopology topology){
@@ -168,6 +201,13 @@ void PipelineBuilder::SetColorAttachmentFormat(VkFormat format)
 	m_RenderInfo.pColorAttachmentFormats = &m_ColorAttachmentformat;
 }
 
+void PipelineBuilder::SetDepthOnly()
+{
+    m_RenderInfo.colorAttachmentCount = 0;
+    m_RenderInfo.pColorAttachmentFormats = nullptr;
+    m_ColorBlendAttachment = {};
+}
+
 void PipelineBuilder::SetDepthFormat(VkFormat format)
 {
     m_RenderInfo.depthAttachmentFormat = format;
@@ -223,4 +263,28 @@ void PipelineBuilder::EnableBlendingAlphablend()
     m_ColorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 }
 
+void PipelineBuilder::EnableDepthBias(float constantFactor, float slopeFactor)
+{
+    m_Rasterizer.depthBiasEnable = VK_TRUE;
+    m_Rasterizer.depthBiasConstantFactor = constantFactor;
+    m_Rasterizer.depthBiasSlopeFactor = slopeFactor;
+}
+
+void PipelineBuilder::SetSpecializationConstant(uint32_t constantId, uint32_t value){
+    for (size_t i = 0; i < m_SpecializationEntries.size(); i++){
+        if (m_SpecializationEntries[i].constantID == constantId){
+            m_SpecializationData[i] = value;
+            return;
+        }
+    }
+    m_SpecializationEntries.push_back({ constantId, (uint32_t)(m_SpecializationData.size() * sizeof(uint32_t)), sizeof(uint32_t) });
+    m_SpecializationData.push_back(value);
+}
+
+void PipelineBuilder::AddDynamicState(VkDynamicState state){
+    if (std::find(m_DynamicStates.begin(), m_DynamicStates.end(), state) == m_DynamicStates.end()){
+        m_DynamicStates.push_back(state);
+    }
+}
+
 //< pipeline builder
@@ -0,0 +1,313 @@
+#include <vknator_profiler.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+namespace {
+    int64_t SteadyNs(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // signed distance between two timestamps of a counter with only validBits bits, it may have wrapped in between
+    int64_t TickDelta(uint64_t to, uint64_t from, uint32_t validBits){
+        uint64_t delta = to - from;
+        if (validBits >= 64){
+            return (int64_t)delta;
+        }
+        uint64_t sign = 1ull << (validBits - 1);
+        delta &= (sign << 1) - 1;
+        return (int64_t)(delta ^ sign) - (int64_t)sign;
+    }
+
+    void AppendJsonString(std::string& out, std::string_view text){
+        out += '"';
+        for (char c : text){
+            if (c == '"' || c == '\\'){
+                out += '\\';
+            }
+            out += c;
+        }
+        out += '"';
+    }
+
+    void AppendTraceEvent(std::string& out, const ProfilerScope& scope, uint32_t thread, uint64_t frameNumber, int64_t originNs){
+        out += "{\"name\":";
+        AppendJsonString(out, scope.name);
+        // trace timestamps are microseconds
+        out += fmt::format(",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{\"frame\":{}}}}},\n",
+            thread, (scope.beginNs - originNs) / 1000.0, (scope.endNs - scope.beginNs) / 1000.0, frameNumber);
+    }
+}
+
+void GpuProfiler::Init(VkInstance instance, VkPhysicalDevice gpu, VkDevice device, uint32_t frameCount, float timestampPeriod,
+    const uint32_t (&queueFamilies)[PROFILER_QUEUES], bool calibrated){
+    m_Device = device;
+    m_TimestampPeriod = timestampPeriod;
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &familyCount, families.data());
+    for (uint32_t q = 0; q < PROFILER_QUEUES; q++){
+        m_ValidBits[q] = families[queueFamilies[q]].timestampValidBits;
+    }
+
+    VkQueryPoolCreateInfo queryPoolInfo = { .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = 2 * PROFILER_MAX_SCOPES;
+    m_Slots.resize(frameCount);
+    for (Slot& slot : m_Slots){
+        for (uint32_t q = 0; q < PROFILER_QUEUES; q++){
+            if (m_ValidBits[q] > 0){
+                VK_CHECK(vkCreateQueryPool(m_Device, &queryPoolInfo, nullptr, &slot.queues[q].pool));
+            }
+        }
+    }
+    // two values per query, the timestamp and its availability
+    m_Results.resize(4 * PROFILER_MAX_SCOPES);
+
+    // the trace puts the gpu next to steady_clock, which is CLOCK_MONOTONIC on linux. Other platforms report other
+    // host domains and fall back to the submit times
+    if (calibrated){
+        auto getTimeDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+        m_GetCalibratedTimestamps = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(m_Device, "vkGetCalibratedTimestampsEXT");
+        uint32_t domainCount = 0;
+        std::vector<VkTimeDomainEXT> domains;
+        if (getTimeDomains && getTimeDomains(gpu, &domainCount, nullptr) == VK_SUCCESS){
+            domains.resize(domainCount);
+            VK_CHECK(getTimeDomains(gpu, &domainCount, domains.data()));
+        }
+        auto hasDomain = [&](VkTimeDomainEXT domain){ return std::find(domains.begin(), domains.end(), domain) != domains.end(); };
+        m_Calibrated = m_GetCalibratedTimestamps && hasDomain(VK_TIME_DOMAIN_DEVICE_EXT) && hasDomain(VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT);
+    }
+    m_Enabled = true;
+    LOG_INFO("GPU profiler: compute queue {}, {} clocks", m_ValidBits[(size_t)ProfilerQueue::Compute] > 0 ? "timed" : "not timed",
+        m_Calibrated ? "calibrated" : "approximate");
+}
+
+void GpuProfiler::Destroy(){
+    for (Slot& slot : m_Slots){
+        for (QueueQueries& queries : slot.queues){
+            if (queries.pool != VK_NULL_HANDLE){
+                vkDestroyQueryPool(m_Device, queries.pool, nullptr);
+            }
+        }
+    }
+    m_Slots.clear();
+    m_Enabled = false;
+}
+
+const ProfilerFrame* GpuProfiler::BeginFrame(uint32_t slotIndex, uint64_t frameNumber){
+    m_FrameNumber = frameNumber;
+    // the cpu events follow the frames kept for the trace
+    while (!m_CpuEvents.empty() && m_CpuEvents.front().frameNumber + PROFILER_HISTORY_FRAMES < frameNumber){
+        m_CpuEvents.pop_front();
+    }
+    if (!m_Enabled){
+        return nullptr;
+    }
+    m_Slot = slotIndex;
+    Slot& slot = m_Slots[slotIndex];
+    if (m_Calibrated){
+        Calibrate();
+    }
+
+    ProfilerFrame frame;
+    frame.frameNumber = slot.frameNumber;
+    bool resolved = false;
+    for (uint32_t q = 0; q < PROFILER_QUEUES; q++){
+        QueueQueries& queries = slot.queues[q];
+        uint32_t queryCount = 2 * (uint32_t)queries.scopes.size();
+        if (queryCount == 0){
+            continue;
+        }
+        // no wait flag, a query the gpu has not written is left out instead of blocking. With the fence waited on
+        // that only happens to scopes whose commands were never submitted
+        VkResult result = vkGetQueryPoolResults(m_Device, queries.pool, 0, queryCount, sizeof(uint64_t) * 2 * queryCount, m_Results.data(),
+            sizeof(uint64_t) * 2, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if (result == VK_SUCCESS || result == VK_NOT_READY){
+            uint64_t firstTicks = m_Results[0];
+            for (uint32_t i = 0; i < (uint32_t)queries.scopes.size(); i++){
+                const uint64_t* values = &m_Results[4 * i];
+                if (!values[1] || !values[3]){
+                    continue;
+                }
+                auto toHostNs = [&](uint64_t ticks){
+                    if (m_Calibrated){
+                        return m_Calibration.hostNs + (int64_t)(TickDelta(ticks, m_Calibration.gpuTicks, m_ValidBits[q]) * (double)m_TimestampPeriod);
+                    }
+                    return queries.submitNs + (int64_t)(TickDelta(ticks, firstTicks, m_ValidBits[q]) * (double)m_TimestampPeriod);
+                };
+                frame.scopes[q].push_back({ std::move(queries.scopes[i].name), queries.scopes[i].depth, toHostNs(values[0]), toHostNs(values[2]) });
+                resolved = true;
+            }
+        }
+        queries.scopes.clear();
+    }
+    slot.frameNumber = frameNumber;
+    if (!resolved){
+        return nullptr;
+    }
+
+    m_History.push_back(std::move(frame));
+    if (m_History.size() > PROFILER_HISTORY_FRAMES){
+        m_History.pop_front();
+    }
+    UpdateStats(m_History.back());
+    return &m_History.back();
+}
+
+void GpuProfiler::BeginCommands(VkCommandBuffer cmd, ProfilerQueue queue){
+    uint32_t q = (uint32_t)queue;
+    if (!m_Enabled || m_ValidBits[q] == 0){
+        m_Commands[q] = VK_NULL_HANDLE;
+        return;
+    }
+    m_Commands[q] = cmd;
+    m_Depth[q] = 0;
+    vkCmdResetQueryPool(cmd, m_Slots[m_Slot].queues[q].pool, 0, 2 * PROFILER_MAX_SCOPES);
+}
+
+void GpuProfiler::EndCommands(ProfilerQueue queue){
+    uint32_t q = (uint32_t)queue;
+    if (m_Commands[q] != VK_NULL_HANDLE){
+        m_Slots[m_Slot].queues[q].submitNs = SteadyNs();
+        m_Commands[q] = VK_NULL_HANDLE;
+    }
+}
+
+uint32_t GpuProfiler::FindQueue(VkCommandBuffer cmd) const{
+    uint32_t q = 0;
+    while (q < PROFILER_QUEUES && (cmd == VK_NULL_HANDLE || m_Commands[q] != cmd)){
+        q++;
+    }
+    return q;
+}
+
+uint32_t GpuProfiler::BeginScope(VkCommandBuffer cmd, std::string_view name){
+    uint32_t q = FindQueue(cmd);
+    if (q == PROFILER_QUEUES){
+        return NO_SCOPE;
+    }
+    QueueQueries& queries = m_Slots[m_Slot].queues[q];
+    if (queries.scopes.size() == PROFILER_MAX_SCOPES){
+        return NO_SCOPE;
+    }
+    uint32_t scope = (uint32_t)queries.scopes.size();
+    // all commands, so a scope covers the whole of the work recorded inside it and none of the work before
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, queries.pool, 2 * scope);
+    queries.scopes.push_back({ std::string(name), m_Depth[q]++ });
+    return scope;
+}
+
+void GpuProfiler::EndScope(VkCommandBuffer cmd, uint32_t scope){
+    uint32_t q = FindQueue(cmd);
+    if (scope == NO_SCOPE || q == PROFILER_QUEUES){
+        return;
+    }
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, m_Slots[m_Slot].queues[q].pool, 2 * scope + 1);
+    m_Depth[q]--;
+}
+
+GpuProfiler::CpuScope::CpuScope(GpuProfiler& profiler, std::string_view name)
+    : m_Profiler(profiler), m_Name(name), m_Depth(profiler.m_CpuDepth++), m_BeginNs(SteadyNs()) {}
+
+GpuProfiler::CpuScope::~CpuScope(){
+    m_Profiler.m_CpuDepth--;
+    m_Profiler.m_CpuEvents.push_back({ { std::string(m_Name), m_Depth, m_BeginNs, SteadyNs() }, m_Profiler.m_FrameNumber });
+}
+
+void GpuProfiler::Calibrate(){
+    VkCalibratedTimestampInfoEXT infos[2] = {
+        { .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_DEVICE_EXT },
+        { .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT },
+    };
+    uint64_t timestamps[2];
+    uint64_t deviation;
+    // a failed sample keeps the last one, the clocks hardly drift apart between frames
+    if (m_GetCalibratedTimestamps(m_Device, 2, infos, timestamps, &deviation) == VK_SUCCESS){
+        m_Calibration = { timestamps[0], (int64_t)timestamps[1], deviation };
+    }
+}
+
+void GpuProfiler::UpdateStats(const ProfilerFrame& frame){
+    // the scopes can change between frames, the list follows the last frame and keeps the history of known scopes
+    std::vector<ProfilerScopeStats> stats;
+    for (uint32_t q = 0; q < PROFILER_QUEUES; q++){
+        for (const ProfilerScope& scope : frame.scopes[q]){
+            auto previous = std::find_if(m_Stats.begin(), m_Stats.end(), [&](const ProfilerScopeStats& s){
+                return s.queue == (ProfilerQueue)q && s.depth == scope.depth && s.name == scope.name;
+            });
+            ProfilerScopeStats entry;
+            if (previous != m_Stats.end()){
+                // moved out, a second scope of the same name starts a history of its own
+                entry = std::move(*previous);
+                previous->name.clear();
+            } else {
+                entry = { scope.name, (ProfilerQueue)q, scope.depth, 0.f, 0.f, 0.f, std::vector<float>(PROFILER_HISTORY_FRAMES, 0.f), 0, 0 };
+            }
+            entry.lastMs = scope.Ms();
+            entry.history[entry.historyOffset] = entry.lastMs;
+            entry.historyOffset = (entry.historyOffset + 1) % PROFILER_HISTORY_FRAMES;
+            entry.samples = std::min(entry.samples + 1, PROFILER_HISTORY_FRAMES);
+            float sum = 0.f;
+            entry.maxMs = 0.f;
+            for (uint32_t i = 1; i <= entry.samples; i++){
+                float ms = entry.history[(entry.historyOffset + PROFILER_HISTORY_FRAMES - i) % PROFILER_HISTORY_FRAMES];
+                sum += ms;
+                entry.maxMs = std::max(entry.maxMs, ms);
+            }
+            entry.avgMs = sum / entry.samples;
+            stats.push_back(std::move(entry));
+        }
+    }
+    m_Stats.swap(stats);
+}
+
+bool GpuProfiler::ExportTrace(const std::string& path) const{
+    // the trace starts at the first event, the steady_clock epoch is meaningless
+    int64_t originNs = INT64_MAX;
+    for (const CpuEvent& event : m_CpuEvents){
+        originNs = std::min(originNs, event.scope.beginNs);
+    }
+    for (const ProfilerFrame& frame : m_History){
+        for (const std::vector<ProfilerScope>& scopes : frame.scopes){
+            for (const ProfilerScope& scope : scopes){
+                originNs = std::min(originNs, scope.beginNs);
+            }
+        }
+    }
+
+    // one thread per lane, the viewers nest the complete events of a thread by their time
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    const char* lanes[] = { "cpu", "gpu graphics", "gpu compute" };
+    for (uint32_t thread = 0; thread < 3; thread++){
+        out += fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}},\n", thread, lanes[thread]);
+        out += fmt::format("{{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"sort_index\":{}}}}},\n", thread, thread);
+    }
+    size_t eventCount = 0;
+    for (const CpuEvent& event : m_CpuEvents){
+        AppendTraceEvent(out, event.scope, 0, event.frameNumber, originNs);
+        eventCount++;
+    }
+    for (const ProfilerFrame& frame : m_History){
+        for (uint32_t q = 0; q < PROFILER_QUEUES; q++){
+            for (const ProfilerScope& scope : frame.scopes[q]){
+                AppendTraceEvent(out, scope, 1 + q, frame.frameNumber, originNs);
+                eventCount++;
+            }
+        }
+    }
+    // the last event is followed by a comma, the metadata always comes before it
+    out.resize(out.size() - 2);
+    out += "\n]}\n";
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(out.data(), out.size());
+    if (!file){
+        LOG_ERROR("Could not write trace {}", path);
+        return false;
+    }
+    LOG_INFO("Wrote {} events of {} frames to {}", eventCount, m_History.size(), path);
+    return true;
+}
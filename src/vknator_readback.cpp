@@ -0,0 +1,151 @@
+#include <vknator_readback.h>
+#include <vknator_utils.h>
+#include <chrono>
+#include <filesystem>
+
+bool FrameReadback::Init(VkDevice device, VmaAllocator allocator, uint32_t frameCount, VkExtent2D extent, VkFormat format,
+    const std::string& directory, uint32_t encoderThreads){
+    m_Device = device;
+    m_Allocator = allocator;
+    m_Extent = extent;
+    m_Directory = directory;
+    m_Stats = {};
+    if (format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB){
+        m_SwapRedBlue = true;
+    } else if (format != VK_FORMAT_R8G8B8A8_UNORM && format != VK_FORMAT_R8G8B8A8_SRGB){
+        LOG_ERROR("Frame readback needs an 8 bit rgba or bgra image, got format {}", (int)format);
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(m_Directory, error);
+    if (error){
+        LOG_ERROR("Could not create output directory {}: {}", m_Directory, error.message());
+        return false;
+    }
+
+    // random access from the cpu, so cached memory is preferred over write combined
+    VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    bufferInfo.size = (VkDeviceSize)extent.width * extent.height * 4;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    VmaAllocationCreateInfo vmaallocInfo = {};
+    vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+    vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    vmaallocInfo.preferredFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+
+    m_Slots.resize(frameCount);
+    for (Slot& slot : m_Slots){
+        VK_CHECK(vmaCreateBuffer(m_Allocator, &bufferInfo, &vmaallocInfo, &slot.buffer.buffer, &slot.buffer.allocation, &slot.buffer.info));
+    }
+    m_Encoders.Init(std::max(1u, encoderThreads));
+    LOG_INFO("Writing frames to {}", m_Directory);
+    return true;
+}
+
+void FrameReadback::Destroy(){
+    Retire(0);
+    m_Encoders.Shutdown();
+    for (Slot& slot : m_Slots){
+        vmaDestroyBuffer(m_Allocator, slot.buffer.buffer, slot.buffer.allocation);
+    }
+    m_Slots.clear();
+    LOG_INFO("Frame readback: {} frames written ({} failed, {:.1f} MB), {:.2f} ms per encode, {} stalls",
+        m_Stats.written, m_Stats.failed, m_Stats.bytes / (1024.0 * 1024.0),
+        m_Stats.written ? m_Stats.encodeMs / m_Stats.written : 0.0, m_Stats.stalls);
+}
+
+void FrameReadback::RecordCopy(VkCommandBuffer cmd, uint32_t frame, VkImage image, uint32_t frameIndex){
+    Slot& slot = m_Slots[frame];
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { m_Extent.width, m_Extent.height, 1 };
+    vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer.buffer, 1, &region);
+
+    // the fence alone does not make the copy visible to the host
+    VkBufferMemoryBarrier2 hostBarrier = { .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2 };
+    hostBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    hostBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    hostBarrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+    hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.buffer = slot.buffer.buffer;
+    hostBarrier.size = VK_WHOLE_SIZE;
+    VkDependencyInfo dependency = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    dependency.bufferMemoryBarrierCount = 1;
+    dependency.pBufferMemoryBarriers = &hostBarrier;
+    vkCmdPipelineBarrier2(cmd, &dependency);
+
+    slot.pending = true;
+    slot.frameIndex = frameIndex;
+}
+
+void FrameReadback::Collect(uint32_t frame){
+    Slot& slot = m_Slots[frame];
+    if (!slot.pending){
+        return;
+    }
+    slot.pending = false;
+    Retire(READBACK_MAX_PENDING_ENCODES - 1);
+
+    // a plain copy out of the mapped buffer, the slot can take the next frame while this one is encoded
+    VK_CHECK(vmaInvalidateAllocation(m_Allocator, slot.buffer.allocation, 0, VK_WHOLE_SIZE));
+    size_t size = (size_t)m_Extent.width * m_Extent.height * 4;
+    const uint8_t* mapped = (const uint8_t*)slot.buffer.info.pMappedData;
+    std::vector<uint8_t> pixels(mapped, mapped + size);
+
+    std::string path = fmt::format("{}/frame_{:05}.png", m_Directory, slot.frameIndex);
+    VkExtent2D extent = m_Extent;
+    bool swapRedBlue = m_SwapRedBlue;
+    m_Encodes.push_back(m_Encoders.Submit([pixels = std::move(pixels), path = std::move(path), extent, swapRedBlue]() mutable {
+        auto start = std::chrono::steady_clock::now();
+        // rgba or bgra to rgb in place, the alpha of the composite is meaningless
+        size_t pixelCount = (size_t)extent.width * extent.height;
+        int red = swapRedBlue ? 2 : 0;
+        int blue = swapRedBlue ? 0 : 2;
+        for (size_t i = 0; i < pixelCount; i++){
+            uint8_t r = pixels[i * 4 + red];
+            uint8_t g = pixels[i * 4 + 1];
+            uint8_t b = pixels[i * 4 + blue];
+            pixels[i * 3 + 0] = r;
+            pixels[i * 3 + 1] = g;
+            pixels[i * 3 + 2] = b;
+        }
+        EncodeResult result;
+        result.written = vknatorutils::WritePng(path, pixels.data(), extent.width, extent.height);
+        if (!result.written){
+            LOG_ERROR("Could not write frame {}", path);
+        }
+        result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::error_code error;
+        result.bytes = result.written ? std::filesystem::file_size(path, error) : 0;
+        if (error){
+            result.bytes = 0;
+        }
+        return result;
+    }));
+}
+
+void FrameReadback::Retire(size_t maxPending){
+    while (!m_Encodes.empty()){
+        std::future<EncodeResult>& oldest = m_Encodes.front();
+        bool ready = oldest.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        if (!ready && m_Encodes.size() <= maxPending){
+            break;
+        }
+        if (!ready && maxPending > 0){
+            m_Stats.stalls++;
+        }
+        EncodeResult result = oldest.get();
+        if (result.written){
+            m_Stats.written++;
+        } else {
+            m_Stats.failed++;
+        }
+        m_Stats.encodeMs += result.ms;
+        m_Stats.bytes += result.bytes;
+        m_Encodes.pop_front();
+    }
+}
@@ -0,0 +1,453 @@
+#include <vknator_rendergraph.h>
+#include <vknator_initializers.h>
+#include <algorithm>
+
+namespace {
+    // pipeline state a single access needs
+    struct UsageInfo {
+        VkPipelineStageFlags2 stage;
+        VkAccessFlags2 access;
+        VkImageLayout layout;
+        VkImageUsageFlags imageUsage;
+    };
+
+    UsageInfo GetUsageInfo(RGUsage usage, bool write, RGQueue queue){
+        VkPipelineStageFlags2 shaderStages = (queue == RGQueue::Compute) ? VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT
+                                                                        : VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+        switch (usage){
+        case RGUsage::ColorAttachment:
+            return { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                     write ? VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT : VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT,
+                     VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT };
+        case RGUsage::DepthAttachment:
+            return { VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                     write ? VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT : VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+                     write ? VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT };
+        case RGUsage::StorageRead:
+            return { shaderStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT };
+        case RGUsage::StorageWrite:
+            return { shaderStages, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT };
+        case RGUsage::Sampled:
+            return { shaderStages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT };
+        case RGUsage::TransferSrc:
+            return { VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT };
+        case RGUsage::TransferDst:
+            return { VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT };
+        case RGUsage::UniformBuffer:
+            return { shaderStages, VK_ACCESS_2_UNIFORM_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+        case RGUsage::StorageBufferRead:
+            return { shaderStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+        case RGUsage::StorageBufferWrite:
+            return { shaderStages, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+        case RGUsage::IndirectBuffer:
+            return { VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+        }
+        return { VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, 0 };
+    }
+
+    bool IsDepthFormat(VkFormat format){
+        return format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+    }
+
+    // sync state of a resource while walking the passes
+    struct SyncState {
+        VkImageLayout layout;
+        VkPipelineStageFlags2 writeStages;
+        VkAccessFlags2 writeAccess;
+        // stages and accesses that already saw the last write
+        VkPipelineStageFlags2 readStages;
+        VkAccessFlags2 readAccess;
+    };
+}
+
+//> pass_builder
+RGPassBuilder& RGPassBuilder::Read(RGHandle resource, RGUsage usage){
+    m_Graph->m_Passes[m_Pass].accesses.push_back({ resource, usage, false, false });
+    return *this;
+}
+
+RGPassBuilder& RGPassBuilder::Write(RGHandle resource, RGUsage usage, bool discard){
+    m_Graph->m_Passes[m_Pass].accesses.push_back({ resource, usage, true, discard });
+    return *this;
+}
+
+RGPassBuilder& RGPassBuilder::SideEffect(){
+    m_Graph->m_Passes[m_Pass].sideEffect = true;
+    return *this;
+}
+//< pass_builder
+
+void RenderGraph::Init(VkDevice device, VmaAllocator allocator, uint32_t framesInFlight){
+    m_Device = device;
+    m_Allocator = allocator;
+    m_FramesInFlight = framesInFlight;
+}
+
+void RenderGraph::Destroy(){
+    RetireTransients();
+    // called once the device is idle, nothing can use the retired memory anymore
+    m_FrameIndex += m_FramesInFlight;
+    Reset();
+}
+
+void RenderGraph::Reset(){
+    m_FrameIndex++;
+    m_Passes.clear();
+    m_Resources.clear();
+    m_FinalBarriers.clear();
+
+    auto done = std::partition(m_Retired.begin(), m_Retired.end(), [&](const auto& retired){
+        return retired.first + m_FramesInFlight > m_FrameIndex;
+    });
+    for (auto it = done; it != m_Retired.end(); it++){
+        for (const AllocatedImage& img : it->second.images){
+            vkDestroyImageView(m_Device, img.imageView, nullptr);
+            vkDestroyImage(m_Device, img.image, nullptr);
+        }
+        for (VmaAllocation allocation : it->second.allocations){
+            vmaFreeMemory(m_Allocator, allocation);
+        }
+    }
+    m_Retired.erase(done, m_Retired.end());
+}
+
+RGHandle RenderGraph::ImportImage(const char* name, const AllocatedImage& image, VkImageLayout initialLayout, VkImageLayout finalLayout){
+    Resource res {};
+    res.name = name;
+    res.isImage = true;
+    res.image = image;
+    res.initialLayout = initialLayout;
+    res.finalLayout = finalLayout;
+    res.output = finalLayout != VK_IMAGE_LAYOUT_UNDEFINED;
+    m_Resources.push_back(res);
+    return (RGHandle)m_Resources.size() - 1;
+}
+
+RGHandle RenderGraph::ImportBuffer(const char* name, VkBuffer buffer, bool output){
+    Resource res {};
+    res.name = name;
+    res.buffer = buffer;
+    res.output = output;
+    m_Resources.push_back(res);
+    return (RGHandle)m_Resources.size() - 1;
+}
+
+RGHandle RenderGraph::CreateImage(const char* name, const RGImageDesc& desc){
+    Resource res {};
+    res.name = name;
+    res.isImage = true;
+    res.transient = true;
+    res.desc = desc;
+    res.image.imageFormat = desc.format;
+    res.image.imageExtent = desc.extent;
+    // aliased memory has no meaningful contents when a transient is first used
+    res.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    res.finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    m_Resources.push_back(res);
+    return (RGHandle)m_Resources.size() - 1;
+}
+
+RGPassBuilder RenderGraph::AddPass(const char* name, RGQueue queue, ExecuteFunction&& execute){
+    Pass pass {};
+    pass.name = name;
+    pass.queue = queue;
+    pass.execute = std::move(execute);
+    m_Passes.push_back(std::move(pass));
+    return RGPassBuilder(this, (uint32_t)m_Passes.size() - 1);
+}
+
+const AllocatedImage& RenderGraph::GetImage(RGHandle resource) const {
+    return m_Resources[resource].image;
+}
+
+void RenderGraph::Compile(){
+    m_Stats = {};
+    m_Stats.declaredPasses = (uint32_t)m_Passes.size();
+
+    CullPasses();
+    AllocateTransients();
+    ComputeBarriers();
+}
+
+void RenderGraph::CullPasses(){
+    // walk backwards from the outputs, a pass survives if it writes something a later pass or the outside needs
+    std::vector<bool> needed(m_Resources.size(), false);
+    for (size_t i = 0; i < m_Resources.size(); i++){
+        needed[i] = m_Resources[i].output;
+    }
+
+    for (auto pass = m_Passes.rbegin(); pass != m_Passes.rend(); pass++){
+        bool alive = pass->sideEffect;
+        for (const Access& a : pass->accesses){
+            alive |= a.write && needed[a.resource];
+        }
+        pass->culled = !alive;
+        if (!alive){
+            m_Stats.culledPasses++;
+            continue;
+        }
+        // a full overwrite ends the dependency on older contents, everything else reads them
+        for (const Access& a : pass->accesses){
+            if (a.write && a.discard){
+                needed[a.resource] = false;
+            }
+        }
+        for (const Access& a : pass->accesses){
+            if (!(a.write && a.discard)){
+                needed[a.resource] = true;
+            }
+        }
+    }
+}
+
+void RenderGraph::ComputeBarriers(){
+    std::vector<SyncState> states(m_Resources.size());
+    for (size_t i = 0; i < m_Resources.size(); i++){
+        // work of earlier submissions is only ordered by an execution dependency,
+        // fences and semaphores already made its memory available
+        states[i] = { m_Resources[i].initialLayout, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE };
+    }
+
+    for (Pass& pass : m_Passes){
+        pass.imageBarriers.clear();
+        pass.bufferBarriers.clear();
+        if (pass.culled){
+            continue;
+        }
+        for (const Access& a : pass.accesses){
+            Resource& res = m_Resources[a.resource];
+            SyncState& state = states[a.resource];
+            UsageInfo info = GetUsageInfo(a.usage, a.write, pass.queue);
+
+            bool layoutChange = res.isImage && info.layout != state.layout;
+            bool alreadyVisible = (state.readStages & info.stage) == info.stage && (state.readAccess & info.access) == info.access;
+            bool hazard = a.write ? (state.writeStages | state.readStages) != VK_PIPELINE_STAGE_2_NONE
+                                  : state.writeStages != VK_PIPELINE_STAGE_2_NONE && !alreadyVisible;
+            if (!layoutChange && !hazard){
+                continue;
+            }
+
+            // writes and layout changes wait for every earlier reader, reads only for the last writer
+            VkPipelineStageFlags2 srcStages = (a.write || layoutChange) ? state.writeStages | state.readStages : state.writeStages;
+            if (res.isImage){
+                VkImageMemoryBarrier2 barrier { .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+                barrier.srcStageMask = srcStages;
+                barrier.srcAccessMask = state.writeAccess;
+                barrier.dstStageMask = info.stage;
+                barrier.dstAccessMask = info.access;
+                // a full overwrite lets the driver throw the old contents away
+                barrier.oldLayout = (a.discard && layoutChange) ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+                barrier.newLayout = info.layout;
+                barrier.image = res.image.image;
+                barrier.subresourceRange = vknatorinit::image_subresource_range(IsDepthFormat(res.image.imageFormat) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT);
+                pass.imageBarriers.push_back(barrier);
+            } else {
+                VkBufferMemoryBarrier2 barrier { .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2 };
+                barrier.srcStageMask = srcStages;
+                barrier.srcAccessMask = state.writeAccess;
+                barrier.dstStageMask = info.stage;
+                barrier.dstAccessMask = info.access;
+                barrier.buffer = res.buffer;
+                barrier.offset = 0;
+                barrier.size = VK_WHOLE_SIZE;
+                pass.bufferBarriers.push_back(barrier);
+            }
+
+            if (a.write){
+                state = { info.layout, info.stage, info.access & (VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+                                                                  | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT),
+                          VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE };
+            } else if (layoutChange){
+                // the transition itself acts like a write that is visible to this stage only
+                state = { info.layout, info.stage, VK_ACCESS_2_NONE, info.stage, info.access };
+            } else {
+                state.readStages |= info.stage;
+                state.readAccess |= info.access;
+            }
+        }
+        if (!pass.imageBarriers.empty() || !pass.bufferBarriers.empty()){
+            m_Stats.barrierBatches++;
+            m_Stats.imageBarriers += (uint32_t)pass.imageBarriers.size();
+            m_Stats.bufferBarriers += (uint32_t)pass.bufferBarriers.size();
+        }
+    }
+
+    // leave outputs in the layout the outside world expects (present, ...)
+    for (size_t i = 0; i < m_Resources.size(); i++){
+        const Resource& res = m_Resources[i];
+        if (!res.isImage || res.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED || res.finalLayout == states[i].layout){
+            continue;
+        }
+        VkImageMemoryBarrier2 barrier { .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+        barrier.srcStageMask = states[i].writeStages | states[i].readStages;
+        barrier.srcAccessMask = states[i].writeAccess;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+        barrier.dstAccessMask = VK_ACCESS_2_NONE;
+        barrier.oldLayout = states[i].layout;
+        barrier.newLayout = res.finalLayout;
+        barrier.image = res.image.image;
+        barrier.subresourceRange = vknatorinit::image_subresource_range(IsDepthFormat(res.image.imageFormat) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT);
+        m_FinalBarriers.push_back(barrier);
+    }
+    if (!m_FinalBarriers.empty()){
+        m_Stats.barrierBatches++;
+        m_Stats.imageBarriers += (uint32_t)m_FinalBarriers.size();
+    }
+}
+
+void RenderGraph::AllocateTransients(){
+    std::vector<uint32_t> transients;
+    std::string key;
+    for (uint32_t i = 0; i < m_Resources.size(); i++){
+        Resource& res = m_Resources[i];
+        if (!res.transient){
+            continue;
+        }
+        res.firstPass = ~0u;
+        res.lastPass = 0;
+        res.usage = 0;
+        for (uint32_t p = 0; p < m_Passes.size(); p++){
+            if (m_Passes[p].culled){
+                continue;
+            }
+            for (const Access& a : m_Passes[p].accesses){
+                if (a.resource != i){
+                    continue;
+                }
+                if (res.firstPass == ~0u && !(a.write && a.discard)){
+                    LOG_ERROR("Render graph: transient {} is read by {} before it is written", res.name, m_Passes[p].name);
+                }
+                res.firstPass = std::min(res.firstPass, p);
+                res.lastPass = std::max(res.lastPass, p);
+                res.usage |= GetUsageInfo(a.usage, a.write, m_Passes[p].queue).imageUsage;
+            }
+        }
+        if (res.firstPass == ~0u){
+            //only used by culled passes
+            continue;
+        }
+        transients.push_back(i);
+        key += res.name + ":" + std::to_string(res.desc.format) + ":" + std::to_string(res.desc.extent.width) + "x" + std::to_string(res.desc.extent.height)
+             + ":" + std::to_string(res.usage) + ":" + std::to_string(res.firstPass) + "-" + std::to_string(res.lastPass) + ";";
+    }
+
+    if (key != m_TransientKey){
+        RetireTransients();
+        m_TransientKey = key;
+
+        std::vector<VkMemoryRequirements> requirements(transients.size());
+        for (size_t t = 0; t < transients.size(); t++){
+            Resource& res = m_Resources[transients[t]];
+            VkImageCreateInfo imgInfo = vknatorinit::image_create_info(res.desc.format, res.usage, res.desc.extent);
+            AllocatedImage img {};
+            img.imageFormat = res.desc.format;
+            img.imageExtent = res.desc.extent;
+            VK_CHECK(vkCreateImage(m_Device, &imgInfo, nullptr, &img.image));
+            vkGetImageMemoryRequirements(m_Device, img.image, &requirements[t]);
+            m_Transients.images.push_back(img);
+        }
+
+        // greedy interval packing: biggest images first, share a block with every image whose lifetime does not overlap
+        std::vector<uint32_t> order(transients.size());
+        for (uint32_t t = 0; t < order.size(); t++){
+            order[t] = t;
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){ return requirements[a].size > requirements[b].size; });
+
+        std::vector<MemoryBlock> blocks;
+        std::vector<VkMemoryRequirements> blockRequirements;
+        std::vector<uint32_t> blockOf(transients.size());
+        for (uint32_t t : order){
+            const Resource& res = m_Resources[transients[t]];
+            m_Transients.requested += requirements[t].size;
+            uint32_t chosen = (uint32_t)blocks.size();
+            for (uint32_t b = 0; b < blocks.size(); b++){
+                bool overlaps = std::any_of(blocks[b].lifetimes.begin(), blocks[b].lifetimes.end(), [&](const auto& life){
+                    return res.firstPass <= life.second && life.first <= res.lastPass;
+                });
+                if (!overlaps && (blockRequirements[b].memoryTypeBits & requirements[t].memoryTypeBits)){
+                    chosen = b;
+                    break;
+                }
+            }
+            if (chosen == blocks.size()){
+                blocks.push_back({ VK_NULL_HANDLE, 0, {} });
+                blockRequirements.push_back(requirements[t]);
+            }
+            VkMemoryRequirements& blockReq = blockRequirements[chosen];
+            blockReq.size = std::max(blockReq.size, requirements[t].size);
+            blockReq.alignment = std::max(blockReq.alignment, requirements[t].alignment);
+            blockReq.memoryTypeBits &= requirements[t].memoryTypeBits;
+            blocks[chosen].lifetimes.push_back({ res.firstPass, res.lastPass });
+            blockOf[t] = chosen;
+        }
+
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        for (size_t b = 0; b < blocks.size(); b++){
+            VK_CHECK(vmaAllocateMemory(m_Allocator, &blockRequirements[b], &allocInfo, &blocks[b].allocation, nullptr));
+            blocks[b].size = blockRequirements[b].size;
+            m_Transients.allocated += blocks[b].size;
+            m_Transients.allocations.push_back(blocks[b].allocation);
+        }
+
+        for (size_t t = 0; t < transients.size(); t++){
+            AllocatedImage& img = m_Transients.images[t];
+            img.allocation = blocks[blockOf[t]].allocation;
+            VK_CHECK(vmaBindImageMemory(m_Allocator, img.allocation, img.image));
+            VkImageViewCreateInfo viewInfo = vknatorinit::imageview_create_info(img.imageFormat, img.image,
+                IsDepthFormat(img.imageFormat) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT);
+            VK_CHECK(vkCreateImageView(m_Device, &viewInfo, nullptr, &img.imageView));
+        }
+        LOG_DEBUG("Render graph: {} transient images placed in {} memory blocks", transients.size(), blocks.size());
+    }
+
+    for (size_t t = 0; t < transients.size(); t++){
+        m_Resources[transients[t]].image = m_Transients.images[t];
+    }
+    m_Stats.transientRequested = m_Transients.requested;
+    m_Stats.transientAllocated = m_Transients.allocated;
+}
+
+void RenderGraph::RetireTransients(){
+    if (!m_Transients.images.empty() || !m_Transients.allocations.empty()){
+        m_Retired.push_back({ m_FrameIndex, std::move(m_Transients) });
+    }
+    m_Transients = {};
+    m_TransientKey.clear();
+}
+
+void RenderGraph::Execute(VkCommandBuffer cmd){
+    Execute(cmd, 0, (uint32_t)m_Passes.size());
+}
+
+void RenderGraph::Execute(VkCommandBuffer cmd, uint32_t firstPass, uint32_t endPass){
+    for (uint32_t p = firstPass; p < endPass; p++){
+        Pass& pass = m_Passes[p];
+        if (pass.culled){
+            continue;
+        }
+        // one batched barrier per pass boundary
+        if (!pass.imageBarriers.empty() || !pass.bufferBarriers.empty()){
+            VkDependencyInfo depInfo { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+            depInfo.imageMemoryBarrierCount = (uint32_t)pass.imageBarriers.size();
+            depInfo.pImageMemoryBarriers = pass.imageBarriers.data();
+            depInfo.bufferMemoryBarrierCount = (uint32_t)pass.bufferBarriers.size();
+            depInfo.pBufferMemoryBarriers = pass.bufferBarriers.data();
+            vkCmdPipelineBarrier2(cmd, &depInfo);
+        }
+        // the barrier is left out of the pass time
+        uint32_t scope = m_Profiler ? m_Profiler->BeginScope(cmd, pass.name) : GpuProfiler::NO_SCOPE;
+        pass.execute(cmd);
+        if (m_Profiler){
+            m_Profiler->EndScope(cmd, scope);
+        }
+    }
+    if (endPass == m_Passes.size() && !m_FinalBarriers.empty()){
+        VkDependencyInfo depInfo { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        depInfo.imageMemoryBarrierCount = (uint32_t)m_FinalBarriers.size();
+        depInfo.pImageMemoryBarriers = m_FinalBarriers.data();
+        vkCmdPipelineBarrier2(cmd, &depInfo);
+    }
+}
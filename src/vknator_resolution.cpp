@@ -0,0 +1,38 @@
+#include <vknator_resolution.h>
+#include <algorithm>
+
+void ResolutionController::SetLimits(float minScale, float maxScale){
+    m_MinScale = minScale;
+    m_MaxScale = maxScale;
+    m_Scale = std::clamp(m_Scale, m_MinScale, m_MaxScale);
+}
+
+void ResolutionController::Reset(float scale){
+    m_Scale = std::clamp(scale, m_MinScale, m_MaxScale);
+    // start the integral where it reproduces the current scale, so enabling the controller does not jump
+    m_Integral = (m_Scale - m_MaxScale) / m_Ki;
+    m_PreviousError = 0.0f;
+    m_FilteredMs = 0.0f;
+}
+
+float ResolutionController::Update(float gpuMs){
+    m_FilteredMs = (m_FilteredMs == 0.0f) ? gpuMs : m_FilteredMs + (gpuMs - m_FilteredMs) * m_Smoothing;
+
+    // positive error = headroom, the scale can go up
+    float error = (m_TargetMs - m_FilteredMs) / m_TargetMs;
+    float derivative = error - m_PreviousError;
+    m_PreviousError = error;
+
+    float integral = m_Integral + error;
+    float output = m_MaxScale + m_Kp * error + m_Ki * integral + m_Kd * derivative;
+
+    // anti windup: stop integrating while the output is pinned at a limit and the error pushes further out
+    bool saturated = (output >= m_MaxScale && error > 0.0f) || (output <= m_MinScale && error < 0.0f);
+    if (!saturated){
+        m_Integral = integral;
+    }
+
+    float target = std::clamp(output, m_MinScale, m_MaxScale);
+    m_Scale = std::clamp(target, m_Scale - m_MaxStep, m_Scale + m_MaxStep);
+    return m_Scale;
+}
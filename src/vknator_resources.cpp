@@ -0,0 +1,173 @@
+#include <vknator_resources.h>
+#include <vknator_descriptors.h>
+
+void ResourceRegistry::Init(VkDevice device, VmaAllocator allocator){
+    m_Device = device;
+    m_Allocator = allocator;
+}
+
+void ResourceRegistry::Destroy(){
+    // the cache goes down first and takes its sets with it
+    m_DescriptorCache = nullptr;
+    // everything pending is done once the device is idle
+    Collect(UINT64_MAX);
+
+    m_Buffers.ForEachLive([&](const AllocatedBuffer& b){ vmaDestroyBuffer(m_Allocator, b.buffer, b.allocation); });
+    m_Images.ForEachLive([&](const AllocatedImage& i){
+        vkDestroyImageView(m_Device, i.imageView, nullptr);
+        vmaDestroyImage(m_Allocator, i.image, i.allocation);
+    });
+    m_Samplers.ForEachLive([&](VkSampler s){ vkDestroySampler(m_Device, s, nullptr); });
+    m_Pipelines.ForEachLive([&](VkPipeline p){ vkDestroyPipeline(m_Device, p, nullptr); });
+    m_Buffers.Clear();
+    m_Images.Clear();
+    m_Samplers.Clear();
+    m_Pipelines.Clear();
+    if (m_StaleHandles > 0){
+        LOG_INFO("Resource registry saw {} stale handles", m_StaleHandles);
+    }
+}
+
+BufferHandle ResourceRegistry::AddBuffer(const AllocatedBuffer& buffer){
+    return m_Buffers.Add(buffer);
+}
+
+ImageHandle ResourceRegistry::AddImage(const AllocatedImage& image){
+    return m_Images.Add(image);
+}
+
+SamplerHandle ResourceRegistry::AddSampler(VkSampler sampler){
+    return m_Samplers.Add(sampler);
+}
+
+PipelineHandle ResourceRegistry::AddPipeline(VkPipeline pipeline){
+    return m_Pipelines.Add(pipeline);
+}
+
+void ResourceRegistry::CountStale(const char* type){
+    // logged once to find the caller, the counter tells how often it happens
+    if (m_StaleHandles++ == 0){
+        LOG_ERROR("Stale {} handle used, the resource was already released", type);
+    }
+}
+
+const AllocatedBuffer* ResourceRegistry::GetBuffer(BufferHandle handle){
+    const AllocatedBuffer* buffer = m_Buffers.Get(handle);
+    if (!buffer){
+        CountStale("buffer");
+    }
+    return buffer;
+}
+
+const AllocatedImage* ResourceRegistry::GetImage(ImageHandle handle){
+    const AllocatedImage* image = m_Images.Get(handle);
+    if (!image){
+        CountStale("image");
+    }
+    return image;
+}
+
+VkSampler ResourceRegistry::GetSampler(SamplerHandle handle){
+    VkSampler* sampler = m_Samplers.Get(handle);
+    if (!sampler){
+        CountStale("sampler");
+        return VK_NULL_HANDLE;
+    }
+    return *sampler;
+}
+
+VkPipeline ResourceRegistry::GetPipeline(PipelineHandle handle){
+    VkPipeline* pipeline = m_Pipelines.Get(handle);
+    if (!pipeline){
+        CountStale("pipeline");
+        return VK_NULL_HANDLE;
+    }
+    return *pipeline;
+}
+
+void ResourceRegistry::Release(BufferHandle handle, uint64_t value){
+    AllocatedBuffer buffer;
+    if (!m_Buffers.Remove(handle, buffer)){
+        CountStale("buffer");
+        return;
+    }
+    m_BufferQueue.Push(buffer, value);
+}
+
+void ResourceRegistry::Release(ImageHandle handle, uint64_t value){
+    AllocatedImage image;
+    if (!m_Images.Remove(handle, image)){
+        CountStale("image");
+        return;
+    }
+    m_ImageQueue.Push(image, value);
+}
+
+void ResourceRegistry::Release(SamplerHandle handle, uint64_t value){
+    VkSampler sampler;
+    if (!m_Samplers.Remove(handle, sampler)){
+        CountStale("sampler");
+        return;
+    }
+    m_SamplerQueue.Push(sampler, value);
+}
+
+void ResourceRegistry::Release(PipelineHandle handle, uint64_t value){
+    VkPipeline pipeline;
+    if (!m_Pipelines.Remove(handle, pipeline)){
+        CountStale("pipeline");
+        return;
+    }
+    m_PipelineQueue.Push(pipeline, value);
+}
+
+void ResourceRegistry::Release(VkImageView view, uint64_t value){
+    m_ViewQueue.Push(view, value);
+}
+
+void ResourceRegistry::Release(VkSwapchainKHR swapchain, uint64_t value){
+    m_SwapchainQueue.Push(swapchain, value);
+}
+
+void ResourceRegistry::Collect(uint64_t completed){
+    m_DestroyedHandles.clear();
+    m_InvalidatedSets.clear();
+    // views before the swapchains and images they point into
+    m_Destroyed += m_ViewQueue.Retire(completed, [&](VkImageView v){
+        m_DestroyedHandles.push_back((uint64_t)v);
+        vkDestroyImageView(m_Device, v, nullptr);
+    });
+    m_Destroyed += m_SwapchainQueue.Retire(completed, [&](VkSwapchainKHR s){ vkDestroySwapchainKHR(m_Device, s, nullptr); });
+    m_Destroyed += m_PipelineQueue.Retire(completed, [&](VkPipeline p){ vkDestroyPipeline(m_Device, p, nullptr); });
+    m_Destroyed += m_SamplerQueue.Retire(completed, [&](VkSampler s){
+        m_DestroyedHandles.push_back((uint64_t)s);
+        vkDestroySampler(m_Device, s, nullptr);
+    });
+    m_Destroyed += m_ImageQueue.Retire(completed, [&](const AllocatedImage& i){
+        m_DestroyedHandles.push_back((uint64_t)i.imageView);
+        vkDestroyImageView(m_Device, i.imageView, nullptr);
+        vmaDestroyImage(m_Allocator, i.image, i.allocation);
+    });
+    m_Destroyed += m_BufferQueue.Retire(completed, [&](const AllocatedBuffer& b){
+        m_DestroyedHandles.push_back((uint64_t)b.buffer);
+        vmaDestroyBuffer(m_Allocator, b.buffer, b.allocation);
+    });
+    // before a new object can get one of the handles back
+    if (m_DescriptorCache && !m_DestroyedHandles.empty()){
+        std::span<const VkDescriptorSet> pinned = m_DescriptorCache->invalidate(m_DestroyedHandles);
+        m_InvalidatedSets.assign(pinned.begin(), pinned.end());
+    }
+}
+
+ResourceRegistry::Stats ResourceRegistry::GetStats() const{
+    Stats stats;
+    stats.buffers = m_Buffers.GetLiveCount();
+    stats.images = m_Images.GetLiveCount();
+    stats.samplers = m_Samplers.GetLiveCount();
+    stats.pipelines = m_Pipelines.GetLiveCount();
+    stats.pending = m_BufferQueue.GetPendingCount() + m_ImageQueue.GetPendingCount() + m_SamplerQueue.GetPendingCount()
+        + m_PipelineQueue.GetPendingCount() + m_ViewQueue.GetPendingCount() + m_SwapchainQueue.GetPendingCount();
+    stats.destroyed = m_Destroyed;
+    stats.staleHandles = m_StaleHandles;
+    return stats;
+}
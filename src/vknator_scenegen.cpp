@@ -0,0 +1,239 @@
+#include <vknator_scenegen.h>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtx/transform.hpp>
+#include <random>
+
+namespace {
+    // the area the roots are spread over, the same box the light benchmark places its lights in
+    const glm::vec2 AREA_MIN { -6.f, -8.f };
+    const glm::vec2 AREA_MAX { 6.f, 2.f };
+    // heights the lights orbit at, again those of the light benchmark
+    const float LIGHT_MIN_Y = -1.f;
+    const float LIGHT_MAX_Y = 3.f;
+    // lights touching an average point, see ClusteredLighting::CoverageRadius
+    const float LIGHT_OVERLAP = 8.f;
+
+    // mt19937 is specified bit for bit, the standard distributions are not. The floats are built by hand so
+    // every standard library generates the same scene. The order of function arguments is unspecified, so every
+    // draw that goes into an expression with another one is taken into a local first
+    struct Random {
+        std::mt19937 engine;
+
+        explicit Random(uint32_t seed) : engine(seed) {}
+        float Next() { return (engine() >> 8) * (1.f / 16777216.f); }
+        float Range(float low, float high) { return low + (high - low) * Next(); }
+        uint32_t Below(uint32_t count) { return count ? engine() % count : 0; }
+    };
+
+    void FinishMesh(GeneratedMesh& mesh){
+        glm::vec3 minPos = mesh.vertices[0].position;
+        glm::vec3 maxPos = mesh.vertices[0].position;
+        for (const Vertex& v : mesh.vertices){
+            minPos = glm::min(minPos, v.position);
+            maxPos = glm::max(maxPos, v.position);
+        }
+        mesh.bounds.origin = (maxPos + minPos) / 2.f;
+        mesh.bounds.extents = (maxPos - minPos) / 2.f;
+        mesh.bounds.sphereRadius = glm::length(mesh.bounds.extents);
+    }
+
+    void AddVertex(GeneratedMesh& mesh, glm::vec3 position, glm::vec3 normal, glm::vec2 uv, glm::vec4 color){
+        Vertex v;
+        v.position = position;
+        v.normal = normal;
+        v.uv_x = uv.x;
+        v.uv_y = uv.y;
+        v.color = color;
+        mesh.vertices.push_back(v);
+    }
+
+    // grid of (columns + 1) * (rows + 1) vertices, two triangles per cell
+    void AddGridIndices(GeneratedMesh& mesh, uint32_t first, uint32_t columns, uint32_t rows){
+        for (uint32_t y = 0; y < rows; y++){
+            for (uint32_t x = 0; x < columns; x++){
+                uint32_t a = first + y * (columns + 1) + x;
+                uint32_t b = a + columns + 1;
+                mesh.indices.insert(mesh.indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+            }
+        }
+    }
+
+    GeneratedMesh Sphere(uint32_t rings, glm::vec4 color){
+        GeneratedMesh mesh;
+        uint32_t segments = rings * 2;
+        for (uint32_t y = 0; y <= rings; y++){
+            float theta = glm::pi<float>() * y / rings;
+            for (uint32_t x = 0; x <= segments; x++){
+                float phi = glm::two_pi<float>() * x / segments;
+                glm::vec3 normal { glm::sin(theta) * glm::cos(phi), glm::cos(theta), glm::sin(theta) * glm::sin(phi) };
+                AddVertex(mesh, normal * 0.5f, normal, { (float)x / segments, (float)y / rings }, color);
+            }
+        }
+        AddGridIndices(mesh, 0, segments, rings);
+        return mesh;
+    }
+
+    GeneratedMesh Torus(uint32_t rings, glm::vec4 color){
+        GeneratedMesh mesh;
+        uint32_t segments = rings * 2;
+        const float major = 0.35f;
+        const float minor = 0.15f;
+        for (uint32_t y = 0; y <= rings; y++){
+            float theta = glm::two_pi<float>() * y / rings;
+            for (uint32_t x = 0; x <= segments; x++){
+                float phi = glm::two_pi<float>() * x / segments;
+                glm::vec3 ring { glm::cos(phi), 0.f, glm::sin(phi) };
+                glm::vec3 normal = ring * glm::cos(theta) + glm::vec3(0.f, glm::sin(theta), 0.f);
+                AddVertex(mesh, ring * major + normal * minor, normal, { (float)x / segments, (float)y / rings }, color);
+            }
+        }
+        AddGridIndices(mesh, 0, segments, rings);
+        return mesh;
+    }
+
+    GeneratedMesh Box(glm::vec4 color){
+        GeneratedMesh mesh;
+        // one quad per face, the tangents span the face
+        const glm::vec3 normals[] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+        const glm::vec3 tangents[] = { {0, 0, -1}, {0, 0, 1}, {1, 0, 0}, {1, 0, 0}, {1, 0, 0}, {-1, 0, 0} };
+        for (int face = 0; face < 6; face++){
+            glm::vec3 n = normals[face];
+            glm::vec3 t = tangents[face];
+            glm::vec3 b = glm::cross(n, t);
+            uint32_t first = (uint32_t)mesh.vertices.size();
+            for (uint32_t y = 0; y <= 1; y++){
+                for (uint32_t x = 0; x <= 1; x++){
+                    glm::vec3 position = 0.4f * (n + t * (x * 2.f - 1.f) + b * (y * 2.f - 1.f));
+                    AddVertex(mesh, position, n, { (float)x, (float)y }, color);
+                }
+            }
+            AddGridIndices(mesh, first, 1, 1);
+        }
+        return mesh;
+    }
+
+    GeneratedTexture Texture(Random& rng, uint32_t size){
+        GeneratedTexture texture;
+        texture.size = size;
+        texture.pixels.resize((size_t)size * size);
+        glm::vec4 a { rng.Range(0.2f, 1.f), rng.Range(0.2f, 1.f), rng.Range(0.2f, 1.f), 1.f };
+        glm::vec4 b { rng.Range(0.f, 0.5f), rng.Range(0.f, 0.5f), rng.Range(0.f, 0.5f), 1.f };
+        uint32_t cells = 2u << rng.Below(4);
+        // a checkerboard fading into a gradient, every mip level looks different
+        for (uint32_t y = 0; y < size; y++){
+            for (uint32_t x = 0; x < size; x++){
+                bool odd = ((x * cells / size) ^ (y * cells / size)) & 1;
+                float fade = (float)y / size;
+                glm::vec4 color = glm::mix(odd ? a : b, glm::vec4(fade, fade, 1.f - fade, 1.f), 0.25f);
+                texture.pixels[(size_t)y * size + x] = glm::packUnorm4x8(color);
+            }
+        }
+        return texture;
+    }
+}
+
+GeneratedScene GenerateScene(const SceneGenDesc& desc){
+    GeneratedScene scene;
+    Random rng(desc.seed);
+    uint32_t detail = std::max(desc.meshDetail, 3u);
+
+    uint32_t meshCount = std::max(desc.meshes, 1u);
+    for (uint32_t i = 0; i < meshCount; i++){
+        glm::vec4 color { rng.Range(0.7f, 1.f), rng.Range(0.7f, 1.f), rng.Range(0.7f, 1.f), 1.f };
+        GeneratedMesh mesh;
+        switch (i % 3){
+            case 0: mesh = Sphere(detail, color); mesh.name = fmt::format("sphere{}", i); break;
+            case 1: mesh = Box(color); mesh.name = fmt::format("box{}", i); break;
+            default: mesh = Torus(detail, color); mesh.name = fmt::format("torus{}", i); break;
+        }
+        FinishMesh(mesh);
+        scene.meshes.push_back(std::move(mesh));
+    }
+
+    uint32_t textureSize = std::max(desc.textureSize, 1u);
+    for (uint32_t i = 0; i < desc.textures; i++){
+        scene.textures.push_back(Texture(rng, textureSize));
+    }
+
+    uint32_t materialCount = std::max(desc.materials, 1u);
+    for (uint32_t i = 0; i < materialCount; i++){
+        GeneratedMaterial material;
+        material.texture = desc.textures ? (int32_t)(i % desc.textures) : -1;
+        material.colorFactors = { rng.Range(0.5f, 1.f), rng.Range(0.5f, 1.f), rng.Range(0.5f, 1.f), 1.f };
+        material.metalRoughFactors = { rng.Range(0.f, 1.f), rng.Range(0.2f, 1.f), 0.f, 0.f };
+        scene.materials.push_back(material);
+    }
+
+    // the nodes fill the levels in order, level l takes nodes [l * n / depth, (l + 1) * n / depth)
+    uint32_t depth = std::clamp(desc.hierarchyDepth, 1u, std::max(desc.nodes, 1u));
+    auto levelStart = [&](uint32_t level){ return (uint32_t)((uint64_t)level * desc.nodes / depth); };
+    uint32_t roots = levelStart(1);
+    uint32_t columns = (uint32_t)std::ceil(std::sqrt((float)std::max(roots, 1u)));
+    glm::vec2 area = AREA_MAX - AREA_MIN;
+    float cell = std::min(area.x, area.y) / columns;
+
+    scene.nodes.reserve(desc.nodes);
+    for (uint32_t level = 0; level < depth; level++){
+        for (uint32_t i = levelStart(level); i < levelStart(level + 1); i++){
+            GeneratedNode node;
+            node.mesh = rng.Below(meshCount);
+            // round robin, so every material is used once there are enough nodes
+            node.material = i % materialCount;
+            float angle = rng.Range(0.f, glm::two_pi<float>());
+            if (level == 0){
+                glm::vec2 jitter;
+                jitter.x = rng.Range(0.3f, 0.7f);
+                jitter.y = rng.Range(0.3f, 0.7f);
+                glm::vec2 position = AREA_MIN + cell * (glm::vec2(i % columns, i / columns) + jitter);
+                node.parent = -1;
+                node.localTransform = glm::translate(glm::vec3(position.x, 0.f, position.y)) * glm::rotate(angle, glm::vec3(0.f, 1.f, 0.f))
+                    * glm::scale(glm::vec3(cell * 0.6f));
+            } else {
+                // next to its parent, in the parent's space
+                uint32_t parentFirst = levelStart(level - 1);
+                node.parent = (int32_t)(parentFirst + rng.Below(levelStart(level) - parentFirst));
+                glm::vec3 offset { rng.Range(-1.f, 1.f), rng.Range(0.2f, 1.f), rng.Range(-1.f, 1.f) };
+                float distance = rng.Range(0.6f, 1.2f);
+                float scale = rng.Range(0.5f, 0.8f);
+                node.localTransform = glm::translate(glm::normalize(offset) * distance) * glm::rotate(angle, glm::vec3(0.f, 1.f, 0.f))
+                    * glm::scale(glm::vec3(scale));
+            }
+            scene.nodes.push_back(node);
+        }
+    }
+
+    // point lights with every fourth one a spot looking down, as in ClusteredLighting::BuildBenchmarkScene
+    glm::vec3 lightMin { AREA_MIN.x, LIGHT_MIN_Y, AREA_MIN.y };
+    glm::vec3 lightExtent = glm::vec3(AREA_MAX.x, LIGHT_MAX_Y, AREA_MAX.y) - lightMin;
+    float lightRadius = ClusteredLighting::CoverageRadius(desc.lights, lightExtent, LIGHT_OVERLAP);
+    scene.lights.reserve(desc.lights);
+    scene.lightOrbits.reserve(desc.lights);
+    for (uint32_t i = 0; i < desc.lights; i++){
+        LightOrbit orbit;
+        glm::vec3 place { rng.Next(), rng.Next(), rng.Next() };
+        orbit.center = lightMin + lightExtent * place;
+        orbit.radius = rng.Range(0.2f, 1.2f);
+        orbit.speed = rng.Range(0.5f, 1.5f);
+        orbit.phase = rng.Range(0.f, glm::two_pi<float>());
+
+        Light light;
+        light.position = orbit.center;
+        light.radius = lightRadius;
+        glm::vec3 tint { rng.Next(), rng.Next(), rng.Next() };
+        light.color = glm::vec3(0.2f) + 0.8f * tint;
+        light.intensity = 0.5f;
+        light.type = (i % 4 == 3) ? LightType::Spot : LightType::Point;
+        float tiltX = rng.Range(-0.5f, 0.5f);
+        float tiltZ = rng.Range(-0.5f, 0.5f);
+        light.direction = glm::normalize(glm::vec3(tiltX, -1.f, tiltZ));
+        light.innerCos = std::cos(glm::radians(20.f));
+        light.outerCos = std::cos(glm::radians(35.f));
+        scene.lights.push_back(light);
+        scene.lightOrbits.push_back(orbit);
+    }
+
+    glm::vec2 middle = (AREA_MIN + AREA_MAX) / 2.f;
+    scene.center = glm::vec3(middle.x, 0.5f, middle.y);
+    scene.radius = glm::length(area) / 2.f;
+    return scene;
+}
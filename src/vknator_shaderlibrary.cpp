@@ -0,0 +1,111 @@
+#include <vknator_shaderlibrary.h>
+#include <algorithm>
+
+void ShaderLibrary::Init(VkDevice device){
+    m_Device = device;
+    for (size_t i = 0; i < g_EmbeddedShaderCount; i++){
+        m_Shaders[g_EmbeddedShaders[i].name] = &g_EmbeddedShaders[i];
+    }
+    LOG_DEBUG("Shader library with {} embedded shaders", m_Shaders.size());
+}
+
+void ShaderLibrary::Destroy(){
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for (auto& [name, module] : m_Modules){
+        vkDestroyShaderModule(m_Device, module, nullptr);
+    }
+    m_Modules.clear();
+}
+
+const EmbeddedShader* ShaderLibrary::Find(const std::string& name) const{
+    auto it = m_Shaders.find(name);
+    return it == m_Shaders.end() ? nullptr : it->second;
+}
+
+VkShaderModule ShaderLibrary::GetModule(const std::string& name){
+    const EmbeddedShader* shader = Find(name);
+    if (!shader){
+        LOG_ERROR("No embedded shader {}", name);
+        return VK_NULL_HANDLE;
+    }
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto it = m_Modules.find(name);
+    if (it != m_Modules.end()){
+        return it->second;
+    }
+    // module creation is cheap compared to the pipeline compile, it is fine to hold the lock
+    VkShaderModuleCreateInfo createInfo = { .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+    createInfo.codeSize = shader->code.size_bytes();
+    createInfo.pCode = shader->code.data();
+    VkShaderModule module;
+    if (vkCreateShaderModule(m_Device, &createInfo, nullptr, &module) != VK_SUCCESS){
+        LOG_ERROR("Could not create shader module {}", name);
+        return VK_NULL_HANDLE;
+    }
+    m_Modules[name] = module;
+    return module;
+}
+
+glm::uvec3 ShaderLibrary::GetLocalSize(const std::string& name) const{
+    const EmbeddedShader* shader = Find(name);
+    if (!shader || shader->stage != VK_SHADER_STAGE_COMPUTE_BIT){
+        return glm::uvec3(1);
+    }
+    glm::uvec3 localSize(shader->localSize[0], shader->localSize[1], shader->localSize[2]);
+    // reflection only sees literal LocalSize modes, LocalSizeId and spec constant sizes come back as 0. The callers
+    // divide by the size, so it is clamped, a dispatch then covers at least the intended area
+    if (localSize.x == 0 || localSize.y == 0 || localSize.z == 0){
+        LOG_ERROR("Workgroup size of {} is not known at build time, dispatching it as 1x1x1", name);
+        return glm::max(localSize, glm::uvec3(1));
+    }
+    return localSize;
+}
+
+bool ShaderLibrary::ValidateSetLayout(std::initializer_list<const char*> shaders, uint32_t set, const DescriptorLayoutBuilder& layout) const{
+    bool valid = true;
+    for (const char* name : shaders){
+        const EmbeddedShader* shader = Find(name);
+        if (!shader){
+            LOG_ERROR("Layout check: no embedded shader {}", name);
+            valid = false;
+            continue;
+        }
+        for (const ShaderBinding& reflected : shader->bindings){
+            if (reflected.set != set){
+                continue;
+            }
+            auto binding = std::find_if(layout.bindings.begin(), layout.bindings.end(),
+                [&](const VkDescriptorSetLayoutBinding& b){ return b.binding == reflected.binding; });
+            if (binding == layout.bindings.end()){
+                LOG_ERROR("Layout check: {} uses set {} binding {} which the layout does not have", name, set, reflected.binding);
+                valid = false;
+            } else if (binding->descriptorType != reflected.type){
+                LOG_ERROR("Layout check: {} set {} binding {} is {} in the shader but {} in the layout", name, set, reflected.binding,
+                    string_VkDescriptorType(reflected.type), string_VkDescriptorType(binding->descriptorType));
+                valid = false;
+            } else if (binding->descriptorCount < reflected.count){
+                LOG_ERROR("Layout check: {} set {} binding {} needs {} descriptors, the layout has {}", name, set, reflected.binding,
+                    reflected.count, binding->descriptorCount);
+                valid = false;
+            } else if (!(binding->stageFlags & shader->stage)){
+                LOG_ERROR("Layout check: {} set {} binding {} is not visible to the {} stage", name, set, reflected.binding,
+                    string_VkShaderStageFlagBits(shader->stage));
+                valid = false;
+            }
+        }
+    }
+    return valid;
+}
+
+bool ShaderLibrary::ValidatePushConstants(std::initializer_list<const char*> shaders, uint32_t size) const{
+    bool valid = true;
+    for (const char* name : shaders){
+        const EmbeddedShader* shader = Find(name);
+        if (shader && shader->pushConstantSize > size){
+            LOG_ERROR("Layout check: {} reads {} bytes of push constants, the range has {}", name, shader->pushConstantSize, size);
+            valid = false;
+        }
+    }
+    return valid;
+}
@@ -0,0 +1,216 @@
+#include <vknator_shadows.h>
+#include <vknator_initializers.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+
+void CascadedShadows::Init(VkDevice device, VmaAllocator allocator, PipelineCompiler* compiler, ShaderLibrary* shaders){
+    m_Device = device;
+    m_Allocator = allocator;
+
+    m_Image.imageFormat = VK_FORMAT_D32_SFLOAT;
+    m_Image.imageExtent = { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1 };
+    VkImageCreateInfo imageInfo = vknatorinit::image_create_info(m_Image.imageFormat,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, m_Image.imageExtent);
+    imageInfo.arrayLayers = SHADOW_CASCADES;
+    VmaAllocationCreateInfo vmaAllocInfo = {};
+    vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    vmaAllocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VK_CHECK(vmaCreateImage(m_Allocator, &imageInfo, &vmaAllocInfo, &m_Image.image, &m_Image.allocation, nullptr));
+
+    // the scene samples every cascade through one array view, each cascade is rendered through its own layer
+    VkImageViewCreateInfo viewInfo = vknatorinit::imageview_create_info(m_Image.imageFormat, m_Image.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.subresourceRange.layerCount = SHADOW_CASCADES;
+    VK_CHECK(vkCreateImageView(m_Device, &viewInfo, nullptr, &m_Image.imageView));
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.subresourceRange.layerCount = 1;
+    for (uint32_t i = 0; i < SHADOW_CASCADES; i++){
+        viewInfo.subresourceRange.baseArrayLayer = i;
+        VK_CHECK(vkCreateImageView(m_Device, &viewInfo, nullptr, &m_LayerViews[i]));
+    }
+
+    // hardware depth compare with bilinear pcf, outside the map counts as lit
+    VkSamplerCreateInfo samplerInfo = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    samplerInfo.compareEnable = VK_TRUE;
+    samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    VK_CHECK(vkCreateSampler(m_Device, &samplerInfo, nullptr, &m_Sampler));
+
+    // the matrix is light view projection * model, positions come from the position stream
+    VkPushConstantRange pushConstant{};
+    pushConstant.offset = 0;
+    pushConstant.size = sizeof(GPUDepthPushConstants);
+    pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    VkPipelineLayoutCreateInfo layoutInfo = vknatorinit::pipeline_layout_create_info();
+    layoutInfo.pPushConstantRanges = &pushConstant;
+    layoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(m_Device, &layoutInfo, nullptr, &m_Layout));
+    shaders->ValidatePushConstants({ "depth_only.vert" }, pushConstant.size);
+
+    PipelineBuilder builder;
+    builder.m_PipelineLayout = m_Layout;
+    builder.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    builder.SetPolygonMode(VK_POLYGON_MODE_FILL);
+    builder.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+    builder.SetMultisamplingNone();
+    builder.SetDepthOnly();
+    builder.SetDepthFormat(m_Image.imageFormat);
+    builder.EnableDepthtest(true, VK_COMPARE_OP_LESS_OR_EQUAL);
+    // slope scaled bias for the steep receivers, the shader offsets along the normal for the rest
+    builder.EnableDepthBias(1.25f, 1.75f);
+    compiler->CompileGraphics(builder, "depth_only.vert", "", "shadow depth", &m_Pipeline);
+
+    LOG_DEBUG("Shadow map {}x{} with {} cascades", SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, SHADOW_CASCADES);
+}
+
+void CascadedShadows::Destroy(){
+    vkDestroyPipelineLayout(m_Device, m_Layout, nullptr);
+    vkDestroySampler(m_Device, m_Sampler, nullptr);
+    for (VkImageView view : m_LayerViews){
+        vkDestroyImageView(m_Device, view, nullptr);
+    }
+    vkDestroyImageView(m_Device, m_Image.imageView, nullptr);
+    vmaDestroyImage(m_Allocator, m_Image.image, m_Image.allocation);
+}
+
+void CascadedShadows::Update(uint64_t frame, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& sunDirection){
+    m_Stats.renderedCascades = 0;
+    m_Stats.drawnObjects = 0;
+    m_Stats.culledObjects = 0;
+    for (Cascade& cascade : m_Cascades){
+        cascade.render = false;
+    }
+    if (!m_Enabled){
+        return;
+    }
+
+    glm::vec3 sun = glm::normalize(sunDirection);
+    glm::vec3 up = std::abs(sun.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+    m_LightView = glm::lookAt(glm::vec3(0.f), -sun, up);
+
+    // view frustum corner rays scaled to a view depth of 1, reverse z: ndc depth 1 is the near plane
+    glm::mat4 inverseProjection = glm::inverse(projection);
+    glm::mat4 inverseView = glm::inverse(view);
+    glm::vec3 rays[4];
+    float cameraNear = 0.f;
+    for (uint32_t i = 0; i < 4; i++){
+        glm::vec4 corner = inverseProjection * glm::vec4((i & 1) ? 1.f : -1.f, (i & 2) ? 1.f : -1.f, 1.f, 1.f);
+        glm::vec3 point = glm::vec3(corner) / corner.w;
+        cameraNear = -point.z;
+        rays[i] = point / -point.z;
+    }
+
+    float splitNear = cameraNear;
+    for (uint32_t c = 0; c < SHADOW_CASCADES; c++){
+        Cascade& cascade = m_Cascades[c];
+        float t = (float)(c + 1) / SHADOW_CASCADES;
+        float logSplit = cameraNear * std::pow(SHADOW_DISTANCE / cameraNear, t);
+        float uniformSplit = cameraNear + (SHADOW_DISTANCE - cameraNear) * t;
+        float splitFar = glm::mix(uniformSplit, logSplit, SHADOW_SPLIT_LAMBDA);
+        cascade.splitFar = splitFar;
+
+        // bounding sphere of the slice, its size does not change with the camera orientation
+        glm::vec3 corners[8];
+        glm::vec3 center(0.f);
+        for (uint32_t i = 0; i < 8; i++){
+            glm::vec3 viewPoint = rays[i & 3] * (i < 4 ? splitNear : splitFar);
+            corners[i] = glm::vec3(inverseView * glm::vec4(viewPoint, 1.f));
+            center += corners[i] / 8.f;
+        }
+        float radius = 0.f;
+        for (const glm::vec3& corner : corners){
+            radius = std::max(radius, glm::length(corner - center));
+        }
+        radius = std::ceil(radius * 16.f) / 16.f;
+        splitNear = splitFar;
+
+        bool cached = m_Caching && SHADOW_UPDATE_INTERVALS[c] != 1;
+        bool valid = cached && cascade.valid && glm::dot(cascade.sunDirection, sun) > 0.9999f && cascade.staticVersion == m_StaticVersion
+            && glm::length(center - cascade.center) + radius <= cascade.radius;
+        if (valid){
+            uint32_t interval = SHADOW_UPDATE_INTERVALS[c];
+            cascade.render = interval != 0 && (frame + c) % interval == 0;
+        } else {
+            Fit(cascade, m_LightView, center, cached ? radius * (1.f + SHADOW_CACHE_MARGIN) : radius);
+            cascade.sunDirection = sun;
+            cascade.staticVersion = m_StaticVersion;
+            cascade.valid = true;
+            cascade.render = true;
+            if (cached){
+                m_Stats.refits++;
+            }
+        }
+        if (cascade.render){
+            m_Stats.renderedCascades++;
+            m_Rendered = true;
+        } else {
+            m_Stats.cachedCascades++;
+        }
+    }
+}
+
+void CascadedShadows::Fit(Cascade& cascade, const glm::mat4& lightView, const glm::vec3& center, float radius){
+    cascade.center = center;
+    cascade.radius = radius;
+
+    // move the box in whole texels only, so the rasterized shadow edges stay put while the camera moves
+    glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.f));
+    float texel = 2.f * radius / SHADOW_MAP_SIZE;
+    lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+    lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+    cascade.boxCenter = glm::vec2(lightCenter);
+
+    // light space looks down -z, the box reaches further towards the sun to catch casters outside the sphere
+    cascade.zNear = -(lightCenter.z + radius) - SHADOW_CASTER_DISTANCE;
+    cascade.zFar = -(lightCenter.z - radius);
+    glm::mat4 projection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius,
+        cascade.zNear, cascade.zFar);
+    cascade.viewProj = projection * lightView;
+}
+
+bool CascadedShadows::NeedsRender() const{
+    for (uint32_t c = 0; c < SHADOW_CASCADES; c++){
+        if (NeedsRender(c)){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CascadedShadows::IsVisible(uint32_t cascade, const glm::mat4& transform, const Bounds& bounds) const{
+    const Cascade& box = m_Cascades[cascade];
+    glm::vec3 lightPoint = glm::vec3(m_LightView * transform * glm::vec4(bounds.origin, 1.f));
+    float scale = std::max({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+    float radius = bounds.sphereRadius * scale;
+
+    float depth = -lightPoint.z;
+    return std::abs(lightPoint.x - box.boxCenter.x) <= box.radius + radius
+        && std::abs(lightPoint.y - box.boxCenter.y) <= box.radius + radius
+        && depth + radius >= box.zNear && depth - radius <= box.zFar;
+}
+
+GPUShadowData CascadedShadows::GetSceneData(const glm::mat4& view) const{
+    GPUShadowData data {};
+    // clip space xy to uv, depth stays as it is
+    glm::mat4 toUv = glm::translate(glm::mat4(1.f), glm::vec3(0.5f, 0.5f, 0.f)) * glm::scale(glm::mat4(1.f), glm::vec3(0.5f, 0.5f, 1.f));
+    glm::mat4 inverseView = glm::inverse(view);
+    for (uint32_t c = 0; c < SHADOW_CASCADES; c++){
+        const Cascade& cascade = m_Cascades[c];
+        data.matrices[c] = toUv * cascade.viewProj * inverseView;
+        data.splits[c] = cascade.splitFar;
+        data.normalBias[c] = 1.5f * 2.f * cascade.radius / SHADOW_MAP_SIZE;
+    }
+    data.params = glm::vec4(1.f / SHADOW_MAP_SIZE, (m_Enabled && m_Rendered) ? 1.f : 0.f, 0.f, 0.f);
+    return data;
+}
+
+void CascadedShadows::CountDraws(uint32_t drawn, uint32_t culled){
+    m_Stats.drawnObjects += drawn;
+    m_Stats.culledObjects += culled;
+}
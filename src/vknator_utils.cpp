@@ -1,5 +1,9 @@
 #include <vknator_utils.h>
 #include <vknator_initializers.h>
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <vector>
 
 void vknatorutils::TransitionImage(VkCommandBuffer cmd, VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout){
     VkImageMemoryBarrier2 imageBarrier {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
@@ -58,3 +62,100 @@ void vknatorutils::CopyImageToImage(VkCommandBuffer cmd, VkImage source, VkImage
 
 	vkCmdBlitImage2(cmd, &blitInfo);
 }
+
+namespace {
+    uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size){
+        static const std::array<uint32_t, 256> table = [](){
+            std::array<uint32_t, 256> t {};
+            for (uint32_t n = 0; n < 256; n++){
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++){
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                t[n] = c;
+            }
+            return t;
+        }();
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++){
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    void PutBigEndian(std::vector<uint8_t>& out, uint32_t value){
+        out.push_back((uint8_t)(value >> 24));
+        out.push_back((uint8_t)(value >> 16));
+        out.push_back((uint8_t)(value >> 8));
+        out.push_back((uint8_t)value);
+    }
+
+    void PutChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data){
+        PutBigEndian(out, (uint32_t)data.size());
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        // the crc covers the type and the data, not the length
+        PutBigEndian(out, Crc32(0, out.data() + start, out.size() - start));
+    }
+}
+
+bool vknatorutils::WritePng(const std::string& path, const uint8_t* rgb, uint32_t width, uint32_t height){
+    std::vector<uint8_t> header;
+    PutBigEndian(header, width);
+    PutBigEndian(header, height);
+    // 8 bit depth, truecolor, deflate, adaptive filtering, no interlace
+    header.insert(header.end(), { 8, 2, 0, 0, 0 });
+
+    // every row starts with its filter type, 0 keeps the bytes as they are
+    size_t rowSize = (size_t)width * 3;
+    std::vector<uint8_t> raw;
+    raw.reserve((rowSize + 1) * height);
+    for (uint32_t y = 0; y < height; y++){
+        raw.push_back(0);
+        raw.insert(raw.end(), rgb + y * rowSize, rgb + (y + 1) * rowSize);
+    }
+
+    // zlib stream made of stored blocks, at most 65535 bytes each
+    std::vector<uint8_t> zlib;
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+    size_t offset = 0;
+    do {
+        uint16_t blockSize = (uint16_t)std::min<size_t>(raw.size() - offset, 65535);
+        bool last = offset + blockSize == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back((uint8_t)blockSize);
+        zlib.push_back((uint8_t)(blockSize >> 8));
+        zlib.push_back((uint8_t)~blockSize);
+        zlib.push_back((uint8_t)(~blockSize >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+        offset += blockSize;
+    } while (offset < raw.size());
+    // adler32, 5552 bytes is the most that can be summed before the modulo without overflowing b
+    uint32_t a = 1, b = 0;
+    for (size_t start = 0; start < raw.size(); start += 5552){
+        size_t end = std::min<size_t>(start + 5552, raw.size());
+        for (size_t i = start; i < end; i++){
+            a += raw[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    PutBigEndian(zlib, (b << 16) | a);
+
+    std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    png.reserve(zlib.size() + 64);
+    PutChunk(png, "IHDR", header);
+    PutChunk(png, "IDAT", zlib);
+    PutChunk(png, "IEND", {});
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()){
+        return false;
+    }
+    file.write((const char*)png.data(), png.size());
+    return (bool)file;
+}
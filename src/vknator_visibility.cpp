@@ -0,0 +1,175 @@
+#include <vknator_visibility.h>
+#include <vknator_initializers.h>
+#include <vknator_descriptors.h>
+
+namespace {
+    // dispatch, pixel total, then counts, offsets and cursors, see VisibilityBins in visibility.glsl
+    constexpr VkDeviceSize BIN_BUFFER_SIZE = sizeof(uint32_t) * (4 + 3 * VISIBILITY_MATERIAL_BINS);
+}
+
+void VisibilityBuffer::Init(VkDevice device, VmaAllocator allocator, ResourceRegistry* resources, uint32_t frameCount, PipelineCompiler* compiler,
+    ShaderLibrary* shaders, VkDescriptorSetLayout sceneLayout, VkDescriptorSetLayout materialLayout){
+    m_Device = device;
+    m_Allocator = allocator;
+    m_Resources = resources;
+
+    // raster pass: positions only, the draw index comes with the push constants
+    VkPushConstantRange rasterPush{};
+    rasterPush.offset = 0;
+    rasterPush.size = sizeof(VisibilityRasterPushConstants);
+    rasterPush.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    VkPipelineLayoutCreateInfo layoutInfo = vknatorinit::pipeline_layout_create_info();
+    layoutInfo.pPushConstantRanges = &rasterPush;
+    layoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(m_Device, &layoutInfo, nullptr, &m_RasterLayout));
+    shaders->ValidatePushConstants({ "vis.vert" }, rasterPush.size);
+
+    PipelineBuilder builder;
+    builder.m_PipelineLayout = m_RasterLayout;
+    builder.SetInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    builder.SetPolygonMode(VK_POLYGON_MODE_FILL);
+    //same culling and depth test as the opaque material pipelines
+    builder.SetCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+    builder.SetMultisamplingNone();
+    builder.DisableBlending();
+    builder.EnableDepthtest(true, VK_COMPARE_OP_LESS_OR_EQUAL);
+    builder.SetColorAttachmentFormat(VISIBILITY_FORMAT);
+    builder.SetDepthFormat(VK_FORMAT_D32_SFLOAT);
+    compiler->CompileGraphics(builder, "vis.vert", "vis.frag", "visibility", &m_RasterPipeline);
+
+    // compute passes: scene, bindless materials and the two targets, every buffer goes through its address
+    {
+        DescriptorLayoutBuilder targets;
+        targets.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        targets.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        m_TargetLayout = targets.build(m_Device, VK_SHADER_STAGE_COMPUTE_BIT);
+        shaders->ValidateSetLayout({ "visibility_shade.comp" }, 2, targets);
+    }
+    VkPushConstantRange computePush{};
+    computePush.offset = 0;
+    computePush.size = sizeof(VisibilityPushConstants);
+    computePush.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    VkDescriptorSetLayout setLayouts[] = { sceneLayout, materialLayout, m_TargetLayout };
+    layoutInfo.pSetLayouts = setLayouts;
+    layoutInfo.setLayoutCount = 3;
+    layoutInfo.pPushConstantRanges = &computePush;
+    VK_CHECK(vkCreatePipelineLayout(m_Device, &layoutInfo, nullptr, &m_ComputeLayout));
+    shaders->ValidatePushConstants({ "visibility_count.comp", "visibility_bins.comp", "visibility_scatter.comp", "visibility_shade.comp" },
+        computePush.size);
+
+    m_PixelLocalSize = shaders->GetLocalSize("visibility_count.comp");
+    compiler->CompileCompute(m_ComputeLayout, "visibility_count.comp", "visibility count", &m_CountPipeline);
+    compiler->CompileCompute(m_ComputeLayout, "visibility_bins.comp", "visibility bins", &m_BinsPipeline);
+    compiler->CompileCompute(m_ComputeLayout, "visibility_scatter.comp", "visibility scatter", &m_ScatterPipeline);
+    compiler->CompileCompute(m_ComputeLayout, "visibility_shade.comp", "visibility shade", &m_ShadePipeline);
+
+    // the pixel lists are sized on first use, when the draw extent is known
+    m_Frames.resize(frameCount);
+    for (FrameBuffers& frame : m_Frames){
+        frame.draws = CreateBuffer(sizeof(GPUVisibilityDraw) * MAX_VISIBILITY_DRAWS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VMA_MEMORY_USAGE_CPU_TO_GPU, frame.drawAddress);
+        frame.bins = CreateBuffer(BIN_BUFFER_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+            | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY, frame.binAddress);
+    }
+    LOG_DEBUG("Visibility buffer with {} draws and {} material bins", MAX_VISIBILITY_DRAWS, VISIBILITY_MATERIAL_BINS);
+}
+
+void VisibilityBuffer::Destroy(){
+    for (FrameBuffers& frame : m_Frames){
+        vmaDestroyBuffer(m_Allocator, frame.draws.buffer, frame.draws.allocation);
+        vmaDestroyBuffer(m_Allocator, frame.bins.buffer, frame.bins.allocation);
+        if (frame.pixelCapacity > 0){
+            m_Resources->Release(frame.pixels, 0);
+        }
+    }
+    m_Frames.clear();
+    vkDestroyPipelineLayout(m_Device, m_ComputeLayout, nullptr);
+    descriptor_layout_destroy(m_Device, m_TargetLayout);
+    vkDestroyPipelineLayout(m_Device, m_RasterLayout, nullptr);
+}
+
+AllocatedBuffer VisibilityBuffer::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkDeviceAddress& address){
+    VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    bufferInfo.size = size;
+    bufferInfo.usage = usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    VmaAllocationCreateInfo vmaallocInfo = {};
+    vmaallocInfo.usage = memoryUsage;
+    vmaallocInfo.flags = memoryUsage == VMA_MEMORY_USAGE_CPU_TO_GPU ? VMA_ALLOCATION_CREATE_MAPPED_BIT : 0;
+    AllocatedBuffer buffer;
+    VK_CHECK(vmaCreateBuffer(m_Allocator, &bufferInfo, &vmaallocInfo, &buffer.buffer, &buffer.allocation, &buffer.info));
+
+    VkBufferDeviceAddressInfo addressInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
+    addressInfo.buffer = buffer.buffer;
+    address = vkGetBufferDeviceAddress(m_Device, &addressInfo);
+    return buffer;
+}
+
+void VisibilityBuffer::EnsureCapacity(uint32_t frame, VkExtent2D extent, uint64_t releaseValue){
+    FrameBuffers& buffers = m_Frames[frame];
+    uint32_t pixels = extent.width * extent.height;
+    if (pixels <= buffers.pixelCapacity){
+        return;
+    }
+    if (buffers.pixelCapacity > 0){
+        m_Resources->Release(buffers.pixels, releaseValue);
+    }
+    AllocatedBuffer list = CreateBuffer(sizeof(uint32_t) * pixels, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
+        buffers.pixelAddress);
+    buffers.pixels = m_Resources->AddBuffer(list);
+    buffers.pixelCapacity = pixels;
+}
+
+VkBuffer VisibilityBuffer::GetPixelBuffer(uint32_t frame){
+    const AllocatedBuffer* buffer = m_Resources->GetBuffer(m_Frames[frame].pixels);
+    return buffer ? buffer->buffer : VK_NULL_HANDLE;
+}
+
+VisibilityPushConstants VisibilityBuffer::PushConstants(uint32_t frame, VkExtent2D extent) const{
+    VisibilityPushConstants push;
+    push.drawBuffer = m_Frames[frame].drawAddress;
+    push.binBuffer = m_Frames[frame].binAddress;
+    push.pixelBuffer = m_Frames[frame].pixelAddress;
+    push.extent = glm::uvec2(extent.width, extent.height);
+    return push;
+}
+
+void VisibilityBuffer::Dispatch(VkCommandBuffer cmd, VkPipeline pipeline, const VisibilityPushConstants& push, glm::uvec3 groups){
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdPushConstants(cmd, m_ComputeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(VisibilityPushConstants), &push);
+    vkCmdDispatch(cmd, groups.x, groups.y, groups.z);
+}
+
+void VisibilityBuffer::RecordCount(VkCommandBuffer cmd, uint32_t frame, VkExtent2D extent){
+    // the counts are accumulated with atomics, they start at zero
+    vkCmdFillBuffer(cmd, m_Frames[frame].bins.buffer, 0, VK_WHOLE_SIZE, 0);
+    VkMemoryBarrier2 clearBarrier = { .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+    clearBarrier.srcStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT;
+    clearBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    clearBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    clearBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    VkDependencyInfo dependency = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    dependency.memoryBarrierCount = 1;
+    dependency.pMemoryBarriers = &clearBarrier;
+    vkCmdPipelineBarrier2(cmd, &dependency);
+
+    glm::uvec3 groups((extent.width + m_PixelLocalSize.x - 1) / m_PixelLocalSize.x, (extent.height + m_PixelLocalSize.y - 1) / m_PixelLocalSize.y, 1);
+    Dispatch(cmd, m_CountPipeline, PushConstants(frame, extent), groups);
+}
+
+void VisibilityBuffer::RecordBins(VkCommandBuffer cmd, uint32_t frame, VkExtent2D extent){
+    // a single workgroup scans every bin
+    Dispatch(cmd, m_BinsPipeline, PushConstants(frame, extent), glm::uvec3(1));
+}
+
+void VisibilityBuffer::RecordScatter(VkCommandBuffer cmd, uint32_t frame, VkExtent2D extent){
+    glm::uvec3 groups((extent.width + m_PixelLocalSize.x - 1) / m_PixelLocalSize.x, (extent.height + m_PixelLocalSize.y - 1) / m_PixelLocalSize.y, 1);
+    Dispatch(cmd, m_ScatterPipeline, PushConstants(frame, extent), groups);
+}
+
+void VisibilityBuffer::RecordShade(VkCommandBuffer cmd, uint32_t frame, VkExtent2D extent){
+    // the bins pass wrote the group count for the covered pixels at the start of the bin buffer
+    VisibilityPushConstants push = PushConstants(frame, extent);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_ShadePipeline);
+    vkCmdPushConstants(cmd, m_ComputeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(VisibilityPushConstants), &push);
+    vkCmdDispatchIndirect(cmd, m_Frames[frame].bins.buffer, 0);
+}
@@ -0,0 +1,83 @@
+#include <vknator_workers.h>
+#include <atomic>
+
+void WorkerPool::Init(uint32_t threadCount){
+    m_Stopping = false;
+    for (uint32_t i = 0; i < threadCount; i++){
+        m_Threads.emplace_back([this](){ WorkerLoop(); });
+    }
+    LOG_DEBUG("Worker pool started with {} threads", threadCount);
+}
+
+void WorkerPool::Shutdown(){
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stopping = true;
+    }
+    m_Condition.notify_all();
+    for (auto& t : m_Threads){
+        t.join();
+    }
+    m_Threads.clear();
+    m_Jobs.clear();
+}
+
+void WorkerPool::WorkerLoop(){
+    while (true){
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Condition.wait(lock, [this](){ return m_Stopping || !m_Jobs.empty(); });
+            if (m_Stopping && m_Jobs.empty()){
+                return;
+            }
+            job = std::move(m_Jobs.front());
+            m_Jobs.pop_front();
+        }
+        job();
+    }
+}
+
+void WorkerPool::ParallelFor(uint32_t slotCount, const std::function<void(uint32_t)>& job){
+    if (slotCount == 0){
+        return;
+    }
+    // the state is shared with the helper jobs, which may only get scheduled after this call returned
+    struct ForState {
+        const std::function<void(uint32_t)>* job;
+        uint32_t count;
+        std::atomic<uint32_t> next {0};
+        std::atomic<uint32_t> done {0};
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto state = std::make_shared<ForState>();
+    state->job = &job;
+    state->count = slotCount;
+
+    auto runSlots = [](ForState& s){
+        for (uint32_t slot = s.next++; slot < s.count; slot = s.next++){
+            (*s.job)(slot);
+            if (++s.done == s.count){
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.finished.notify_all();
+            }
+        }
+    };
+
+    uint32_t helpers = std::min<uint32_t>(slotCount - 1, (uint32_t)m_Threads.size());
+    if (helpers > 0){
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            for (uint32_t i = 0; i < helpers; i++){
+                m_Jobs.emplace_back([state, runSlots](){ runSlots(*state); });
+            }
+        }
+        m_Condition.notify_all();
+    }
+
+    runSlots(*state);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&](){ return state->done.load() == state->count; });
+}
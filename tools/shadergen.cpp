@@ -0,0 +1,367 @@
+// build step: embeds compiled SPIR-V into a C++ source together with the reflection data the engine needs
+// (descriptor bindings, push constant size, workgroup size), so no shader file is read at runtime.
+//
+// usage: vknator_shadergen <output.cpp> <shader.spv>...
+// shaders are named after their file without .spv, e.g. mesh.vert
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// the subset of the SPIR-V spec the reflection needs
+enum Op : uint32_t {
+    OpEntryPoint = 15,
+    OpExecutionMode = 16,
+    OpTypeBool = 20,
+    OpTypeInt = 21,
+    OpTypeFloat = 22,
+    OpTypeVector = 23,
+    OpTypeMatrix = 24,
+    OpTypeImage = 25,
+    OpTypeSampler = 26,
+    OpTypeSampledImage = 27,
+    OpTypeArray = 28,
+    OpTypeRuntimeArray = 29,
+    OpTypeStruct = 30,
+    OpTypePointer = 32,
+    OpConstant = 43,
+    OpVariable = 59,
+    OpDecorate = 71,
+    OpMemberDecorate = 72,
+};
+enum Decoration : uint32_t {
+    DecorationBlock = 2,
+    DecorationBufferBlock = 3,
+    DecorationArrayStride = 6,
+    DecorationMatrixStride = 7,
+    DecorationBinding = 33,
+    DecorationDescriptorSet = 34,
+    DecorationOffset = 35,
+};
+enum StorageClass : uint32_t {
+    StorageUniformConstant = 0,
+    StorageUniform = 2,
+    StoragePushConstant = 9,
+    StorageStorageBuffer = 12,
+    StoragePhysicalStorageBuffer = 5349,
+};
+constexpr uint32_t SpirvMagic = 0x07230203;
+constexpr uint32_t ExecutionModeLocalSize = 17;
+constexpr uint32_t DimBuffer = 5;
+constexpr uint32_t DimSubpassData = 6;
+
+struct Type {
+    uint32_t op = 0;
+    std::vector<uint32_t> operands;
+};
+
+struct Binding {
+    uint32_t set;
+    uint32_t binding;
+    std::string type;
+    uint32_t count;
+};
+
+struct Reflection {
+    std::string stage = "VK_SHADER_STAGE_ALL";
+    std::vector<Binding> bindings;
+    uint32_t pushConstantSize = 0;
+    uint32_t localSize[3] = { 0, 0, 0 };
+};
+
+class Reflector {
+public:
+    explicit Reflector(const std::vector<uint32_t>& code) : m_Code(code) {}
+
+    bool Run(Reflection& out, std::string& error){
+        if (m_Code.size() < 5 || m_Code[0] != SpirvMagic){
+            error = "not a SPIR-V module";
+            return false;
+        }
+        for (size_t i = 5; i < m_Code.size();){
+            uint32_t count = m_Code[i] >> 16;
+            uint32_t op = m_Code[i] & 0xFFFF;
+            if (count == 0 || i + count > m_Code.size()){
+                error = "truncated instruction";
+                return false;
+            }
+            Parse(op, &m_Code[i + 1], count - 1, out);
+            i += count;
+        }
+        for (uint32_t variable : m_Variables){
+            Reflect(variable, out);
+        }
+        return true;
+    }
+
+private:
+    void Parse(uint32_t op, const uint32_t* args, uint32_t argCount, Reflection& out){
+        switch (op){
+            case OpEntryPoint:
+                switch (args[0]){
+                    case 0: out.stage = "VK_SHADER_STAGE_VERTEX_BIT"; break;
+                    case 1: out.stage = "VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT"; break;
+                    case 2: out.stage = "VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT"; break;
+                    case 3: out.stage = "VK_SHADER_STAGE_GEOMETRY_BIT"; break;
+                    case 4: out.stage = "VK_SHADER_STAGE_FRAGMENT_BIT"; break;
+                    case 5: out.stage = "VK_SHADER_STAGE_COMPUTE_BIT"; break;
+                }
+                break;
+            case OpExecutionMode:
+                if (args[1] == ExecutionModeLocalSize && argCount >= 5){
+                    out.localSize[0] = args[2];
+                    out.localSize[1] = args[3];
+                    out.localSize[2] = args[4];
+                }
+                break;
+            case OpDecorate:
+                if (argCount >= 3){
+                    m_Decorations[args[0]][args[1]] = args[2];
+                } else {
+                    m_Decorations[args[0]][args[1]] = 1;
+                }
+                break;
+            case OpMemberDecorate:
+                if (argCount >= 4){
+                    m_MemberDecorations[args[0]][args[1]][args[2]] = args[3];
+                }
+                break;
+            case OpConstant:
+                m_Constants[args[1]] = args[2];
+                break;
+            case OpVariable:
+                m_VariableTypes[args[1]] = args[0];
+                m_Variables.push_back(args[1]);
+                break;
+            case OpTypeBool:
+            case OpTypeInt:
+            case OpTypeFloat:
+            case OpTypeVector:
+            case OpTypeMatrix:
+            case OpTypeImage:
+            case OpTypeSampler:
+            case OpTypeSampledImage:
+            case OpTypeArray:
+            case OpTypeRuntimeArray:
+            case OpTypeStruct:
+            case OpTypePointer:
+                m_Types[args[0]] = { op, std::vector<uint32_t>(args + 1, args + argCount) };
+                break;
+        }
+    }
+
+    uint32_t Decoration(uint32_t id, uint32_t decoration, uint32_t fallback) const {
+        auto it = m_Decorations.find(id);
+        if (it == m_Decorations.end()){
+            return fallback;
+        }
+        auto value = it->second.find(decoration);
+        return value == it->second.end() ? fallback : value->second;
+    }
+
+    uint32_t MemberDecoration(uint32_t id, uint32_t member, uint32_t decoration, uint32_t fallback) const {
+        auto it = m_MemberDecorations.find(id);
+        if (it == m_MemberDecorations.end() || !it->second.count(member)){
+            return fallback;
+        }
+        auto value = it->second.at(member).find(decoration);
+        return value == it->second.at(member).end() ? fallback : value->second;
+    }
+
+    // byte size of a type in an explicitly laid out block
+    uint32_t Size(uint32_t id) const {
+        auto it = m_Types.find(id);
+        if (it == m_Types.end()){
+            return 0;
+        }
+        const Type& type = it->second;
+        switch (type.op){
+            case OpTypeBool: return 4;
+            case OpTypeInt:
+            case OpTypeFloat: return type.operands[0] / 8;
+            case OpTypeVector: return Size(type.operands[0]) * type.operands[1];
+            case OpTypeMatrix: return Size(type.operands[0]) * type.operands[1];
+            case OpTypeArray: {
+                uint32_t length = m_Constants.count(type.operands[1]) ? m_Constants.at(type.operands[1]) : 0;
+                return Decoration(id, DecorationArrayStride, Size(type.operands[0])) * length;
+            }
+            case OpTypePointer: return 8;
+            case OpTypeStruct: {
+                uint32_t size = 0;
+                for (uint32_t member = 0; member < type.operands.size(); member++){
+                    uint32_t memberType = type.operands[member];
+                    uint32_t memberSize = Size(memberType);
+                    // matrices in blocks are laid out by their stride, not by their column size
+                    auto memberIt = m_Types.find(memberType);
+                    if (memberIt != m_Types.end() && memberIt->second.op == OpTypeMatrix){
+                        memberSize = MemberDecoration(id, member, DecorationMatrixStride, memberSize / memberIt->second.operands[1])
+                            * memberIt->second.operands[1];
+                    }
+                    uint32_t end = MemberDecoration(id, member, DecorationOffset, size) + memberSize;
+                    size = std::max(size, end);
+                }
+                return size;
+            }
+        }
+        return 0;
+    }
+
+    void Reflect(uint32_t variable, Reflection& out) const {
+        const Type& pointer = m_Types.at(m_VariableTypes.at(variable));
+        uint32_t storage = pointer.operands[0];
+        uint32_t typeId = pointer.operands[1];
+
+        if (storage == StoragePushConstant){
+            out.pushConstantSize = std::max(out.pushConstantSize, Size(typeId));
+            return;
+        }
+        if (storage != StorageUniformConstant && storage != StorageUniform && storage != StorageStorageBuffer){
+            return;
+        }
+
+        // arrays of descriptors, a runtime array is unbounded and reported with count 0
+        uint32_t count = 1;
+        const Type* type = &m_Types.at(typeId);
+        if (type->op == OpTypeArray){
+            count = m_Constants.count(type->operands[1]) ? m_Constants.at(type->operands[1]) : 1;
+            typeId = type->operands[0];
+            type = &m_Types.at(typeId);
+        } else if (type->op == OpTypeRuntimeArray){
+            count = 0;
+            typeId = type->operands[0];
+            type = &m_Types.at(typeId);
+        }
+
+        std::string descriptorType;
+        switch (type->op){
+            case OpTypeSampledImage:
+                descriptorType = "VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER";
+                break;
+            case OpTypeSampler:
+                descriptorType = "VK_DESCRIPTOR_TYPE_SAMPLER";
+                break;
+            case OpTypeImage: {
+                uint32_t dim = type->operands[1];
+                bool storageImage = type->operands[5] == 2;
+                if (dim == DimSubpassData){
+                    descriptorType = "VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT";
+                } else if (dim == DimBuffer){
+                    descriptorType = storageImage ? "VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER" : "VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER";
+                } else {
+                    descriptorType = storageImage ? "VK_DESCRIPTOR_TYPE_STORAGE_IMAGE" : "VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE";
+                }
+                break;
+            }
+            case OpTypeStruct:
+                if (storage == StorageStorageBuffer || Decoration(typeId, DecorationBufferBlock, 0)){
+                    descriptorType = "VK_DESCRIPTOR_TYPE_STORAGE_BUFFER";
+                } else {
+                    descriptorType = "VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER";
+                }
+                break;
+            default:
+                return;
+        }
+        out.bindings.push_back({ Decoration(variable, DecorationDescriptorSet, 0), Decoration(variable, DecorationBinding, 0), descriptorType, count });
+    }
+
+    const std::vector<uint32_t>& m_Code;
+    std::map<uint32_t, Type> m_Types;
+    std::map<uint32_t, uint32_t> m_Constants;
+    std::map<uint32_t, uint32_t> m_VariableTypes;
+    std::vector<uint32_t> m_Variables;
+    std::map<uint32_t, std::map<uint32_t, uint32_t>> m_Decorations;
+    std::map<uint32_t, std::map<uint32_t, std::map<uint32_t, uint32_t>>> m_MemberDecorations;
+};
+
+std::string Identifier(const std::string& name){
+    std::string result = name;
+    for (char& c : result){
+        if (!isalnum((unsigned char)c)){
+            c = '_';
+        }
+    }
+    return result;
+}
+
+}
+
+int main(int argc, char** argv){
+    if (argc < 2){
+        fprintf(stderr, "usage: %s <output.cpp> <shader.spv>...\n", argv[0]);
+        return 1;
+    }
+
+    std::ostringstream source;
+    std::ostringstream table;
+    source << "// generated by vknator_shadergen, do not edit\n";
+    source << "#include <vknator_shaderlibrary.h>\n\n";
+    source << "namespace {\n";
+
+    for (int i = 2; i < argc; i++){
+        std::filesystem::path path = argv[i];
+        std::ifstream file(path, std::ios::ate | std::ios::binary);
+        if (!file.is_open()){
+            fprintf(stderr, "could not open %s\n", argv[i]);
+            return 1;
+        }
+        std::vector<uint32_t> code((size_t)file.tellg() / sizeof(uint32_t));
+        file.seekg(0);
+        file.read((char*)code.data(), code.size() * sizeof(uint32_t));
+
+        Reflection reflection;
+        std::string error;
+        if (!Reflector(code).Run(reflection, error)){
+            fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+            return 1;
+        }
+
+        std::string name = path.stem().string();
+        std::string id = Identifier(name);
+
+        source << "\nconstexpr uint32_t " << id << "_code[] = {";
+        for (size_t word = 0; word < code.size(); word++){
+            source << (word % 8 == 0 ? "\n    " : " ");
+            char hex[16];
+            snprintf(hex, sizeof(hex), "0x%08x,", code[word]);
+            source << hex;
+        }
+        source << "\n};\n";
+
+        if (!reflection.bindings.empty()){
+            source << "constexpr ShaderBinding " << id << "_bindings[] = {\n";
+            for (const Binding& binding : reflection.bindings){
+                source << "    { " << binding.set << ", " << binding.binding << ", " << binding.type << ", " << binding.count << " },\n";
+            }
+            source << "};\n";
+        }
+
+        table << "    { \"" << name << "\", " << reflection.stage << ", " << id << "_code, ";
+        if (reflection.bindings.empty()){
+            table << "{}, ";
+        } else {
+            table << id << "_bindings, ";
+        }
+        table << reflection.pushConstantSize << ", { " << reflection.localSize[0] << ", " << reflection.localSize[1] << ", " << reflection.localSize[2] << " } },\n";
+    }
+
+    source << "\n}\n\n";
+    source << "const EmbeddedShader g_EmbeddedShaders[] = {\n" << table.str() << "};\n";
+    source << "const size_t g_EmbeddedShaderCount = " << (argc - 2) << ";\n";
+
+    std::filesystem::path outputPath = argv[1];
+    if (outputPath.has_parent_path()){
+        std::filesystem::create_directories(outputPath.parent_path());
+    }
+    std::ofstream output(argv[1], std::ios::binary | std::ios::trunc);
+    output << source.str();
+    return output ? 0 : 1;
+}